@@ -0,0 +1,364 @@
+//===----------------------------------------------------------------------===//
+//
+// autoprewarm.c
+//  Warm restart of the shared buffer pool.
+//
+//  With autoprewarm on, the background writer records which blocks are
+//  in the buffer pool: at shutdown, and every autoprewarm_interval
+//  seconds, it writes the BufferTag of every valid buffer to
+//  AUTOPREWARM_FILE in the data directory (see dump_buffer_tags()).
+//
+//  At startup the postmaster forks the buffer loader, which reads the
+//  file back, sorts the tags into file order and reads the blocks into
+//  shared buffers, autoprewarm_delay milliseconds between batches so
+//  that it doesn't crowd out the real work. Relations that have been
+//  dropped meanwhile are skipped, as are blocks past the end of a
+//  relation that was truncated. The loader stops once the freelist is
+//  empty: from then on every block it read would evict one that some
+//  backend actually asked for.
+//
+//  The file is text, one "tbl_node rel_node block_num" line per buffer
+//  after a line with the count, and is replaced atomically by rename().
+//
+// Portions Copyright (c) 1996-2001, PostgreSQL Global Development Group
+// Portions Copyright (c) 1994, Regents of the University of California
+//
+//===----------------------------------------------------------------------===//
+
+#include "rdbms/postmaster/autoprewarm.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "rdbms/miscadmin.h"
+#include "rdbms/postgres.h"
+#include "rdbms/storage/buf_internals.h"
+#include "rdbms/storage/bufmgr.h"
+#include "rdbms/storage/fd.h"
+#include "rdbms/storage/ipc.h"
+#include "rdbms/storage/shmem.h"
+#include "rdbms/storage/smgr.h"
+#include "rdbms/utils/elog.h"
+#include "rdbms/utils/memutils.h"
+
+// GUC parameters.
+bool AutoPrewarm = false;       // Dump and reload the buffer pool
+int AutoPrewarmInterval = 300;  // Seconds between dumps, 0 = only at shutdown
+int AutoPrewarmDelay = 10;      // Milliseconds between loader batches
+
+// Blocks the loader reads between naps.
+#define AUTOPREWARM_BATCH 64
+
+typedef struct AutoPrewarmShmemStruct {
+  // Set while the loader runs. The pool then holds only part of what the
+  // file lists, so dumping it would lose the rest.
+  AtomicUint32 loading;
+} AutoPrewarmShmemStruct;
+
+static AutoPrewarmShmemStruct* AutoPrewarmShmem = NULL;
+
+static volatile sig_atomic_t LoaderShutdownRequested = false;
+
+static int buffer_tag_comparator(const void* pa, const void* pb);
+static char* autoprewarm_path(const char* suffix);
+static int load_relation(BufferTag* tags, int ntags, bool* pool_full);
+
+// Estimate the shared memory needed by autoprewarm_shmem_init().
+Size autoprewarm_shmem_size(void) { return MAX_ALIGN(sizeof(AutoPrewarmShmemStruct)); }
+
+// Allocate and initialize the shared state.
+void autoprewarm_shmem_init(void) {
+  bool found;
+
+  AutoPrewarmShmem =
+      (AutoPrewarmShmemStruct*)shmem_init_struct("Autoprewarm Data", sizeof(AutoPrewarmShmemStruct), &found);
+
+  if (!AutoPrewarmShmem) {
+    elog(FATAL, "%s: couldn't initialize autoprewarm data", __func__);
+  }
+
+  if (!found) {
+    atomic_init_u32(&AutoPrewarmShmem->loading, false);
+  }
+}
+
+static char* autoprewarm_path(const char* suffix) {
+  char* path = (char*)palloc(strlen(DataDir) + strlen(AUTOPREWARM_FILE) + strlen(suffix) + 2);
+
+  sprintf(path, "%s/%s%s", DataDir, AUTOPREWARM_FILE, suffix);
+
+  return path;
+}
+
+// Write the tags of all valid buffers to AUTOPREWARM_FILE.
+//
+// Returns the number of tags written, or -1 if nothing was written (the
+// loader is still running, or the file could not be written; the
+// previous file is left in place either way).
+int dump_buffer_tags(void) {
+  BufferTag* tags;
+  char* tmp_path;
+  char* path;
+  FILE* file;
+  int num_tags = 0;
+  int i;
+
+  if (atomic_read_u32(&AutoPrewarmShmem->loading)) {
+    return -1;
+  }
+
+  tags = (BufferTag*)palloc(NBuffers * sizeof(BufferTag));
+
+  for (i = 0; i < NBuffers; i++) {
+    BufferDesc* buf_hdr = &BufferDescriptors[i];
+    uint32 buf_state = lock_buf_hdr(buf_hdr);
+
+    // Buffers on the freelist are marked BM_DELETED; they hold nothing.
+    if ((buf_state & BM_VALID) && !(buf_state & BM_DELETED)) {
+      tags[num_tags++] = buf_hdr->tag;
+    }
+
+    UNLOCK_BUF_HDR(buf_hdr, buf_state);
+  }
+
+  tmp_path = autoprewarm_path(".tmp");
+  path = autoprewarm_path("");
+
+  file = allocate_file(tmp_path, "w");
+
+  if (file == NULL) {
+    elog(NOTICE, "%s: could not open %s: %s", __func__, tmp_path, strerror(errno));
+    num_tags = -1;
+    goto done;
+  }
+
+  fprintf(file, "%d\n", num_tags);
+
+  for (i = 0; i < num_tags; i++) {
+    fprintf(file, "%u %u %u\n", tags[i].rnode.tbl_node, tags[i].rnode.rel_node, tags[i].block_num);
+  }
+
+  if (ferror(file) || fflush(file) != 0 || pg_fsync(fileno(file)) != 0) {
+    elog(NOTICE, "%s: could not write %s: %s", __func__, tmp_path, strerror(errno));
+    free_file(file);
+    unlink(tmp_path);
+    num_tags = -1;
+    goto done;
+  }
+
+  free_file(file);
+
+  if (rename(tmp_path, path) != 0) {
+    elog(NOTICE, "%s: could not rename %s to %s: %s", __func__, tmp_path, path, strerror(errno));
+    unlink(tmp_path);
+    num_tags = -1;
+  }
+
+done:
+  pfree(tmp_path);
+  pfree(path);
+  pfree(tags);
+
+  return num_tags;
+}
+
+// Fork the buffer loader. Called by the postmaster after shared memory
+// is initialized; returns the child's pid, or 0 if there is nothing to
+// do or the fork failed.
+pid_t start_buffer_loader(void) {
+  pid_t pid;
+
+  if (!AutoPrewarm) {
+    return 0;
+  }
+
+  // Set before forking, so that a dump can't slip in before the loader
+  // gets going.
+  atomic_write_u32(&AutoPrewarmShmem->loading, true);
+
+  pid = fork();
+
+  if (pid < 0) {
+    elog(NOTICE, "%s: could not fork buffer loader: %s", __func__, strerror(errno));
+    atomic_write_u32(&AutoPrewarmShmem->loading, false);
+    return 0;
+  }
+
+  if (pid == 0) {
+    buffer_loader_main();
+    proc_exit(0);
+  }
+
+  return pid;
+}
+
+static void loader_shutdown_handler(int signo) { LoaderShutdownRequested = true; }
+
+// Main of the buffer loader process.
+void buffer_loader_main(void) {
+  struct sigaction act;
+  BufferTag* tags = NULL;
+  char* path;
+  FILE* file;
+  int num_tags = 0;
+  int num_loaded = 0;
+  bool pool_full = false;
+  int start;
+  int i;
+
+  MEMSET(&act, 0, sizeof(act));
+  sigemptyset(&act.sa_mask);
+  act.sa_handler = loader_shutdown_handler;
+  sigaction(SIGTERM, &act, NULL);
+  act.sa_handler = SIG_IGN;
+  sigaction(SIGINT, &act, NULL);
+  sigaction(SIGPIPE, &act, NULL);
+
+  path = autoprewarm_path("");
+  file = allocate_file(path, "r");
+
+  if (file == NULL) {
+    // No dump yet (first start), or it was removed: nothing to do.
+    goto done;
+  }
+
+  if (fscanf(file, "%d\n", &num_tags) != 1 || num_tags < 0) {
+    elog(NOTICE, "%s: %s is corrupted", __func__, path);
+    free_file(file);
+    num_tags = 0;
+    goto done;
+  }
+
+  tags = (BufferTag*)palloc(MAX(num_tags, 1) * sizeof(BufferTag));
+
+  for (i = 0; i < num_tags; i++) {
+    if (fscanf(file, "%u %u %u\n", &tags[i].rnode.tbl_node, &tags[i].rnode.rel_node, &tags[i].block_num) != 3) {
+      elog(NOTICE, "%s: %s is corrupted after %d entries", __func__, path, i);
+      num_tags = i;
+      break;
+    }
+  }
+
+  free_file(file);
+
+  // Read each relation's blocks in block order, one relation after the
+  // other, so that the reads are as sequential as they can be.
+  qsort(tags, num_tags, sizeof(BufferTag), buffer_tag_comparator);
+
+  for (start = 0; start < num_tags && !pool_full && !LoaderShutdownRequested; start = i) {
+    for (i = start + 1; i < num_tags && REL_FILE_NODE_EQUALS(tags[i].rnode, tags[start].rnode); i++) {
+    }
+
+    num_loaded += load_relation(&tags[start], i - start, &pool_full);
+  }
+
+  elog(DEBUG, "%s: loaded %d of %d blocks%s", __func__, num_loaded, num_tags,
+       pool_full ? ", buffer pool full" : "");
+
+done:
+  if (tags) {
+    pfree(tags);
+  }
+  pfree(path);
+
+  atomic_write_u32(&AutoPrewarmShmem->loading, false);
+}
+
+// Read the listed blocks of one relation, all with the same rnode and in
+// block order. Returns the number of blocks read.
+static int load_relation(BufferTag* tags, int ntags, bool* pool_full) {
+  FormData_pg_class form;
+  RelationData relation;
+  struct timeval delay;
+  BlockNumber nblocks;
+  Buffer buffers[BUFFER_MAX_COMBINE];
+  int num_loaded = 0;
+  int run_len;
+  int i;
+  int j;
+
+  // The relation cache may not be usable here, and we need nothing from
+  // it: the storage manager only looks at rd_node and rd_fd, and the
+  // buffer manager at the name, for messages.
+  MEMSET(&relation, 0, sizeof(relation));
+  MEMSET(&form, 0, sizeof(form));
+  relation.rd_fd = -1;
+  relation.rd_node = tags[0].rnode;
+  relation.rd_rel = &form;
+  snprintf(NAME_STR(form.relname), NAME_DATA_LEN, "%u/%u", tags[0].rnode.tbl_node, tags[0].rnode.rel_node);
+
+  // Dropped since the dump.
+  relation.rd_fd = smgr_open(DEFAULT_SMGR, &relation, true);
+  if (relation.rd_fd < 0) {
+    return 0;
+  }
+
+  nblocks = smgr_nblocks(DEFAULT_SMGR, &relation);
+
+  for (i = 0; i < ntags; i += run_len) {
+    if (LoaderShutdownRequested) {
+      break;
+    }
+
+    // Truncated since the dump. Tags are sorted, so the rest are too.
+    if (tags[i].block_num >= nblocks) {
+      break;
+    }
+
+    if (!have_free_buffer()) {
+      *pool_full = true;
+      break;
+    }
+
+    // Runs of consecutive blocks are read with one call.
+    for (run_len = 1; i + run_len < ntags && run_len < BUFFER_MAX_COMBINE; run_len++) {
+      if (tags[i + run_len].block_num != tags[i].block_num + run_len || tags[i + run_len].block_num >= nblocks) {
+        break;
+      }
+    }
+
+    read_buffers(&relation, tags[i].block_num, run_len, buffers);
+
+    for (j = 0; j < run_len; j++) {
+      if (BUFFER_IS_VALID(buffers[j])) {
+        release_buffer(buffers[j]);
+        num_loaded++;
+      }
+    }
+
+    if (AutoPrewarmDelay > 0 && (i + run_len) / AUTOPREWARM_BATCH != i / AUTOPREWARM_BATCH) {
+      delay.tv_sec = AutoPrewarmDelay / 1000;
+      delay.tv_usec = (AutoPrewarmDelay % 1000) * 1000;
+      (void)select(0, NULL, NULL, NULL, &delay);
+    }
+  }
+
+  smgr_close(DEFAULT_SMGR, &relation);
+
+  return num_loaded;
+}
+
+// Sort order putting tags in file order.
+static int buffer_tag_comparator(const void* pa, const void* pb) {
+  const BufferTag* a = (const BufferTag*)pa;
+  const BufferTag* b = (const BufferTag*)pb;
+
+  if (a->rnode.tbl_node != b->rnode.tbl_node) {
+    return a->rnode.tbl_node < b->rnode.tbl_node ? -1 : 1;
+  }
+
+  if (a->rnode.rel_node != b->rnode.rel_node) {
+    return a->rnode.rel_node < b->rnode.rel_node ? -1 : 1;
+  }
+
+  if (a->block_num != b->block_num) {
+    return a->block_num < b->block_num ? -1 : 1;
+  }
+
+  return 0;
+}
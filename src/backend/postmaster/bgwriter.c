@@ -0,0 +1,399 @@
+//===----------------------------------------------------------------------===//
+//
+// bgwriter.c
+//  The background writer.
+//
+//  The background writer is started by the postmaster as soon as shared
+//  memory is set up. It writes out dirty shared buffers just ahead of the
+//  clock sweep, so that a backend needing a victim buffer finds a clean
+//  one and does not have to wait for a write itself. The amount of work
+//  per round follows the recent buffer allocation rate, see
+//  bg_buffer_sync() in bufmgr.c.
+//
+//  When there is nothing to do the writer hibernates with a much longer
+//  sleep; the first backend to allocate a buffer afterwards wakes it
+//  with SIGUSR1 (see strategy_notify_bgwriter()).
+//
+//  Every checkpoint_timeout seconds the writer also runs a checkpoint,
+//  writing every dirty buffer in file order (see checkpoint_buffers()).
+//  The writes are spread over checkpoint_completion_target of the
+//  interval, and the LRU cleaning above goes on while it waits.
+//
+//  With autoprewarm on, the writer also records the contents of the
+//  buffer pool every autoprewarm_interval seconds and at shutdown (see
+//  autoprewarm.c).
+//
+//  The writer is also the one process that fsyncs relation files.
+//  Backends that write to a segment hand it over with
+//  forward_fsync_request() through a queue in shared memory, and the
+//  writer collects the requests every round (absorb_fsync_requests())
+//  into md.c's table of pending fsyncs, where duplicates fold into one.
+//  At the end of a checkpoint each segment in the table is fsync'd once
+//  (see md_sync()), so commits don't have to.
+//
+//  SIGTERM makes the writer finish any checkpoint in progress at full
+//  speed, do a last checkpoint and exit.
+//
+// Portions Copyright (c) 1996-2001, PostgreSQL Global Development Group
+// Portions Copyright (c) 1994, Regents of the University of California
+//
+//===----------------------------------------------------------------------===//
+
+#include "rdbms/postmaster/bgwriter.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rdbms/postgres.h"
+#include "rdbms/postmaster/autoprewarm.h"
+#include "rdbms/storage/buf_internals.h"
+#include "rdbms/storage/bufmgr.h"
+#include "rdbms/storage/ipc.h"
+#include "rdbms/storage/lwlock.h"
+#include "rdbms/storage/s_lock.h"
+#include "rdbms/storage/shmem.h"
+#include "rdbms/storage/smgr.h"
+#include "rdbms/utils/elog.h"
+
+// GUC parameters.
+int CheckPointTimeout = 300;              // Seconds between checkpoints
+double CheckPointCompletionTarget = 0.5;  // Fraction of interval to write in
+int BgWriterDelay = 200;              // Milliseconds between rounds
+int BgWriterLruMaxPages = 100;        // Most buffers written per round
+double BgWriterLruMultiplier = 2.0;   // Expected allocations to clean for
+
+// Multiplier applied to BgWriterDelay while hibernating.
+#define HIBERNATE_FACTOR 50
+
+// A segment that was written to and has to be fsync'd.
+typedef struct FsyncRequest {
+  RelFileNode rnode;
+  BlockNumber seg_no;
+} FsyncRequest;
+
+typedef struct BgWriterShmemStruct {
+  TasLock mutex;  // Protects stats and pid
+  BgWriterStats stats;
+  pid_t pid;  // The background writer's, 0 if it isn't running
+
+  AtomicUint32 sync_cycle;  // Bumped by each absorb_fsync_requests()
+  LWLock request_lock;      // Protects the queue below
+  int num_requests;
+  int max_requests;
+  FsyncRequest requests[];  // max_requests of them
+} BgWriterShmemStruct;
+
+static BgWriterShmemStruct* BgWriterShmem = NULL;
+
+static bool AmBackgroundWriter = false;
+
+static volatile sig_atomic_t ShutdownRequested = false;
+
+static bool compact_fsync_requests(void);
+static int fsync_request_comparator(const void* pa, const void* pb);
+
+// Estimate the shared memory needed by bgwriter_shmem_init().
+Size bgwriter_shmem_size(void) { return MAX_ALIGN(sizeof(BgWriterShmemStruct) + NBuffers * sizeof(FsyncRequest)); }
+
+// Allocate and initialize the background writer's shared memory. The
+// fsync request queue has room for one request per shared buffer.
+void bgwriter_shmem_init(void) {
+  Size size;
+  bool found;
+
+  size = sizeof(BgWriterShmemStruct) + NBuffers * sizeof(FsyncRequest);
+  BgWriterShmem = (BgWriterShmemStruct*)shmem_init_struct("Background Writer Data", size, &found);
+
+  if (!BgWriterShmem) {
+    elog(FATAL, "%s: couldn't initialize background writer data", __func__);
+  }
+
+  if (!found) {
+    MEMSET(BgWriterShmem, 0, sizeof(BgWriterShmemStruct));
+    INIT_LOCK(&BgWriterShmem->mutex);
+    atomic_init_u32(&BgWriterShmem->sync_cycle, 0);
+    lwlock_init(&BgWriterShmem->request_lock);
+    BgWriterShmem->max_requests = NBuffers;
+  }
+}
+
+// Fork the background writer. Called by the postmaster after shared
+// memory is initialized; returns the child's pid, or 0 on failure.
+pid_t start_background_writer(void) {
+  pid_t pid;
+
+  pid = fork();
+
+  if (pid < 0) {
+    elog(NOTICE, "%s: could not fork background writer: %s", __func__, strerror(errno));
+    return 0;
+  }
+
+  if (pid == 0) {
+    background_writer_main();
+    proc_exit(0);
+  }
+
+  return pid;
+}
+
+static void bgwriter_shutdown_handler(int signo) { ShutdownRequested = true; }
+
+// SIGUSR1 only needs to interrupt the sleep.
+static void bgwriter_wakeup_handler(int signo) {}
+
+// Sleep for the given number of milliseconds, or until a signal arrives.
+static void bgwriter_sleep(long milliseconds) {
+  struct timeval delay;
+
+  delay.tv_sec = milliseconds / 1000;
+  delay.tv_usec = (milliseconds % 1000) * 1000;
+  (void)select(0, NULL, NULL, NULL, &delay);
+}
+
+// Main loop of the background writer process.
+void background_writer_main(void) {
+  struct sigaction act;
+  bool can_hibernate;
+  time_t last_checkpoint_time;
+  time_t last_dump_time;
+  long sleep_ms;
+
+  MEMSET(&act, 0, sizeof(act));
+  sigemptyset(&act.sa_mask);
+
+  // No SA_RESTART: both signals must interrupt the sleep in select().
+  act.sa_handler = bgwriter_shutdown_handler;
+  sigaction(SIGTERM, &act, NULL);
+  act.sa_handler = bgwriter_wakeup_handler;
+  sigaction(SIGUSR1, &act, NULL);
+  act.sa_handler = SIG_IGN;
+  sigaction(SIGINT, &act, NULL);
+  sigaction(SIGPIPE, &act, NULL);
+
+  AmBackgroundWriter = true;
+
+  LOCK_ACQUIRE(&BgWriterShmem->mutex);
+  BgWriterShmem->pid = getpid();
+  LOCK_RELEASE(&BgWriterShmem->mutex);
+
+  last_checkpoint_time = time(NULL);
+  last_dump_time = last_checkpoint_time;
+
+  while (!ShutdownRequested) {
+    absorb_fsync_requests();
+
+    if (time(NULL) - last_checkpoint_time >= CheckPointTimeout) {
+      // Measure the interval from the start of the checkpoint, so that
+      // throttled writes do not push the next one further out.
+      last_checkpoint_time = time(NULL);
+      checkpoint_buffers(false);
+    }
+
+    if (AutoPrewarm && AutoPrewarmInterval > 0 && time(NULL) - last_dump_time >= AutoPrewarmInterval) {
+      last_dump_time = time(NULL);
+      (void)dump_buffer_tags();
+    }
+
+    can_hibernate = bg_buffer_sync();
+
+    if (ShutdownRequested) {
+      break;
+    }
+
+    if (can_hibernate) {
+      // Nobody is allocating buffers and everything ahead of the clock
+      // is clean. Ask to be woken by the next allocation and take a long
+      // nap. An allocation that slips in before the request is only
+      // noticed when the nap ends, which is harmless on a system that
+      // was idle a moment ago.
+      spin_acquire(BufMgrLock);
+      strategy_notify_bgwriter(getpid());
+      spin_release(BufMgrLock);
+
+      // Don't sleep through the next checkpoint.
+      sleep_ms = (long)BgWriterDelay * HIBERNATE_FACTOR;
+      sleep_ms = MIN(sleep_ms, (last_checkpoint_time + CheckPointTimeout - time(NULL)) * 1000L);
+
+      if (sleep_ms > 0) {
+        bgwriter_sleep(sleep_ms);
+      }
+
+      spin_acquire(BufMgrLock);
+      strategy_notify_bgwriter(0);
+      spin_release(BufMgrLock);
+    } else {
+      bgwriter_sleep(BgWriterDelay);
+    }
+  }
+
+  // Shutdown checkpoint: get everything to disk before we go.
+  checkpoint_buffers(true);
+
+  if (AutoPrewarm) {
+    (void)dump_buffer_tags();
+  }
+
+  LOCK_ACQUIRE(&BgWriterShmem->mutex);
+  BgWriterShmem->pid = 0;
+  LOCK_RELEASE(&BgWriterShmem->mutex);
+}
+
+// True once SIGTERM has been received. A throttled checkpoint uses this
+// to stop pacing itself and finish as fast as it can.
+bool bgwriter_shutdown_requested(void) { return ShutdownRequested; }
+
+// Count a dirty victim that a backend had to write itself.
+void bgwriter_count_backend_write(void) {
+  LOCK_ACQUIRE(&BgWriterShmem->mutex);
+  BgWriterShmem->stats.buf_written_backend++;
+  LOCK_RELEASE(&BgWriterShmem->mutex);
+}
+
+// Account for one round of bg_buffer_sync().
+void bgwriter_count_clean(int num_written, bool hit_max, uint32 num_allocs) {
+  LOCK_ACQUIRE(&BgWriterShmem->mutex);
+  BgWriterShmem->stats.buf_written_clean += num_written;
+  BgWriterShmem->stats.buf_alloc += num_allocs;
+
+  if (hit_max) {
+    BgWriterShmem->stats.maxwritten_clean++;
+  }
+  LOCK_RELEASE(&BgWriterShmem->mutex);
+}
+
+// Copy out the current counters.
+void bgwriter_get_stats(BgWriterStats* stats) {
+  LOCK_ACQUIRE(&BgWriterShmem->mutex);
+  *stats = BgWriterShmem->stats;
+  LOCK_RELEASE(&BgWriterShmem->mutex);
+}
+
+// Is there a background writer to hand fsync requests to? Without one
+// (in a standalone backend, say) a backend has to do its own fsyncs.
+bool bgwriter_takes_fsync_requests(void) {
+  return AmBackgroundWriter || (BgWriterShmem != NULL && BgWriterShmem->pid != 0);
+}
+
+// Ask the background writer to fsync segment seg_no of rnode at the next
+// checkpoint. Returns false if the queue is full even after dropping
+// duplicate requests, in which case the caller has to do the fsync.
+//
+// The background writer itself keeps its requests in md.c directly.
+bool forward_fsync_request(RelFileNode rnode, BlockNumber seg_no) {
+  FsyncRequest* request;
+
+  if (AmBackgroundWriter) {
+    remember_fsync_request(rnode, seg_no);
+    return true;
+  }
+
+  lwlock_acquire(&BgWriterShmem->request_lock, LW_EXCLUSIVE);
+
+  if (BgWriterShmem->num_requests >= BgWriterShmem->max_requests && !compact_fsync_requests()) {
+    lwlock_release(&BgWriterShmem->request_lock);
+    return false;
+  }
+
+  request = &BgWriterShmem->requests[BgWriterShmem->num_requests++];
+  request->rnode = rnode;
+  request->seg_no = seg_no;
+
+  lwlock_release(&BgWriterShmem->request_lock);
+
+  return true;
+}
+
+// The number of times the queue has been absorbed. A backend need not
+// ask for a segment to be fsync'd again while it is unchanged, since the
+// request it made is still waiting.
+uint32 fsync_request_cycle(void) { return BgWriterShmem ? atomic_read_acquire_u32(&BgWriterShmem->sync_cycle) : 0; }
+
+// Move the queued fsync requests into md.c's table of pending fsyncs.
+//
+// The cycle is bumped first: a backend writing to a segment after this
+// sees the new cycle and asks again, so no write can fall between our
+// taking its segment's request and the fsync.
+void absorb_fsync_requests(void) {
+  FsyncRequest* requests;
+  int num_requests;
+  int i;
+
+  if (BgWriterShmem == NULL) {
+    return;
+  }
+
+  atomic_fetch_add_u32(&BgWriterShmem->sync_cycle, 1);
+
+  lwlock_acquire(&BgWriterShmem->request_lock, LW_EXCLUSIVE);
+
+  num_requests = BgWriterShmem->num_requests;
+
+  if (num_requests == 0) {
+    lwlock_release(&BgWriterShmem->request_lock);
+    return;
+  }
+
+  // Copy them out, so as not to hold up the backends while we fill in
+  // the table.
+  requests = (FsyncRequest*)palloc(num_requests * sizeof(FsyncRequest));
+  memcpy(requests, BgWriterShmem->requests, num_requests * sizeof(FsyncRequest));
+  BgWriterShmem->num_requests = 0;
+
+  lwlock_release(&BgWriterShmem->request_lock);
+
+  for (i = 0; i < num_requests; i++) {
+    remember_fsync_request(requests[i].rnode, requests[i].seg_no);
+  }
+
+  pfree(requests);
+}
+
+// Drop duplicate requests from the full queue, in place. The caller
+// holds request_lock. Returns true if that made room.
+static bool compact_fsync_requests(void) {
+  FsyncRequest* requests = BgWriterShmem->requests;
+  int num_kept = 0;
+  int i;
+
+  qsort(requests, BgWriterShmem->num_requests, sizeof(FsyncRequest), fsync_request_comparator);
+
+  for (i = 0; i < BgWriterShmem->num_requests; i++) {
+    if (num_kept > 0 && fsync_request_comparator(&requests[num_kept - 1], &requests[i]) == 0) {
+      continue;
+    }
+
+    requests[num_kept++] = requests[i];
+  }
+
+  elog(DEBUG, "%s: compacted fsync request queue from %d entries to %d", __func__, BgWriterShmem->num_requests,
+       num_kept);
+
+  BgWriterShmem->num_requests = num_kept;
+
+  return num_kept < BgWriterShmem->max_requests;
+}
+
+static int fsync_request_comparator(const void* pa, const void* pb) {
+  const FsyncRequest* a = (const FsyncRequest*)pa;
+  const FsyncRequest* b = (const FsyncRequest*)pb;
+
+  if (a->rnode.tbl_node != b->rnode.tbl_node) {
+    return a->rnode.tbl_node < b->rnode.tbl_node ? -1 : 1;
+  }
+
+  if (a->rnode.rel_node != b->rnode.rel_node) {
+    return a->rnode.rel_node < b->rnode.rel_node ? -1 : 1;
+  }
+
+  if (a->seg_no != b->seg_no) {
+    return a->seg_no < b->seg_no ? -1 : 1;
+  }
+
+  return 0;
+}
@@ -14,7 +14,10 @@
 //===----------------------------------------------------------------------===//
 
 #include "rdbms/postgres.h"
+#include "rdbms/postmaster/autoprewarm.h"
+#include "rdbms/postmaster/bgwriter.h"
 #include "rdbms/storage/buf_internals.h"
+#include "rdbms/storage/smgr.h"
 
 static void shutdown_buffer_pool_access();
 
@@ -31,18 +34,15 @@ long* CurTraceBuf;
 
 int ShowPinTrace = 0;
 int DataDescriptors;
-int FreeListDescriptor;
 int LookupListDescriptor;
 int NumDescriptors;
 
 BufferDesc* BufferDescriptors;
+BufferDescCold* BufferDescriptorsCold;
+BufferBlock BufferBlocks;
 Block* BufferBlockPointers;
 
-long* PrivateRefCount;                  // Also used in freelist.c.
-bits8* BufferLocks;                     // Flag bits showing locks I have set.
-BufferTag* BufferTagLastDirtied;        // Tag buffer had when last dirtied by me.
-BufferBlindId* BufferBlindLastDirtied;  // And its BlindId too.
-bool* BufferDirtiedByMe;                // T if buf has been dirtied in cur xact.
+SpinLock BufMgrLock;  // Buffer pool exclusive access
 
 long int ReadBufferCount;
 long int ReadLocalBufferCount;
@@ -51,19 +51,46 @@ long int LocalBufferHitCount;
 long int BufferFlushCount;
 long int LocalBufferFlushCount;
 
+// Estimate the shared memory needed by init_buffer_pool(), including
+// the tables of the modules it initializes.
+Size buffer_shmem_size(void) {
+  Size size = 0;
+
+  // Shmem index entries of the pool and its modules.
+  size += hash_estimate_size(SHMEM_INDEX_SIZE, SHMEM_INDEX_KEY_SIZE, SHMEM_INDEX_DATA_SIZE);
+
+  size += MAX_ALIGN(NBuffers * sizeof(BufferDesc) + CACHE_LINE_SIZE);
+  size += MAX_ALIGN(NBuffers * sizeof(BufferDescCold));
+  size += MAX_ALIGN(NBuffers * BLCKSZ + IO_ALIGN_SIZE);
+
+  size += buf_table_shmem_size();
+  size += strategy_shmem_size();
+  size += buf_stats_shmem_size();
+  size += bgwriter_shmem_size();
+  size += autoprewarm_shmem_size();
+  size += relsize_cache_shmem_size();
+#ifdef STABLE_MEMORY_STORAGE
+  size += mm_shmem_size();
+#endif
+
+  return size;
+}
+
 // Initialize module:
 //
 // should calculate size of pool dynamically based on the
 // amount of available memory.
-void init_buffer_pool(IPCKey key) {
+void init_buffer_pool(void) {
   bool found_bufs;
   bool found_descs;
+  bool found_cold;
+  char* descs;
+  char* blocks;
   int i;
 
   DataDescriptors = NBuffers;
-  FreeListDescriptor = DataDescriptors;
-  LookupListDescriptor = DataDescriptors + 1;
-  NumDescriptors = DataDescriptors + 1;
+  LookupListDescriptor = DataDescriptors;
+  NumDescriptors = DataDescriptors;
 
   spin_acquire(BufMgrLock);
 
@@ -74,13 +101,22 @@ void init_buffer_pool(IPCKey key) {
   TraceBuf = (bmtrace*)&(CurTraceBuf[1]);
 #endif
 
-  BufferDescriptors =
-      (BufferDesc*)shmem_init_struct("Buffer Descriptors", NumDescriptors * sizeof(BufferDesc), &found_descs);
-  BufferBlocks = (BufferBlock)shmem_init_struct("Buffer Blocks", NBuffers * BLCKSZ, &found_bufs);
-
-  if (found_descs || found_bufs) {
-    // Both should be present or neither.
-    assert(found_descs && found_bufs);
+  // Shared memory is only MAX_ALIGN'd, so allocate a spare line and
+  // start the descriptors on a cache line boundary.
+  descs = (char*)shmem_init_struct("Buffer Descriptors", NumDescriptors * sizeof(BufferDesc) + CACHE_LINE_SIZE,
+                                   &found_descs);
+  BufferDescriptors = descs ? (BufferDesc*)TYPE_ALIGN(CACHE_LINE_SIZE, descs) : NULL;
+  BufferDescriptorsCold = (BufferDescCold*)shmem_init_struct("Buffer Descriptors Cold",
+                                                             NumDescriptors * sizeof(BufferDescCold), &found_cold);
+
+  // The blocks are read and written with direct I/O, so they have to
+  // start on an IO_ALIGN_SIZE boundary too.
+  blocks = (char*)shmem_init_struct("Buffer Blocks", NBuffers * BLCKSZ + IO_ALIGN_SIZE, &found_bufs);
+  BufferBlocks = blocks ? (BufferBlock)TYPE_ALIGN(IO_ALIGN_SIZE, blocks) : NULL;
+
+  if (found_descs || found_cold || found_bufs) {
+    // All should be present or none.
+    assert(found_descs && found_cold && found_bufs);
   } else {
     BufferDesc* buf;
     unsigned long block;
@@ -88,35 +124,36 @@ void init_buffer_pool(IPCKey key) {
     buf = BufferDescriptors;
     block = (unsigned long)BufferBlocks;
 
-    // Link the buffers into a circular, doubly-linked list to
-    // initialize free list.  Still don't know anything about
-    // replacement strategy in this file.
+    MEMSET(BufferDescriptorsCold, 0, NumDescriptors * sizeof(BufferDescCold));
+
+    // Initially link all the buffers together as unused. Subsequent
+    // management of this list is done by freelist.c.
     for (i = 0; i < DataDescriptors; block += BLCKSZ, buf++, i++) {
       assert(shmem_is_valid((unsigned long)block));
 
       buf->free_next = i + 1;
-      buf->free_prev = i - 1;
 
       CLEAR_BUFFERTAG(&(buf->tag));
       buf->data = MAKE_OFFSET(block);
-      buf->flags = (BM_DELETED | BM_FREE | BM_VALID);
-      buf->refcount = 0;
+      atomic_init_u32(&buf->state, BM_DELETED | BM_VALID);
       buf->buf_id = i;
+      lwlock_init(&buf->content_lock);
+      condition_variable_init(&BufferDescriptorsCold[i].io_cv);
     }
 
-    // Close the circular queue.
-    BufferDescriptors[0].free_prev = DataDescriptors - 1;
-    BufferDescriptors[DataDescriptors - 1].free_next = 0;
+    // Correct last entry of linked list.
+    BufferDescriptors[DataDescriptors - 1].free_next = FREENEXT_END_OF_LIST;
   }
 
   // Init the rest of the module.
   init_buf_table();
   init_freelist(!found_descs);
+  init_buf_stats(!found_descs);
+  bgwriter_shmem_init();
+  autoprewarm_shmem_init();
+  relsize_cache_shmem_init();
+#ifdef STABLE_MEMORY_STORAGE
+  mm_shmem_init();
+#endif
   spin_release(BufMgrLock);
-
-  PrivateRefCount = (long*)calloc(NBuffers, sizeof(long));
-  BufferLocks = (bits8*)calloc(NBuffers, sizeof(bits8));
-  BufferTagLastDirtied = (BufferTag*)calloc(NBuffers, sizeof(BufferTag));
-  BufferBlindLastDirtied = (BufferBlindId*)calloc(NBuffers, sizeof(BufferBlindId));
-  BufferDirtiedByMe = (bool*)calloc(NBuffers, sizeof(bool));
 }
\ No newline at end of file
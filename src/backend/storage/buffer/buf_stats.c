@@ -0,0 +1,407 @@
+//===----------------------------------------------------------------------===//
+//
+// buf_stats.c
+//  Buffer pool introspection.
+//
+//  Two views of the shared buffer pool, for sizing NBuffers and for
+//  finding the relations that thrash it:
+//
+//  buffer_usage_by_relation() takes a snapshot of what the pool holds
+//  right now: per relation, how many buffers are resident, dirty and
+//  pinned, and how their usage counts are spread.
+//
+//  buffer_rel_stats() returns counters of hits, reads and writes per
+//  relation, accumulated by all backends since startup. They live in a
+//  fixed-size open-addressing table in shared memory. A relation claims
+//  its slot once, with a compare-and-swap; after that counting is a
+//  single atomic add, so it costs no lock on the read_buffer() path.
+//  A relation's slot is one of the REL_STATS_PROBES slots following its
+//  hash; relations that don't find one there are counted together in an
+//  overflow entry. Dropping a relation's buffers releases its slot for
+//  another relation to claim.
+//
+// Portions Copyright (c) 1996-2001, PostgreSQL Global Development Group
+// Portions Copyright (c) 1994, Regents of the University of California
+//
+//===----------------------------------------------------------------------===//
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rdbms/storage/buf_internals.h"
+#include "rdbms/storage/bufmgr.h"
+#include "rdbms/utils/elog.h"
+#include "rdbms/utils/hashfn.h"
+#include "rdbms/utils/memutils.h"
+
+// Number of slots in the shared counter table. Must be a power of 2.
+#define REL_STATS_SLOTS 4096
+
+// Slots a relation may be in, starting at its hash.
+#define REL_STATS_PROBES 16
+
+// Slot states.
+#define REL_STATS_EMPTY    0
+#define REL_STATS_CLAIMED  1  // Being filled in, rnode not valid yet
+#define REL_STATS_READY    2
+#define REL_STATS_FREE     3  // Released; lookups go on past it
+
+#define REL_STATS_PROBE(start, i) (&RelStats->slots[((start) + (i)) & (REL_STATS_SLOTS - 1)])
+
+typedef struct RelStatsSlot {
+  AtomicUint32 state;
+  RelFileNode rnode;
+  AtomicUint64 counters[BUF_STATS_NUM_COUNTERS];
+} RelStatsSlot;
+
+typedef struct RelStatsTable {
+  RelStatsSlot overflow;  // Relations that found no slot
+  RelStatsSlot slots[REL_STATS_SLOTS];
+} RelStatsTable;
+
+static RelStatsTable* RelStats = NULL;
+
+// A buffer seen by buffer_usage_by_relation().
+typedef struct BufUsageItem {
+  RelFileNode rnode;
+  uint32 state;
+} BufUsageItem;
+
+extern long int ReadBufferCount;
+extern long int ReadLocalBufferCount;
+extern long int BufferHitCount;
+extern long int LocalBufferHitCount;
+extern long int BufferFlushCount;
+extern long int LocalBufferFlushCount;
+
+static RelStatsSlot* rel_stats_slot(RelFileNode rnode);
+static uint32 rel_stats_slot_state(RelStatsSlot* slot);
+static int rnode_cmp(const RelFileNode* a, const RelFileNode* b);
+static int rnode_comparator(const void* pa, const void* pb);
+static int usage_comparator(const void* pa, const void* pb);
+
+// Estimate the shared memory needed by init_buf_stats().
+Size buf_stats_shmem_size(void) { return MAX_ALIGN(sizeof(RelStatsTable)); }
+
+// Allocate (or attach to) the shared counter table.
+void init_buf_stats(bool init) {
+  bool found;
+  int i;
+  int j;
+
+  RelStats = (RelStatsTable*)shmem_init_struct("Buffer Relation Stats", sizeof(RelStatsTable), &found);
+
+  if (!RelStats) {
+    elog(FATAL, "%s: couldn't initialize buffer relation stats", __func__);
+  }
+
+  if (!found) {
+    ASSERT(init);
+
+    for (i = 0; i <= REL_STATS_SLOTS; i++) {
+      RelStatsSlot* slot = (i == REL_STATS_SLOTS) ? &RelStats->overflow : &RelStats->slots[i];
+
+      atomic_init_u32(&slot->state, REL_STATS_EMPTY);
+      slot->rnode.tbl_node = INVALID_OID;
+      slot->rnode.rel_node = INVALID_OID;
+
+      for (j = 0; j < BUF_STATS_NUM_COUNTERS; j++) {
+        atomic_init_u64(&slot->counters[j], 0);
+      }
+    }
+
+    atomic_init_u32(&RelStats->overflow.state, REL_STATS_READY);
+  }
+}
+
+// Count one hit, read or write of a page of rnode.
+void buf_stats_count(RelFileNode rnode, BufStatsCounter counter) {
+  atomic_fetch_add_u64(&rel_stats_slot(rnode)->counters[counter], 1);
+}
+
+// Release rnode's slot, once its buffers have been dropped, so that a
+// dropped relation doesn't keep it forever. A backend that looked the
+// slot up just before may still add a count to the next relation in it.
+void buf_stats_forget(RelFileNode rnode) {
+  RelStatsSlot* slot;
+  uint32 start;
+  uint32 state;
+  int i;
+
+  start = (uint32)tag_hash((int*)&rnode, sizeof(RelFileNode));
+
+  for (i = 0; i < REL_STATS_PROBES; i++) {
+    slot = REL_STATS_PROBE(start, i);
+    state = rel_stats_slot_state(slot);
+
+    if (state == REL_STATS_EMPTY) {
+      return;
+    }
+
+    if (state == REL_STATS_READY && REL_FILE_NODE_EQUALS(slot->rnode, rnode)) {
+      atomic_compare_exchange_u32(&slot->state, &state, REL_STATS_FREE);
+      return;
+    }
+  }
+}
+
+// Find rnode's slot, claiming an empty or released one if it has none
+// yet.
+static RelStatsSlot* rel_stats_slot(RelFileNode rnode) {
+  RelStatsSlot* slot;
+  uint32 start;
+  uint32 state;
+  int i;
+  int j;
+
+  start = (uint32)tag_hash((int*)&rnode, sizeof(RelFileNode));
+
+  // Look for the relation's slot before claiming one, as a slot released
+  // in front of it must not give it a second one. Slots are claimed in
+  // order, so none past an empty one has ever been used.
+  for (i = 0; i < REL_STATS_PROBES; i++) {
+    slot = REL_STATS_PROBE(start, i);
+    state = rel_stats_slot_state(slot);
+
+    if (state == REL_STATS_EMPTY) {
+      break;
+    }
+
+    if (state == REL_STATS_READY && REL_FILE_NODE_EQUALS(slot->rnode, rnode)) {
+      return slot;
+    }
+  }
+
+  for (i = 0; i < REL_STATS_PROBES; i++) {
+    slot = REL_STATS_PROBE(start, i);
+    state = rel_stats_slot_state(slot);
+
+    if (state == REL_STATS_EMPTY || state == REL_STATS_FREE) {
+      if (atomic_compare_exchange_u32(&slot->state, &state, REL_STATS_CLAIMED)) {
+        // A released slot still has its last relation's counts.
+        for (j = 0; j < BUF_STATS_NUM_COUNTERS; j++) {
+          atomic_write_u64(&slot->counters[j], 0);
+        }
+
+        slot->rnode = rnode;
+        atomic_unlocked_write_u32(&slot->state, REL_STATS_READY);
+        return slot;
+      }
+
+      // Somebody else claimed it first, maybe for the same relation.
+      state = rel_stats_slot_state(slot);
+    }
+
+    if (state == REL_STATS_READY && REL_FILE_NODE_EQUALS(slot->rnode, rnode)) {
+      return slot;
+    }
+  }
+
+  return &RelStats->overflow;
+}
+
+// Read the state of a slot, waiting until it is no longer being claimed;
+// that takes only a few instructions.
+static uint32 rel_stats_slot_state(RelStatsSlot* slot) {
+  uint32 state;
+
+  do {
+    state = atomic_read_acquire_u32(&slot->state);
+  } while (state == REL_STATS_CLAIMED);
+
+  return state;
+}
+
+// Return the shared hit/read/write counters of every relation that has
+// any, in a palloc'd array (overflow entry last, if used). Returns the
+// number of entries.
+//
+// Each counter is read atomically, but the set is not a consistent
+// snapshot while other backends are running.
+int buffer_rel_stats(BufferRelStats** stats) {
+  BufferRelStats* result;
+  int n = 0;
+  int i;
+
+  result = (BufferRelStats*)palloc((REL_STATS_SLOTS + 1) * sizeof(BufferRelStats));
+
+  for (i = 0; i <= REL_STATS_SLOTS; i++) {
+    RelStatsSlot* slot = (i == REL_STATS_SLOTS) ? &RelStats->overflow : &RelStats->slots[i];
+
+    if (atomic_read_acquire_u32(&slot->state) != REL_STATS_READY) {
+      continue;
+    }
+
+    result[n].rnode = slot->rnode;
+    result[n].hits = atomic_read_u64(&slot->counters[BUF_STATS_HIT]);
+    result[n].reads = atomic_read_u64(&slot->counters[BUF_STATS_READ]);
+    result[n].writes = atomic_read_u64(&slot->counters[BUF_STATS_WRITE]);
+
+    if (result[n].hits + result[n].reads + result[n].writes > 0) {
+      n++;
+    }
+  }
+
+  *stats = result;
+
+  return n;
+}
+
+// Zero all shared counters. Relations keep their slots.
+void reset_buffer_rel_stats(void) {
+  int i;
+  int j;
+
+  for (i = 0; i <= REL_STATS_SLOTS; i++) {
+    RelStatsSlot* slot = (i == REL_STATS_SLOTS) ? &RelStats->overflow : &RelStats->slots[i];
+
+    for (j = 0; j < BUF_STATS_NUM_COUNTERS; j++) {
+      atomic_write_u64(&slot->counters[j], 0);
+    }
+  }
+}
+
+// Report what each relation holds in the shared buffer pool.
+//
+// Walks all buffer descriptors, taking each header lock only long enough
+// to copy the tag and state, so the result is a consistent picture of
+// every buffer but not of the pool as a whole. Returns the number of
+// relations found, and a palloc'd array of them in *usage, most resident
+// buffers first.
+int buffer_usage_by_relation(BufferRelUsage** usage) {
+  BufUsageItem* items;
+  BufferRelUsage* result;
+  int num_items = 0;
+  int num_rels = 0;
+  int i;
+
+  items = (BufUsageItem*)palloc(NBuffers * sizeof(BufUsageItem));
+
+  for (i = 0; i < NBuffers; i++) {
+    BufferDesc* buf_hdr = &BufferDescriptors[i];
+    uint32 buf_state = lock_buf_hdr(buf_hdr);
+
+    // Buffers on the freelist are marked BM_DELETED; they hold nothing.
+    if ((buf_state & BM_VALID) && !(buf_state & BM_DELETED)) {
+      items[num_items].rnode = buf_hdr->tag.rnode;
+      items[num_items].state = buf_state;
+      if (buf_hdr->cntx_dirty) {
+        items[num_items].state |= BM_DIRTY;
+      }
+      num_items++;
+    }
+
+    UNLOCK_BUF_HDR(buf_hdr, buf_state);
+  }
+
+  // Group the buffers by relation.
+  qsort(items, num_items, sizeof(BufUsageItem), rnode_comparator);
+
+  result = (BufferRelUsage*)palloc(MAX(num_items, 1) * sizeof(BufferRelUsage));
+
+  for (i = 0; i < num_items; i++) {
+    BufferRelUsage* rel;
+
+    if (i == 0 || !REL_FILE_NODE_EQUALS(items[i].rnode, items[i - 1].rnode)) {
+      rel = &result[num_rels++];
+      MEMSET(rel, 0, sizeof(BufferRelUsage));
+      rel->rnode = items[i].rnode;
+    } else {
+      rel = &result[num_rels - 1];
+    }
+
+    rel->resident++;
+
+    if (items[i].state & BM_DIRTY) {
+      rel->dirty++;
+    }
+
+    if (BUF_STATE_GET_REFCOUNT(items[i].state) > 0) {
+      rel->pinned++;
+    }
+
+    rel->usage_counts[BUF_STATE_GET_USAGECOUNT(items[i].state)]++;
+  }
+
+  pfree(items);
+
+  qsort(result, num_rels, sizeof(BufferRelUsage), usage_comparator);
+
+  *usage = result;
+
+  return num_rels;
+}
+
+// Print the backend's buffer counters and the shared pool's contents.
+void print_buffer_usage(FILE* statfp) {
+  BufferRelUsage* usage;
+  BufferRelStats* stats;
+  int num_rels;
+  int i;
+  int j;
+
+  fprintf(statfp, "!\tShared blocks: %10ld read, %10ld written, buffer hit rate = %.2f%%\n",
+          ReadBufferCount - BufferHitCount, BufferFlushCount,
+          ReadBufferCount > 0 ? (double)BufferHitCount * 100 / ReadBufferCount : 0.0);
+  fprintf(statfp, "!\tLocal  blocks: %10ld read, %10ld written, buffer hit rate = %.2f%%\n",
+          ReadLocalBufferCount - LocalBufferHitCount, LocalBufferFlushCount,
+          ReadLocalBufferCount > 0 ? (double)LocalBufferHitCount * 100 / ReadLocalBufferCount : 0.0);
+
+  num_rels = buffer_usage_by_relation(&usage);
+
+  fprintf(statfp, "!\t%10s %10s %8s %8s %8s  usage counts 0..%d\n", "tbl_node", "rel_node", "resident", "dirty",
+          "pinned", BUF_USAGE_HISTOGRAM_SIZE - 1);
+
+  for (i = 0; i < num_rels; i++) {
+    fprintf(statfp, "!\t%10u %10u %8d %8d %8d ", usage[i].rnode.tbl_node, usage[i].rnode.rel_node, usage[i].resident,
+            usage[i].dirty, usage[i].pinned);
+
+    for (j = 0; j < BUF_USAGE_HISTOGRAM_SIZE; j++) {
+      fprintf(statfp, " %d", usage[i].usage_counts[j]);
+    }
+
+    fprintf(statfp, "\n");
+  }
+
+  pfree(usage);
+
+  num_rels = buffer_rel_stats(&stats);
+
+  fprintf(statfp, "!\t%10s %10s %12s %12s %12s\n", "tbl_node", "rel_node", "hits", "reads", "writes");
+
+  for (i = 0; i < num_rels; i++) {
+    fprintf(statfp, "!\t%10u %10u %12lu %12lu %12lu\n", stats[i].rnode.tbl_node, stats[i].rnode.rel_node,
+            stats[i].hits, stats[i].reads, stats[i].writes);
+  }
+
+  pfree(stats);
+}
+
+static int rnode_cmp(const RelFileNode* a, const RelFileNode* b) {
+  if (a->tbl_node != b->tbl_node) {
+    return a->tbl_node < b->tbl_node ? -1 : 1;
+  }
+
+  if (a->rel_node != b->rel_node) {
+    return a->rel_node < b->rel_node ? -1 : 1;
+  }
+
+  return 0;
+}
+
+// Sort order grouping buffers of one relation together.
+static int rnode_comparator(const void* pa, const void* pb) {
+  return rnode_cmp(&((const BufUsageItem*)pa)->rnode, &((const BufUsageItem*)pb)->rnode);
+}
+
+// Sort order putting the relations holding most buffers first.
+static int usage_comparator(const void* pa, const void* pb) {
+  const BufferRelUsage* a = (const BufferRelUsage*)pa;
+  const BufferRelUsage* b = (const BufferRelUsage*)pb;
+
+  if (a->resident != b->resident) {
+    return a->resident > b->resident ? -1 : 1;
+  }
+
+  return rnode_cmp(&a->rnode, &b->rnode);
+}
@@ -13,57 +13,172 @@
 //
 // =========================================================================
 
-// OLD COMMENTS
-//
 // Data Structures:
 //
-//  Buffers are identified by their BufferTag (buf.h).	This
-// file contains routines for allocating a shmem hash table to
-// map buffer tags to buffer descriptors.
+//  Buffers are identified by their BufferTag (buf.h). This file
+//  contains routines for allocating a shmem hash table to map buffer
+//  tags to buffer descriptors.
+//
+//  The mapping is split into NUM_BUFFER_PARTITIONS independent hash
+//  tables. The partition a tag belongs to is chosen from the tag's hash
+//  code, and each partition is protected by its own lock, so lookups of
+//  unrelated blocks by different backends never contend.
 //
 // Synchronization:
 //
-//  All routines in this file assume buffer manager spinlock is
-//  held by their caller.
+//  Callers compute the hash code once with buf_table_hash_code() and
+//  pass it to the other routines. All buf_table_* routines assume the
+//  caller holds the partition lock for that hash code
+//  (BUF_MAPPING_PARTITION_LOCK(hash_code)).
+//
+// Relation index:
+//
+//  A second set of partitioned tables maps each RelFileNode to the list
+//  of its resident buffers, linked through rel_next/rel_prev in the
+//  cold descriptors. Dropping or truncating a relation looks at that
+//  list instead of sweeping all NBuffers descriptors. The buf_rel_*
+//  routines take the relation's BufRelLocks partition lock themselves;
+//  callers changing a buffer's tag hold its mapping partition lock, so
+//  a mapping lock may be held while taking a relation lock, never the
+//  other way around.
 
 #include "rdbms/storage/buf_internals.h"
 #include "rdbms/storage/bufmgr.h"
 #include "rdbms/utils/elog.h"
 #include "rdbms/utils/hashfn.h"
 #include "rdbms/utils/hsearch.h"
+#include "rdbms/utils/memutils.h"
 
-static HTAB* SharedBufHash;
+static HashTable* SharedBufHash[NUM_BUFFER_PARTITIONS];
+static HashTable* RelBufHash[NUM_BUFFER_PARTITIONS];
+
+BufMappingLock* BufMappingLocks;
+BufMappingLock* BufRelLocks;
 
 typedef struct lookup {
   BufferTag key;
   Buffer id;
 } LookupEnt;
 
-// Initialize shmem hash table for mapping buffers.
-void init_buf_table(void) {
-  extern int NBuffers;
+typedef struct RelBufEnt {
+  RelFileNode key;
+  int first_buf;  // Head of the relation's list of buffers
+  int nbuffers;   // Length of the list
+} RelBufEnt;
+
+static RelBufEnt* buf_rel_search(RelFileNode* rnode, uint32 hash_code, HashAction action);
+
+// The hash function of each partition's table. It must agree with the
+// value buf_table_lookup() and friends derive from buf_table_hash_code(),
+// because the tables rehash entries with it when they expand.
+//
+// The low bits of the tag hash select the partition, so the table only
+// sees the remaining bits; otherwise every entry of a partition would
+// land in the same 1/NUM_BUFFER_PARTITIONS of its buckets.
+static long buf_table_partition_hash(int* key, int keysize) {
+  return (long)((uint32)tag_hash(key, keysize) / NUM_BUFFER_PARTITIONS);
+}
+
+// Tags are not spread perfectly evenly, so give every partition some
+// headroom over its fair share of NBuffers.
+static long buf_table_partition_size(void) { return 2 * (NBuffers / NUM_BUFFER_PARTITIONS + 1); }
+
+// Estimate the shared memory needed by init_buf_table().
+Size buf_table_shmem_size(void) {
+  long partition_size = buf_table_partition_size();
+  Size size = 0;
+
+  size += NUM_BUFFER_PARTITIONS * hash_estimate_size(partition_size, sizeof(BufferTag), sizeof(Buffer));
+  size += NUM_BUFFER_PARTITIONS *
+          hash_estimate_size(partition_size, sizeof(RelFileNode), sizeof(RelBufEnt) - sizeof(RelFileNode));
+  size += 2 * MAX_ALIGN(NUM_BUFFER_PARTITIONS * sizeof(BufMappingLock));
 
-  HASHCTL info;
+  return size;
+}
+
+// Initialize shmem hash tables for mapping buffers.
+void init_buf_table(void) {
+  HashCtrl info;
   int hash_flags;
+  long partition_size;
+  char name[SHMEM_INDEX_KEY_SIZE];
+  bool found;
+  int i;
 
   // Assume lock is held.
   info.keysize = sizeof(BufferTag);
   info.datasize = sizeof(Buffer);
-  info.hash = tag_hash;
+  info.hash = buf_table_partition_hash;
 
   hash_flags = (HASH_ELEM | HASH_FUNCTION);
 
-  SharedBufHash = (HTAB*)shmem_init_hash("Shared Buffer Lookup Table", NBuffers, NBuffers, &info, hash_flags);
+  partition_size = buf_table_partition_size();
+
+  for (i = 0; i < NUM_BUFFER_PARTITIONS; i++) {
+    snprintf(name, sizeof(name), "Shared Buffer Lookup Table %d", i);
+    SharedBufHash[i] = shmem_init_hash(name, partition_size, partition_size, &info, hash_flags);
+
+    if (!SharedBufHash[i]) {
+      elog(FATAL, "%s couldn't initialize shared buffer pool hash table", __func__);
+      exit(1);
+    }
+  }
 
-  if (!SharedBufHash) {
-    elog(FATAL, "%s couldn't initialize shared buffer pool hash table", __func__);
+  // A relation has at least one buffer in the index, so there are never
+  // more relations than buffers.
+  info.keysize = sizeof(RelFileNode);
+  info.datasize = sizeof(RelBufEnt) - sizeof(RelFileNode);
+
+  for (i = 0; i < NUM_BUFFER_PARTITIONS; i++) {
+    snprintf(name, sizeof(name), "Buffer Relation Table %d", i);
+    RelBufHash[i] = shmem_init_hash(name, partition_size, partition_size, &info, hash_flags);
+
+    if (!RelBufHash[i]) {
+      elog(FATAL, "%s couldn't initialize buffer relation hash table", __func__);
+      exit(1);
+    }
+  }
+
+  BufMappingLocks =
+      (BufMappingLock*)shmem_init_struct("Buffer Mapping Locks", NUM_BUFFER_PARTITIONS * sizeof(BufMappingLock), &found);
+
+  if (!BufMappingLocks) {
+    elog(FATAL, "%s couldn't initialize buffer mapping locks", __func__);
     exit(1);
   }
+
+  if (!found) {
+    for (i = 0; i < NUM_BUFFER_PARTITIONS; i++) {
+      INIT_LOCK(&BufMappingLocks[i].lock);
+    }
+  }
+
+  BufRelLocks =
+      (BufMappingLock*)shmem_init_struct("Buffer Relation Locks", NUM_BUFFER_PARTITIONS * sizeof(BufMappingLock), &found);
+
+  if (!BufRelLocks) {
+    elog(FATAL, "%s couldn't initialize buffer relation locks", __func__);
+    exit(1);
+  }
+
+  if (!found) {
+    for (i = 0; i < NUM_BUFFER_PARTITIONS; i++) {
+      INIT_LOCK(&BufRelLocks[i].lock);
+    }
+  }
 }
 
-BufferDesc* buf_table_lookup(BufferTag* tag_ptr) {
-  extern BufferDesc* BufferDescriptors;
+// Compute the hash code associated with a BufferTag.
+//
+// This must be passed to the lookup/insert/delete routines along with
+// the tag. We do it like this because the callers need to know the hash
+// code in order to determine which partition to lock, and we don't want
+// to do the hash computation twice.
+uint32 buf_table_hash_code(BufferTag* tag_ptr) { return (uint32)tag_hash((int*)tag_ptr, sizeof(BufferTag)); }
 
+// Lookup the given BufferTag; return the descriptor, or NULL if not found.
+// Caller must hold at least the partition lock for tag's partition.
+BufferDesc* buf_table_lookup(BufferTag* tag_ptr, uint32 hash_code) {
   LookupEnt* result;
   bool found;
 
@@ -71,7 +186,9 @@ BufferDesc* buf_table_lookup(BufferTag* tag_ptr) {
     return NULL;
   }
 
-  result = (LookupEnt*)hash_search(SharedBufHash, (char*)tag_ptr, HASH_FIND, &found);
+  result = (LookupEnt*)hash_search_with_hash_value(SharedBufHash[BUF_TABLE_HASH_PARTITION(hash_code)],
+                                                   (char*)tag_ptr, hash_code / NUM_BUFFER_PARTITIONS, HASH_FIND,
+                                                   &found);
 
   if (!result) {
     elog(ERROR, "%s: BufferLookup table corrupted", __func__);
@@ -85,49 +202,197 @@ BufferDesc* buf_table_lookup(BufferTag* tag_ptr) {
   return &(BufferDescriptors[result->id]);
 }
 
-bool buf_table_delete(BufferDesc* buf_desc) {
+// Insert a hashtable entry for given tag and buffer ID, unless an entry
+// already exists for that tag.
+//
+// Returns -1 on successful insertion. If a conflicting entry exists
+// already, returns the buffer ID in that entry.
+//
+// Caller must hold the partition lock for tag's partition.
+int buf_table_insert(BufferTag* tag_ptr, uint32 hash_code, int buf_id) {
   LookupEnt* result;
   bool found;
 
-  // Buffer not initialized or has been removed from table already.
-  // BM_DELETED keeps us from removing buffer twice.
-  if (buf_desc->flags & BM_DELETED) {
-    return true;
-  }
+  ASSERT(buf_id >= 0);                        // -1 is reserved for not-in-table
+  ASSERT(tag_ptr->block_num != P_NEW);        // Invalid tag
 
-  buf_desc->flags |= BM_DELETED;
-  result = (LookupEnt*)hash_search(SharedBufHash, (char*)&(buf_desc->tag), HASH_REMOVE, &found);
+  result = (LookupEnt*)hash_search_with_hash_value(SharedBufHash[BUF_TABLE_HASH_PARTITION(hash_code)],
+                                                   (char*)tag_ptr, hash_code / NUM_BUFFER_PARTITIONS, HASH_ENTER,
+                                                   &found);
 
-  if (!(result && found)) {
+  if (!result) {
     elog(ERROR, "%s: BufferLookup table corrupted", __func__);
-    return false;
+    return -1;
+  }
+
+  // Found something else in the table.
+  if (found) {
+    return result->id;
   }
 
-  return true;
+  result->id = buf_id;
+
+  return -1;
 }
 
-bool buf_table_insert(BufferDesc* buf_desc) {
+// Delete the hashtable entry for given tag (which must exist).
+//
+// Caller must hold the partition lock for tag's partition.
+void buf_table_delete(BufferTag* tag_ptr, uint32 hash_code) {
   LookupEnt* result;
   bool found;
 
-  // Cannot insert it twice.
-  assert(buf_desc->flags & BM_DELETED);
+  result = (LookupEnt*)hash_search_with_hash_value(SharedBufHash[BUF_TABLE_HASH_PARTITION(hash_code)],
+                                                   (char*)tag_ptr, hash_code / NUM_BUFFER_PARTITIONS, HASH_REMOVE,
+                                                   &found);
+
+  if (!(result && found)) {
+    elog(ERROR, "%s: BufferLookup table corrupted", __func__);
+  }
+}
+
+// Compute the hash code of a RelFileNode, which picks its partition of
+// the relation index.
+uint32 buf_rel_hash_code(RelFileNode* rnode) { return (uint32)tag_hash((int*)rnode, sizeof(RelFileNode)); }
+
+static RelBufEnt* buf_rel_search(RelFileNode* rnode, uint32 hash_code, HashAction action) {
+  RelBufEnt* result;
+  bool found;
 
-  buf_desc->flags &= ~(BM_DELETED);
-  result = (LookupEnt*)hash_search(SharedBufHash, (char*)&(buf_desc->tag), HASH_ENTER, &found);
+  result = (RelBufEnt*)hash_search_with_hash_value(RelBufHash[BUF_TABLE_HASH_PARTITION(hash_code)], (char*)rnode,
+                                                   hash_code / NUM_BUFFER_PARTITIONS, action, &found);
 
   if (!result) {
-    elog(ERROR, "%s: BufferLookup table corrupted", __func__);
-    return false;
+    elog(ERROR, "%s: buffer relation table corrupted", __func__);
+    return NULL;
   }
 
-  // Found something else in the table.
-  if (found) {
-    elog(ERROR, "%s: BufferLookup table corrupted", __func__);
-    return false;
+  if (action == HASH_ENTER && !found) {
+    result->first_buf = -1;
+    result->nbuffers = 0;
+  }
+
+  if (action == HASH_FIND && !found) {
+    return NULL;
+  }
+
+  return result;
+}
+
+// Add a buffer to the list of rnode's buffers, as its tag is changed to
+// a block of rnode.
+void buf_rel_insert(BufferDesc* buf_desc, RelFileNode rnode) {
+  uint32 hash_code = buf_rel_hash_code(&rnode);
+  TasLock* rel_lock = BUF_REL_PARTITION_LOCK(hash_code);
+  BufferDescCold* cold = BUFFER_DESCRIPTOR_GET_COLD(buf_desc);
+  RelBufEnt* ent;
+
+  LOCK_ACQUIRE(rel_lock);
+
+  ent = buf_rel_search(&rnode, hash_code, HASH_ENTER);
+
+  cold->rel_prev = -1;
+  cold->rel_next = ent->first_buf;
+
+  if (ent->first_buf >= 0) {
+    BufferDescriptorsCold[ent->first_buf].rel_prev = buf_desc->buf_id;
   }
 
-  result->id = buf_desc->buf_id;
+  ent->first_buf = buf_desc->buf_id;
+  ent->nbuffers++;
 
-  return true;
-}
\ No newline at end of file
+  LOCK_RELEASE(rel_lock);
+}
+
+// Remove a buffer from the list of rnode's buffers, as its tag stops
+// being a block of rnode. The relation's entry goes with its last buffer.
+void buf_rel_delete(BufferDesc* buf_desc, RelFileNode rnode) {
+  uint32 hash_code = buf_rel_hash_code(&rnode);
+  TasLock* rel_lock = BUF_REL_PARTITION_LOCK(hash_code);
+  BufferDescCold* cold = BUFFER_DESCRIPTOR_GET_COLD(buf_desc);
+  RelBufEnt* ent;
+
+  LOCK_ACQUIRE(rel_lock);
+
+  ent = buf_rel_search(&rnode, hash_code, HASH_FIND);
+
+  if (ent == NULL) {
+    LOCK_RELEASE(rel_lock);
+    elog(ERROR, "%s: buffer relation table corrupted", __func__);
+    return;
+  }
+
+  if (cold->rel_prev >= 0) {
+    BufferDescriptorsCold[cold->rel_prev].rel_next = cold->rel_next;
+  } else {
+    ASSERT(ent->first_buf == buf_desc->buf_id);
+    ent->first_buf = cold->rel_next;
+  }
+
+  if (cold->rel_next >= 0) {
+    BufferDescriptorsCold[cold->rel_next].rel_prev = cold->rel_prev;
+  }
+
+  cold->rel_next = -1;
+  cold->rel_prev = -1;
+
+  if (--ent->nbuffers == 0) {
+    ASSERT(ent->first_buf < 0);
+    buf_rel_search(&rnode, hash_code, HASH_REMOVE);
+  }
+
+  LOCK_RELEASE(rel_lock);
+}
+
+// Return the number of buffers holding blocks of rnode, and their ids in
+// *buf_ids, palloc'd (NULL if there are none).
+//
+// This is a snapshot: buffers may join or leave the list as soon as the
+// lock is released, so callers must recheck each buffer's tag.
+int buf_rel_lookup(RelFileNode rnode, int** buf_ids) {
+  uint32 hash_code = buf_rel_hash_code(&rnode);
+  TasLock* rel_lock = BUF_REL_PARTITION_LOCK(hash_code);
+  RelBufEnt* ent;
+  int nbuffers;
+  int buf_id;
+  int i;
+
+  *buf_ids = NULL;
+
+  // palloc may elog(ERROR), so size the array with the lock released and
+  // try again if the list grew meanwhile.
+  for (;;) {
+    LOCK_ACQUIRE(rel_lock);
+    ent = buf_rel_search(&rnode, hash_code, HASH_FIND);
+    nbuffers = ent ? ent->nbuffers : 0;
+    LOCK_RELEASE(rel_lock);
+
+    if (nbuffers == 0) {
+      return 0;
+    }
+
+    *buf_ids = (int*)palloc(nbuffers * sizeof(int));
+
+    LOCK_ACQUIRE(rel_lock);
+    ent = buf_rel_search(&rnode, hash_code, HASH_FIND);
+
+    if (ent == NULL || ent->nbuffers <= nbuffers) {
+      break;
+    }
+
+    LOCK_RELEASE(rel_lock);
+    pfree(*buf_ids);
+  }
+
+  i = 0;
+
+  if (ent != NULL) {
+    for (buf_id = ent->first_buf; buf_id >= 0; buf_id = BufferDescriptorsCold[buf_id].rel_next) {
+      (*buf_ids)[i++] = buf_id;
+    }
+  }
+
+  LOCK_RELEASE(rel_lock);
+
+  return i;
+}
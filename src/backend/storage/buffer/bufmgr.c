@@ -1,7 +1,22 @@
 #include "rdbms/storage/bufmgr.h"
 
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
 #include "rdbms/access/xlogdefs.h"
+#include "rdbms/miscadmin.h"
+#include "rdbms/postmaster/bgwriter.h"
+#include "rdbms/storage/aio.h"
 #include "rdbms/storage/buf_internals.h"
+#include "rdbms/storage/ipc.h"
+#include "rdbms/storage/smgr.h"
+#include "rdbms/utils/elog.h"
+#include "rdbms/utils/hashfn.h"
+#include "rdbms/utils/hsearch.h"
+#include "rdbms/utils/memutils.h"
 
 #define BUFFER_GET_LSN(buf_hdr) (*((XLogRecPtr*)MAKE_PTR((buf_hdr)->data)))
 
@@ -20,37 +35,341 @@ extern long int LocalBufferFlushCount;
 // after transaction is committed/aborted.
 bool SharedBufferChanged = false;
 
-static void wait_io(BufferDesc* buf, SpinLock spinlock);
-static void start_buffer_io(BufferDesc* buf, bool forInput);
-static void terminate_buffer_io(BufferDesc* buf);
-static void continue_buffer_io(BufferDesc* buf, bool forInput);
+// The buffers this backend is doing I/O on, so that abort_buffer_io()
+// can clean up after an elog(ERROR). read_buffers() holds a run of up to
+// BUFFER_MAX_COMBINE of them for input, and may have to write out one
+// victim meanwhile; a checkpoint holds a run of them for output. Up to
+// MAX_ASYNC_BUFS more may be in AsyncIos.
+#define MAX_IN_PROGRESS_BUFS (BUFFER_MAX_COMBINE + 1 + MAX_ASYNC_BUFS)
+
+static BufferDesc* InProgressBufs[MAX_IN_PROGRESS_BUFS];
+static bool InProgressForInput[MAX_IN_PROGRESS_BUFS];
+static int NumInProgressBufs = 0;
+
+// Reads and writes this backend has in flight through aio.c.
+//
+// With AsyncIoDepth above 0, prefetch_buffer() reads the block into a
+// buffer in the background instead of only hinting the kernel, and the
+// background writer and checkpoints start their writes without waiting
+// for them, keeping up to AsyncIoDepth blocks in flight. Each I/O keeps
+// a pin on its buffers and their BM_IO_IN_PROGRESS, until we reap it.
+//
+// Nobody reaps our completions but us. We poll for them whenever a
+// buffer is read, wait for one when we need room for another I/O, and
+// wait for all of them before we block on anything that may be waiting
+// for them in turn: another backend's I/O, a content lock, or the lack of
+// an unpinned buffer. A backend that wants a block we are reading sleeps
+// in wait_io() until we next come by.
+int AsyncIoDepth = 32;
+
+typedef struct AsyncIo {
+  BufferDesc* bufs[BUFFER_MAX_COMBINE];
+  int nbufs;  // 0 if the entry is free
+  bool for_input;
+} AsyncIo;
+
+static AsyncIo AsyncIos[MAX_ASYNC_BUFS];  // Indexed by aio.c I/O id
+static int NumAsyncBufs = 0;              // Buffers in all of AsyncIos
+
+// Pins and content locks this backend holds on shared buffers.
+//
+// A backend only has a handful of buffers pinned at any time, so instead
+// of an entry for each of NBuffers the entries live in a small array,
+// searched linearly, and only spill into a hash table when more buffers
+// than that are pinned at once. Entries are freed with the last pin, so
+// memory use follows what the backend holds, not the size of the pool.
+// Every pin and unpin searches the array, so it is kept to what fits in
+// a few cache lines; runs of buffers being read or written together use
+// the hash table.
+#define REFCOUNT_ARRAY_ENTRIES 8
+#define REFCOUNT_HASH_SIZE     64
+
+static PrivateRefCountEntry PrivateRefCountArray[REFCOUNT_ARRAY_ENTRIES];
+static HashTable* PrivateRefCountHash = NULL;
+static int PrivateRefCountOverflowed = 0;  // Entries in PrivateRefCountHash
+static int PrivateRefCountClock = 0;       // Next array entry to move out
+
+// Microseconds to sleep between checks while waiting for other backends
+// to drop their pins.
+#define PIN_WAIT_DELAY 1000
+
+// Growth of the extents read_buffer(P_NEW) extends a relation by; see
+// get_new_block(). A relation extended again within
+// EXTEND_PRESSURE_WINDOW milliseconds gets twice the blocks it got the
+// last time, up to EXTEND_MAX_BLOCKS; otherwise half.
+#define EXTEND_PRESSURE_WINDOW 1000
+#define EXTEND_MAX_BLOCKS      256
+
+// Times take_spare_blocks() looks for the spare blocks of a relation
+// whose size keeps changing under it before giving up.
+#define RECLAIM_TRIES 3
+
+// Read-ahead window of read_ahead(), in blocks. It starts at
+// READ_AHEAD_MIN_BLOCKS once a relation is read sequentially, and
+// doubles each time it is refilled, up to READ_AHEAD_MAX_BLOCKS or
+// AsyncIoDepth, whichever is less.
+#define READ_AHEAD_MIN_BLOCKS 4
+#define READ_AHEAD_MAX_BLOCKS 32
+
+// Milliseconds a throttled checkpoint sleeps when ahead of schedule.
+#define CHECKPOINT_WRITE_DELAY 100
+
+// A dirty buffer to be written by a checkpoint, sorted into file order.
+typedef struct CkptSortItem {
+  RelFileNode rnode;
+  BlockNumber block_num;
+  int buf_id;
+} CkptSortItem;
+
+static void wait_io(BufferDesc* buf);
+static bool start_buffer_io(BufferDesc* buf, bool for_input);
+static void terminate_buffer_io(BufferDesc* buf, BufFlags set_flag_bits);
 extern void abort_buffer_io(void);
 
+// Return codes of sync_one_buffer().
+#define BUF_WRITTEN  0x01
+#define BUF_REUSABLE 0x02
+
 // Note that write error doesn't mean the buffer broken.
 #define BUFFER_IS_BROKEN(buf) \
-  ((buf->flags & BM_IO_ERROR) && !(buf->flags & BM_DIRTY))
+  ((atomic_read_u32(&(buf)->state) & BM_IO_ERROR) && !(atomic_read_u32(&(buf)->state) & BM_DIRTY))
 
-static Buffer read_buffer_with_buffer_lock(Relation relation,
-                                           BlockNumber block_number,
-                                           bool buffer_lock_held);
+static Buffer read_buffer_with_buffer_lock(Relation relation, BlockNumber block_number, BufferAccessStrategy strategy,
+                                          bool buffer_lock_held);
+static BufferDesc* buffer_alloc(Relation relation, BlockNumber block_number, BufferAccessStrategy strategy,
+                                bool* found_ptr);
+static void read_buffer_run(Relation relation, BlockNumber block_number, BufferDesc** bufs, int nbufs,
+                            Buffer* buffers);
+static BlockNumber get_new_block(Relation relation, bool* preallocated);
+static BlockNumber take_spare_blocks(Relation relation, int nblocks, int extend_by);
+static bool reclaim_spare_blocks(Relation relation);
+static bool block_is_resident(Relation relation, BlockNumber block_number);
+static bool preallocated_block_is_ours(Relation relation, BlockNumber block_number, bool found);
+static void read_ahead(Relation relation, BlockNumber block_number);
+static bool buffer_replace(BufferDesc* buf_hdr);
+static int write_buffer_run(BufferDesc** bufs, int nbufs);
+static int checkpoint_write_run(CkptSortItem* items, int nitems, int* num_written);
+static int sync_one_buffer(int buf_id, bool skip_recently_used);
+static int ckpt_buforder_comparator(const void* pa, const void* pb);
+static bool is_checkpoint_on_schedule(double progress, struct timespec* start);
+static void checkpoint_write_delay(bool immediate, double progress, struct timespec* start);
+static void invalidate_buffer(BufferDesc* buf_hdr, RelFileNode rnode, BlockNumber first_del_block);
+static void prepare_buffer_write(BufferDesc** bufs, int nbufs, char** pages);
+static int finish_buffer_write(BufferDesc** bufs, int nbufs, bool written);
+static int reserve_async_io(int nbufs);
+static bool start_async_read(Relation relation, BlockNumber block_number);
+static bool start_async_write(BufferDesc** bufs, int nbufs);
+static void reap_async_io(bool wait);
+static void finish_async_io(AsyncIo* aio, int result);
+static void acquire_content_lock(BufferDesc* buf, LWLockMode mode);
+static bool lock_buffer_for_write(BufferDesc* buf, bool wait);
+static void unlock_buffer_for_write(BufferDesc* buf);
 
-Buffer relation_get_buffer_write_buffer(Relation relation,
-                                        BlockNumber block_number,
-                                        Buffer buffer) {
+// Read a buffer, or return the one we already hold if it contains the
+// requested page.
+//
+// This avoids a release_buffer()/read_buffer() round trip when a scan
+// keeps asking for the block it already has pinned. The tag is checked
+// under the buffer's header lock only; no global lock is taken.
+Buffer relation_get_buffer_write_buffer(Relation relation, BlockNumber block_number, Buffer buffer) {
   BufferDesc* buf_hdr;
+  uint32 buf_state;
 
   if (BUFFER_IS_VALID(buffer)) {
     if (!BUFFER_IS_LOCAL(buffer)) {
       buf_hdr = &BufferDescriptors[buffer - 1];
-      spin_acquire(BufMgrLock);
 
-      if (buf_hdr->tag.block_num == block_number &&
-          REL_FILE_NODE_EQUALS(buf_hdr->tag.rnode, relation->rd_node)) {
-        spin_release(BufMgrLock);
+      buf_state = lock_buf_hdr(buf_hdr);
+      if (buf_hdr->tag.block_num == block_number && REL_FILE_NODE_EQUALS(buf_hdr->tag.rnode, relation->rd_node)) {
+        UNLOCK_BUF_HDR(buf_hdr, buf_state);
+        return buffer;
+      }
+      UNLOCK_BUF_HDR(buf_hdr, buf_state);
+
+      unpin_buffer(buf_hdr);
+    } else {
+      buf_hdr = &LocalBufferDescriptors[-buffer - 1];
+
+      if (buf_hdr->tag.block_num == block_number && REL_FILE_NODE_EQUALS(buf_hdr->tag.rnode, relation->rd_node)) {
         return buffer;
       }
 
-      return read_buffer_with_buffer_lock(relation, block_number, true);
+      ASSERT(LocalRefCount[-buffer - 1] > 0);
+      LocalRefCount[-buffer - 1]--;
+    }
+  }
+
+  return read_buffer_with_buffer_lock(relation, block_number, NULL, false);
+}
+
+// Return a pinned buffer holding the requested block of the relation.
+//
+// If block_number is P_NEW the relation is extended by one zeroed block.
+Buffer read_buffer(Relation relation, BlockNumber block_number) {
+  return read_buffer_with_buffer_lock(relation, block_number, NULL, false);
+}
+
+// read_buffer() with a buffer access strategy.
+//
+// A bulk operation passes the strategy it got from get_access_strategy()
+// to every call, so that pages it has to read in recycle a small ring of
+// buffers instead of evicting other backends' pages. A NULL strategy is
+// the same as read_buffer().
+Buffer read_buffer_extended(Relation relation, BlockNumber block_number, BufferAccessStrategy strategy) {
+  return read_buffer_with_buffer_lock(relation, block_number, strategy, false);
+}
+
+// Initiate asynchronous read of a block of a relation.
+//
+// If the block isn't in the buffer pool already, ask the kernel to start
+// reading it in, so that a read_buffer() a little later finds it in the
+// OS cache instead of waiting for the disk. Callers that know which
+// blocks they will need next (sequential or bitmap scans) can keep
+// several reads in flight this way.
+//
+// This is only a hint: nothing is pinned, and the block may well be
+// evicted or read by somebody else before we come to it. Local buffers
+// have no lookup table, so for a local relation we always issue the hint.
+//
+// With asynchronous I/O (see AsyncIos) a block of a shared relation is
+// read straight into a buffer instead, and the read completes while the
+// caller goes on with other work.
+void prefetch_buffer(Relation relation, BlockNumber block_number) {
+  BufferTag new_tag;  // Identity of requested block
+  uint32 new_hash;    // Hash value for new_tag
+  TasLock* new_partition_lock;
+  BufferDesc* buf;
+
+  ASSERT(BLOCK_NUMBER_IS_VALID(block_number));
+
+  if (!relation->rd_my_xact_only) {
+    if (AsyncIoDepth > 0 && start_async_read(relation, block_number)) {
+      return;
+    }
+
+    // Create a tag so we can lookup the buffer.
+    INIT_BUFFERTAG(&new_tag, relation, block_number);
+
+    // Determine its hash code and partition lock ID.
+    new_hash = buf_table_hash_code(&new_tag);
+    new_partition_lock = BUF_MAPPING_PARTITION_LOCK(new_hash);
+
+    // See if the block is in the buffer pool already.
+    LOCK_ACQUIRE(new_partition_lock);
+    buf = buf_table_lookup(&new_tag, new_hash);
+    LOCK_RELEASE(new_partition_lock);
+
+    // If not in buffers, initiate prefetch.
+    if (buf != NULL) {
+      return;
+    }
+  }
+
+  smgr_prefetch(DEFAULT_SMGR, relation, block_number);
+}
+
+// Read a run of consecutive blocks of a relation.
+//
+// On return buffers[i] holds block block_number + i, pinned as if by
+// read_buffer(), or INVALID_BUFFER if it could not be read. The blocks
+// that are not in the pool already are read with one smgr_readv() per
+// run of consecutive misses (up to BUFFER_MAX_COMBINE blocks), so a
+// sequential scan can bring in its next nblocks blocks with a single
+// system call instead of one seek and one read per block. Returns the
+// number of valid buffers.
+//
+// Local relations are read block by block.
+int read_buffers(Relation relation, BlockNumber block_number, int nblocks, Buffer* buffers) {
+  BufferDesc* run[BUFFER_MAX_COMBINE];
+  int run_start = 0;  // Index of the first block of the run
+  int run_len = 0;
+  int num_valid = 0;
+  BufferDesc* buf_hdr;
+  bool found;
+  int i;
+
+  ASSERT(BLOCK_NUMBER_IS_VALID(block_number));
+
+  if (NumAsyncBufs > 0) {
+    reap_async_io(false);
+  }
+
+  for (i = 0; i < nblocks; i++) {
+    if (relation->rd_my_xact_only) {
+      buffers[i] = read_buffer(relation, block_number + i);
+      continue;
+    }
+
+    ReadBufferCount++;
+
+    // Blocks are only ever read in ascending order while a run has I/O
+    // in progress, so waiting here for another backend's read of this
+    // block cannot deadlock.
+    buf_hdr = buffer_alloc(relation, block_number + i, NULL, &found);
+
+    if (buf_hdr == NULL || found || run_len == BUFFER_MAX_COMBINE) {
+      if (run_len > 0) {
+        read_buffer_run(relation, block_number + run_start, run, run_len, &buffers[run_start]);
+        run_len = 0;
+      }
+    }
+
+    if (buf_hdr == NULL) {
+      buffers[i] = INVALID_BUFFER;
+      continue;
+    }
+
+    buf_stats_count(relation->rd_node, found ? BUF_STATS_HIT : BUF_STATS_READ);
+
+    if (found) {
+      BufferHitCount++;
+      buffers[i] = BUFFER_DESCRIPTOR_GET_BUFFER(buf_hdr);
+      continue;
+    }
+
+    // We own the input I/O on this one; add it to the run.
+    if (run_len == 0) {
+      run_start = i;
+    }
+    run[run_len++] = buf_hdr;
+  }
+
+  if (run_len > 0) {
+    read_buffer_run(relation, block_number + run_start, run, run_len, &buffers[run_start]);
+  }
+
+  for (i = 0; i < nblocks; i++) {
+    if (buffers[i] != INVALID_BUFFER) {
+      num_valid++;
+    }
+  }
+
+  return num_valid;
+}
+
+// Read consecutive blocks, starting at block_number, into buffers that
+// buffer_alloc() returned with input I/O started, and finish the I/O.
+// Stores the resulting Buffers (INVALID_BUFFER on failure) in buffers.
+static void read_buffer_run(Relation relation, BlockNumber block_number, BufferDesc** bufs, int nbufs,
+                            Buffer* buffers) {
+  char* pages[BUFFER_MAX_COMBINE];
+  int status;
+  int i;
+
+  for (i = 0; i < nbufs; i++) {
+    pages[i] = (char*)MAKE_PTR(bufs[i]->data);
+  }
+
+  status = smgr_readv(DEFAULT_SMGR, relation, block_number, pages, nbufs);
+
+  for (i = 0; i < nbufs; i++) {
+    if (status == SM_FAIL) {
+      terminate_buffer_io(bufs[i], BM_IO_ERROR);
+      unpin_buffer(bufs[i]);
+      buffers[i] = INVALID_BUFFER;
+    } else {
+      terminate_buffer_io(bufs[i], BM_VALID);
+      buffers[i] = BUFFER_DESCRIPTOR_GET_BUFFER(bufs[i]);
     }
   }
 }
@@ -58,20 +377,2006 @@ Buffer relation_get_buffer_write_buffer(Relation relation,
 // Does the work of ReadBuffer() but with the possibility that the buffer lock
 // has already been held. this is yet another effort to reduce the number of
 // semops in the system.
-static Buffer read_buffer_with_buffer_lock(Relation relation,
-                                           BlockNumber block_number,
-                                           bool buffer_lock_held) {
+//
+// The buffer lookup itself no longer needs BufMgrLock (see buffer_alloc()),
+// so if the caller holds it we simply drop it first.
+static Buffer read_buffer_with_buffer_lock(Relation relation, BlockNumber block_number, BufferAccessStrategy strategy,
+                                          bool buffer_lock_held) {
   BufferDesc* buf_hdr;
   int extend;  // Extending the file by one block
+  bool preallocated = false;  // The new block is in the file already
   int status;
   bool found;
   bool is_local_buf;
 
+  if (buffer_lock_held) {
+    spin_release(BufMgrLock);
+  }
+
+  if (NumAsyncBufs > 0) {
+    reap_async_io(false);
+  }
+
   extend = (block_number == P_NEW);
   is_local_buf = relation->rd_my_xact_only;
 
   if (is_local_buf) {
     ReadLocalBufferCount++;
-    buf_hdr = local_buffer_alloc(relation, block_num, &found);
+    buf_hdr = local_buffer_alloc(relation, block_number, &found);
+
+    if (found) {
+      LocalBufferHitCount++;
+    }
+  } else {
+    ReadBufferCount++;
+
+    // Lookup the buffer. If extending, the new block number is the
+    // current length of the relation, or a spare block somebody extended
+    // it by in advance.
+    if (extend) {
+      for (;;) {
+        block_number = get_new_block(relation, &preallocated);
+        buf_hdr = buffer_alloc(relation, block_number, strategy, &found);
+
+        if (!preallocated || buf_hdr == NULL || preallocated_block_is_ours(relation, block_number, found)) {
+          break;
+        }
+
+        // Somebody else has the block; take another.
+        if (!found) {
+          terminate_buffer_io(buf_hdr, 0);
+        }
+        unpin_buffer(buf_hdr);
+      }
+    } else {
+      if (EnableDirectIo && AsyncIoDepth > 0) {
+        read_ahead(relation, block_number);
+      }
+
+      buf_hdr = buffer_alloc(relation, block_number, strategy, &found);
+    }
+
+    if (found) {
+      BufferHitCount++;
+    }
+
+    if (buf_hdr) {
+      buf_stats_count(relation->rd_node, found ? BUF_STATS_HIT : BUF_STATS_READ);
+    }
+  }
+
+  if (!buf_hdr) {
+    return INVALID_BUFFER;
+  }
+
+  // If it's already in the buffer pool, we're done.
+  if (found) {
+    // This happens when a bogus buffer was returned previously and is
+    // floating around in the buffer pool. A routine calling this would
+    // want this extended.
+    if (extend) {
+      // New buffers are zero-filled.
+      MEMSET((char*)MAKE_PTR(buf_hdr->data), 0, BLCKSZ);
+      if (!preallocated) {
+        smgr_extend(DEFAULT_SMGR, relation, (char*)MAKE_PTR(buf_hdr->data));
+      }
+    }
+
+    return BUFFER_DESCRIPTOR_GET_BUFFER(buf_hdr);
+  }
+
+  // If we have gotten to this point, the relation must be open in the
+  // smgr, and we have I/O in progress on the buffer (unless it is local).
+  if (extend) {
+    // New buffers are zero-filled, and so are preallocated blocks.
+    MEMSET((char*)MAKE_PTR(buf_hdr->data), 0, BLCKSZ);
+    status = preallocated ? SM_SUCCESS : smgr_extend(DEFAULT_SMGR, relation, (char*)MAKE_PTR(buf_hdr->data));
+  } else {
+    status = smgr_read(DEFAULT_SMGR, relation, block_number, (char*)MAKE_PTR(buf_hdr->data));
+  }
+
+  if (is_local_buf) {
+    return BUFFER_DESCRIPTOR_GET_BUFFER(buf_hdr);
+  }
+
+  if (status == SM_FAIL) {
+    terminate_buffer_io(buf_hdr, BM_IO_ERROR);
+    unpin_buffer(buf_hdr);
+
+    return INVALID_BUFFER;
+  }
+
+  terminate_buffer_io(buf_hdr, BM_VALID);
+
+  return BUFFER_DESCRIPTOR_GET_BUFFER(buf_hdr);
+}
+
+// Keep a sequential reader of a shared relation ahead of the disk.
+//
+// Relation files opened for direct I/O get no read-ahead from the
+// kernel, so a scan would wait for every block in turn. Instead, once
+// read_buffer() is asked for the block after the one it was asked for
+// last, the following blocks are read into buffers in the background
+// with prefetch_buffer(), in a window that doubles each time it is
+// refilled. It is refilled when the reader is more than half way
+// through it, so reads are started a batch at a time and the reader
+// rarely catches up with them. Reading any other block ends the run.
+static void read_ahead(Relation relation, BlockNumber block_number) {
+  BlockNumber nblocks;
+  BlockNumber end;
+  int max_distance;
+
+  if (block_number != relation->rd_read_ahead_next) {
+    relation->rd_read_ahead_next = block_number + 1;
+    relation->rd_read_ahead_end = 0;
+    relation->rd_read_ahead_distance = 0;
+    return;
+  }
+
+  relation->rd_read_ahead_next = block_number + 1;
+
+  if (relation->rd_read_ahead_end > block_number &&
+      relation->rd_read_ahead_end - block_number > relation->rd_read_ahead_distance / 2) {
+    return;
+  }
+
+  if (!aio_available()) {
+    return;
+  }
+
+  max_distance = MIN(READ_AHEAD_MAX_BLOCKS, AsyncIoDepth);
+  relation->rd_read_ahead_distance = relation->rd_read_ahead_distance == 0
+                                         ? MIN(READ_AHEAD_MIN_BLOCKS, max_distance)
+                                         : MIN(relation->rd_read_ahead_distance * 2, max_distance);
+
+  nblocks = smgr_nblocks(DEFAULT_SMGR, relation);
+  end = MIN(block_number + 1 + relation->rd_read_ahead_distance, nblocks);
+
+  for (block_number = MAX(block_number + 1, relation->rd_read_ahead_end); block_number < end; block_number++) {
+    prefetch_buffer(relation, block_number);
+  }
+
+  relation->rd_read_ahead_end = MAX(end, relation->rd_read_ahead_end);
+}
+
+// Pick the block read_buffer(P_NEW) gives a shared relation, extending
+// the relation if it has no spare blocks left.
+//
+// A relation that keeps being extended gets extents of growing size
+// (see EXTEND_PRESSURE_WINDOW) with one smgr_extend_by() each. The spare
+// blocks are recorded in the relation's slot in the shared size cache
+// (relsize.c), and the following calls, by this backend or any other,
+// take them from there without going to the storage manager at all. A
+// relation extended now and then gets single blocks, written by the
+// caller with smgr_extend() as before; *preallocated tells the two
+// apart. So does one whose spare blocks can't be recorded.
+static BlockNumber get_new_block(Relation relation, bool* preallocated) {
+  BlockNumber block_number;
+  struct timeval now;
+  long now_ms;
+
+  *preallocated = true;
+
+  block_number = take_spare_blocks(relation, 1, 0);
+
+  if (block_number != INVALID_BLOCK_NUMBER) {
+    return block_number;
+  }
+
+  gettimeofday(&now, NULL);
+  now_ms = now.tv_sec * 1000L + now.tv_usec / 1000;
+
+  if (relation->rd_extent_size > 0 && now_ms - relation->rd_extent_time < EXTEND_PRESSURE_WINDOW) {
+    relation->rd_extent_size = MIN(relation->rd_extent_size * 2, EXTEND_MAX_BLOCKS);
+  } else {
+    relation->rd_extent_size = MAX(relation->rd_extent_size / 2, 1);
+  }
+  relation->rd_extent_time = now_ms;
+
+  if (relation->rd_extent_size > 1) {
+    block_number = take_spare_blocks(relation, 1, relation->rd_extent_size);
+
+    if (block_number != INVALID_BLOCK_NUMBER) {
+      return block_number;
+    }
+  }
+
+  *preallocated = false;
+
+  return smgr_nblocks(DEFAULT_SMGR, relation);
+}
+
+// Take nblocks consecutive spare blocks of a shared relation, extending
+// it by extend_by blocks at a time (none if 0) until it has them. Returns
+// the first block, or INVALID_BLOCK_NUMBER if the relation has too few
+// and isn't to be extended, or if its spare blocks are not recorded and
+// can't be found out (no shared size cache, or the relation keeps
+// changing while we look).
+static BlockNumber take_spare_blocks(Relation relation, int nblocks, int extend_by) {
+  BlockNumber block_number;
+  int reclaims = 0;
+  bool known;
+
+  for (;;) {
+    block_number = relsize_cache_take(relation->rd_node, nblocks, &known);
+
+    if (block_number != INVALID_BLOCK_NUMBER) {
+      return block_number;
+    }
+
+    if (!known) {
+      if (++reclaims > RECLAIM_TRIES || !reclaim_spare_blocks(relation)) {
+        return INVALID_BLOCK_NUMBER;
+      }
+    } else if (extend_by == 0) {
+      return INVALID_BLOCK_NUMBER;
+    } else if (smgr_extend_by(DEFAULT_SMGR, relation, extend_by) == SM_FAIL) {
+      elog(ERROR, "%s: cannot extend %s by %d blocks", __func__, RELATION_GET_PHYSICAL_RELATION_NAME(relation),
+           extend_by);
+    }
+  }
+}
+
+// Find out which blocks at the end of a shared relation are spare, when
+// its slot in the size cache doesn't say: after a restart, or once the
+// slot has been evicted or forgotten, spare blocks somebody extended the
+// relation by would otherwise stay in the file unused for good.
+//
+// Going back from the end, a block is spare if nobody has it in the pool
+// and it is a zero page on disk, as md_extend_by() left it. The search
+// stops at the first block in use, and after EXTEND_MAX_BLOCKS blocks.
+// A block given out before the slot was lost that somebody writes while
+// we look spoils the ticket, and nothing is recorded; one they haven't
+// got a buffer for yet may be given out again, but then only one of
+// the two finds it missing from the pool, and the other takes another.
+//
+// Returns false if there was nowhere to record the spare blocks, or they
+// are recorded already; otherwise true, whether or not this search got
+// them recorded.
+static bool reclaim_spare_blocks(Relation relation) {
+  BlockNumber nblocks;
+  BlockNumber nused;
+  BlockNumber limit;
+  uint32 ticket;
+  char* page;
+  int i;
+
+  // Count the blocks, if nobody has.
+  (void)smgr_nblocks(DEFAULT_SMGR, relation);
+
+  ticket = relsize_cache_start_reclaim(relation->rd_node, &nblocks);
+
+  if (ticket == 0) {
+    return false;
+  }
+
+  page = (char*)palloc(BLCKSZ);
+  limit = nblocks > EXTEND_MAX_BLOCKS ? nblocks - EXTEND_MAX_BLOCKS : 0;
+
+  for (nused = nblocks; nused > limit; nused--) {
+    if (block_is_resident(relation, nused - 1) ||
+        smgr_read(DEFAULT_SMGR, relation, nused - 1, page) == SM_FAIL) {
+      break;
+    }
+
+    for (i = 0; i < BLCKSZ && page[i] == 0; i++) {
+    }
+
+    if (i < BLCKSZ) {
+      break;
+    }
+  }
+
+  pfree(page);
+
+  (void)relsize_cache_finish_reclaim(relation->rd_node, nused, ticket);
+
+  return true;
+}
+
+// Whether a block of a shared relation is in the buffer pool.
+static bool block_is_resident(Relation relation, BlockNumber block_number) {
+  BufferTag tag;
+  uint32 hash;
+  TasLock* partition_lock;
+  BufferDesc* buf;
+
+  INIT_BUFFERTAG(&tag, relation, block_number);
+  hash = buf_table_hash_code(&tag);
+  partition_lock = BUF_MAPPING_PARTITION_LOCK(hash);
+
+  LOCK_ACQUIRE(partition_lock);
+  buf = buf_table_lookup(&tag, hash);
+  LOCK_RELEASE(partition_lock);
+
+  return buf != NULL;
+}
+
+// Check that a spare block get_new_block() took is still ours, once
+// buffer_alloc() has given us a buffer for it.
+//
+// buffer_alloc() looked the block up under its mapping partition lock,
+// so if it was in the pool (found) somebody else got to it first (see
+// reclaim_spare_blocks()), and we must not zero it. The size is looked
+// up again now that nobody else can read the block in, in case the
+// relation was truncated after the block was taken.
+static bool preallocated_block_is_ours(Relation relation, BlockNumber block_number, bool found) {
+  return !found && block_number < (BlockNumber)smgr_nblocks(DEFAULT_SMGR, relation);
+}
+
+// Extend a relation by nblocks zeroed blocks at once.
+//
+// On return buffers[i] holds the i'th new block, pinned as if by
+// read_buffer(relation, P_NEW), or INVALID_BUFFER if no buffer was free
+// for it or somebody else has it. Returns the number of the first new
+// block. The blocks are taken from the spare blocks at the end of a
+// shared relation, which is grown with one smgr_extend_by() call if it
+// has too few. The new pages go into the pool as valid zero pages
+// without being read or written. As with P_NEW, callers must make sure
+// nobody else extends the relation meanwhile.
+BlockNumber extend_buffers(Relation relation, int nblocks, Buffer* buffers) {
+  BlockNumber first_block = INVALID_BLOCK_NUMBER;
+  BufferDesc* buf_hdr;
+  bool found;
+  int i;
+
+  ASSERT(nblocks > 0);
+
+  if (!relation->rd_my_xact_only) {
+    first_block = take_spare_blocks(relation, nblocks, nblocks);
+  }
+
+  // Without a record of the spare blocks, the new blocks are simply the
+  // ones past the end.
+  if (first_block == INVALID_BLOCK_NUMBER) {
+    first_block =
+        relation->rd_my_xact_only ? (BlockNumber)relation->rd_nblocks : smgr_nblocks(DEFAULT_SMGR, relation);
+
+    if (smgr_extend_by(DEFAULT_SMGR, relation, nblocks) == SM_FAIL) {
+      elog(ERROR, "%s: cannot extend %s by %d blocks", __func__, RELATION_GET_PHYSICAL_RELATION_NAME(relation),
+           nblocks);
+    }
+  }
+
+  for (i = 0; i < nblocks; i++) {
+    if (relation->rd_my_xact_only) {
+      ReadLocalBufferCount++;
+      buf_hdr = local_buffer_alloc(relation, P_NEW, &found);
+    } else {
+      ReadBufferCount++;
+      buf_hdr = buffer_alloc(relation, first_block + i, NULL, &found);
+    }
+
+    if (buf_hdr == NULL) {
+      buffers[i] = INVALID_BUFFER;
+      continue;
+    }
+
+    // A shared block in the pool already is somebody else's; see
+    // preallocated_block_is_ours().
+    if (!relation->rd_my_xact_only && found) {
+      unpin_buffer(buf_hdr);
+      buffers[i] = INVALID_BUFFER;
+      continue;
+    }
+
+    MEMSET((char*)MAKE_PTR(buf_hdr->data), 0, BLCKSZ);
+
+    if (!relation->rd_my_xact_only) {
+      buf_stats_count(relation->rd_node, BUF_STATS_READ);
+      terminate_buffer_io(buf_hdr, BM_VALID);
+    }
+
+    buffers[i] = BUFFER_DESCRIPTOR_GET_BUFFER(buf_hdr);
+  }
+
+  return first_block;
+}
+
+// Get a buffer from the buffer pool for the given block.
+//
+// The buffer is returned pinned. If it already held the block *found_ptr
+// is set to true; otherwise the caller owns the buffer's input I/O and
+// must finish it with terminate_buffer_io().
+//
+// The tag's hash code is computed once and used to pick the mapping
+// partition as well as for the lookup and insertion in that partition,
+// so lookups of different blocks only contend when they fall in the same
+// partition. BufMgrLock is taken only around the victim search; a hit
+// pins the buffer with a single compare-and-swap on its state word.
+//
+// strategy only affects the choice of a victim; a page that is already
+// in the pool is used wherever it is.
+static BufferDesc* buffer_alloc(Relation relation, BlockNumber block_number, BufferAccessStrategy strategy,
+                                bool* found_ptr) {
+  BufferTag new_tag;      // Identity of requested block
+  uint32 new_hash;        // Hash value for new_tag
+  TasLock* new_partition_lock;
+  BufferTag old_tag;      // Previous identity of selected buffer
+  uint32 old_hash;        // Hash value for old_tag
+  TasLock* old_partition_lock;
+  uint32 old_flags;
+  uint32 buf_state;
+  BufferDesc* buf;
+  BufferBlindId* blind;
+  int buf_id;
+
+  // Create a tag so we can lookup the buffer.
+  INIT_BUFFERTAG(&new_tag, relation, block_number);
+
+  // Determine its hash code and partition lock ID.
+  new_hash = buf_table_hash_code(&new_tag);
+  new_partition_lock = BUF_MAPPING_PARTITION_LOCK(new_hash);
+
+  // See if the block is in the buffer pool already. If it is we pin it
+  // under the partition lock, when we can't afford to allocate memory or
+  // elog(ERROR), so make room for the pin first.
+  reserve_private_refcount_entry();
+  LOCK_ACQUIRE(new_partition_lock);
+  buf = buf_table_lookup(&new_tag, new_hash);
+
+  if (buf != NULL) {
+    // Found it. Now, pin the buffer so no one can steal it from the
+    // buffer pool, and check to see if the correct data has been loaded
+    // into the buffer.
+    pin_buffer(buf);
+    LOCK_RELEASE(new_partition_lock);
+
+    *found_ptr = true;
+
+    buf_state = atomic_read_u32(&buf->state);
+    if (!(buf_state & BM_VALID) || (buf_state & BM_IO_IN_PROGRESS)) {
+      // We can only get here if (a) someone else is still reading in the
+      // page, or (b) a previous read attempt failed. We have to wait for
+      // any active read attempt to finish, and then set up our own read
+      // attempt if the page is still not BM_VALID. start_buffer_io does
+      // it all.
+      if (start_buffer_io(buf, true)) {
+        // If we get here, previous attempts to read the buffer must have
+        // failed ... but we shall bravely try again.
+        *found_ptr = false;
+      }
+    }
+
+    return buf;
+  }
+
+  // Didn't find it in the buffer pool. We'll have to initialize a new
+  // buffer. Remember to unlock the mapping lock while doing the work.
+  LOCK_RELEASE(new_partition_lock);
+
+  // Loop here in case we have to try another victim buffer.
+  for (;;) {
+    // Select a victim buffer. The buffer is returned with its header
+    // lock held, which pin_buffer_locked() releases.
+    reserve_private_refcount_entry();
+    spin_acquire(BufMgrLock);
+    buf = get_free_buffer(strategy, &buf_state);
+
+    if (buf == NULL) {
+      spin_release(BufMgrLock);
+      strategy_wake_bgwriter();
+
+      // Our own asynchronous I/O may be holding the pins.
+      if (NumAsyncBufs > 0) {
+        finish_async_buffer_io();
+        continue;
+      }
+
+      return NULL;
+    }
+
+    pin_buffer_locked(buf);
+    spin_release(BufMgrLock);
+    strategy_wake_bgwriter();
+
+    // If the buffer was dirty, try to write it out. Somebody may dirty
+    // it again while we're writing, which we notice below.
+    if (buf_state & BM_DIRTY || buf->cntx_dirty) {
+      if (!buffer_replace(buf)) {
+        // The write failed; give the buffer back and try another.
+        unpin_buffer(buf);
+        continue;
+      }
+    }
+
+    // Remember the buffer's old identity. Only the header lock protects
+    // it right now, but the tag cannot change again while we hold a pin
+    // because nobody replaces a pinned buffer.
+    buf_state = lock_buf_hdr(buf);
+    old_flags = buf_state & BUF_FLAG_MASK;
+    old_tag = buf->tag;
+    UNLOCK_BUF_HDR(buf, buf_state);
+
+    // To change the association of a valid buffer, we'll need to have
+    // exclusive locks on both the old and new mapping partitions. Take
+    // them in address order to avoid deadlocking with a backend doing
+    // the same for another pair of partitions. We may have to pin
+    // somebody else's buffer for the block under them, so make room for
+    // the pin first, as above.
+    reserve_private_refcount_entry();
+
+    if (!(old_flags & BM_DELETED)) {
+      old_hash = buf_table_hash_code(&old_tag);
+      old_partition_lock = BUF_MAPPING_PARTITION_LOCK(old_hash);
+
+      if (old_partition_lock < new_partition_lock) {
+        LOCK_ACQUIRE(old_partition_lock);
+        LOCK_ACQUIRE(new_partition_lock);
+      } else if (old_partition_lock > new_partition_lock) {
+        LOCK_ACQUIRE(new_partition_lock);
+        LOCK_ACQUIRE(old_partition_lock);
+      } else {
+        // Only one lock is needed.
+        LOCK_ACQUIRE(new_partition_lock);
+      }
+    } else {
+      // If it wasn't valid, we need only the new partition.
+      LOCK_ACQUIRE(new_partition_lock);
+      old_hash = 0;
+      old_partition_lock = NULL;
+    }
+
+    // Try to make a hashtable entry for the buffer under its new tag.
+    // This could fail because while we were writing someone else
+    // allocated another buffer for the same block we want to read in.
+    buf_id = buf_table_insert(&new_tag, new_hash, buf->buf_id);
+
+    if (buf_id >= 0) {
+      // Got a collision. Someone has already done what we were about to
+      // do. We'll just handle this as if it were found in the buffer
+      // pool in the first place. First, give up the buffer we were
+      // planning to use.
+      unpin_buffer(buf);
+
+      // Remaining code should match code at top of routine.
+      buf = &BufferDescriptors[buf_id];
+      pin_buffer(buf);
+
+      // Can give up that buffer's mapping partition lock now.
+      if (old_partition_lock != NULL && old_partition_lock != new_partition_lock) {
+        LOCK_RELEASE(old_partition_lock);
+      }
+      LOCK_RELEASE(new_partition_lock);
+
+      *found_ptr = true;
+
+      buf_state = atomic_read_u32(&buf->state);
+      if (!(buf_state & BM_VALID) || (buf_state & BM_IO_IN_PROGRESS)) {
+        if (start_buffer_io(buf, true)) {
+          *found_ptr = false;
+        }
+      }
+
+      return buf;
+    }
+
+    // Need to lock the buffer header too in order to change its tag.
+    buf_state = lock_buf_hdr(buf);
+
+    // Somebody could have pinned or re-dirtied the buffer while we were
+    // doing the I/O and making the new hashtable entry. If so, we can't
+    // recycle this buffer; we must undo everything we've done and start
+    // over with a new victim buffer.
+    old_flags = buf_state & BUF_FLAG_MASK;
+
+    if (BUF_STATE_GET_REFCOUNT(buf_state) == 1 && !(old_flags & BM_DIRTY) && !buf->cntx_dirty) {
+      break;
+    }
+
+    UNLOCK_BUF_HDR(buf, buf_state);
+    buf_table_delete(&new_tag, new_hash);
+
+    if (old_partition_lock != NULL && old_partition_lock != new_partition_lock) {
+      LOCK_RELEASE(old_partition_lock);
+    }
+    LOCK_RELEASE(new_partition_lock);
+
+    unpin_buffer(buf);
   }
-}
\ No newline at end of file
+
+  // Okay, it's finally safe to rename the buffer.
+  //
+  // Clearing BM_VALID here is necessary, clearing the dirty bits is just
+  // paranoia. We also reset the usage_count since any recency of use of
+  // the old content is no longer relevant.
+  buf->tag = new_tag;
+  buf_state &= ~(BM_VALID | BM_DELETED | BM_DIRTY | BM_JUST_DIRTIED | BM_CHECKPOINT_NEEDED | BM_IO_ERROR |
+                 BUF_USAGECOUNT_MASK);
+  buf_state += BUF_USAGECOUNT_ONE;
+
+  UNLOCK_BUF_HDR(buf, buf_state);
+
+  if (old_partition_lock != NULL) {
+    buf_table_delete(&old_tag, old_hash);
+    buf_rel_delete(buf, old_tag.rnode);
+
+    if (old_partition_lock != new_partition_lock) {
+      LOCK_RELEASE(old_partition_lock);
+    }
+  }
+
+  buf_rel_insert(buf, new_tag.rnode);
+
+  LOCK_RELEASE(new_partition_lock);
+
+  // Save the names for a possible blind write of this buffer later.
+  blind = &BUFFER_DESCRIPTOR_GET_COLD(buf)->blind;
+  if (DatabaseName != NULL) {
+    strncpy(blind->db_name, DatabaseName, NAME_DATA_LEN);
+  } else {
+    strncpy(blind->db_name, "Recovery", NAME_DATA_LEN);
+  }
+  blind->db_name[NAME_DATA_LEN - 1] = '\0';
+
+  strncpy(blind->rel_name, RELATION_GET_PHYSICAL_RELATION_NAME(relation), NAME_DATA_LEN);
+  blind->rel_name[NAME_DATA_LEN - 1] = '\0';
+
+  // Buffer contents are currently invalid. Try to get the io_in_progress
+  // lock. If start_buffer_io returns false, then someone else managed to
+  // read it before we did, so there's nothing left for buffer_alloc()
+  // to do.
+  if (start_buffer_io(buf, true)) {
+    *found_ptr = false;
+  } else {
+    *found_ptr = true;
+  }
+
+  return buf;
+}
+
+// Write out a dirty buffer that is about to be replaced.
+//
+// The caller holds a pin on the buffer. We write it out by name only
+// (the relation may not be open in this backend); see write_buffer_run().
+// Returns false if the write failed.
+//
+// A write we do ourselves is counted as a backend write: the background
+// writer should have got to the buffer first. If someone else flushed
+// it meanwhile, it was not our write to count.
+static bool buffer_replace(BufferDesc* buf_hdr) {
+  bool written = true;
+
+  lock_buffer_for_write(buf_hdr, true);
+
+  if (start_buffer_io(buf_hdr, false)) {
+    written = write_buffer_run(&buf_hdr, 1) == 1;
+
+    if (written) {
+      bgwriter_count_backend_write();
+    }
+  }
+
+  unlock_buffer_for_write(buf_hdr);
+
+  return written;
+}
+
+// Write out dirty buffers holding consecutive blocks of one relation,
+// with a single smgr_blind_writev().
+//
+// The caller holds a pin and the content lock, shared, on each buffer,
+// and has started output I/O on it; see lock_buffer_for_write().
+// BM_JUST_DIRTIED tells us whether someone dirtied a page again during
+// the write. Returns the number of buffers written: all of them,
+// or none if the write failed.
+static int write_buffer_run(BufferDesc** bufs, int nbufs) {
+  char* pages[BUFFER_MAX_COMBINE];
+  int status;
+
+  prepare_buffer_write(bufs, nbufs, pages);
+
+  status = smgr_blind_writev(DEFAULT_SMGR, bufs[0]->tag.rnode, bufs[0]->tag.block_num, pages, nbufs, false);
+
+  return finish_buffer_write(bufs, nbufs, status == SM_SUCCESS);
+}
+
+// First half of write_buffer_run(): note that the pages are about to be
+// written, and collect them into pages.
+//
+// A page changed under an exclusive content lock is only marked with
+// cntx_dirty. That goes into BM_DIRTY before we clear it, so the buffer
+// stays dirty if the write fails, until finish_buffer_write() knows the
+// page is on disk.
+static void prepare_buffer_write(BufferDesc** bufs, int nbufs, char** pages) {
+  uint32 buf_state;
+  int i;
+
+  for (i = 0; i < nbufs; i++) {
+    buf_state = lock_buf_hdr(bufs[i]);
+    if (bufs[i]->cntx_dirty) {
+      buf_state |= BM_DIRTY;
+      bufs[i]->cntx_dirty = false;
+    }
+    buf_state &= ~BM_JUST_DIRTIED;
+    UNLOCK_BUF_HDR(bufs[i], buf_state);
+
+    pages[i] = (char*)MAKE_PTR(bufs[i]->data);
+  }
+}
+
+// Second half of write_buffer_run(), once the write is done: finish the
+// output I/O, marking the buffers clean if written is set and nobody
+// dirtied them again meanwhile. Doesn't unpin them.
+static int finish_buffer_write(BufferDesc** bufs, int nbufs, bool written) {
+  uint32 buf_state;
+  int i;
+
+  if (!written) {
+    elog(NOTICE, "%s: cannot write %u..%u for %s", __func__, bufs[0]->tag.block_num,
+         bufs[0]->tag.block_num + nbufs - 1, BUFFER_DESCRIPTOR_GET_COLD(bufs[0])->blind.rel_name);
+
+    for (i = 0; i < nbufs; i++) {
+      terminate_buffer_io(bufs[i], BM_IO_ERROR);
+    }
+
+    return 0;
+  }
+
+  for (i = 0; i < nbufs; i++) {
+    BufferFlushCount++;
+    buf_stats_count(bufs[i]->tag.rnode, BUF_STATS_WRITE);
+
+    // If the buffer was dirtied while we were writing it, it stays dirty.
+    // Either way what a running checkpoint needed is on disk now.
+    buf_state = lock_buf_hdr(bufs[i]);
+    if (!(buf_state & BM_JUST_DIRTIED)) {
+      buf_state &= ~BM_DIRTY;
+    }
+    buf_state &= ~BM_CHECKPOINT_NEEDED;
+    UNLOCK_BUF_HDR(bufs[i], buf_state);
+
+    terminate_buffer_io(bufs[i], 0);
+  }
+
+  return nbufs;
+}
+
+// Start reading a block of a shared relation into a buffer, for
+// prefetch_buffer(), without waiting for the read. Returns false if the
+// read could not be started, and the caller should fall back on a hint.
+static bool start_async_read(Relation relation, BlockNumber block_number) {
+  BufferDesc* buf_hdr;
+  AsyncIo* aio;
+  bool found;
+  int id;
+
+  id = reserve_async_io(1);
+  if (id < 0) {
+    return false;
+  }
+
+  buf_hdr = buffer_alloc(relation, block_number, NULL, &found);
+
+  if (buf_hdr == NULL) {
+    return false;
+  }
+
+  if (found) {
+    // Already there, or being read by somebody else.
+    unpin_buffer(buf_hdr);
+    return true;
+  }
+
+  if (smgr_start_read(DEFAULT_SMGR, relation, block_number, (char*)MAKE_PTR(buf_hdr->data), id) == SM_FAIL) {
+    terminate_buffer_io(buf_hdr, 0);
+    unpin_buffer(buf_hdr);
+    return false;
+  }
+
+  aio = &AsyncIos[id];
+  aio->bufs[0] = buf_hdr;
+  aio->nbufs = 1;
+  aio->for_input = true;
+  NumAsyncBufs++;
+
+  return true;
+}
+
+// Like write_buffer_run(), but only start the write. On success the
+// pins, content locks and output I/O on bufs belong to the write, and are
+// given up when it is reaped. Returns false if the write could not be started, and the
+// caller should do it synchronously.
+static bool start_async_write(BufferDesc** bufs, int nbufs) {
+  char* pages[BUFFER_MAX_COMBINE];
+  AsyncIo* aio;
+  int id;
+  int i;
+
+  id = reserve_async_io(nbufs);
+  if (id < 0) {
+    return false;
+  }
+
+  for (i = 0; i < nbufs; i++) {
+    pages[i] = (char*)MAKE_PTR(bufs[i]->data);
+  }
+
+  // Leave the buffers alone until the write is under way, so that the
+  // caller can write them synchronously as if we had never been called.
+  if (smgr_start_blind_writev(DEFAULT_SMGR, bufs[0]->tag.rnode, bufs[0]->tag.block_num, pages, nbufs, id) ==
+      SM_FAIL) {
+    return false;
+  }
+
+  // That is still soon enough to note that they are being written: the
+  // content locks we hold keep anybody from changing them until the
+  // write is reaped.
+  prepare_buffer_write(bufs, nbufs, pages);
+
+  aio = &AsyncIos[id];
+  for (i = 0; i < nbufs; i++) {
+    aio->bufs[i] = bufs[i];
+  }
+  aio->nbufs = nbufs;
+  aio->for_input = false;
+  NumAsyncBufs += nbufs;
+
+  return true;
+}
+
+// Find a free entry in AsyncIos for an I/O of nbufs buffers, first
+// waiting for earlier ones to complete if they already fill
+// AsyncIoDepth. Returns its index, or -1 if asynchronous I/O is off or
+// not available.
+static int reserve_async_io(int nbufs) {
+  static bool exit_registered = false;
+  int id;
+
+  if (nbufs > AsyncIoDepth || !aio_available()) {
+    return -1;
+  }
+
+  // Buffers would be left with BM_IO_IN_PROGRESS set forever if we went
+  // away with I/O in flight.
+  if (!exit_registered) {
+    on_proc_exit(finish_async_buffer_io, 0);
+    exit_registered = true;
+  }
+
+  while (NumAsyncBufs + nbufs > AsyncIoDepth) {
+    reap_async_io(true);
+  }
+
+  // Every I/O has at least one buffer, so one is free.
+  for (id = 0; AsyncIos[id].nbufs > 0; id++) {
+  }
+
+  ASSERT(id < MAX_ASYNC_BUFS);
+
+  return id;
+}
+
+// Finish the asynchronous I/Os that have completed. If wait is set, wait
+// for at least one, if any are in flight.
+static void reap_async_io(bool wait) {
+  AioResult results[MAX_ASYNC_BUFS];
+  int nresults;
+  int i;
+
+  nresults = aio_reap(results, MAX_ASYNC_BUFS, wait ? 1 : 0);
+
+  for (i = 0; i < nresults; i++) {
+    finish_async_io(&AsyncIos[results[i].id], results[i].result);
+  }
+}
+
+// Finish an asynchronous I/O that transferred result bytes (or failed
+// with -result), and drop its content locks and pins.
+//
+// A read that came up short leaves the buffer invalid without an error:
+// it was only a prefetch, and whoever reads the block for real does the
+// I/O again, reporting any error, or zeroing a block past the end.
+static void finish_async_io(AsyncIo* aio, int result) {
+  int i;
+
+  if (aio->for_input) {
+    if (result != BLCKSZ) {
+      elog(DEBUG, "%s: prefetch of block %u got %d", __func__, aio->bufs[0]->tag.block_num, result);
+    }
+
+    terminate_buffer_io(aio->bufs[0], result == BLCKSZ ? BM_VALID : 0);
+  } else {
+    // The segment must be fsync'd before the checkpoint that may be
+    // waiting for this write can finish.
+    if (result == aio->nbufs * BLCKSZ) {
+      smgr_blind_mark_dirty(DEFAULT_SMGR, aio->bufs[0]->tag.rnode, aio->bufs[0]->tag.block_num);
+    }
+
+    finish_buffer_write(aio->bufs, aio->nbufs, result == aio->nbufs * BLCKSZ);
+  }
+
+  for (i = 0; i < aio->nbufs; i++) {
+    if (!aio->for_input) {
+      unlock_buffer_for_write(aio->bufs[i]);
+    }
+
+    unpin_buffer(aio->bufs[i]);
+  }
+
+  NumAsyncBufs -= aio->nbufs;
+  aio->nbufs = 0;
+}
+
+// Wait for all of this backend's asynchronous I/O to complete.
+void finish_async_buffer_io(void) {
+  while (NumAsyncBufs > 0) {
+    reap_async_io(true);
+  }
+}
+
+// Write out some dirty buffers in the pool, ahead of the clock sweep.
+//
+// This is called periodically by the background writer process. Returns
+// true if it's appropriate for the background writer to hibernate, that
+// is, nobody allocated a buffer since the last call and everything ahead
+// of the clock up to a full lap is already clean.
+//
+// The goal is that every buffer the clock sweep will hand out before the
+// next call is clean and reusable. We estimate how many buffers will be
+// allocated until then from a moving average of recent allocations (times
+// BgWriterLruMultiplier, for headroom), and how many buffers the clock
+// has to pass per allocation from a moving average of what we and the
+// clock have seen. Then we scan forward from the point where the last
+// round stopped until that many reusable buffers are known to lie ahead
+// of the clock, writing the dirty ones, but never more than
+// BgWriterLruMaxPages per round.
+bool bg_buffer_sync(void) {
+  // Info obtained from freelist.c.
+  int strategy_buf_id;
+  uint32 strategy_passes;
+  uint32 recent_alloc;
+
+  // Information saved between calls so we can determine the strategy
+  // point's advance rate and avoid scanning already-cleaned buffers.
+  static bool saved_info_valid = false;
+  static int prev_strategy_buf_id;
+  static uint32 prev_strategy_passes;
+  static int next_to_clean;
+  static uint32 next_passes;
+
+  // Moving averages of allocation rate and clean-buffer density.
+  static float smoothed_alloc = 0;
+  static float smoothed_density = 10.0;
+
+  // Potentially these could be tunables, but for now, not.
+  float smoothing_samples = 16;
+  float scan_whole_pool_milliseconds = 120000.0;
+
+  // Used to compute how far we scan ahead.
+  long strategy_delta;
+  int bufs_to_lap;
+  int bufs_ahead;
+  float scans_per_alloc;
+  int reusable_buffers_est;
+  int upcoming_alloc_est;
+  int min_scan_buffers;
+
+  // Variables for the scanning loop proper.
+  int num_to_scan;
+  int num_written;
+  int reusable_buffers;
+  bool hit_max = false;
+
+  // Variables for final smoothed_density update.
+  long new_strategy_delta;
+  uint32 new_recent_alloc;
+
+  // Find out where the freelist clock sweep currently is, and how many
+  // buffer allocations have happened since our last call.
+  spin_acquire(BufMgrLock);
+  strategy_buf_id = strategy_sync_start(&strategy_passes, &recent_alloc);
+  spin_release(BufMgrLock);
+
+  // If we're not running the LRU scan, just stop after doing the stats
+  // stuff. We mark the saved state invalid so that we can recover sanely
+  // if LRU scan is turned back on later.
+  if (BgWriterLruMaxPages <= 0) {
+    bgwriter_count_clean(0, false, recent_alloc);
+    saved_info_valid = false;
+    return true;
+  }
+
+  // Compute strategy_delta = how many buffers have been scanned by the
+  // clock sweep since last time. If first time through, assume none.
+  // Then see if we are still ahead of the clock sweep, and if so, how
+  // many buffers we could scan before we'd catch up with it and "lap" it.
+  // Note: weird-looking coding of xxx_passes comparisons are to avoid
+  // bogus behavior when the passes counts wrap around.
+  if (saved_info_valid) {
+    int32 passes_delta = strategy_passes - prev_strategy_passes;
+
+    strategy_delta = strategy_buf_id - prev_strategy_buf_id;
+    strategy_delta += (long)passes_delta * NBuffers;
+
+    ASSERT(strategy_delta >= 0);
+
+    if ((int32)(next_passes - strategy_passes) > 0) {
+      // We're one pass ahead of the strategy point.
+      bufs_to_lap = strategy_buf_id - next_to_clean;
+    } else if (next_passes == strategy_passes && next_to_clean >= strategy_buf_id) {
+      // On same pass, but ahead or at least not behind.
+      bufs_to_lap = NBuffers - (next_to_clean - strategy_buf_id);
+    } else {
+      // We're behind, so skip forward to the strategy point and start
+      // cleaning from there.
+      next_to_clean = strategy_buf_id;
+      next_passes = strategy_passes;
+      bufs_to_lap = NBuffers;
+    }
+  } else {
+    // Initializing at startup or after LRU scanning had been off. Always
+    // start at the strategy point.
+    strategy_delta = 0;
+    next_to_clean = strategy_buf_id;
+    next_passes = strategy_passes;
+    bufs_to_lap = NBuffers;
+  }
+
+  // Update saved info for next time.
+  prev_strategy_buf_id = strategy_buf_id;
+  prev_strategy_passes = strategy_passes;
+  saved_info_valid = true;
+
+  // Compute how many buffers had to be scanned for each new allocation,
+  // ie, 1/density of reusable buffers, and track a moving average of that.
+  //
+  // If the strategy point didn't move, we don't update the density
+  // estimate.
+  if (strategy_delta > 0 && recent_alloc > 0) {
+    scans_per_alloc = (float)strategy_delta / (float)recent_alloc;
+    smoothed_density += (scans_per_alloc - smoothed_density) / smoothing_samples;
+  }
+
+  // Estimate how many reusable buffers there are between the current
+  // strategy point and where we've scanned ahead to, based on the
+  // smoothed density estimate.
+  bufs_ahead = NBuffers - bufs_to_lap;
+  reusable_buffers_est = (float)bufs_ahead / smoothed_density;
+
+  // Track a moving average of recent buffer allocations. Here, rather
+  // than a true average we want a fast-attack, slow-decline behavior: we
+  // immediately follow any increase.
+  if (smoothed_alloc <= (float)recent_alloc) {
+    smoothed_alloc = recent_alloc;
+  } else {
+    smoothed_alloc += ((float)recent_alloc - smoothed_alloc) / smoothing_samples;
+  }
+
+  // Scale the estimate by a GUC to allow more aggressive tuning.
+  upcoming_alloc_est = (int)(smoothed_alloc * BgWriterLruMultiplier);
+
+  // If recent_alloc remains at zero for many cycles, smoothed_alloc will
+  // eventually underflow to zero, and the underflows produce annoying
+  // kernel warnings on some platforms. Once upcoming_alloc_est has gone
+  // to zero, there's no point in tracking smaller and smaller values of
+  // smoothed_alloc, so just reset it to exactly zero to avoid this
+  // syndrome. It will pop back up as soon as recent_alloc increases.
+  if (upcoming_alloc_est == 0) {
+    smoothed_alloc = 0;
+  }
+
+  // Even in cases where there's been little or no buffer allocation
+  // activity, we want to make a small amount of progress through the
+  // buffer cache so that as many reusable buffers as possible are clean
+  // after an idle period.
+  //
+  // (scan_whole_pool_milliseconds / BgWriterDelay) computes how many
+  // times the BGW will be called during the scan_whole_pool time; slice
+  // the buffer pool into that many sections.
+  min_scan_buffers = (int)(NBuffers / (scan_whole_pool_milliseconds / BgWriterDelay));
+
+  if (upcoming_alloc_est < (min_scan_buffers + reusable_buffers_est)) {
+    upcoming_alloc_est = min_scan_buffers + reusable_buffers_est;
+  }
+
+  // Now write out dirty reusable buffers, working forward from the
+  // next_to_clean point, until we have lapped the strategy scan, or
+  // cleaned enough buffers to match our estimate of the next cycle's
+  // allocation requirements, or hit the BgWriterLruMaxPages limit.
+  num_to_scan = bufs_to_lap;
+  num_written = 0;
+  reusable_buffers = reusable_buffers_est;
+
+  // Execute the LRU scan.
+  while (num_to_scan > 0 && reusable_buffers < upcoming_alloc_est) {
+    int sync_state = sync_one_buffer(next_to_clean, true);
+
+    if (++next_to_clean >= NBuffers) {
+      next_to_clean = 0;
+      next_passes++;
+    }
+    num_to_scan--;
+
+    if (sync_state & BUF_WRITTEN) {
+      reusable_buffers++;
+
+      if (++num_written >= BgWriterLruMaxPages) {
+        hit_max = true;
+        break;
+      }
+    } else if (sync_state & BUF_REUSABLE) {
+      reusable_buffers++;
+    }
+  }
+
+  // Nobody but us can finish our writes, so see them through before we
+  // go to sleep.
+  finish_async_buffer_io();
+
+  bgwriter_count_clean(num_written, hit_max, recent_alloc);
+
+  // Consider the above scan as being like a new allocation scan.
+  // Characterize its density and update the smoothed one based on it.
+  // This effectively halves the moving average period in cases where
+  // both the strategy and the background writer are doing some useful
+  // scanning, which is helpful because a long memory isn't as desirable
+  // on the density estimates.
+  new_strategy_delta = bufs_to_lap - num_to_scan;
+  new_recent_alloc = reusable_buffers - reusable_buffers_est;
+
+  if (new_strategy_delta > 0 && new_recent_alloc > 0) {
+    scans_per_alloc = (float)new_strategy_delta / (float)new_recent_alloc;
+    smoothed_density += (scans_per_alloc - smoothed_density) / smoothing_samples;
+  }
+
+  // Return true if OK to hibernate.
+  return (bufs_to_lap == 0 && recent_alloc == 0);
+}
+
+// Process a single buffer during syncing.
+//
+// If skip_recently_used is true, we don't write currently-pinned buffers,
+// nor buffers marked recently used, as these are not replacement
+// candidates.
+//
+// Returns a bitmask containing the following flag bits:
+//  BUF_WRITTEN: we wrote the buffer.
+//  BUF_REUSABLE: buffer is available for replacement, ie, it has pin
+//      count 0 and usage count 0.
+static int sync_one_buffer(int buf_id, bool skip_recently_used) {
+  BufferDesc* buf_hdr = &BufferDescriptors[buf_id];
+  int result = 0;
+  uint32 buf_state;
+
+  reserve_private_refcount_entry();
+
+  // Check whether buffer needs writing. If someone dirties it just after
+  // we look, it is simply written on a later round.
+  buf_state = lock_buf_hdr(buf_hdr);
+
+  if (BUF_STATE_GET_REFCOUNT(buf_state) == 0 && BUF_STATE_GET_USAGECOUNT(buf_state) == 0) {
+    result |= BUF_REUSABLE;
+  } else if (skip_recently_used) {
+    // Caller told us not to write recently-used buffers.
+    UNLOCK_BUF_HDR(buf_hdr, buf_state);
+    return result;
+  }
+
+  if (!(buf_state & BM_VALID) || !(buf_state & BM_DIRTY || buf_hdr->cntx_dirty)) {
+    // It's clean, so nothing to do.
+    UNLOCK_BUF_HDR(buf_hdr, buf_state);
+    return result;
+  }
+
+  // Pin it and write it out. pin_buffer_locked() does not bump the usage
+  // count, so we don't make the buffer look recently used.
+  pin_buffer_locked(buf_hdr);
+  lock_buffer_for_write(buf_hdr, true);
+
+  if (!start_buffer_io(buf_hdr, false)) {
+    // Someone else flushed the buffer meanwhile.
+    result |= BUF_WRITTEN;
+  } else if (start_async_write(&buf_hdr, 1)) {
+    // The write has our pin and lock now.
+    return result | BUF_WRITTEN;
+  } else if (write_buffer_run(&buf_hdr, 1) == 1) {
+    result |= BUF_WRITTEN;
+  }
+
+  unlock_buffer_for_write(buf_hdr);
+  unpin_buffer(buf_hdr);
+
+  return result;
+}
+
+// Write out all dirty buffers in the pool, for a checkpoint.
+//
+// Writing the buffers in BufferDescriptors order would be random I/O, so
+// we first collect the tags of the dirty buffers, marking each buffer
+// BM_CHECKPOINT_NEEDED, and sort them by file and block. The writes then
+// go out in file order. Buffers written (or recycled) by somebody else
+// in the meantime lose the mark and are skipped.
+//
+// Unless immediate is set, the writes are spread out so that they finish
+// after CheckPointCompletionTarget of the checkpoint interval, instead of
+// saturating the disk in one burst. Finally every segment written to
+// since the last checkpoint, by us or anybody else, is fsync'd once
+// (see smgr_sync()).
+void checkpoint_buffers(bool immediate) {
+  CkptSortItem* items;
+  struct timespec start;
+  uint32 buf_state;
+  int num_to_scan;
+  int num_written;
+  int buf_id;
+  int i;
+  int n;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  items = (CkptSortItem*)palloc(NBuffers * sizeof(CkptSortItem));
+
+  // Loop over all buffers, and mark the ones that need to be written with
+  // BM_CHECKPOINT_NEEDED. Count them as we go (num_to_scan), so that we
+  // can estimate how much work needs to be done.
+  //
+  // This allows us to write only those pages that were dirty when the
+  // checkpoint began, and not those that get dirtied while it proceeds.
+  num_to_scan = 0;
+
+  for (buf_id = 0; buf_id < NBuffers; buf_id++) {
+    BufferDesc* buf_hdr = &BufferDescriptors[buf_id];
+
+    // Header spinlock is enough to examine BM_DIRTY.
+    buf_state = lock_buf_hdr(buf_hdr);
+
+    if ((buf_state & BM_VALID) && (buf_state & BM_DIRTY || buf_hdr->cntx_dirty)) {
+      buf_state |= BM_CHECKPOINT_NEEDED;
+
+      items[num_to_scan].rnode = buf_hdr->tag.rnode;
+      items[num_to_scan].block_num = buf_hdr->tag.block_num;
+      items[num_to_scan].buf_id = buf_id;
+      num_to_scan++;
+    }
+
+    UNLOCK_BUF_HDR(buf_hdr, buf_state);
+  }
+
+  // Sort buffers that need to be written to reduce the likelihood of
+  // random IO.
+  qsort(items, num_to_scan, sizeof(CkptSortItem), ckpt_buforder_comparator);
+
+  // Write the buffers in file order, pacing ourselves between writes.
+  // Adjacent blocks of a relation go out together.
+  num_written = 0;
+
+  for (i = 0; i < num_to_scan; i += n) {
+    n = checkpoint_write_run(&items[i], MIN(num_to_scan - i, BUFFER_MAX_COMBINE), &num_written);
+
+    // Sleep to throttle our I/O rate.
+    checkpoint_write_delay(immediate, (double)(i + n) / num_to_scan, &start);
+  }
+
+  finish_async_buffer_io();
+
+  // Make the writes durable. Every write, ours or another backend's,
+  // asked for its segment to be fsync'd; each is now, once.
+  smgr_sync();
+
+  elog(DEBUG, "%s: wrote %d of %d dirty buffers", __func__, num_written, num_to_scan);
+
+  pfree(items);
+}
+
+// Write the buffer of items[0] for a checkpoint, together with those of
+// the following items (at most nitems in all) that hold the next blocks
+// of the same relation, in one write. The write is asynchronous if it
+// can be.
+//
+// The run ends at the first buffer that no longer needs writing: somebody
+// else wrote or recycled it since we marked it BM_CHECKPOINT_NEEDED.
+// Returns the number of items done with, at least one, and adds the
+// number of buffers written to *num_written.
+static int checkpoint_write_run(CkptSortItem* items, int nitems, int* num_written) {
+  BufferDesc* bufs[BUFFER_MAX_COMBINE];
+  BufferDesc* buf_hdr;
+  uint32 buf_state;
+  int nbufs = 0;
+  int i;
+
+  for (i = 0; i < nitems; i++) {
+    if (i > 0 && (!REL_FILE_NODE_EQUALS(items[i].rnode, items[0].rnode) ||
+                  items[i].block_num != items[0].block_num + i)) {
+      break;
+    }
+
+    buf_hdr = &BufferDescriptors[items[i].buf_id];
+
+    // BM_CHECKPOINT_NEEDED is cleared whenever the buffer is written or
+    // gets a new tag, so if it's still set the buffer holds our block.
+    reserve_private_refcount_entry();
+    buf_state = lock_buf_hdr(buf_hdr);
+
+    if (!(buf_state & BM_CHECKPOINT_NEEDED) || !(buf_state & BM_VALID) ||
+        !(buf_state & BM_DIRTY || buf_hdr->cntx_dirty)) {
+      UNLOCK_BUF_HDR(buf_hdr, buf_state);
+      break;
+    }
+
+    // pin_buffer_locked() does not bump the usage count, so we don't make
+    // the buffer look recently used.
+    pin_buffer_locked(buf_hdr);
+
+    // We hold the locks of the buffers before it in the run, so we must
+    // not wait for this one; it ends the run unless it's the first.
+    if (!lock_buffer_for_write(buf_hdr, i == 0)) {
+      unpin_buffer(buf_hdr);
+      break;
+    }
+
+    if (!start_buffer_io(buf_hdr, false)) {
+      unlock_buffer_for_write(buf_hdr);
+      unpin_buffer(buf_hdr);
+      break;
+    }
+
+    bufs[nbufs++] = buf_hdr;
+  }
+
+  if (nbufs > 0) {
+    if (start_async_write(bufs, nbufs)) {
+      // Counted now; should it fail, finish_buffer_write() complains.
+      *num_written += nbufs;
+    } else {
+      *num_written += write_buffer_run(bufs, nbufs);
+
+      for (i = 0; i < nbufs; i++) {
+        unlock_buffer_for_write(bufs[i]);
+        unpin_buffer(bufs[i]);
+      }
+    }
+  }
+
+  return MAX(nbufs, 1);
+}
+
+// Comparator determining the writeout order in a checkpoint.
+static int ckpt_buforder_comparator(const void* pa, const void* pb) {
+  const CkptSortItem* a = (const CkptSortItem*)pa;
+  const CkptSortItem* b = (const CkptSortItem*)pb;
+
+  // Compare tablespace-like node first, then relation, then block.
+  if (a->rnode.tbl_node != b->rnode.tbl_node) {
+    return a->rnode.tbl_node < b->rnode.tbl_node ? -1 : 1;
+  }
+
+  if (a->rnode.rel_node != b->rnode.rel_node) {
+    return a->rnode.rel_node < b->rnode.rel_node ? -1 : 1;
+  }
+
+  if (a->block_num != b->block_num) {
+    return a->block_num < b->block_num ? -1 : 1;
+  }
+
+  return 0;
+}
+
+// Determine if we're on schedule to finish the checkpoint in time.
+//
+// progress is the fraction of the writes done so far. We compare it with
+// the fraction of the allowed time (CheckPointCompletionTarget of
+// CheckPointTimeout) that has passed since start.
+static bool is_checkpoint_on_schedule(double progress, struct timespec* start) {
+  struct timespec now;
+  double elapsed_time;
+
+  // Scale progress according to CheckPointCompletionTarget.
+  progress *= CheckPointCompletionTarget;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  elapsed_time = (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+  elapsed_time /= CheckPointTimeout;
+
+  return progress >= elapsed_time;
+}
+
+// Yield some time to other processes during a checkpoint.
+//
+// If we are ahead of schedule we sleep a bit, keeping the LRU scan of
+// the background writer going meanwhile. An immediate checkpoint, or one
+// the background writer is asked to finish for shutdown, does not sleep.
+static void checkpoint_write_delay(bool immediate, double progress, struct timespec* start) {
+  struct timeval delay;
+
+  if (immediate || bgwriter_shutdown_requested()) {
+    return;
+  }
+
+  while (is_checkpoint_on_schedule(progress, start) && !bgwriter_shutdown_requested()) {
+    // Keep the fsync request queue from filling up.
+    absorb_fsync_requests();
+    (void)bg_buffer_sync();
+
+    delay.tv_sec = 0;
+    delay.tv_usec = CHECKPOINT_WRITE_DELAY * 1000L;
+    (void)select(0, NULL, NULL, NULL, &delay);
+  }
+}
+
+// Discard the buffers holding blocks first_del_block and up of a
+// relation, without writing them even if they are dirty. Used when the
+// relation is dropped (first_del_block 0) or truncated.
+//
+// The caller must hold a lock that keeps other backends from reading
+// blocks of the relation in the meantime. Only the relation's own
+// buffers are visited, found through the relation index in buf_table.c
+// (or, for a local relation, by looking up its blocks), so dropping a
+// small relation costs the same however big the pool is.
+void drop_relation_buffers(Relation relation, BlockNumber first_del_block) {
+  int* buf_ids;
+  int nbuffers;
+  int i;
+
+  if (relation->rd_my_xact_only) {
+    drop_local_relation_buffers(relation, first_del_block);
+    return;
+  }
+
+  // Our asynchronous I/O holds pins, maybe on the relation's buffers.
+  finish_async_buffer_io();
+
+  nbuffers = buf_rel_lookup(relation->rd_node, &buf_ids);
+
+  for (i = 0; i < nbuffers; i++) {
+    invalidate_buffer(&BufferDescriptors[buf_ids[i]], relation->rd_node, first_del_block);
+  }
+
+  if (buf_ids != NULL) {
+    pfree(buf_ids);
+  }
+
+  if (first_del_block == 0) {
+    buf_stats_forget(relation->rd_node);
+  }
+}
+
+// Throw away the contents of a buffer if it still holds a block of rnode
+// at or past first_del_block, and put it on the freelist.
+static void invalidate_buffer(BufferDesc* buf_hdr, RelFileNode rnode, BlockNumber first_del_block) {
+  BufferTag tag;
+  uint32 hash_code;
+  TasLock* partition_lock;
+  uint32 buf_state;
+  struct timeval delay;
+
+  for (;;) {
+    buf_state = lock_buf_hdr(buf_hdr);
+    tag = buf_hdr->tag;
+    UNLOCK_BUF_HDR(buf_hdr, buf_state);
+
+    // Got a new identity since we looked at the relation's list.
+    if ((buf_state & BM_DELETED) || !REL_FILE_NODE_EQUALS(tag.rnode, rnode) || tag.block_num < first_del_block) {
+      return;
+    }
+
+    // Changing the tag requires the mapping partition lock as well.
+    hash_code = buf_table_hash_code(&tag);
+    partition_lock = BUF_MAPPING_PARTITION_LOCK(hash_code);
+
+    LOCK_ACQUIRE(partition_lock);
+    buf_state = lock_buf_hdr(buf_hdr);
+
+    if ((buf_state & BM_DELETED) || !REL_FILE_NODE_EQUALS(buf_hdr->tag.rnode, tag.rnode) ||
+        buf_hdr->tag.block_num != tag.block_num) {
+      UNLOCK_BUF_HDR(buf_hdr, buf_state);
+      LOCK_RELEASE(partition_lock);
+      continue;
+    }
+
+    if (BUF_STATE_GET_REFCOUNT(buf_state) == 0 && !(buf_state & BM_IO_IN_PROGRESS)) {
+      break;
+    }
+
+    UNLOCK_BUF_HDR(buf_hdr, buf_state);
+    LOCK_RELEASE(partition_lock);
+
+    if (get_private_refcount(BUFFER_DESCRIPTOR_GET_BUFFER(buf_hdr)) > 0) {
+      elog(ERROR, "%s: block %u of %u/%u is still pinned", __func__, tag.block_num, tag.rnode.tbl_node,
+           tag.rnode.rel_node);
+    }
+
+    // Somebody else has it pinned, for a write by the background writer
+    // or a checkpoint most likely. Wait for them to finish.
+    delay.tv_sec = 0;
+    delay.tv_usec = PIN_WAIT_DELAY;
+    (void)select(0, NULL, NULL, NULL, &delay);
+  }
+
+  // The buffer now holds nothing, like the ones on the freelist at
+  // startup. Its changes go with it, both those in BM_DIRTY and those
+  // only in cntx_dirty; nobody can be changing the page, as nobody holds
+  // a pin, and the header lock keeps a concurrent write from seeing one
+  // flag cleared without the other.
+  CLEAR_BUFFERTAG(&buf_hdr->tag);
+  buf_hdr->cntx_dirty = false;
+  buf_state &= ~(BM_DIRTY | BM_JUST_DIRTIED | BM_CHECKPOINT_NEEDED | BM_IO_ERROR | BUF_USAGECOUNT_MASK);
+  buf_state |= BM_DELETED | BM_VALID;
+  UNLOCK_BUF_HDR(buf_hdr, buf_state);
+
+  buf_table_delete(&tag, hash_code);
+  buf_rel_delete(buf_hdr, tag.rnode);
+
+  LOCK_RELEASE(partition_lock);
+
+  // Nobody can find the buffer any more, so only the clock sweep can
+  // take it, under BufMgrLock. If it did so already, leave it be.
+  spin_acquire(BufMgrLock);
+  buf_state = atomic_read_u32(&buf_hdr->state);
+  if ((buf_state & BM_DELETED) && BUF_STATE_GET_REFCOUNT(buf_state) == 0) {
+    add_buffer_to_freelist(buf_hdr);
+  }
+  spin_release(BufMgrLock);
+}
+
+// Release the pin on a buffer.
+int release_buffer(Buffer buffer) {
+  BufferDesc* buf_hdr;
+
+  if (BUFFER_IS_LOCAL(buffer)) {
+    ASSERT(LocalRefCount[-buffer - 1] > 0);
+    LocalRefCount[-buffer - 1]--;
+
+    return STATUS_OK;
+  }
+
+  if (BAD_BUFFER_ID(buffer)) {
+    return STATUS_ERROR;
+  }
+
+  buf_hdr = &BufferDescriptors[buffer - 1];
+
+  unpin_buffer(buf_hdr);
+
+  return STATUS_OK;
+}
+
+// Mark a buffer dirty, without releasing our pin on it.
+int write_no_release_buffer(Buffer buffer) {
+  BufferDesc* buf_hdr;
+  uint32 buf_state;
+
+  if (BUFFER_IS_LOCAL(buffer)) {
+    return write_local_buffer(buffer, false);
+  }
+
+  if (BAD_BUFFER_ID(buffer)) {
+    return STATUS_ERROR;
+  }
+
+  buf_hdr = &BufferDescriptors[buffer - 1];
+
+  SharedBufferChanged = true;
+
+  buf_state = lock_buf_hdr(buf_hdr);
+  ASSERT(BUF_STATE_GET_REFCOUNT(buf_state) > 0);
+  buf_state |= (BM_DIRTY | BM_JUST_DIRTIED);
+  UNLOCK_BUF_HDR(buf_hdr, buf_state);
+
+  return STATUS_OK;
+}
+
+// Mark a buffer dirty and release our pin on it.
+//
+// The buffer is not written here; that happens when it is replaced or
+// at checkpoint/commit time.
+int write_buffer(Buffer buffer) {
+  int status;
+
+  if (BUFFER_IS_LOCAL(buffer)) {
+    return write_local_buffer(buffer, true);
+  }
+
+  status = write_no_release_buffer(buffer);
+
+  if (status == STATUS_OK) {
+    unpin_buffer(&BufferDescriptors[buffer - 1]);
+  }
+
+  return status;
+}
+
+// Reserve a free slot in PrivateRefCountArray, moving an entry out to
+// the overflow hash table if the array is full.
+//
+// pin_buffer_locked() runs with a buffer header lock held, when we can't
+// afford to allocate memory or elog(ERROR). Calling this before taking
+// the lock makes sure it finds room in the array.
+void reserve_private_refcount_entry(void) {
+  PrivateRefCountEntry* victim;
+  PrivateRefCountEntry* hash_ent;
+  HashCtrl info;
+  bool found;
+  int i;
+
+  for (i = 0; i < REFCOUNT_ARRAY_ENTRIES; i++) {
+    if (PrivateRefCountArray[i].buffer == INVALID_BUFFER) {
+      return;
+    }
+  }
+
+  if (PrivateRefCountHash == NULL) {
+    info.keysize = sizeof(Buffer);
+    info.datasize = sizeof(PrivateRefCountEntry) - sizeof(Buffer);
+    info.hash = tag_hash;
+
+    PrivateRefCountHash = hash_create(REFCOUNT_HASH_SIZE, &info, HASH_ELEM | HASH_FUNCTION);
+
+    if (!PrivateRefCountHash) {
+      elog(ERROR, "%s: could not initialize private refcount hash table", __func__);
+    }
+  }
+
+  // Move the entries out round robin, so that the one that has been in
+  // the array longest goes first.
+  victim = &PrivateRefCountArray[PrivateRefCountClock];
+  PrivateRefCountClock = (PrivateRefCountClock + 1) % REFCOUNT_ARRAY_ENTRIES;
+
+  hash_ent = (PrivateRefCountEntry*)hash_search(PrivateRefCountHash, (char*)&victim->buffer, HASH_ENTER, &found);
+
+  if (!hash_ent) {
+    elog(ERROR, "%s: private refcount hash table out of memory", __func__);
+  }
+
+  ASSERT(!found);
+  hash_ent->refcount = victim->refcount;
+  hash_ent->locks = victim->locks;
+  PrivateRefCountOverflowed++;
+
+  victim->buffer = INVALID_BUFFER;
+  victim->refcount = 0;
+  victim->locks = 0;
+}
+
+// Find this backend's pin count and lock flags for a shared buffer.
+//
+// Returns NULL if the backend has no entry for the buffer, unless create
+// is true; then a zeroed entry is made. The entry stays valid until the
+// next call that may create or forget an entry.
+PrivateRefCountEntry* get_private_refcount_entry(Buffer buffer, bool create) {
+  PrivateRefCountEntry* free_ref = NULL;
+  PrivateRefCountEntry* ref;
+  bool found;
+  int i;
+
+  ASSERT(!BAD_BUFFER_ID(buffer));
+
+  for (i = 0; i < REFCOUNT_ARRAY_ENTRIES; i++) {
+    ref = &PrivateRefCountArray[i];
+
+    if (ref->buffer == buffer) {
+      return ref;
+    }
+
+    if (ref->buffer == INVALID_BUFFER && free_ref == NULL) {
+      free_ref = ref;
+    }
+  }
+
+  if (PrivateRefCountOverflowed > 0) {
+    ref = (PrivateRefCountEntry*)hash_search(PrivateRefCountHash, (char*)&buffer, HASH_FIND, &found);
+
+    if (!ref) {
+      elog(ERROR, "%s: private refcount hash table corrupted", __func__);
+    }
+
+    if (found) {
+      return ref;
+    }
+  }
+
+  if (!create) {
+    return NULL;
+  }
+
+  if (free_ref == NULL) {
+    reserve_private_refcount_entry();
+
+    for (i = 0; PrivateRefCountArray[i].buffer != INVALID_BUFFER; i++) {
+    }
+
+    free_ref = &PrivateRefCountArray[i];
+  }
+
+  free_ref->buffer = buffer;
+  free_ref->refcount = 0;
+  free_ref->locks = 0;
+
+  return free_ref;
+}
+
+// Free an entry once the backend holds neither pins nor locks on its
+// buffer.
+void forget_private_refcount_entry(PrivateRefCountEntry* ref) {
+  bool found;
+
+  ASSERT(ref->refcount == 0 && ref->locks == 0);
+
+  if (ref >= &PrivateRefCountArray[0] && ref < &PrivateRefCountArray[REFCOUNT_ARRAY_ENTRIES]) {
+    ref->buffer = INVALID_BUFFER;
+    return;
+  }
+
+  if (!hash_search(PrivateRefCountHash, (char*)&ref->buffer, HASH_REMOVE, &found) || !found) {
+    elog(ERROR, "%s: private refcount hash table corrupted", __func__);
+  }
+
+  PrivateRefCountOverflowed--;
+}
+
+// The number of pins this backend holds on a shared buffer.
+long get_private_refcount(Buffer buffer) {
+  PrivateRefCountEntry* ref = get_private_refcount_entry(buffer, false);
+
+  return ref ? ref->refcount : 0;
+}
+
+// Pin again a shared buffer this backend already has pinned; see
+// INCR_BUFFER_REF_COUNT().
+void incr_private_refcount(Buffer buffer) {
+  PrivateRefCountEntry* ref = get_private_refcount_entry(buffer, false);
+
+  ASSERT(ref != NULL && ref->refcount > 0);
+  ref->refcount++;
+}
+
+// Acquire or release the content lock of a buffer.
+//
+// Any number of backends can hold BUFFER_LOCK_SHARE at once, to read the
+// page; BUFFER_LOCK_EXCLUSIVE, needed to change it, waits until they are
+// all gone. Backends that have to wait sleep on their semaphore instead
+// of spinning (see lwlock.c). The caller must hold a pin. Local buffers
+// are only seen by this backend and need no locking.
+void lock_buffer(Buffer buffer, int mode) {
+  PrivateRefCountEntry* ref;
+  BufferDesc* buf;
+  bits8* buflock;
+
+  ASSERT(BUFFER_IS_VALID(buffer));
+
+  if (BUFFER_IS_LOCAL(buffer)) {
+    return;
+  }
+
+  buf = &BufferDescriptors[buffer - 1];
+  ref = get_private_refcount_entry(buffer, false);
+
+  if (ref == NULL) {
+    elog(ERROR, "%s: buffer %ld is not pinned", __func__, buffer);
+  }
+
+  buflock = &ref->locks;
+
+  if (mode == BUFFER_LOCK_UNLOCK) {
+    if (!(*buflock & (BL_R_LOCK | BL_W_LOCK))) {
+      elog(ERROR, "%s: buffer %ld is not locked", __func__, buffer);
+    }
+
+    lwlock_release(&buf->content_lock);
+    *buflock &= ~(BL_R_LOCK | BL_W_LOCK);
+  } else if (mode == BUFFER_LOCK_SHARE) {
+    ASSERT(!(*buflock & (BL_R_LOCK | BL_W_LOCK)));
+
+    acquire_content_lock(buf, LW_SHARED);
+    *buflock |= BL_R_LOCK;
+  } else if (mode == BUFFER_LOCK_EXCLUSIVE) {
+    ASSERT(!(*buflock & (BL_R_LOCK | BL_W_LOCK)));
+
+    acquire_content_lock(buf, LW_EXCLUSIVE);
+    *buflock |= BL_W_LOCK;
+
+    // An exclusive lock is only taken to change the page.
+    buf->cntx_dirty = true;
+  } else {
+    elog(ERROR, "%s: unknown lock mode %d", __func__, mode);
+  }
+}
+
+// Take the content lock of buf for lock_buffer(). If we have to wait,
+// we first finish our asynchronous I/O: the holder may be waiting for it.
+static void acquire_content_lock(BufferDesc* buf, LWLockMode mode) {
+  if (NumAsyncBufs > 0) {
+    if (lwlock_conditional_acquire(&buf->content_lock, mode)) {
+      return;
+    }
+
+    finish_async_buffer_io();
+  }
+
+  lwlock_acquire(&buf->content_lock, mode);
+}
+
+// Take the content lock of a buffer we are about to write, shared, so
+// that nobody changes the page while it is being written out: it is
+// changed only under the lock held exclusive (see lock_buffer()). The
+// caller holds a pin. Unless wait is set, gives up and returns false if
+// the lock is not free. unlock_buffers() releases it after an
+// elog(ERROR), like one taken by lock_buffer().
+static bool lock_buffer_for_write(BufferDesc* buf, bool wait) {
+  PrivateRefCountEntry* ref;
+
+  ref = get_private_refcount_entry(BUFFER_DESCRIPTOR_GET_BUFFER(buf), false);
+
+  ASSERT(ref != NULL && !(ref->locks & (BL_R_LOCK | BL_W_LOCK)));
+
+  if (wait) {
+    acquire_content_lock(buf, LW_SHARED);
+  } else if (!lwlock_conditional_acquire(&buf->content_lock, LW_SHARED)) {
+    return false;
+  }
+
+  ref->locks |= BL_R_LOCK;
+
+  return true;
+}
+
+// Release the lock taken by lock_buffer_for_write().
+static void unlock_buffer_for_write(BufferDesc* buf) {
+  lock_buffer(BUFFER_DESCRIPTOR_GET_BUFFER(buf), BUFFER_LOCK_UNLOCK);
+}
+
+// Release all content locks this backend holds, after an elog(ERROR).
+//
+// Locks are only held with a pin, so this only visits the entries of
+// pinned buffers and never has to free one.
+void unlock_buffers(void) {
+  PrivateRefCountEntry* ref;
+  HashSeqStatus status;
+  int i;
+
+  for (i = 0; i < REFCOUNT_ARRAY_ENTRIES; i++) {
+    ref = &PrivateRefCountArray[i];
+
+    if (ref->buffer != INVALID_BUFFER && (ref->locks & (BL_R_LOCK | BL_W_LOCK))) {
+      lwlock_release(&BufferDescriptors[ref->buffer - 1].content_lock);
+    }
+
+    ref->locks = 0;
+  }
+
+  if (PrivateRefCountOverflowed > 0) {
+    hash_seq_init(&status, PrivateRefCountHash);
+
+    while ((ref = (PrivateRefCountEntry*)hash_seq_search(&status)) != NULL) {
+      if (ref->locks & (BL_R_LOCK | BL_W_LOCK)) {
+        lwlock_release(&BufferDescriptors[ref->buffer - 1].content_lock);
+      }
+
+      ref->locks = 0;
+    }
+  }
+}
+
+// Block until the I/O in progress on buf completes.
+//
+// The caller must hold a pin. We sleep on the buffer's io_cv, which
+// whoever clears BM_IO_IN_PROGRESS broadcasts, so a crowd of backends
+// wanting the same block being read in sleeps in the kernel and wakes
+// once, instead of each polling the state word.
+//
+// The I/O may be one of our own asynchronous ones, or the backend doing
+// it may be waiting for one of ours, so we finish all of those first.
+static void wait_io(BufferDesc* buf) {
+  ConditionVariable* cv = &BUFFER_DESCRIPTOR_GET_COLD(buf)->io_cv;
+  uint32 seq;
+
+  finish_async_buffer_io();
+
+  for (;;) {
+    seq = condition_variable_prepare_to_sleep(cv);
+
+    if (!(atomic_read_u32(&buf->state) & BM_IO_IN_PROGRESS)) {
+      condition_variable_cancel_sleep(cv);
+      break;
+    }
+
+    condition_variable_sleep(cv, seq);
+  }
+}
+
+// Begin I/O on a buffer.
+//
+// For input, the buffer must be pinned; for output, it must be pinned and
+// the caller expects to write it. Returns true if the caller should do
+// the I/O, false if someone else already did it (the buffer is valid for
+// input, or clean for output).
+static bool start_buffer_io(BufferDesc* buf, bool for_input) {
+  uint32 buf_state;
+
+  ASSERT(NumInProgressBufs < MAX_IN_PROGRESS_BUFS);
+
+  for (;;) {
+    buf_state = lock_buf_hdr(buf);
+
+    if (!(buf_state & BM_IO_IN_PROGRESS)) {
+      break;
+    }
+
+    // Somebody else is doing I/O on the buffer. Wait for them to finish,
+    // then see whether they did what we wanted to do.
+    UNLOCK_BUF_HDR(buf, buf_state);
+    wait_io(buf);
+  }
+
+  // Once we get here, there is definitely no I/O active on this buffer.
+  if (for_input ? (buf_state & BM_VALID) : !(buf_state & BM_DIRTY || buf->cntx_dirty)) {
+    // Someone else already did the I/O.
+    UNLOCK_BUF_HDR(buf, buf_state);
+    return false;
+  }
+
+  buf_state |= BM_IO_IN_PROGRESS;
+
+  UNLOCK_BUF_HDR(buf, buf_state);
+
+  InProgressBufs[NumInProgressBufs] = buf;
+  InProgressForInput[NumInProgressBufs] = for_input;
+  NumInProgressBufs++;
+
+  return true;
+}
+
+// Finish the I/O started by start_buffer_io(), setting set_flag_bits.
+//
+// BM_IO_ERROR in a failed write is not cleared; the next write attempt
+// will see it.
+static void terminate_buffer_io(BufferDesc* buf, BufFlags set_flag_bits) {
+  uint32 buf_state;
+  int i;
+
+  for (i = 0; i < NumInProgressBufs && InProgressBufs[i] != buf; i++) {
+  }
+
+  ASSERT(i < NumInProgressBufs);
+
+  buf_state = lock_buf_hdr(buf);
+
+  ASSERT(buf_state & BM_IO_IN_PROGRESS);
+  buf_state &= ~BM_IO_IN_PROGRESS;
+  buf_state |= set_flag_bits;
+
+  UNLOCK_BUF_HDR(buf, buf_state);
+
+  condition_variable_broadcast(&BUFFER_DESCRIPTOR_GET_COLD(buf)->io_cv);
+
+  NumInProgressBufs--;
+  InProgressBufs[i] = InProgressBufs[NumInProgressBufs];
+  InProgressForInput[i] = InProgressForInput[NumInProgressBufs];
+}
+
+// Clean up any active buffer I/O after an error.
+//
+// All we need to do is clear BM_IO_IN_PROGRESS and mark the buffers as
+// failed, so that waiters retry the I/O themselves. Asynchronous I/O is
+// still going on in the kernel, though, so we let it finish normally.
+void abort_buffer_io(void) {
+  BufferDesc* buf;
+  uint32 buf_state;
+  int i;
+
+  finish_async_buffer_io();
+
+  for (i = 0; i < NumInProgressBufs; i++) {
+    buf = InProgressBufs[i];
+    buf_state = lock_buf_hdr(buf);
+
+    ASSERT(buf_state & BM_IO_IN_PROGRESS);
+
+    if (InProgressForInput[i]) {
+      ASSERT(!(buf_state & BM_DIRTY || buf->cntx_dirty));
+      // We'd better not think buffer is valid yet.
+      ASSERT(!(buf_state & BM_VALID));
+    } else {
+      ASSERT(buf_state & BM_DIRTY || buf->cntx_dirty);
+    }
+
+    buf_state &= ~BM_IO_IN_PROGRESS;
+    buf_state |= BM_IO_ERROR;
+
+    UNLOCK_BUF_HDR(buf, buf_state);
+
+    condition_variable_broadcast(&BUFFER_DESCRIPTOR_GET_COLD(buf)->io_cv);
+  }
+
+  NumInProgressBufs = 0;
+}
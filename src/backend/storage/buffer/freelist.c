@@ -1,8 +1,7 @@
 // =========================================================================
 //
 // freelist.c
-//  routines for manipulating the buffer pool's replacement strategy
-//  freelist.
+//  routines for managing the buffer pool's replacement strategy.
 //
 // Portions Copyright (c) 1996=2000, PostgreSQL, Inc
 // Portions Copyright (c) 1994, Regents of the University of California
@@ -13,145 +12,556 @@
 //
 // =========================================================================
 
-// OLD COMMENTS
+// Replacement strategy:
 //
-// Data Structures:
-//  SharedFreeList is a circular queue.  Notice that this
-//  is a shared memory queue so the next/prev "ptrs" are
-//  buffer ids, not addresses.
+//  Buffers are replaced with the clock sweep algorithm. Each buffer
+//  descriptor carries a usage_count which pin_buffer() bumps (up to
+//  BM_MAX_USAGE_COUNT). The shared clock hand (next_victim_buffer)
+//  walks the descriptor array; an unpinned buffer with a usage_count
+//  of zero is the victim, otherwise its count is decremented and the
+//  hand moves on. Pinning and unpinning therefore only touch the
+//  descriptor being pinned and never relink a shared list, which the
+//  old LRU freelist did on every pin and every unpin.
 //
-// Sync: all routines in this file assume that the buffer
-//  semaphore has been acquired by the caller.
+//  A separate freelist (linked through free_next) holds buffers whose
+//  contents are known to be useless: never-used buffers after startup
+//  and buffers invalidated by a relation drop. get_free_buffer() always
+//  tries it before running the clock.
+//
+//  A backend doing a bulk operation (a big sequential scan, COPY IN,
+//  VACUUM) may pass a BufferAccessStrategy. The strategy is a small
+//  private ring of buffers: once the ring is full, get_free_buffer()
+//  recycles the ring's buffers instead of taking a victim from the
+//  shared pool, so the operation cannot push the rest of the working set
+//  out of the cache. A ring buffer that somebody else is using (pinned,
+//  or used again since we put it in the ring) is left alone and replaced
+//  in the ring by a normal victim.
+//
+// Sync: BufMgrLock protects only the strategy state (the freelist and
+//  the clock hand), and must be held by callers of get_free_buffer(),
+//  add_buffer_to_freelist() and strategy_sync_start(). The per-buffer
+//  fields live in each descriptor's atomic state word: pinning and
+//  unpinning update it with a compare-and-swap and need no lock at all.
 
-#include "rdbms/storage/freelist.h"
+#include <signal.h>
 
 #include "rdbms/postgres.h"
+#include "rdbms/storage/buf_internals.h"
+#include "rdbms/storage/bufmgr.h"
+#include "rdbms/utils/elog.h"
+#include "rdbms/utils/memutils.h"
+
+// The shared state of the replacement strategy.
+typedef struct BufferStrategyControl {
+  int next_victim_buffer;  // Clock hand: next buffer to examine
+  int first_free_buffer;   // Head of list of unused buffers
+  int last_free_buffer;    // Tail of list of unused buffers
+
+  // Statistics. These counters are allowed to wrap around.
+  uint32 complete_passes;   // # of times the clock hand wrapped around
+  uint32 num_buffer_allocs;  // # of buffers handed out since last reset
 
-static BufferDesc* SharedFreeList;
+  // Pid of a hibernating background writer to wake up at the next
+  // allocation, or 0.
+  pid_t bgwriter_pid;
+} BufferStrategyControl;
+
+static BufferStrategyControl* StrategyControl = NULL;
+
+// Background writer that get_free_buffer() took it upon itself to wake,
+// once the caller has released BufMgrLock; see strategy_wake_bgwriter().
+static pid_t BgWriterToWake = 0;
 
 // Only actually used in debugging.  The lock
 // should be acquired before calling the freelist manager.
-extern SPINLOCK BufMgrLock;
+extern SpinLock BufMgrLock;
+
+// Private (non-shared) state for managing a ring of shared buffers to
+// re-use. This is currently the only kind of BufferAccessStrategy object,
+// but someday we might have more kinds.
+typedef struct BufferAccessStrategyData {
+  BufferAccessStrategyType btype;  // Overall strategy type
+  int ring_size;                   // Number of elements in buffers[]
 
-#define IsInQueue(bf)                                                                            \
-  (assert((bf->free_next != INVALID_DESCRIPTOR)), assert((bf->free_prev != INVALID_DESCRIPTOR)), \
-   assert((bf->flags & BM_FREE)))
+  // Index of the "current" slot in the ring, ie, the one most recently
+  // returned by get_free_buffer().
+  int current;
 
-#define NotInQueue(bf)                                                                           \
-  (assert((bf->free_next == INVALID_DESCRIPTOR)), assert((bf->free_prev == INVALID_DESCRIPTOR)), \
-   assert(!(bf->flags & BM_FREE)))
+  // Array of buffer numbers. INVALID_BUFFER (that is, zero) indicates we
+  // have not yet selected a buffer for this ring slot.
+  Buffer buffers[1];  // VARIABLE LENGTH ARRAY
+} BufferAccessStrategyData;
 
-// In theory, this is the only routine that needs to be changed
-// if the buffer replacement strategy changes. Just change
-// the manner in which buffers are added to the freelist queue.
-// Currently, they are added on an LRU basis.
+#define IS_IN_FREELIST(bf) ((bf)->free_next != FREENEXT_NOT_IN_LIST)
+
+static BufferDesc* get_buffer_from_ring(BufferAccessStrategy strategy, uint32* buf_state);
+static void add_buffer_to_ring(BufferAccessStrategy strategy, BufferDesc* buf_desc);
+
+// Put a buffer whose contents are no longer of interest at the head of
+// the freelist, so that it is reused before anything the clock would pick.
+// The buffer must not be pinned.
 void add_buffer_to_freelist(BufferDesc* buf_desc) {
+  uint32 buf_state;
+
 #ifdef BMTRACE
   _bm_trace(bf->tag.relId.dbId, bf->tag.relId.relId, bf->tag.blockNum, BufferDescriptorGetBuffer(bf), BMT_DEALLOC);
 #endif  // BMTRACE
 
-  NotInQueue(buf_desc);
+  ASSERT(BUF_STATE_GET_REFCOUNT(atomic_read_u32(&buf_desc->state)) == 0);
 
-  // Change bf so it points to inFrontOfNew and its successor.
-  buf_desc->free_prev = SharedFreeList->free_prev;
-  buf_desc->free_next = Free_List_Descriptor;
+  // It is possible that we are told to put something in the freelist
+  // that is already in it; don't screw up the list if so.
+  if (IS_IN_FREELIST(buf_desc)) {
+    return;
+  }
 
-  // Insert new into chain.
-  BufferDescriptors[buf_desc->free_next].free_prev = buf_desc->buf_id;
-  BufferDescriptors[buf_desc->free_prev].free_next = buf_desc->buf_id;
+  buf_state = lock_buf_hdr(buf_desc);
+  buf_state &= ~BUF_USAGECOUNT_MASK;
+  UNLOCK_BUF_HDR(buf_desc, buf_state);
+
+  buf_desc->free_next = StrategyControl->first_free_buffer;
+
+  if (buf_desc->free_next < 0) {
+    StrategyControl->last_free_buffer = buf_desc->buf_id;
+  }
+
+  StrategyControl->first_free_buffer = buf_desc->buf_id;
+}
+
+// Lock the buffer header, i.e. set BM_LOCKED in its state word, and
+// return the state with BM_LOCKED set. Release with UNLOCK_BUF_HDR().
+uint32 lock_buf_hdr(BufferDesc* buf_desc) {
+  unsigned spins = 0;
+  uint32 old_buf_state;
+
+  for (;;) {
+    // Set BM_LOCKED flag.
+    old_buf_state = atomic_fetch_or_u32(&buf_desc->state, BM_LOCKED);
+
+    // If it wasn't set before we're OK.
+    if (!(old_buf_state & BM_LOCKED)) {
+      break;
+    }
+
+    s_lock_delay(spins++, &buf_desc->state, __FILE__, __LINE__);
+  }
+
+  return old_buf_state | BM_LOCKED;
+}
+
+// Wait until the buffer header lock is released and return the state.
+//
+// For CAS loops that must not act on a locked state word, but have no
+// need to take the lock themselves.
+uint32 wait_buf_hdr_unlocked(BufferDesc* buf_desc) {
+  unsigned spins = 0;
+  uint32 buf_state;
+
+  buf_state = atomic_read_u32(&buf_desc->state);
+
+  while (buf_state & BM_LOCKED) {
+    s_lock_delay(spins++, &buf_desc->state, __FILE__, __LINE__);
+    buf_state = atomic_read_u32(&buf_desc->state);
+  }
+
+  return buf_state;
 }
 
 // Make buffer unavailable for replacement.
+//
+// This only touches the descriptor itself: bump the shared reference
+// count the first time this backend pins the buffer, and bump the
+// usage count so the clock hand will pass it by for a while. Both are
+// done with a single compare-and-swap on the state word, so pinning a
+// buffer found in the mapping table takes no lock at all.
 void pin_buffer(BufferDesc* buf_desc) {
-  long b;
+  PrivateRefCountEntry* ref = get_private_refcount_entry(BUFFER_DESCRIPTOR_GET_BUFFER(buf_desc), true);
+  uint32 buf_state;
+  uint32 old_buf_state;
 
-  if (buf_desc->refcount == 0) {
-    IsInQueue(buf_desc);
+  ASSERT(ref->refcount >= 0);
 
-    // Remove from freelist queue.
-    BufferDescriptors[buf_desc->free_next].free_prev = buf_desc->free_prev;
-    BufferDescriptors[buf_desc->free_prev].free_next = buf_desc->free_next;
-    buf_desc->free_next = buf_desc->free_prev = INVALID_DESCRIPTOR;
+  if (ref->refcount == 0) {
+    old_buf_state = atomic_read_u32(&buf_desc->state);
 
-    // Mark buffer as no longer free.
-    buf_desc->flags &= ~BM_FREE;
-  } else {
-    NotInQueue(buf_desc);
+    for (;;) {
+      if (old_buf_state & BM_LOCKED) {
+        old_buf_state = wait_buf_hdr_unlocked(buf_desc);
+      }
+
+      buf_state = old_buf_state;
+
+      // Increase refcount.
+      buf_state += BUF_REFCOUNT_ONE;
+
+      // Increase usagecount unless already max.
+      if (BUF_STATE_GET_USAGECOUNT(buf_state) < BM_MAX_USAGE_COUNT) {
+        buf_state += BUF_USAGECOUNT_ONE;
+      }
+
+      if (atomic_compare_exchange_u32(&buf_desc->state, &old_buf_state, buf_state)) {
+        break;
+      }
+    }
   }
 
-  b = BufferDescriptorGetBuffer(buf_desc) - 1;
+  ref->refcount++;
+}
+
+// Pin a buffer whose header lock is already held by the caller, and
+// release the header lock.
+//
+// Used on freshly chosen victims. The usage count is left alone: the
+// caller sets it once the buffer holds its new page, and a victim that
+// is not used after all should stay cheap to evict.
+void pin_buffer_locked(BufferDesc* buf_desc) {
+  PrivateRefCountEntry* ref;
+  uint32 buf_state;
+
+  // Doesn't allocate if the caller called reserve_private_refcount_entry()
+  // before taking the header lock.
+  ref = get_private_refcount_entry(BUFFER_DESCRIPTOR_GET_BUFFER(buf_desc), true);
+
+  ASSERT(ref->refcount >= 0);
 
-  assert(PrivateRefCount[b] >= 0);
+  buf_state = atomic_read_u32(&buf_desc->state);
+  ASSERT(buf_state & BM_LOCKED);
 
-  // TODO(gc): 为什么等于的0时候 需要+1
-  if (PrivateRefCount[b] == 0) {
-    buf_desc->refcount++;
+  if (ref->refcount == 0) {
+    buf_state += BUF_REFCOUNT_ONE;
   }
 
-  PrivateRefCount[b]++;
+  UNLOCK_BUF_HDR(buf_desc, buf_state);
+
+  ref->refcount++;
 }
 
 // Make buffer available for replacement.
+//
+// Nothing needs to be done for the replacement strategy: once the
+// shared reference count drops to zero the clock sweep may pick it.
 void unpin_buffer(BufferDesc* buf_desc) {
-  long b = BufferDescriptorGetBuffer(buf_desc) - 1;
+  PrivateRefCountEntry* ref = get_private_refcount_entry(BUFFER_DESCRIPTOR_GET_BUFFER(buf_desc), false);
+  uint32 buf_state;
+  uint32 old_buf_state;
+
+  ASSERT(ref != NULL && ref->refcount > 0);
+
+  ref->refcount--;
+
+  if (ref->refcount == 0) {
+    // The content lock must be released before the last pin.
+    ASSERT(ref->locks == 0);
+    forget_private_refcount_entry(ref);
+
+    old_buf_state = atomic_read_u32(&buf_desc->state);
+
+    for (;;) {
+      if (old_buf_state & BM_LOCKED) {
+        old_buf_state = wait_buf_hdr_unlocked(buf_desc);
+      }
+
+      ASSERT(BUF_STATE_GET_REFCOUNT(old_buf_state) > 0);
+      buf_state = old_buf_state - BUF_REFCOUNT_ONE;
+
+      if (atomic_compare_exchange_u32(&buf_desc->state, &old_buf_state, buf_state)) {
+        break;
+      }
+    }
+  }
+}
+
+// Choose a victim buffer for replacement.
+//
+// The buffer is returned unpinned but with its header lock held, so that
+// nobody can pin it before the caller does (see pin_buffer_locked()). Its
+// locked state word is stored in *buf_state. Returns NULL if every buffer
+// is pinned.
+//
+// strategy is a BufferAccessStrategy object, or NULL for default strategy.
+BufferDesc* get_free_buffer(BufferAccessStrategy strategy, uint32* buf_state) {
+  BufferDesc* buf_desc;
+  uint32 local_buf_state;
+  int try_counter;
+
+  // If given a strategy object, see whether it can select a buffer. We
+  // assume strategy objects don't need the strategy state.
+  if (strategy != NULL) {
+    buf_desc = get_buffer_from_ring(strategy, buf_state);
+
+    if (buf_desc != NULL) {
+      return buf_desc;
+    }
+  }
+
+  // If the background writer is hibernating, it will want to clean
+  // ahead of us now that buffers are being allocated again. We clear the
+  // request so that only one backend sends the signal, but leave the
+  // signal itself to strategy_wake_bgwriter(): a system call has no
+  // place under BufMgrLock.
+  if (StrategyControl->bgwriter_pid != 0) {
+    BgWriterToWake = StrategyControl->bgwriter_pid;
+    StrategyControl->bgwriter_pid = 0;
+  }
 
-  assert(buf_desc->refcount > 0);
-  assert(PrivateRefCount[b] > 0);
-  PrivateRefCount[b]--;
+  // Ring reuse is not counted: it does not consume clean buffers from
+  // the shared pool.
+  StrategyControl->num_buffer_allocs++;
 
-  if (PrivateRefCount[b] == 0) {
-    buf_desc->refcount--;
+  // First try the freelist. Buffers on it may have been pinned since
+  // they were put there (someone found the block in the lookup table
+  // before it was invalidated), so skip those.
+  while (StrategyControl->first_free_buffer >= 0) {
+    buf_desc = &BufferDescriptors[StrategyControl->first_free_buffer];
+    ASSERT(IS_IN_FREELIST(buf_desc));
+
+    // Unconditionally remove buffer from freelist.
+    StrategyControl->first_free_buffer = buf_desc->free_next;
+    buf_desc->free_next = FREENEXT_NOT_IN_LIST;
+
+    local_buf_state = lock_buf_hdr(buf_desc);
+
+    if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0 && BUF_STATE_GET_USAGECOUNT(local_buf_state) == 0) {
+      if (strategy != NULL) {
+        add_buffer_to_ring(strategy, buf_desc);
+      }
+
+      *buf_state = local_buf_state;
+      return buf_desc;
+    }
+
+    UNLOCK_BUF_HDR(buf_desc, local_buf_state);
   }
 
-  if (buf_desc->refcount == 0) {
-    add_buffer_to_freelist(buf_desc);
-    buf_desc->flags |= BM_FREE;
+  // Nothing on the freelist, so run the clock sweep. Every pass over an
+  // unpinned buffer decrements its usage count, so after at most
+  // BM_MAX_USAGE_COUNT complete passes any unpinned buffer is a victim.
+  // If we visit NBuffers buffers in a row without finding one that is
+  // unpinned (or whose count we could decrement) everything is pinned.
+  try_counter = NBuffers;
+
+  for (;;) {
+    buf_desc = &BufferDescriptors[StrategyControl->next_victim_buffer];
+
+    if (++StrategyControl->next_victim_buffer >= NBuffers) {
+      StrategyControl->next_victim_buffer = 0;
+      StrategyControl->complete_passes++;
+    }
+
+    local_buf_state = lock_buf_hdr(buf_desc);
+
+    if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0) {
+      if (BUF_STATE_GET_USAGECOUNT(local_buf_state) != 0) {
+        local_buf_state -= BUF_USAGECOUNT_ONE;
+        try_counter = NBuffers;
+      } else {
+        if (strategy != NULL) {
+          add_buffer_to_ring(strategy, buf_desc);
+        }
+
+        *buf_state = local_buf_state;
+        return buf_desc;
+      }
+    } else if (--try_counter == 0) {
+      // We've scanned all the buffers without making any state changes,
+      // so all the buffers are pinned (or were when we looked at them).
+      UNLOCK_BUF_HDR(buf_desc, local_buf_state);
+      elog(NOTICE, "%s: out of free buffers: time to abort!", __func__);
+
+      return NULL;
+    }
+
+    UNLOCK_BUF_HDR(buf_desc, local_buf_state);
   }
 }
 
-// Get the 'next' buffer from the freelist.
-BufferDesc* get_free_buffer(void) {
+// Create a BufferAccessStrategy object.
+//
+// The object is allocated in the current memory context. Returns NULL
+// for BAS_NORMAL, which callers pass on to mean the default strategy.
+BufferAccessStrategy get_access_strategy(BufferAccessStrategyType btype) {
+  BufferAccessStrategy strategy;
+  int ring_size;
+
+  // Select ring size to use.
+  switch (btype) {
+    case BAS_NORMAL:
+      // If someone asks for NORMAL, just give 'em a "default" object.
+      return NULL;
+
+    case BAS_BULKREAD:
+      // Big enough to keep the scan's read-ahead going, small enough to
+      // stay in L2 cache.
+      ring_size = 256 * 1024 / BLCKSZ;
+      break;
+
+    case BAS_BULKWRITE:
+      // Bigger, so that every ring buffer is not written out (and waited
+      // on) again just before it is refilled.
+      ring_size = 16 * 1024 * 1024 / BLCKSZ;
+      break;
+
+    case BAS_VACUUM:
+      ring_size = 256 * 1024 / BLCKSZ;
+      break;
+
+    default:
+      elog(ERROR, "%s: unrecognized buffer access strategy: %d", __func__, (int)btype);
+      return NULL;  // Keep compiler quiet
+  }
+
+  // Make sure ring isn't an undue fraction of shared buffers.
+  ring_size = MIN(NBuffers / 8, ring_size);
+  ring_size = MAX(ring_size, 1);
+
+  // Allocate the object and initialize all elements to zeroes.
+  strategy = (BufferAccessStrategy)palloc(offsetof(BufferAccessStrategyData, buffers) + ring_size * sizeof(Buffer));
+  MEMSET(strategy, 0, offsetof(BufferAccessStrategyData, buffers) + ring_size * sizeof(Buffer));
+
+  // Set fields that don't start out zero.
+  strategy->btype = btype;
+  strategy->ring_size = ring_size;
+
+  return strategy;
+}
+
+// Release a BufferAccessStrategy object.
+//
+// A simple pfree would do at the moment, but we would prefer that callers
+// don't assume that much about the representation of BufferAccessStrategy.
+void free_access_strategy(BufferAccessStrategy strategy) {
+  // Don't crash if called on a "default" strategy.
+  if (strategy != NULL) {
+    pfree(strategy);
+  }
+}
+
+// Returns a buffer from the ring, or NULL if the ring is empty.
+//
+// The buffer is returned with its header lock held, like get_free_buffer().
+static BufferDesc* get_buffer_from_ring(BufferAccessStrategy strategy, uint32* buf_state) {
   BufferDesc* buf_desc;
+  Buffer buf_num;
+  uint32 local_buf_state;
+
+  // Advance to next ring slot.
+  if (++strategy->current >= strategy->ring_size) {
+    strategy->current = 0;
+  }
 
-  if (Free_List_Descriptor == SharedFreeList->free_next) {
-    // Queue is empty. All buffers in the buffer pool are pinned.
-    printf("[ERROR]: out of free buffers. Time to abort!\n");
+  // If the slot hasn't been filled yet, tell the caller to allocate a new
+  // buffer with the normal allocation strategy. He will then fill this
+  // slot by calling add_buffer_to_ring with the new buffer.
+  buf_num = strategy->buffers[strategy->current];
 
+  if (buf_num == INVALID_BUFFER) {
     return NULL;
   }
 
-  buf_desc = &(BufferDescriptors[SharedFreeList->free_next]);
+  // If the buffer is pinned we cannot use it under any circumstances.
+  //
+  // If usage_count is 0 or 1 then the buffer is fair game (we expect 1,
+  // since our own previous usage of the ring element would have left it
+  // there, but it might've been decremented by clock sweep since then). A
+  // higher usage_count indicates someone else has touched the buffer, so
+  // we shouldn't re-use it.
+  buf_desc = &BufferDescriptors[buf_num - 1];
+  local_buf_state = lock_buf_hdr(buf_desc);
+
+  if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0 && BUF_STATE_GET_USAGECOUNT(local_buf_state) <= 1) {
+    *buf_state = local_buf_state;
+    return buf_desc;
+  }
+
+  UNLOCK_BUF_HDR(buf_desc, local_buf_state);
 
-  // Remove from freelist queue.
-  BufferDescriptors[buf_desc->free_next].free_prev = buf_desc->free_prev;
-  BufferDescriptors[buf_desc->free_prev].free_next = buf_desc->free_next;
-  buf_desc->free_next = buf_desc->free_prev = INVALID_DESCRIPTOR;
+  // Tell caller to allocate a new buffer with the normal allocation
+  // strategy. He'll then replace this ring element via add_buffer_to_ring.
+  return NULL;
+}
 
-  buf_desc->flags &= ~(BM_FREE);
+// Add a buffer to the buffer ring, in the slot get_buffer_from_ring()
+// just found empty or unusable.
+static void add_buffer_to_ring(BufferAccessStrategy strategy, BufferDesc* buf_desc) {
+  strategy->buffers[strategy->current] = BUFFER_DESCRIPTOR_GET_BUFFER(buf_desc);
+}
+
+// Report the clock hand position together with the number of complete
+// passes and the number of buffer allocations since the last call, so
+// that a caller scanning the pool can stay ahead of replacement.
+int strategy_sync_start(uint32* complete_passes, uint32* num_buffer_allocs) {
+  int result = StrategyControl->next_victim_buffer;
+
+  if (complete_passes) {
+    *complete_passes = StrategyControl->complete_passes;
+  }
 
-  return buf_desc;
+  if (num_buffer_allocs) {
+    *num_buffer_allocs = StrategyControl->num_buffer_allocs;
+    StrategyControl->num_buffer_allocs = 0;
+  }
+
+  return result;
+}
+
+// Set or clear the pid of the background writer to signal at the next
+// buffer allocation. The background writer sets it before hibernating.
+void strategy_notify_bgwriter(pid_t bgwriter_pid) { StrategyControl->bgwriter_pid = bgwriter_pid; }
+
+// Wake the background writer if the last get_free_buffer() found it
+// hibernating. Called after releasing BufMgrLock.
+void strategy_wake_bgwriter(void) {
+  if (BgWriterToWake != 0) {
+    kill(BgWriterToWake, SIGUSR1);
+    BgWriterToWake = 0;
+  }
 }
 
-// Initialize the dummy buffer descriptor used as a freelist head.
+// Are there buffers that hold nothing at all?
+//
+// This is only an unlocked peek: the answer may be stale by the time the
+// caller acts on it. Good enough to stop prewarming before it starts
+// evicting pages that backends read in meanwhile.
+bool have_free_buffer(void) { return StrategyControl->first_free_buffer >= 0; }
+
+// Estimate the shared memory needed by init_freelist().
+Size strategy_shmem_size(void) { return MAX_ALIGN(sizeof(BufferStrategyControl)); }
+
+// Initialize the shared state of the replacement strategy.
 //
 // Assume:
-//  All of the buffers are already linked in a circular
-//  queue. Only called by postmaster and only during
-//  initialization.
+//  All of the buffers are already linked into the freelist through
+//  free_next (see init_buffer_pool()). Only called by postmaster and
+//  only during initialization.
 void init_freelist(bool init) {
-  SharedFreeList = &(BufferDescriptors[Free_List_Descriptor]);
+  bool found;
+
+  StrategyControl =
+      (BufferStrategyControl*)shmem_init_struct("Buffer Strategy Status", sizeof(BufferStrategyControl), &found);
+
+  if (!StrategyControl) {
+    elog(FATAL, "%s: couldn't initialize buffer strategy status", __func__);
+  }
 
   if (init) {
     // We only do this once, normally the postmaster.
-    SharedFreeList->data = INVALID_OFFSET;
-    SharedFreeList->flags = 0;
-    SharedFreeList->flags &= ~(BM_VALID | BM_DELETED | BM_FREE);
-    SharedFreeList->buf_id = Free_List_Descriptor;
-
-    // Insert it into a random spot in the circular queue.
-    SharedFreeList->free_next = BufferDescriptors[0].free_next;
-    SharedFreeList->free_prev = 0;
-    BufferDescriptors[SharedFreeList->free_next].free_prev = Free_List_Descriptor;
-    BufferDescriptors[SharedFreeList->free_prev].free_next = Free_List_Descriptor;
-  }
-}
\ No newline at end of file
+    ASSERT(!found);
+
+    // Grab the whole linked list of free buffers for our strategy. We
+    // assume it was previously set up by init_buffer_pool().
+    StrategyControl->first_free_buffer = 0;
+    StrategyControl->last_free_buffer = NBuffers - 1;
+
+    // Initialize the clock sweep pointer.
+    StrategyControl->next_victim_buffer = 0;
+
+    // Clear statistics.
+    StrategyControl->complete_passes = 0;
+    StrategyControl->num_buffer_allocs = 0;
+
+    // No pending background writer wakeup.
+    StrategyControl->bgwriter_pid = 0;
+  } else {
+    ASSERT(found);
+  }
+}
@@ -11,6 +11,13 @@
 //  pool. rd_islocal is reset at the end of a transaction (commit/abort).
 //  This is useful for queries like SELECT INTO TABLE and create index.
 //
+//  Buffers are found through a backend-local hash table keyed on the
+//  BufferTag, and replaced with the same clock sweep as shared buffers
+//  (see freelist.c), so a pool of many thousands of buffers costs no
+//  more per access than a small one. The pool is sized by temp_buffers
+//  and allocated on first use; a new setting takes effect at the next
+//  transaction that uses local buffers.
+//
 // Portions Copyright (c) 1996=2000, PostgreSQL, Inc
 // Portions Copyright (c) 1994=5, Regents of the University of California
 //
@@ -22,29 +29,50 @@
 //
 //===----------------------------------------------------------------------===//
 
-#include <math.h>
-#include <signal.h>
-#include <sys/file.h>
-#include <sys/types.h>
-
 #include "rdbms/storage/buf_internals.h"
 #include "rdbms/storage/bufmgr.h"
+#include "rdbms/storage/smgr.h"
 #include "rdbms/utils/elog.h"
+#include "rdbms/utils/hashfn.h"
+#include "rdbms/utils/hsearch.h"
+#include "rdbms/utils/memutils.h"
 
 extern long int LocalBufferFlushCount;
 
-int NLocBuffer = 64;
+// Entry for buffer lookup hashtable.
+typedef struct LocalBufferLookupEnt {
+  BufferTag key;  // Tag of a disk page
+  int id;         // Associated local buffer's index
+} LocalBufferLookupEnt;
+
+int NumTempBuffers = 1000;  // GUC: size of the pool when next allocated
+
+int NLocBuffer = 0;  // Size of the allocated pool, 0 until first use
 BufferDesc* LocalBufferDescriptors = NULL;
 Block* LocalBufferBlockPointers = NULL;
 long* LocalRefCount = NULL;
 
-static int NextFreeLocalBuf = 0;
+static int NextFreeLocalBuf = 0;  // Clock hand
+static HashTable* LocalBufHash = NULL;
+static MemoryContext LocalBufferContext = NULL;
 
-// Allocate a local buffer. We do round robin allocation for now.
-Buffer* local_buffer_alloc(Relation relation, BlockNumber block_num,
-                           bool* found_ptr) {
-  int i;
-  BufferDesc* buf_hdr = NULL;
+// Get the local buffer holding block_num of relation, allocating one
+// if it isn't there.
+//
+// The buffer is returned pinned; *found_ptr tells whether it already
+// held the block. Otherwise the caller has to read the block into it.
+BufferDesc* local_buffer_alloc(Relation relation, BlockNumber block_num, bool* found_ptr) {
+  BufferTag new_tag;  // Identity of requested block
+  LocalBufferLookupEnt* result;
+  BufferDesc* buf_hdr;
+  uint32 buf_state;
+  int trycounter;
+  bool found;
+  int b;
+
+  if (LocalBufferDescriptors == NULL) {
+    init_local_buffer();
+  }
 
   // 如果创建1个新的
   if (block_num == P_NEW) {
@@ -52,48 +80,361 @@ Buffer* local_buffer_alloc(Relation relation, BlockNumber block_num,
     relation->rd_nblocks++;
   }
 
-  // A low tech search for now -- not optimized for scans.
-  for (i = 0; i < NLocBuffer; i++) {
-    if (LocalBufferDescriptors[i].tag.rnode.rel_node ==
-            relation->rd_node.rel_node &&
-        LocalBufferDescriptors[i].tag.block_num == block_num) {
+  INIT_BUFFERTAG(&new_tag, relation, block_num);
+
+  // See if the desired buffer already exists.
+  result = (LocalBufferLookupEnt*)hash_search(LocalBufHash, (char*)&new_tag, HASH_FIND, &found);
+
+  if (!result) {
+    elog(ERROR, "%s: local buffer hash table corrupted", __func__);
+  }
+
+  if (found) {
+    b = result->id;
+    buf_hdr = &LocalBufferDescriptors[b];
+    ASSERT(buf_hdr->tag.block_num == block_num && REL_FILE_NODE_EQUALS(buf_hdr->tag.rnode, relation->rd_node));
+
 #ifdef LBDEBUG
-      fprintf(stderr, "LB ALLOC (%u,%d) %d\n", RELATION_GET_REL_ID(relation),
-              block_num, -i - 1);
+    fprintf(stderr, "LB ALLOC (%u,%d) %d\n", RELATION_GET_REL_ID(relation), block_num, -b - 1);
 #endif
 
-      LocalRefCount[i]++;
-      *found_ptr = true;
+    // Bump the usage count, as pin_buffer() does for shared buffers.
+    // Nobody else can see the state word, so no locking is needed.
+    buf_state = atomic_read_u32(&buf_hdr->state);
+    if (BUF_STATE_GET_USAGECOUNT(buf_state) < BM_MAX_USAGE_COUNT) {
+      atomic_write_u32(&buf_hdr->state, buf_state + BUF_USAGECOUNT_ONE);
+    }
+
+    LocalRefCount[b]++;
+    *found_ptr = true;
 
-      return &LocalBufferDescriptors[i];
+    return buf_hdr;
+  }
+
+  // Need to get a new buffer. We use a clock sweep algorithm (essentially
+  // the same as what get_free_buffer() does for shared buffers).
+  trycounter = NLocBuffer;
+
+  for (;;) {
+    b = NextFreeLocalBuf;
+
+    if (++NextFreeLocalBuf >= NLocBuffer) {
+      NextFreeLocalBuf = 0;
+    }
+
+    buf_hdr = &LocalBufferDescriptors[b];
+
+    if (LocalRefCount[b] == 0) {
+      buf_state = atomic_read_u32(&buf_hdr->state);
+
+      if (BUF_STATE_GET_USAGECOUNT(buf_state) > 0) {
+        atomic_write_u32(&buf_hdr->state, buf_state - BUF_USAGECOUNT_ONE);
+        trycounter = NLocBuffer;
+      } else {
+        // Found a usable buffer.
+        LocalRefCount[b]++;
+        break;
+      }
+    } else if (--trycounter == 0) {
+      elog(ERROR, "%s: no empty local buffer available", __func__);
     }
   }
 
 #ifdef LBDEBUG
-  fprintf(stderr, "LB ALLOC (%u,%d) %d\n", RELATION_GET_REL_ID(relation),
-          block_num, -NextFreeLocalBuf - 1);
+  fprintf(stderr, "LB ALLOC (%u,%d) %d\n", RELATION_GET_REL_ID(relation), block_num, -b - 1);
 #endif
 
-  // Need to get a new buffer (round robin for now).
+  // This buffer is not referenced but it might still be dirty (the last
+  // transaction to touch it doesn't need its contents but has not
+  // flushed it). If that's the case, write it out before reusing it!
+  buf_state = atomic_read_u32(&buf_hdr->state);
+
+  if (buf_state & BM_DIRTY || buf_hdr->cntx_dirty) {
+    if (smgr_blind_wrt(DEFAULT_SMGR, buf_hdr->tag.rnode, buf_hdr->tag.block_num, (char*)MAKE_PTR(buf_hdr->data),
+                       false) == SM_FAIL) {
+      LocalRefCount[b]--;
+      elog(ERROR, "%s: cannot write block %u of %u/%u", __func__, buf_hdr->tag.block_num, buf_hdr->tag.rnode.tbl_node,
+           buf_hdr->tag.rnode.rel_node);
+    }
+
+    LocalBufferFlushCount++;
+  }
+
+  // Lazy memory allocation: allocate space on first use of a buffer.
+  if (buf_hdr->data == (ShmemOffset)0) {
+    char* data = (char*)memory_context_alloc(LocalBufferContext, BLCKSZ);
+
+    buf_hdr->data = MAKE_OFFSET(data);
+    LocalBufferBlockPointers[b] = (Block)data;
+  }
+
+  // Update the hash table: remove old entry, if any, and make new one.
+  if (buf_state & BM_VALID) {
+    if (!hash_search(LocalBufHash, (char*)&buf_hdr->tag, HASH_REMOVE, &found) || !found) {
+      elog(ERROR, "%s: local buffer hash table corrupted", __func__);
+    }
+
+    // Mark buffer invalid just in case hash insert fails.
+    atomic_write_u32(&buf_hdr->state, 0);
+  }
+
+  result = (LocalBufferLookupEnt*)hash_search(LocalBufHash, (char*)&new_tag, HASH_ENTER, &found);
+
+  if (!result) {
+    LocalRefCount[b]--;
+    elog(ERROR, "%s: local buffer hash table out of memory", __func__);
+  }
+
+  ASSERT(!found);
+  result->id = b;
+
+  // It's all ours now. The caller reads the block in; until the end of
+  // the transaction the buffer counts as valid for lookups.
+  buf_hdr->tag = new_tag;
+  buf_hdr->cntx_dirty = false;
+  atomic_write_u32(&buf_hdr->state, BM_VALID | BUF_USAGECOUNT_ONE);
+
+  *found_ptr = false;
+
+  return buf_hdr;
+}
+
+// Mark a local buffer dirty, and release our pin on it if asked to.
+int write_local_buffer(Buffer buffer, bool release) {
+  int b;
+
+  ASSERT(BUFFER_IS_LOCAL(buffer));
+
+#ifdef LBDEBUG
+  fprintf(stderr, "LB WRITE %d\n", buffer);
+#endif
+
+  b = -buffer - 1;
+
+  atomic_write_u32(&LocalBufferDescriptors[b].state, atomic_read_u32(&LocalBufferDescriptors[b].state) | BM_DIRTY);
+
+  if (release) {
+    ASSERT(LocalRefCount[b] > 0);
+    LocalRefCount[b]--;
+  }
+
+  return true;
+}
+
+// Write a local buffer to disk and fsync it, and release our pin on it
+// if asked to.
+int flush_local_buffer(Buffer buffer, bool release) {
+  BufferDesc* buf_hdr;
+  int b;
+
+  ASSERT(BUFFER_IS_LOCAL(buffer));
+
+#ifdef LBDEBUG
+  fprintf(stderr, "LB FLUSH %d\n", buffer);
+#endif
+
+  b = -buffer - 1;
+  buf_hdr = &LocalBufferDescriptors[b];
+
+  if (smgr_blind_wrt(DEFAULT_SMGR, buf_hdr->tag.rnode, buf_hdr->tag.block_num, (char*)MAKE_PTR(buf_hdr->data),
+                     true) == SM_FAIL) {
+    elog(ERROR, "%s: cannot flush block %u of %u/%u", __func__, buf_hdr->tag.block_num, buf_hdr->tag.rnode.tbl_node,
+         buf_hdr->tag.rnode.rel_node);
+  }
+
+  LocalBufferFlushCount++;
+
+  atomic_write_u32(&buf_hdr->state, atomic_read_u32(&buf_hdr->state) & ~BM_DIRTY);
+  buf_hdr->cntx_dirty = false;
+
+  if (release) {
+    ASSERT(LocalRefCount[b] > 0);
+    LocalRefCount[b]--;
+  }
+
+  return true;
+}
+
+// Forget the contents of a local buffer, dirty or not.
+static void drop_local_buffer(BufferDesc* buf_hdr) {
+  int b = -buf_hdr->buf_id - 2;
+  bool found;
+
+  if (LocalRefCount[b] > 0) {
+    elog(ERROR, "%s: block %u of %u/%u is still pinned", __func__, buf_hdr->tag.block_num,
+         buf_hdr->tag.rnode.tbl_node, buf_hdr->tag.rnode.rel_node);
+  }
+
+  if (!hash_search(LocalBufHash, (char*)&buf_hdr->tag, HASH_REMOVE, &found) || !found) {
+    elog(ERROR, "%s: local buffer hash table corrupted", __func__);
+  }
+
+  CLEAR_BUFFERTAG(&buf_hdr->tag);
+  atomic_write_u32(&buf_hdr->state, 0);
+  buf_hdr->cntx_dirty = false;
+}
+
+// Discard the local buffers holding blocks first_del_block and up of a
+// relation; see drop_relation_buffers(). Must be called before the
+// storage manager truncates or removes the relation, while rd_nblocks
+// still counts all its blocks.
+//
+// The blocks are looked up one by one, so dropping a small temp table
+// costs the same however big temp_buffers is. A relation with more
+// blocks than the pool has buffers is handled with a sweep of the pool.
+void drop_local_relation_buffers(Relation relation, BlockNumber first_del_block) {
+  LocalBufferLookupEnt* result;
+  BufferTag tag;
+  BlockNumber block_num;
+  bool found;
+  int i;
+
+  if (LocalBufferDescriptors == NULL || relation->rd_nblocks <= first_del_block) {
+    return;
+  }
+
+  if (relation->rd_nblocks - first_del_block <= NLocBuffer) {
+    for (block_num = first_del_block; block_num < relation->rd_nblocks; block_num++) {
+      INIT_BUFFERTAG(&tag, relation, block_num);
+
+      result = (LocalBufferLookupEnt*)hash_search(LocalBufHash, (char*)&tag, HASH_FIND, &found);
+
+      if (!result) {
+        elog(ERROR, "%s: local buffer hash table corrupted", __func__);
+      }
+
+      if (found) {
+        drop_local_buffer(&LocalBufferDescriptors[result->id]);
+      }
+    }
+
+    return;
+  }
+
   for (i = 0; i < NLocBuffer; i++) {
-    int b = (NextFreeLocalBuf + i) % NLocBuffer;
+    BufferDesc* buf_hdr = &LocalBufferDescriptors[i];
 
-    if (LocalRefCount[b] == 0) {
-      buf_hdr = &LocalBufferDescriptors[b];
-      LocalRefCount[b]++;
-      NextFreeLocalBuf = (b + 1) % NLocBuffer;
-      break;
+    if ((atomic_read_u32(&buf_hdr->state) & BM_VALID) && REL_FILE_NODE_EQUALS(buf_hdr->tag.rnode, relation->rd_node) &&
+        buf_hdr->tag.block_num >= first_del_block) {
+      drop_local_buffer(buf_hdr);
     }
   }
+}
+
+// Allocate the local buffer pool, NumTempBuffers buffers.
+//
+// Only the descriptors and the lookup table are allocated here; the
+// buffer blocks themselves are allocated when a buffer is first used, so
+// a large temp_buffers costs little for backends that don't need it.
+void init_local_buffer(void) {
+  HashCtrl info;
+  int i;
+
+  ASSERT(LocalBufferDescriptors == NULL);
+
+  LocalBufferContext = alloc_set_context_create(TopMemoryContext, "LocalBufferContext", ALLOCSET_DEFAULT_MIN_SIZE,
+                                                ALLOCSET_DEFAULT_INIT_SIZE, ALLOCSET_DEFAULT_MAX_SIZE);
+
+  NLocBuffer = NumTempBuffers;
 
-  if (buf_hdr == NULL) {
-    elog(ERROR, "no empty local buffer.");
+  LocalBufferDescriptors = (BufferDesc*)memory_context_alloc(LocalBufferContext, NLocBuffer * sizeof(BufferDesc));
+  LocalBufferBlockPointers = (Block*)memory_context_alloc(LocalBufferContext, NLocBuffer * sizeof(Block));
+  LocalRefCount = (long*)memory_context_alloc(LocalBufferContext, NLocBuffer * sizeof(long));
+  MEMSET(LocalBufferDescriptors, 0, NLocBuffer * sizeof(BufferDesc));
+  MEMSET(LocalBufferBlockPointers, 0, NLocBuffer * sizeof(Block));
+  MEMSET(LocalRefCount, 0, NLocBuffer * sizeof(long));
+  NextFreeLocalBuf = 0;
+
+  for (i = 0; i < NLocBuffer; i++) {
+    BufferDesc* buf = &LocalBufferDescriptors[i];
+
+    // Negative to indicate local buffer. This is tricky: shared buffers
+    // start with 0. We have to start with -2. (Note that the routine
+    // BUFFER_DESCRIPTOR_GET_BUFFER adds 1 to buf_id so our first buffer
+    // id is -1.)
+    buf->buf_id = -i - 2;
+    atomic_init_u32(&buf->state, 0);
   }
 
-  // This buffer is not referenced but it might still be dirty (the last
-  // transaction to touch it doesn't need its contents but has not
-  // flushed it).  if that's the case, write it out before reusing it!
-  // TODO(gc): cntx_dirty的作用
-  if (buf_hdr->flags & BM_DIRTY || buf_hdr->cntx_dirty) {
+  info.keysize = sizeof(BufferTag);
+  info.datasize = sizeof(int);
+  info.hash = tag_hash;
+
+  LocalBufHash = hash_create(NLocBuffer, &info, HASH_ELEM | HASH_FUNCTION);
+
+  if (!LocalBufHash) {
+    elog(ERROR, "%s: could not initialize local buffer hash table", __func__);
+  }
+}
+
+// Flush all dirty local buffers to disk.
+//
+// Called at commit time: the relations using local buffers were created
+// in this transaction, and their pages must be on disk before other
+// backends can see them.
+void local_buffer_sync(void) {
+  int i;
+
+  for (i = 0; i < NLocBuffer; i++) {
+    BufferDesc* buf_hdr = &LocalBufferDescriptors[i];
+
+    if (atomic_read_u32(&buf_hdr->state) & BM_DIRTY || buf_hdr->cntx_dirty) {
+#ifdef LBDEBUG
+      fprintf(stderr, "LB SYNC %d\n", -i - 1);
+#endif
+      flush_local_buffer(BUFFER_DESCRIPTOR_GET_BUFFER(buf_hdr), false);
+    }
+  }
+}
+
+// Forget the contents of the local buffer pool, at transaction end.
+//
+// The relations that used it are no longer local, so every buffer is
+// invalidated. If temp_buffers was changed the pool itself is released,
+// and reallocated at the new size when it's next needed.
+void reset_local_buffer_pool(void) {
+  HashCtrl info;
+  int i;
+
+  if (LocalBufferDescriptors == NULL) {
+    return;
+  }
+
+  if (NLocBuffer != NumTempBuffers) {
+    hash_destroy(LocalBufHash);
+    memory_context_delete(LocalBufferContext);
+
+    LocalBufHash = NULL;
+    LocalBufferContext = NULL;
+    LocalBufferDescriptors = NULL;
+    LocalBufferBlockPointers = NULL;
+    LocalRefCount = NULL;
+    NLocBuffer = 0;
+
+    return;
+  }
+
+  for (i = 0; i < NLocBuffer; i++) {
+    BufferDesc* buf = &LocalBufferDescriptors[i];
+
+    CLEAR_BUFFERTAG(&buf->tag);
+    atomic_write_u32(&buf->state, 0);
+    buf->cntx_dirty = false;
+    LocalRefCount[i] = 0;
+  }
+
+  NextFreeLocalBuf = 0;
+
+  // Rebuilding the table is cheaper than deleting the entries one by one.
+  hash_destroy(LocalBufHash);
+
+  info.keysize = sizeof(BufferTag);
+  info.datasize = sizeof(int);
+  info.hash = tag_hash;
+
+  LocalBufHash = hash_create(NLocBuffer, &info, HASH_ELEM | HASH_FUNCTION);
+
+  if (!LocalBufHash) {
+    elog(ERROR, "%s: could not initialize local buffer hash table", __func__);
   }
-}
\ No newline at end of file
+}
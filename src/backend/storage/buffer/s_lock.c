@@ -29,7 +29,7 @@
 
 int SpinCycle[S_NSPIN_CYCLE] = {0, 0, 0, 0, 10000, 0, 0, 0, 10000, 0, 0, 10000, 0, 0, 10000, 0, 10000, 0, 10000, 10000};
 
-static void s_lock_stuck(volatile TasLock* lock, const char* file, const int line) {
+static void s_lock_stuck(volatile void* lock, const char* file, const int line) {
   fprintf(stderr, "\nFATAL: s_lock(%p) at %s:%d, stuck spinlock. Aborting.\n", lock, file, line);
   fprintf(stdout, "\nFATAL: s_lock(%p) at %s:%d, stuck spinlock. Aborting.\n", lock, file, line);
   abort();
@@ -54,3 +54,14 @@ void s_lock(volatile TasLock* lock, const char* file, const int line) {
     }
   }
 }
+
+// Back off in a spin loop over some lock other than a TasLock, such as
+// the BM_LOCKED bit of a buffer's state word. spins is the number of
+// failed attempts so far; gives up like s_lock() if it grows too large.
+void s_lock_delay(unsigned spins, volatile void* lock, const char* file, const int line) {
+  s_lock_sleep(spins);
+
+  if (spins > S_MAX_BUSY) {
+    s_lock_stuck(lock, file, line);
+  }
+}
@@ -0,0 +1,325 @@
+//===----------------------------------------------------------------------===//
+//
+// aio.c
+//  Asynchronous I/O through io_uring.
+//
+//  Each process has one io_uring, set up the first time it is needed
+//  (a process forked from one that had a ring sets up its own). Starting
+//  an I/O puts a request on the submission queue and submits it at once,
+//  so the kernel has resolved the file descriptor before we return and
+//  the caller may close it. Completions are only looked at when the
+//  caller asks for them with aio_reap(), either polling or waiting for
+//  some to arrive; nothing happens behind the caller's back.
+//
+//  The rings are used directly through the io_uring_setup() and
+//  io_uring_enter() system calls rather than a library. Where io_uring is
+//  missing or not allowed, aio_available() says so and callers do their
+//  I/O synchronously.
+//
+// Portions Copyright (c) 1996-2001, PostgreSQL Global Development Group
+// Portions Copyright (c) 1994, Regents of the University of California
+//
+//===----------------------------------------------------------------------===//
+
+#include "rdbms/storage/aio.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
+#include "rdbms/postgres.h"
+#include "rdbms/utils/elog.h"
+
+#ifdef __linux__
+
+// An I/O in flight. The iovecs are kept here until it completes, as the
+// kernel may look at them after aio_start_*() returns.
+typedef struct AioSlot {
+  uint64 id;
+  struct iovec iov[AIO_MAX_IOV];
+  int next_free;  // Next free slot, or -1
+} AioSlot;
+
+typedef struct AioRing {
+  pid_t pid;  // Process that set the ring up, 0 if none did
+  int fd;     // -1 if io_uring is not available
+
+  // Submission queue.
+  unsigned* sq_tail;
+  unsigned* sq_mask;
+  unsigned* sq_array;
+  struct io_uring_sqe* sqes;
+
+  // Completion queue.
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned* cq_mask;
+  struct io_uring_cqe* cqes;
+
+  void* sq_ptr;
+  size_t sq_size;
+  void* cq_ptr;  // Same as sq_ptr with IORING_FEAT_SINGLE_MMAP
+  size_t cq_size;
+  size_t sqes_size;
+} AioRing;
+
+static AioRing Ring = {0, -1};
+static AioSlot Slots[AIO_MAX_IN_FLIGHT];
+static int FreeSlot = -1;
+static int NumInFlight = 0;
+
+static bool aio_setup(void);
+static void aio_release(void);
+static int aio_start(int opcode, int fd, const struct iovec* iov, int iovcnt, long offset, uint64 id);
+
+// Can this process start asynchronous I/O?
+bool aio_available(void) {
+  pid_t pid = getpid();
+
+  if (Ring.pid != pid) {
+    // What a parent had in flight is none of our business.
+    aio_release();
+    Ring.pid = pid;
+    aio_setup();
+  }
+
+  return Ring.fd >= 0;
+}
+
+// Start reading into iovcnt buffers from fd at offset. Returns 0, or -1
+// with errno set if the read could not be started.
+int aio_start_readv(int fd, const struct iovec* iov, int iovcnt, long offset, uint64 id) {
+  return aio_start(IORING_OP_READV, fd, iov, iovcnt, offset, id);
+}
+
+// Start writing iovcnt buffers to fd at offset. The buffers must stay
+// untouched until the write completes.
+int aio_start_writev(int fd, const struct iovec* iov, int iovcnt, long offset, uint64 id) {
+  return aio_start(IORING_OP_WRITEV, fd, iov, iovcnt, offset, id);
+}
+
+int aio_in_flight(void) { return NumInFlight; }
+
+// Collect up to max_results completed I/Os into results, waiting until
+// at least min_results (and no more than are in flight) have completed.
+// Returns the number collected. A min_results of 0 just polls, without a
+// system call.
+int aio_reap(AioResult* results, int max_results, int min_results) {
+  struct io_uring_cqe* cqe;
+  unsigned head;
+  unsigned tail;
+  int nresults = 0;
+  int slot;
+
+  if (NumInFlight == 0) {
+    return 0;
+  }
+
+  min_results = MIN(min_results, NumInFlight);
+
+  for (;;) {
+    head = *Ring.cq_head;
+    tail = __atomic_load_n(Ring.cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail && nresults < max_results) {
+      cqe = &Ring.cqes[head & *Ring.cq_mask];
+      slot = (int)cqe->user_data;
+
+      results[nresults].id = Slots[slot].id;
+      results[nresults].result = cqe->res;
+      nresults++;
+
+      Slots[slot].next_free = FreeSlot;
+      FreeSlot = slot;
+      NumInFlight--;
+      head++;
+    }
+
+    __atomic_store_n(Ring.cq_head, head, __ATOMIC_RELEASE);
+
+    if (nresults >= min_results) {
+      return nresults;
+    }
+
+    if (syscall(__NR_io_uring_enter, Ring.fd, 0, min_results - nresults, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+        errno != EINTR) {
+      elog(FATAL, "%s: io_uring_enter failed: %s", __func__, strerror(errno));
+    }
+  }
+}
+
+static bool aio_setup(void) {
+  struct io_uring_params params;
+  int i;
+
+  MEMSET(&params, 0, sizeof(params));
+
+  Ring.fd = syscall(__NR_io_uring_setup, AIO_MAX_IN_FLIGHT, &params);
+  if (Ring.fd < 0) {
+    elog(DEBUG, "%s: io_uring not available: %s", __func__, strerror(errno));
+    return false;
+  }
+
+  Ring.sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  Ring.cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    Ring.sq_size = Ring.cq_size = MAX(Ring.sq_size, Ring.cq_size);
+  }
+
+  Ring.sq_ptr = mmap(NULL, Ring.sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Ring.fd,
+                     IORING_OFF_SQ_RING);
+  if (Ring.sq_ptr == MAP_FAILED) {
+    goto fail;
+  }
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    Ring.cq_ptr = Ring.sq_ptr;
+  } else {
+    Ring.cq_ptr = mmap(NULL, Ring.cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Ring.fd,
+                       IORING_OFF_CQ_RING);
+    if (Ring.cq_ptr == MAP_FAILED) {
+      munmap(Ring.sq_ptr, Ring.sq_size);
+      goto fail;
+    }
+  }
+
+  Ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  Ring.sqes = (struct io_uring_sqe*)mmap(NULL, Ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                         Ring.fd, IORING_OFF_SQES);
+  if (Ring.sqes == MAP_FAILED) {
+    if (Ring.cq_ptr != Ring.sq_ptr) {
+      munmap(Ring.cq_ptr, Ring.cq_size);
+    }
+    munmap(Ring.sq_ptr, Ring.sq_size);
+    goto fail;
+  }
+
+  Ring.sq_tail = (unsigned*)((char*)Ring.sq_ptr + params.sq_off.tail);
+  Ring.sq_mask = (unsigned*)((char*)Ring.sq_ptr + params.sq_off.ring_mask);
+  Ring.sq_array = (unsigned*)((char*)Ring.sq_ptr + params.sq_off.array);
+  Ring.cq_head = (unsigned*)((char*)Ring.cq_ptr + params.cq_off.head);
+  Ring.cq_tail = (unsigned*)((char*)Ring.cq_ptr + params.cq_off.tail);
+  Ring.cq_mask = (unsigned*)((char*)Ring.cq_ptr + params.cq_off.ring_mask);
+  Ring.cqes = (struct io_uring_cqe*)((char*)Ring.cq_ptr + params.cq_off.cqes);
+
+  // Both queues have at least AIO_MAX_IN_FLIGHT entries, so with no
+  // more than that in flight neither can overflow.
+  FreeSlot = -1;
+  for (i = AIO_MAX_IN_FLIGHT - 1; i >= 0; i--) {
+    Slots[i].next_free = FreeSlot;
+    FreeSlot = i;
+  }
+  NumInFlight = 0;
+
+  return true;
+
+fail:
+  elog(DEBUG, "%s: cannot map io_uring queues: %s", __func__, strerror(errno));
+  close(Ring.fd);
+  Ring.fd = -1;
+  return false;
+}
+
+static void aio_release(void) {
+  if (Ring.fd < 0) {
+    return;
+  }
+
+  munmap(Ring.sqes, Ring.sqes_size);
+  if (Ring.cq_ptr != Ring.sq_ptr) {
+    munmap(Ring.cq_ptr, Ring.cq_size);
+  }
+  munmap(Ring.sq_ptr, Ring.sq_size);
+  close(Ring.fd);
+
+  Ring.fd = -1;
+  FreeSlot = -1;
+  NumInFlight = 0;
+}
+
+static int aio_start(int opcode, int fd, const struct iovec* iov, int iovcnt, long offset, uint64 id) {
+  struct io_uring_sqe* sqe;
+  unsigned tail;
+  unsigned index;
+  int slot;
+  int return_code;
+
+  ASSERT(iovcnt > 0 && iovcnt <= AIO_MAX_IOV);
+
+  if (!aio_available()) {
+    errno = ENOSYS;
+    return -1;
+  }
+
+  if (FreeSlot < 0) {
+    errno = EAGAIN;
+    return -1;
+  }
+
+  slot = FreeSlot;
+  FreeSlot = Slots[slot].next_free;
+  Slots[slot].id = id;
+  memcpy(Slots[slot].iov, iov, iovcnt * sizeof(struct iovec));
+
+  // We are the only submitter, so the tail is ours to read plainly.
+  tail = *Ring.sq_tail;
+  index = tail & *Ring.sq_mask;
+  sqe = &Ring.sqes[index];
+
+  MEMSET(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->off = offset;
+  sqe->addr = (unsigned long)Slots[slot].iov;
+  sqe->len = iovcnt;
+  sqe->user_data = slot;
+
+  Ring.sq_array[index] = index;
+  __atomic_store_n(Ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  do {
+    return_code = syscall(__NR_io_uring_enter, Ring.fd, 1, 0, 0, NULL, 0);
+  } while (return_code < 0 && errno == EINTR);
+
+  if (return_code != 1) {
+    // Not consumed; take it back off the queue.
+    if (return_code == 0) {
+      errno = EAGAIN;
+    }
+    __atomic_store_n(Ring.sq_tail, tail, __ATOMIC_RELEASE);
+    Slots[slot].next_free = FreeSlot;
+    FreeSlot = slot;
+    return -1;
+  }
+
+  NumInFlight++;
+
+  return 0;
+}
+
+#else  // !__linux__
+
+bool aio_available(void) { return false; }
+
+int aio_start_readv(int fd, const struct iovec* iov, int iovcnt, long offset, uint64 id) {
+  errno = ENOSYS;
+  return -1;
+}
+
+int aio_start_writev(int fd, const struct iovec* iov, int iovcnt, long offset, uint64 id) {
+  errno = ENOSYS;
+  return -1;
+}
+
+int aio_in_flight(void) { return 0; }
+
+int aio_reap(AioResult* results, int max_results, int min_results) { return 0; }
+
+#endif  // __linux__
@@ -0,0 +1,586 @@
+//===----------------------------------------------------------------------===//
+//
+// buffile.c
+//  Buffered temporary files.
+//
+//  A BufFile is a temporary file read and written through a private
+//  buffer of BUF_FILE_BUFFER_SIZE bytes, so that callers spilling small
+//  tuples to disk (sorts, hash joins) make one system call per buffer
+//  rather than one per tuple. The file is seen as a single sequence of
+//  bytes that may be read, written, and seeked in freely, as tape-style
+//  reuse of the space needs; underneath it is spread over as many
+//  MAX_PHYSICAL_FILESIZE segments as it takes, each a VFD from
+//  open_temporary_file(), so no one kernel file grows past what the file
+//  system allows. All of it goes away when the BufFile is closed, or at
+//  the end of the transaction.
+//
+//  The buffer always holds one chunk of the file: the bytes from a
+//  multiple of BUF_FILE_BUFFER_SIZE onwards. A chunk is read in when the
+//  position first moves into it, and written out, if changed, when the
+//  position leaves it.
+//
+//  A BufFile may also be compressed. Each chunk is then compressed by
+//  itself with a simple LZ77 codec, fast rather than thorough, and kept
+//  wherever there was room for it when it was written: in its old place
+//  if it still fits, otherwise at the end of the file. Where each chunk
+//  is stored is remembered in memory, so seeking works as before; only
+//  the space of chunks that were rewritten larger is lost.
+//
+// Portions Copyright (c) 1996-2001, PostgreSQL Global Development Group
+// Portions Copyright (c) 1994, Regents of the University of California
+//
+//===----------------------------------------------------------------------===//
+
+#include "rdbms/storage/buffile.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rdbms/postgres.h"
+#include "rdbms/storage/fd.h"
+#include "rdbms/utils/elog.h"
+#include "rdbms/utils/palloc.h"
+
+// Size of the private buffer, and so of a chunk.
+#define BUF_FILE_BUFFER_SIZE (8 * BLCKSZ)
+
+// Size of one segment of a BufFile. Should be a multiple of
+// BUF_FILE_BUFFER_SIZE, though nothing breaks if it isn't.
+#ifndef MAX_PHYSICAL_FILESIZE
+#define MAX_PHYSICAL_FILESIZE (1024L * 1024L * 1024L)
+#endif
+
+// Where a chunk of a compressed BufFile is stored.
+typedef struct BufFileChunk {
+  long phys;   // Offset, counting all segments as one file
+  int length;  // Bytes stored there, 0 if never written
+  bool raw;    // Stored uncompressed, because it didn't compress
+} BufFileChunk;
+
+struct BufFile {
+  int num_files;  // Segments opened so far
+  File* files;    // VFDs of the segments
+  bool compress;  // Chunks are stored compressed
+  long size;      // Bytes in the file, counting the buffer
+
+  long cur_chunk;  // Chunk the position is in
+  int pos;         // Position within it
+  int nbytes;      // Bytes of the chunk in the buffer, if loaded
+  bool loaded;     // The buffer holds cur_chunk
+  bool dirty;      // The buffer has changes not written out yet
+
+  // Compressed files only.
+  BufFileChunk* chunks;  // Indexed by chunk number
+  long max_chunks;       // Entries allocated in chunks
+  long end_phys;         // End of the space used so far
+  char* cbuffer;         // Compressed form of a chunk
+
+  char buffer[BUF_FILE_BUFFER_SIZE];
+};
+
+// The codec. A compressed chunk is a sequence of items, each a token
+// byte, literals, and a match: the high nibble of the token is the
+// number of literals that follow it, the low nibble the length of the
+// match less LZ_MIN_MATCH, and a nibble of 15 means the count goes on in
+// the bytes that follow, each adding up to 255. The match is a 2-byte
+// little-endian distance back into what has been decompressed already.
+// The last item has literals only, and ends the chunk.
+#define LZ_MIN_MATCH  4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS  12
+
+static BufFile* make_buf_file(File first_file, bool compress);
+static void extend_buf_file(BufFile* file);
+static void buf_file_pio(BufFile* file, bool write, char* buf, int amount, long phys);
+static void buf_file_load_buffer(BufFile* file);
+static void buf_file_dump_buffer(BufFile* file);
+static void buf_file_next_chunk(BufFile* file);
+static int lz_compress(const unsigned char* src, int len, unsigned char* dst, int cap);
+static int lz_emit(unsigned char* dst, int cap, int op, const unsigned char* lit, int lit_len, int offset,
+                   int match_len);
+static int lz_decompress(const unsigned char* src, int len, unsigned char* dst, int cap);
+
+// Create a BufFile for a new temporary file, compressed or not. It is
+// deleted when closed, or at the end of the transaction.
+BufFile* buf_file_create_temp(bool compress) {
+  return make_buf_file(open_temporary_file(), compress);
+}
+
+static BufFile* make_buf_file(File first_file, bool compress) {
+  BufFile* file = (BufFile*)palloc(sizeof(BufFile));
+
+  file->num_files = 1;
+  file->files = (File*)palloc(sizeof(File));
+  file->files[0] = first_file;
+  file->compress = compress;
+  file->size = 0;
+
+  file->cur_chunk = 0;
+  file->pos = 0;
+  file->nbytes = 0;
+  file->loaded = true;
+  file->dirty = false;
+
+  file->chunks = NULL;
+  file->max_chunks = 0;
+  file->end_phys = 0;
+  file->cbuffer = compress ? (char*)palloc(BUF_FILE_BUFFER_SIZE) : NULL;
+
+  return file;
+}
+
+// Add another segment.
+static void extend_buf_file(BufFile* file) {
+  File pfile = open_temporary_file();
+
+  file->files = (File*)repalloc(file->files, (file->num_files + 1) * sizeof(File));
+  file->files[file->num_files] = pfile;
+  file->num_files++;
+}
+
+// Close a BufFile, deleting its segments. Whatever is in the buffer is
+// not written out; there's no point.
+void buf_file_close(BufFile* file) {
+  int i;
+
+  for (i = 0; i < file->num_files; i++) {
+    file_close(file->files[i]);
+  }
+
+  pfree(file->files);
+
+  if (file->compress) {
+    if (file->chunks != NULL) {
+      pfree(file->chunks);
+    }
+
+    pfree(file->cbuffer);
+  }
+
+  pfree(file);
+}
+
+// Read or write amount bytes at phys, which may cross from one segment
+// into the next. We always know how much is there, so coming up short
+// is an error.
+static void buf_file_pio(BufFile* file, bool write, char* buf, int amount, long phys) {
+  int seg;
+  long offset;
+  int n;
+
+  while (amount > 0) {
+    seg = phys / MAX_PHYSICAL_FILESIZE;
+    offset = phys % MAX_PHYSICAL_FILESIZE;
+    n = MIN(amount, MAX_PHYSICAL_FILESIZE - offset);
+
+    while (seg >= file->num_files) {
+      extend_buf_file(file);
+    }
+
+    if (write) {
+      if (file_pwrite(file->files[seg], buf, n, offset) != n) {
+        elog(ERROR, "%s: could not write temporary file: %m", __func__);
+      }
+    } else {
+      if (file_pread(file->files[seg], buf, n, offset) != n) {
+        elog(ERROR, "%s: could not read temporary file: %m", __func__);
+      }
+    }
+
+    buf += n;
+    phys += n;
+    amount -= n;
+  }
+}
+
+// Read the current chunk into the buffer.
+static void buf_file_load_buffer(BufFile* file) {
+  long start = file->cur_chunk * BUF_FILE_BUFFER_SIZE;
+  BufFileChunk* chunk;
+
+  ASSERT(!file->dirty);
+
+  file->nbytes = (int)MIN(MAX(file->size - start, 0), BUF_FILE_BUFFER_SIZE);
+  file->loaded = true;
+
+  if (file->nbytes == 0) {
+    return;
+  }
+
+  if (!file->compress) {
+    buf_file_pio(file, false, file->buffer, file->nbytes, start);
+    return;
+  }
+
+  // There are no holes, so every chunk before the end has been stored.
+  ASSERT(file->cur_chunk < file->max_chunks);
+  chunk = &file->chunks[file->cur_chunk];
+  ASSERT(chunk->length > 0);
+
+  if (chunk->raw) {
+    buf_file_pio(file, false, file->buffer, file->nbytes, chunk->phys);
+  } else {
+    buf_file_pio(file, false, file->cbuffer, chunk->length, chunk->phys);
+
+    if (lz_decompress((unsigned char*)file->cbuffer, chunk->length, (unsigned char*)file->buffer, file->nbytes) !=
+        file->nbytes) {
+      elog(ERROR, "%s: compressed temporary file is corrupt", __func__);
+    }
+  }
+}
+
+// Write the buffer out, if it has changed.
+static void buf_file_dump_buffer(BufFile* file) {
+  BufFileChunk* chunk;
+  char* data;
+  int length;
+  bool raw;
+
+  if (!file->dirty) {
+    return;
+  }
+
+  if (!file->compress) {
+    buf_file_pio(file, true, file->buffer, file->nbytes, file->cur_chunk * BUF_FILE_BUFFER_SIZE);
+    file->dirty = false;
+    return;
+  }
+
+  if (file->cur_chunk >= file->max_chunks) {
+    long new_max = MAX(file->max_chunks * 2, 64);
+
+    while (new_max <= file->cur_chunk) {
+      new_max *= 2;
+    }
+
+    if (file->chunks == NULL) {
+      file->chunks = (BufFileChunk*)palloc(new_max * sizeof(BufFileChunk));
+    } else {
+      file->chunks = (BufFileChunk*)repalloc(file->chunks, new_max * sizeof(BufFileChunk));
+    }
+
+    MEMSET(&file->chunks[file->max_chunks], 0, (new_max - file->max_chunks) * sizeof(BufFileChunk));
+    file->max_chunks = new_max;
+  }
+
+  // Keep it as it is unless compressing saves something.
+  length = lz_compress((unsigned char*)file->buffer, file->nbytes, (unsigned char*)file->cbuffer, file->nbytes - 1);
+  raw = length < 0;
+
+  if (raw) {
+    data = file->buffer;
+    length = file->nbytes;
+  } else {
+    data = file->cbuffer;
+  }
+
+  chunk = &file->chunks[file->cur_chunk];
+
+  // A chunk that doesn't fit where it was goes at the end, or in the
+  // next segment if it would straddle two, so it takes one I/O to read.
+  if (length > chunk->length) {
+    if (file->end_phys % MAX_PHYSICAL_FILESIZE + length > MAX_PHYSICAL_FILESIZE) {
+      file->end_phys += MAX_PHYSICAL_FILESIZE - file->end_phys % MAX_PHYSICAL_FILESIZE;
+    }
+
+    chunk->phys = file->end_phys;
+    file->end_phys += length;
+  }
+
+  buf_file_pio(file, true, data, length, chunk->phys);
+
+  chunk->length = length;
+  chunk->raw = raw;
+  file->dirty = false;
+}
+
+// Move the position to the start of the next chunk.
+static void buf_file_next_chunk(BufFile* file) {
+  buf_file_dump_buffer(file);
+
+  file->cur_chunk++;
+  file->pos = 0;
+  file->nbytes = 0;
+  file->loaded = false;
+}
+
+// Like fread() except we assume 1-byte element size.
+size_t buf_file_read(BufFile* file, void* ptr, size_t size) {
+  size_t nread = 0;
+  int n;
+
+  while (size > 0) {
+    if (file->pos >= BUF_FILE_BUFFER_SIZE) {
+      buf_file_next_chunk(file);
+    }
+
+    if (!file->loaded) {
+      buf_file_load_buffer(file);
+    }
+
+    if (file->pos >= file->nbytes) {
+      break;  // No more data
+    }
+
+    n = (int)MIN(size, (size_t)(file->nbytes - file->pos));
+
+    memcpy(ptr, file->buffer + file->pos, n);
+
+    file->pos += n;
+    ptr = (char*)ptr + n;
+    size -= n;
+    nread += n;
+  }
+
+  return nread;
+}
+
+// Like fwrite() except we assume 1-byte element size.
+size_t buf_file_write(BufFile* file, void* ptr, size_t size) {
+  size_t nwritten = 0;
+  int n;
+
+  while (size > 0) {
+    if (file->pos >= BUF_FILE_BUFFER_SIZE) {
+      buf_file_next_chunk(file);
+    }
+
+    // Past the end of the file this reads nothing.
+    if (!file->loaded) {
+      buf_file_load_buffer(file);
+    }
+
+    n = (int)MIN(size, (size_t)(BUF_FILE_BUFFER_SIZE - file->pos));
+
+    memcpy(file->buffer + file->pos, ptr, n);
+
+    file->dirty = true;
+    file->pos += n;
+
+    if (file->pos > file->nbytes) {
+      file->nbytes = file->pos;
+      file->size = MAX(file->size, file->cur_chunk * BUF_FILE_BUFFER_SIZE + file->nbytes);
+    }
+
+    ptr = (char*)ptr + n;
+    size -= n;
+    nwritten += n;
+  }
+
+  return nwritten;
+}
+
+// Like fseek(). Seeking past the end of the file is not allowed, so
+// there are never holes. Returns 0 if OK, EOF if not.
+int buf_file_seek(BufFile* file, long offset, int whence) {
+  long new_offset;
+  long new_chunk;
+
+  switch (whence) {
+    case SEEK_SET:
+      new_offset = offset;
+      break;
+    case SEEK_CUR:
+      new_offset = buf_file_tell(file) + offset;
+      break;
+    case SEEK_END:
+      new_offset = file->size + offset;
+      break;
+    default:
+      elog(ERROR, "%s: invalid whence: %d", __func__, whence);
+      return EOF;
+  }
+
+  if (new_offset < 0 || new_offset > file->size) {
+    return EOF;
+  }
+
+  new_chunk = new_offset / BUF_FILE_BUFFER_SIZE;
+
+  // Within the chunk we have, there is nothing to do but move.
+  if (new_chunk != file->cur_chunk) {
+    buf_file_dump_buffer(file);
+
+    file->cur_chunk = new_chunk;
+    file->nbytes = 0;
+    file->loaded = false;
+  }
+
+  file->pos = (int)(new_offset % BUF_FILE_BUFFER_SIZE);
+
+  return 0;
+}
+
+long buf_file_tell(BufFile* file) { return file->cur_chunk * BUF_FILE_BUFFER_SIZE + file->pos; }
+
+// Seek to the start of a BLCKSZ-sized block, for callers that divide the
+// file into blocks the way a tape sort does. Returns 0 if OK, EOF if
+// not.
+int buf_file_seek_block(BufFile* file, long blknum) { return buf_file_seek(file, blknum * BLCKSZ, SEEK_SET); }
+
+// The block the position is in.
+long buf_file_tell_block(BufFile* file) { return buf_file_tell(file) / BLCKSZ; }
+
+long buf_file_size(BufFile* file) { return file->size; }
+
+// Compress len bytes at src into dst. Returns the compressed length, or
+// -1 if that would be more than cap.
+static int lz_compress(const unsigned char* src, int len, unsigned char* dst, int cap) {
+  int table[1 << LZ_HASH_BITS];
+  int anchor = 0;
+  int ip = 0;
+  int op = 0;
+  int match_len;
+  int ref;
+  uint32 seq;
+  uint32 h;
+  int i;
+
+  for (i = 0; i < (1 << LZ_HASH_BITS); i++) {
+    table[i] = -1;
+  }
+
+  while (ip + LZ_MIN_MATCH <= len) {
+    memcpy(&seq, src + ip, sizeof(seq));
+    h = (seq * 2654435761U) >> (32 - LZ_HASH_BITS);
+    ref = table[h];
+    table[h] = ip;
+
+    if (ref < 0 || ip - ref > LZ_MAX_OFFSET || memcmp(src + ref, src + ip, LZ_MIN_MATCH) != 0) {
+      ip++;
+      continue;
+    }
+
+    match_len = LZ_MIN_MATCH;
+
+    while (ip + match_len < len && src[ref + match_len] == src[ip + match_len]) {
+      match_len++;
+    }
+
+    op = lz_emit(dst, cap, op, src + anchor, ip - anchor, ip - ref, match_len);
+
+    if (op < 0) {
+      return -1;
+    }
+
+    ip += match_len;
+    anchor = ip;
+  }
+
+  return lz_emit(dst, cap, op, src + anchor, len - anchor, 0, 0);
+}
+
+// Append an item to dst, which has op bytes in it already. A match_len
+// of 0 makes it the last item. Returns the new length, or -1 if it
+// would be more than cap.
+static int lz_emit(unsigned char* dst, int cap, int op, const unsigned char* lit, int lit_len, int offset,
+                   int match_len) {
+  int lit_code = MIN(lit_len, 15);
+  int match_code = match_len > 0 ? MIN(match_len - LZ_MIN_MATCH, 15) : 0;
+  int n;
+
+  // Enough for the worst case, so the rest needn't check.
+  if (op + 1 + lit_len / 255 + 1 + lit_len + 2 + match_len / 255 + 1 > cap) {
+    return -1;
+  }
+
+  dst[op++] = (unsigned char)(lit_code << 4 | match_code);
+
+  if (lit_code == 15) {
+    for (n = lit_len - 15; n >= 255; n -= 255) {
+      dst[op++] = 255;
+    }
+
+    dst[op++] = (unsigned char)n;
+  }
+
+  memcpy(dst + op, lit, lit_len);
+  op += lit_len;
+
+  if (match_len == 0) {
+    return op;
+  }
+
+  dst[op++] = (unsigned char)(offset & 0xFF);
+  dst[op++] = (unsigned char)(offset >> 8);
+
+  if (match_code == 15) {
+    for (n = match_len - LZ_MIN_MATCH - 15; n >= 255; n -= 255) {
+      dst[op++] = 255;
+    }
+
+    dst[op++] = (unsigned char)n;
+  }
+
+  return op;
+}
+
+// Decompress len bytes at src into dst. Returns the decompressed length,
+// or -1 if the input is not what lz_compress() makes or would decompress
+// to more than cap bytes.
+static int lz_decompress(const unsigned char* src, int len, unsigned char* dst, int cap) {
+  int ip = 0;
+  int op = 0;
+  int lit_len;
+  int match_len;
+  int offset;
+  unsigned char token;
+
+  while (ip < len) {
+    token = src[ip++];
+    lit_len = token >> 4;
+
+    if (lit_len == 15) {
+      do {
+        if (ip >= len) {
+          return -1;
+        }
+
+        lit_len += src[ip];
+      } while (src[ip++] == 255);
+    }
+
+    if (lit_len > len - ip || lit_len > cap - op) {
+      return -1;
+    }
+
+    memcpy(dst + op, src + ip, lit_len);
+    ip += lit_len;
+    op += lit_len;
+
+    if (ip == len) {
+      break;
+    }
+
+    if (ip + 2 > len) {
+      return -1;
+    }
+
+    offset = src[ip] | src[ip + 1] << 8;
+    ip += 2;
+    match_len = (token & 0x0F) + LZ_MIN_MATCH;
+
+    if ((token & 0x0F) == 15) {
+      do {
+        if (ip >= len) {
+          return -1;
+        }
+
+        match_len += src[ip];
+      } while (src[ip++] == 255);
+    }
+
+    if (offset == 0 || offset > op || match_len > cap - op) {
+      return -1;
+    }
+
+    // The match may overlap what it produces, so byte by byte.
+    while (match_len-- > 0) {
+      dst[op] = dst[op - offset];
+      op++;
+    }
+  }
+
+  return op;
+}
@@ -41,14 +41,20 @@
 
 #include "rdbms/storage/fd.h"
 
+#include <errno.h>
 #include <fcntl.h>
 #include <sys/param.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "rdbms/miscadmin.h"
 #include "rdbms/postgres.h"
+#include "rdbms/storage/aio.h"
 #include "rdbms/storage/ipc.h"
 #include "rdbms/utils/elog.h"
+#include "rdbms/utils/hashfn.h"
 #include "rdbms/utils/memutils.h"
 
 // Problem: Postgres does a system(ld...) to do dynamic loading.
@@ -95,14 +101,20 @@ typedef struct Vfd {
 // These are the assigned bits in fdstate.
 #define FD_DIRTY     (1 << 0)  // Written to, but not yet fsync'd
 #define FD_TEMPORARY (1 << 1)  // Should be unlinked when closed
+#define FD_SHARED    (1 << 2)  // Entered in VfdHash under its filename
+#define FD_UNLINKED  (1 << 3)  // Unlink at last close, if still the same file
 
   File next_free;          // Link to next free VFD, if in freelist
   File lru_more_recently;  // Doubly linked recency-of-use list
   File lru_less_recently;
   long seek_pos;   // Current logical file position
-  char* filename;  // Name of file, or NULL for unused VFD
-  int file_flags;  // open(2) flags for opening the file
-  int file_mode;   // Mode to pass to open(2)
+  char* filename;     // Name of file, or NULL for unused VFD
+  int file_flags;     // open(2) flags for opening the file
+  int file_mode;      // Mode to pass to open(2)
+  int refcount;       // Opens not yet closed; more than 1 only if shared
+  File hash_next;     // Next VFD in the same VfdHash bucket
+  dev_t unlink_dev;   // Which file file_unlink() was asked to delete,
+  ino_t unlink_ino;   // if FD_UNLINKED
 } Vfd;
 
 // Virtual File Descriptor array pointer and size. This grows as
@@ -114,6 +126,29 @@ static Size SizeVfdCache = 0;
 // Number of file descriptors known to be in use by VFD entries.
 static int NFile = 0;
 
+// Most kernel file descriptors a backend may use; the limit of open
+// files is raised to this (plus RESERVE_FOR_LD) at startup, as far as
+// the hard limit lets it.
+int MaxFilesPerProcess = 1000;
+
+// A file opened with file_name_open_shared_file() that is open already
+// gives back the same VFD, instead of taking another one that would
+// compete for kernel descriptors in the LRU ring. Only md.c opens files
+// so: a shared VFD also shares its seek position and kernel descriptor,
+// and md.c only ever reads and writes at a given offset. Opens that must
+// create or truncate the file always get a VFD of their own.
+//
+// VfdHash is a chained hash table of the shared VFDs, by absolute file
+// name, linked through hash_next. It is doubled whenever it holds as many
+// VFDs as it has buckets.
+#define VFD_HASH_INIT_SIZE 64
+
+static File* VfdHash = NULL;
+static int VfdHashSize = 0;   // Number of buckets, a power of 2
+static int VfdHashCount = 0;  // Number of VFDs in them
+
+static FileStats FdStats;
+
 // List of stdio FILEs opened with AllocateFile.
 //
 // Since we don't want to encourage heavy use of AllocateFile, it seems
@@ -166,6 +201,11 @@ static void free_vfd(File file);
 static int file_access(File file);
 static File file_name_open_file_aux(FileName filename, int file_flags,
                                     int file_mode);
+static int timed_open_file(FileName filename, int file_flags, int file_mode);
+static File* vfd_hash_bucket(FileName filename);
+static File vfd_hash_lookup(FileName filename, int file_flags);
+static void vfd_hash_insert(File file);
+static void vfd_hash_delete(File file);
 static char* filepath(char* filename);
 static long pg_nofile(void);
 static void dump_lru();
@@ -181,6 +221,33 @@ File file_name_open_file(FileName filename, int file_flags, int file_mode) {
   return fd;
 }
 
+// Open a file, or take another reference to its VFD if this backend has
+// it open already with the same flags; see VfdHash. Each open needs its
+// own file_close(). The caller must not use the seek position: no
+// file_read(), file_write() or relative file_seek().
+File file_name_open_shared_file(FileName filename, int file_flags, int file_mode) {
+  File fd;
+  char* fname;
+
+  fname = filepath(filename);
+  fd = vfd_hash_lookup(fname, file_flags);
+
+  if (fd > 0) {
+    VfdCache[fd].refcount++;
+    FdStats.shared_opens++;
+  } else {
+    fd = file_name_open_file_aux(fname, file_flags, file_mode);
+
+    if (fd > 0 && !(file_flags & (O_EXCL | O_TRUNC))) {
+      vfd_hash_insert(fd);
+    }
+  }
+
+  pfree(fname);
+
+  return fd;
+}
+
 // Open a file in the database directory ($PGDATA/base/...).
 File path_name_open_file(FileName filename, int file_flags, int file_mode) {
   return file_name_open_file(filename, file_flags, file_mode);
@@ -220,6 +287,13 @@ void file_close(File file) {
 
   DO_DB(elog(DEBUG, "%s %d (%s).\n", __func__, file, VfdCache[file].filename));
 
+  // Somebody else still has it open.
+  if (--VfdCache[file].refcount > 0) {
+    return;
+  }
+
+  vfd_hash_delete(file);
+
   // TODO(gc): 这个地方和lru_delete高度重复
   if (!FILE_IS_NOT_OPEN(file)) {
     // Remove the file from the lru ring.
@@ -249,6 +323,17 @@ void file_close(File file) {
     unlink(VfdCache[file].filename);
   }
 
+  // Or if file_unlink() was called while others had it open, unless
+  // somebody has created a new file by that name since.
+  if (VfdCache[file].fdstate & FD_UNLINKED) {
+    struct stat st;
+
+    if (stat(VfdCache[file].filename, &st) == 0 && st.st_dev == VfdCache[file].unlink_dev &&
+        st.st_ino == VfdCache[file].unlink_ino) {
+      unlink(VfdCache[file].filename);
+    }
+  }
+
   // Return the Vfd slot to the free list.
   free_vfd(file);
 }
@@ -259,6 +344,24 @@ void file_unlink(File file) {
 
   DO_DB(elog(DEBUG, "%s: %d (%s).\n", __func__, file, VfdCache[file].filename));
 
+  // If the VFD is shared, the others may still use it, and reopen the
+  // file after the LRU ring has closed it; so the file stays until they
+  // close it too. Nobody may find it by name meanwhile.
+  if (VfdCache[file].refcount > 1) {
+    struct stat st;
+
+    vfd_hash_delete(file);
+
+    if (stat(VfdCache[file].filename, &st) == 0) {
+      VfdCache[file].fdstate |= FD_UNLINKED;
+      VfdCache[file].unlink_dev = st.st_dev;
+      VfdCache[file].unlink_ino = st.st_ino;
+    }
+
+    VfdCache[file].refcount--;
+    return;
+  }
+
   // Force FileClose to delete it.
   VfdCache[file].fdstate |= FD_TEMPORARY;
   file_close(file);
@@ -308,6 +411,180 @@ int file_write(File file, char* buffer, int amount) {
   return return_code;
 }
 
+// Read amount bytes at offset with a single pread(), instead of a
+// file_seek() and a file_read(). Doesn't use or move the seek position,
+// so callers that always say where to read never pay for an lseek(). A
+// file closed to save kernel descriptors is reopened first. Returns the
+// number of bytes read, or -1 with errno set.
+int file_pread(File file, char* buffer, int amount, long offset) {
+  int return_code;
+
+  ASSERT(FILE_IS_VALID(file));
+
+  DO_DB(elog(DEBUG, "%s: %d (%s) %ld %d %p.\n", __func__, file,
+             VfdCache[file].filename, offset, amount, buffer));
+
+  return_code = file_access(file);
+  if (return_code < 0) {
+    return return_code;
+  }
+
+  return pread(VfdCache[file].fd, buffer, amount, offset);
+}
+
+// Write amount bytes at offset with a single pwrite(). Like
+// file_pread(), doesn't use or move the seek position. Returns the
+// number of bytes written, or -1 with errno set.
+int file_pwrite(File file, char* buffer, int amount, long offset) {
+  int return_code;
+
+  ASSERT(FILE_IS_VALID(file));
+
+  DO_DB(elog(DEBUG, "%s: (%d) (%s) %ld %d %p.\n", __func__, file,
+             VfdCache[file].filename, offset, amount, buffer));
+
+  return_code = file_access(file);
+  if (return_code < 0) {
+    return return_code;
+  }
+
+  return pwrite(VfdCache[file].fd, buffer, amount, offset);
+}
+
+// Read iovcnt buffers from the file, starting at offset, in one system
+// call. Like file_prefetch() this doesn't use or move the seek position.
+// Returns the number of bytes read, which is less than asked for only at
+// end of file, or -1 with errno set.
+int file_readv(File file, const struct iovec* iov, int iovcnt, long offset) {
+  int return_code;
+
+  ASSERT(FILE_IS_VALID(file));
+
+  DO_DB(elog(DEBUG, "%s: %d (%s) %ld %d.\n", __func__, file,
+             VfdCache[file].filename, offset, iovcnt));
+
+  return_code = file_access(file);
+  if (return_code < 0) {
+    return return_code;
+  }
+
+  return preadv(VfdCache[file].fd, iov, iovcnt, offset);
+}
+
+// Write iovcnt buffers to the file, starting at offset, in one system
+// call. Doesn't use or move the seek position. Returns the number of
+// bytes written, or -1 with errno set.
+int file_writev(File file, const struct iovec* iov, int iovcnt, long offset) {
+  int return_code;
+
+  ASSERT(FILE_IS_VALID(file));
+
+  DO_DB(elog(DEBUG, "%s: (%d) (%s) %ld %d.\n", __func__, file,
+             VfdCache[file].filename, offset, iovcnt));
+
+  return_code = file_access(file);
+  if (return_code < 0) {
+    return return_code;
+  }
+
+  return pwritev(VfdCache[file].fd, iov, iovcnt, offset);
+}
+
+// Start reading amount bytes at offset in the background; see aio.c.
+// id is handed back by aio_reap() with the result once the read is
+// done. The descriptor may be closed again before then (the kernel holds
+// on to the file), so this is safe to mix with the VFD cache. Returns 0,
+// or -1 with errno set if the read could not be started.
+int file_aio_read(File file, char* buffer, int amount, long offset, uint64 id) {
+  struct iovec iov;
+  int return_code;
+
+  ASSERT(FILE_IS_VALID(file));
+
+  DO_DB(elog(DEBUG, "%s: %d (%s) %ld %d %p.\n", __func__, file,
+             VfdCache[file].filename, offset, amount, buffer));
+
+  return_code = file_access(file);
+  if (return_code < 0) {
+    return return_code;
+  }
+
+  iov.iov_base = buffer;
+  iov.iov_len = amount;
+
+  return aio_start_readv(VfdCache[file].fd, &iov, 1, offset, id);
+}
+
+// Tell the kernel we will read amount bytes at offset soon, so that it
+// can start the I/O now. Doesn't move the seek position. Returns 0 on
+// success (or if the platform has no way to give the hint), otherwise
+// -1 with errno set.
+int file_prefetch(File file, long offset, int amount) {
+#if defined(POSIX_FADV_WILLNEED)
+  int return_code;
+
+  ASSERT(FILE_IS_VALID(file));
+
+  DO_DB(elog(DEBUG, "%s: %d (%s) %ld %d.\n", __func__, file,
+             VfdCache[file].filename, offset, amount));
+
+  return_code = file_access(file);
+  if (return_code < 0) {
+    return return_code;
+  }
+
+  // posix_fadvise() returns the error number instead of setting errno.
+  return_code = posix_fadvise(VfdCache[file].fd, offset, amount,
+                              POSIX_FADV_WILLNEED);
+  if (return_code != 0) {
+    errno = return_code;
+    return -1;
+  }
+#endif
+
+  return 0;
+}
+
+// Make sure disk space is allocated for amount bytes at offset, growing
+// the file with zeros if that goes past its end. Doesn't use or move the
+// seek position. Where the file system can't preallocate, the zeros are
+// written instead. Returns 0 on success, otherwise -1 with errno set.
+int file_allocate(File file, long offset, long amount) {
+  static _Alignas(IO_ALIGN_SIZE) char zeros[BLCKSZ];  // May be written with O_DIRECT
+  int return_code;
+  long done;
+
+  ASSERT(FILE_IS_VALID(file));
+
+  DO_DB(elog(DEBUG, "%s: %d (%s) %ld %ld.\n", __func__, file,
+             VfdCache[file].filename, offset, amount));
+
+  return_code = file_access(file);
+  if (return_code < 0) {
+    return return_code;
+  }
+
+  // posix_fallocate() returns the error number instead of setting errno.
+  return_code = posix_fallocate(VfdCache[file].fd, offset, amount);
+  if (return_code == 0) {
+    return 0;
+  }
+
+  if (return_code != EINVAL && return_code != EOPNOTSUPP) {
+    errno = return_code;
+    return -1;
+  }
+
+  for (done = 0; done < amount; done += return_code) {
+    return_code = pwrite(VfdCache[file].fd, zeros, MIN(amount - done, BLCKSZ), offset + done);
+    if (return_code <= 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
 // 1. If whence is SEEK_SET, the offset is set to offset bytes.
 // 2. If whence is SEEK_CUR, the offset is set to its current location plus
 //    offset bytes.
@@ -635,6 +912,11 @@ void at_eo_xact_files(void) {
   TempFileCounter = 0;
 }
 
+// Copy out what the VFD cache has done so far.
+void file_get_stats(FileStats* stats) { *stats = FdStats; }
+
+void file_reset_stats(void) { MEMSET(&FdStats, 0, sizeof(FileStats)); }
+
 // pg_fsync --- same as fsync except does nothing if -F switch was given.
 int pg_fsync(int fd) {
   if (EnableFsync) {
@@ -707,6 +989,7 @@ static void lru_delete(File file) {
 
   --NFile;
   vfdp->fd = VFD_CLOSED;
+  FdStats.lru_closes++;
 }
 
 static void insert(File file) {
@@ -749,7 +1032,7 @@ static int lru_insert(File file) {
     // to overall system file table being full.  So, be prepared to
     // release another FD if necessary...
     vfdp->fd =
-        basic_open_file(vfdp->filename, vfdp->file_flags, vfdp->file_mode);
+        timed_open_file(vfdp->filename, vfdp->file_flags, vfdp->file_mode);
 
     if (vfdp->fd < 0) {
       DO_DB(elog(DEBUG, "%s: reopen failed: %d", __func__, errno));
@@ -757,6 +1040,7 @@ static int lru_insert(File file) {
     } else {
       DO_DB(elog(DEBUG, "%s: reopen success", __func__));
       ++NFile;
+      FdStats.reopens++;
     }
 
     // Seek to the right position.
@@ -805,6 +1089,10 @@ static File allocate_vfd(void) {
 
     // Register proc-exit call to ensure temp files are dropped at exit.
     on_proc_exit(at_eo_xact_files, 0);
+
+    // Settle how many kernel descriptors we may have, raising the limit
+    // of open files if need be, before the first one is opened.
+    pg_nofile();
   }
 
   if (VfdCache[0].next_free == 0) {
@@ -860,6 +1148,8 @@ static void free_vfd(File file) {
   }
 
   vfdp->fdstate = 0;
+  vfdp->refcount = 0;
+  vfdp->hash_next = 0;
   vfdp->next_free = VfdCache[0].next_free;
   VfdCache[0].next_free = file;
 }
@@ -911,7 +1201,7 @@ static File file_name_open_file_aux(FileName filename, int file_flags,
     }
   }
 
-  vfdp->fd = basic_open_file(filename, file_flags, file_mode);
+  vfdp->fd = timed_open_file(filename, file_flags, file_mode);
 
   if (vfdp->fd < 0) {
     free_vfd(file);
@@ -935,6 +1225,7 @@ static File file_name_open_file_aux(FileName filename, int file_flags,
   vfdp->file_flags = file_flags & ~(O_CREAT | O_TRUNC | O_EXCL);
   vfdp->file_mode = file_mode;
   vfdp->seek_pos = 0;
+  vfdp->refcount = 1;
 
   // Have to fsync file on commit. Alternative way - log file creation
   // and fsync log before actual file creation.
@@ -947,6 +1238,110 @@ static File file_name_open_file_aux(FileName filename, int file_flags,
   return file;
 }
 
+// basic_open_file(), counting the call and the time it took in FdStats.
+static int timed_open_file(FileName filename, int file_flags, int file_mode) {
+  struct timespec start;
+  struct timespec end;
+  int fd;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  fd = basic_open_file(filename, file_flags, file_mode);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  FdStats.opens++;
+  FdStats.open_time_us += (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_nsec - start.tv_nsec) / 1000;
+
+  return fd;
+}
+
+// The VfdHash bucket filename goes in.
+static File* vfd_hash_bucket(FileName filename) {
+  return &VfdHash[(unsigned long)string_hash(filename, 0) & (VfdHashSize - 1)];
+}
+
+// Find the shared VFD for filename, if it is open with the same flags
+// and it is all right to share it. Returns 0 if there is none.
+static File vfd_hash_lookup(FileName filename, int file_flags) {
+  File file;
+
+  if (VfdHash == NULL || (file_flags & (O_EXCL | O_TRUNC))) {
+    return 0;
+  }
+
+  for (file = *vfd_hash_bucket(filename); file != 0; file = VfdCache[file].hash_next) {
+    if (strcmp(VfdCache[file].filename, filename) == 0) {
+      return VfdCache[file].file_flags == (file_flags & ~O_CREAT) ? file : 0;
+    }
+  }
+
+  return 0;
+}
+
+// Let later opens of the file share this VFD, unless one for the same
+// file is shared already.
+static void vfd_hash_insert(File file) {
+  File* old_hash;
+  File* bucket;
+  File other;
+  File next;
+  int old_size;
+  int i;
+
+  if (vfd_hash_lookup(VfdCache[file].filename, VfdCache[file].file_flags) != 0) {
+    return;
+  }
+
+  if (VfdHashCount >= VfdHashSize) {
+    old_hash = VfdHash;
+    old_size = VfdHashSize;
+
+    VfdHashSize = old_size == 0 ? VFD_HASH_INIT_SIZE : old_size * 2;
+    VfdHash = (File*)calloc(VfdHashSize, sizeof(File));
+
+    if (VfdHash == NULL) {
+      elog(FATAL, "%s: no room for VFD hash table", __func__);
+    }
+
+    for (i = 0; i < old_size; i++) {
+      for (other = old_hash[i]; other != 0; other = next) {
+        next = VfdCache[other].hash_next;
+        bucket = vfd_hash_bucket(VfdCache[other].filename);
+        VfdCache[other].hash_next = *bucket;
+        *bucket = other;
+      }
+    }
+
+    free(old_hash);
+  }
+
+  bucket = vfd_hash_bucket(VfdCache[file].filename);
+  VfdCache[file].hash_next = *bucket;
+  *bucket = file;
+  VfdCache[file].fdstate |= FD_SHARED;
+  VfdHashCount++;
+}
+
+// Stop sharing a VFD, if it is shared.
+static void vfd_hash_delete(File file) {
+  File* link;
+
+  if (!(VfdCache[file].fdstate & FD_SHARED)) {
+    return;
+  }
+
+  link = vfd_hash_bucket(VfdCache[file].filename);
+
+  while (*link != file) {
+    ASSERT(*link != 0);
+    link = &VfdCache[*link].hash_next;
+  }
+
+  *link = VfdCache[file].hash_next;
+  VfdCache[file].hash_next = 0;
+  VfdCache[file].fdstate &= ~FD_SHARED;
+  VfdHashCount--;
+}
+
 // Convert given pathname to absolute.
 //
 // (Generally, this isn't actually necessary, considering that we
@@ -960,7 +1355,7 @@ static char* filepath(char* filename) {
   // Not an absolute path name? Then fill in with database path...
   if (*filename != SEP_CHAR) {
     len = strlen(DatabasePath) + strlen(filename) + 2;
-    buf = (char*)malloc(len);
+    buf = (char*)palloc(len);
     sprintf(buf, "%s%c%s", DatabasePath, SEP_CHAR, filename);
   } else {
     buf = (char*)palloc(strlen(filename) + 1);
@@ -975,11 +1370,35 @@ static char* filepath(char* filename) {
 }
 
 // Determine number of file descriptors that fd.c is allowed to use.
+//
+// The soft limit of open files is often far below the hard one, and
+// every descriptor short of what the backend could use is paid for with
+// LRU closes and reopens. So the soft limit is raised as far as
+// MaxFilesPerProcess wants and the hard limit allows.
 static long pg_nofile(void) {
   static long MaxFilePerProcess = 0;
 
   if (MaxFilePerProcess == 0) {
-#ifndef HAVE_SYSCONF
+#if defined(RLIMIT_NOFILE)
+    struct rlimit rlim;
+    rlim_t wanted = (rlim_t)MaxFilesPerProcess + RESERVE_FOR_LD;
+
+    if (getrlimit(RLIMIT_NOFILE, &rlim) == -1) {
+      elog(DEBUG, "%s: unable to get RLIMIT_NOFILE: %m; using %d", __func__, NOFILE);
+      MaxFilePerProcess = (long)NOFILE;
+    } else {
+      if (rlim.rlim_cur < wanted && rlim.rlim_cur < rlim.rlim_max) {
+        rlim.rlim_cur = MIN(wanted, rlim.rlim_max);
+
+        if (setrlimit(RLIMIT_NOFILE, &rlim) == -1) {
+          elog(DEBUG, "%s: unable to raise RLIMIT_NOFILE: %m", __func__);
+          getrlimit(RLIMIT_NOFILE, &rlim);
+        }
+      }
+
+      MaxFilePerProcess = (long)MIN(rlim.rlim_cur, wanted);
+    }
+#elif !defined(HAVE_SYSCONF)
     MaxFilePerProcess = (long)NOFILE;
 #else
     MaxFilePerProcess = sysconf(_SC_OPEN_MAX);
@@ -30,7 +30,9 @@
 #include <errno.h>
 #include <signal.h>  // For kill()
 #include <stdlib.h>
+#include <string.h>
 #include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/sem.h>
 #include <sys/shm.h>
 #include <sys/types.h>
@@ -703,23 +705,27 @@ static void ipc_memory_delete(int status, Datum shm_id) {
 }
 
 // Rather than allocating shmem segments with IPC_PRIVATE key, we
-// just malloc() the requested amount of space. This code emulates
-// the needed shmem functions.
+// just map an anonymous region of the requested size. It is shared, so
+// that processes a standalone backend forks (and the tests' workers)
+// still see the same segment.
 static void* private_memory_create(uint32 size) {
   void* mem_addr;
 
-  mem_addr = malloc(size);
+  mem_addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
 
-  if (!mem_addr) {
-    fprintf(stderr, "%s: malloc(%u) failed\n", __func__, size);
+  if (mem_addr == MAP_FAILED) {
+    fprintf(stderr, "%s: mmap(%u) failed: %s\n", __func__, size, strerror(errno));
     proc_exit(1);
   }
 
-  MEMSET(mem_addr, 0, size);
-
   on_shmem_exit(private_memory_delete, POINTER_GET_DATUM(mem_addr));
 
   return mem_addr;
 }
 
-static void private_memory_delete(int status, Datum mem_addr) { free(DATUM_GET_POINTER(mem_addr)); }
\ No newline at end of file
+// The segment header says how big the mapping is.
+static void private_memory_delete(int status, Datum mem_addr) {
+  PGShmemHeader* hdr = (PGShmemHeader*)DATUM_GET_POINTER(mem_addr);
+
+  munmap(hdr, hdr->total_size);
+}
@@ -16,6 +16,11 @@
 
 #include "rdbms/storage/ipc.h"
 
+#include "rdbms/storage/bufmgr.h"
+#include "rdbms/storage/shmem.h"
+#include "rdbms/storage/spin.h"
+#include "rdbms/utils/elog.h"
+
 // Creates and initializes shared memory and semaphores.
 //
 // This is called by the postmaster or by a standalone backend.
@@ -31,4 +36,20 @@ void create_shared_memory_and_semaphores(bool make_private, int max_backends) {
   // Size of the Postgres shared-memory block is estimated via
   // moderately-accurate estimates for the big hogs, plus 100K for the
   // stuff that's too small to bother with estimating.
+  size = buffer_shmem_size() + spin_lock_shmem_size();
+  size += 100000;
+
+  // Create the shmem segment.
+  seg_hdr = ipc_memory_create(size, make_private, IPC_PROTECTION);
+
+  if (!seg_hdr) {
+    elog(FATAL, "%s: couldn't create shared memory segment", __func__);
+  }
+
+  // The spinlocks live at the start of the segment, ahead of everything
+  // shmem_alloc() hands out.
+  create_spin_locks(seg_hdr);
+
+  // Set up shmem.c hashtable.
+  init_shmem_allocation(seg_hdr);
 }
\ No newline at end of file
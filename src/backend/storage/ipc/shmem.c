@@ -75,6 +75,8 @@ unsigned long ShmemBase = 0;  // Start address of shared memory
 SpinLock ShmemLock;           // Lock for shared memory allocation
 SpinLock ShmemIndexLock;      // Lock for shmem index access
 
+VariableCache ShmemVariableCache = NULL;  // Transaction manager's shared state
+
 // set up shared-memory allocation and index table.
 void init_shmem_allocation(PGShmemHeader* seg_hdr) {
   HashCtrl info;
@@ -117,7 +119,7 @@ void init_shmem_allocation(PGShmemHeader* seg_hdr) {
     elog(FATAL, "%s: corrupted shmem index", __func__);
   }
 
-  Assert(ShmemBootstrap && !found);
+  ASSERT(ShmemBootstrap && !found);
 
   result->location = MAKE_OFFSET(ShmemIndex->hctl);
   result->size = SHMEM_INDEX_SIZE;
@@ -234,7 +236,7 @@ bool shmem_pid_lookup(int pid, ShmemOffset* location_ptr) {
   ShmemIndexEnt item;
   bool found;
 
-  ASERT(ShmemIndex);
+  ASSERT(ShmemIndex);
 
   MEMSET(item.key, 0, SHMEM_INDEX_KEY_SIZE);
   sprintf(item.key, "PID %d", pid);
@@ -375,7 +377,7 @@ void* shmem_init_struct(char* name, Size size, bool* found_ptr) {
 
   ASSERT(shmem_is_valid((unsigned long)struct_ptr));
 
-  spin_relase(ShmemIndexLock);
+  spin_release(ShmemIndexLock);
 
   return struct_ptr;
 }
@@ -14,11 +14,9 @@
 
 // POSTGRES has two kinds of locks: semaphores (which put the
 // process to sleep) and spinlocks (which are supposed to be
-// short term locks).  Currently both are implemented as SysV
-// semaphores, but presumably this can change if we move to
-// a machine with a test-and-set (TAS) instruction.  Its probably
-// a good idea to think about (and allocate) short term and long
-// term semaphores separately anyway.
+// short term locks). Spinlocks are test-and-set locks (see s_lock.h)
+// kept in an array at the start of the shared memory segment, and a
+// SpinLock is an index into that array.
 //
 // NOTE:
 //  These routines are not supposed to be widely used in Postgres.
@@ -27,81 +25,55 @@
 
 #include "rdbms/storage/spin.h"
 
+#include "rdbms/storage/buf_internals.h"
+#include "rdbms/storage/s_lock.h"
+#include "rdbms/storage/shmem.h"
 #include "rdbms/utils/elog.h"
 
-// Globals used in this file.
-IpcSemaphoreId SpinLockId;
+static TasLock* SpinLockArray = NULL;
 
-static bool spin_is_locked(SpinLock lock) {
-  int semval;
+// Size of the spinlock array in the shared memory segment.
+Size spin_lock_shmem_size(void) { return MAX_ALIGN(MAX_SPINS * sizeof(TasLock)); }
 
-  semval = ipc_semaphore_get_value(SpinLockId, lock);
+// Carve the spinlock array out of the shared memory segment, right after
+// the segment header. This has to come before init_shmem_allocation(),
+// since shmem_alloc() itself takes ShmemLock.
+void create_spin_locks(PGShmemHeader* seg_hdr) {
+  int i;
 
-  return semval < IPC_SEMAPHORE_DEFAULT_START_VALUE;
-}
+  ASSERT(seg_hdr->free_offset + spin_lock_shmem_size() <= seg_hdr->total_size);
 
-// Create a sysV semaphore array for the spinlocks.
-void create_spin_locks(IPCKey key) {
-  SpinLockId = ipc_semaphore_create(key, MAX_SPINS, IPCProtection, IpcSemaphoreDefaultStartValue, true);
+  SpinLockArray = (TasLock*)(((char*)seg_hdr) + seg_hdr->free_offset);
+  seg_hdr->free_offset += spin_lock_shmem_size();
 
-  if (SpinLockId <= 0) {
-    elog(STOP, "%s: cannot create spin locks", __func__);
+  for (i = 0; i < MAX_SPINS; i++) {
+    INIT_LOCK(&SpinLockArray[i]);
   }
+
+  init_spin_locks();
 }
 
-// We need several spinlocks for bootstrapping:
-// ShmemIndexLock (for the shmem index table) and
-// ShmemLock (for the shmem allocator), BufMgrLock (for buffer
-// pool exclusive access), LockMgrLock (for the lock table), and
-// ProcStructLock (a spin lock for the shared process structure).
-// If there's a Sony WORM drive attached, we also have a spinlock
-// (SJCacheLock) for it.  Same story for the main memory storage mgr.
+// We need several spinlocks for bootstrapping: ShmemIndexLock (for the
+// shmem index table) and ShmemLock (for the shmem allocator), and
+// BufMgrLock (for buffer pool exclusive access). The lock manager's,
+// the proc table's and the transaction manager's locks get their ids
+// here too once those modules are built.
 void init_spin_locks() {
-  extern SpinLock ShmemLock;
-  extern SpinLock ShmemIndexLock;
-  extern SpinLock BufMgrLock;
-  extern SpinLock LockMgrLock;
-  extern SpinLock ProcStructLock;
-  extern SpinLock SInvalLock;
-  extern SpinLock OidGenLockId;
-  extern SpinLock XidGenLockId;
-  extern SpinLock ControlFileLockId;
-
-#ifdef STABLE_MEMORY_STORAGE
-  extern SpinLock MMCacheLock;
-
-#endif
-
-  // These five (or six) spinlocks have fixed location is shmem.
-  ShmemLock = (SpinLock)SHMEM_LOCKID;
-  ShmemIndexLock = (SpinLock)SHMEM_INDEX_LOCKID;
-  BufMgrLock = (SpinLock)BUF_MGR_LOCKID;
-  LockMgrLock = (SpinLock)LOCK_MGR_LOCKID;
-  ProcStructLock = (SpinLock)PROC_STRUCT_LOCKID;
-  SInvalLock = (SpinLock)SINVAL_LOCKID;
-  OidGenLockId = (SpinLock)OID_GEN_LOCKID;
-  XidGenLockId = (SpinLock)XID_GEN_LOCKID;
-  ControlFileLockId = (SpinLock)CNTL_FILE_LOCKID;
-
-#ifdef STABLE_MEMORY_STORAGE
-  MMCacheLock = (SpinLock)MMCACHELOCKID;
-#endif
+  ShmemLock = (SpinLock)SHMEM_LOCK_ID;
+  ShmemIndexLock = (SpinLock)SHMEM_INDEX_LOCK_ID;
+  BufMgrLock = (SpinLock)BUF_MGR_LOCK_ID;
 }
 
-// Try to grab a spinlock.
-// FAILS if the semaphore is corrupted.
+// Grab a spinlock, spinning (and eventually sleeping) until we get it.
 void spin_acquire(SpinLock lock) {
-  ipc_semaphore_lock(SpinLockId, lock, IPC_EXCLUSIVE_LOCK);
+  ASSERT(SpinLockArray != NULL && lock >= 0 && lock < MAX_SPINS);
 
-  // TODO(gc): fix this.
-  // PROC_INCR_SLOCK(lock);
+  LOCK_ACQUIRE(&SpinLockArray[lock]);
 }
 
 // Release a spin lock.
 void spin_release(SpinLock lock) {
-  assert(spin_is_locked(lock));
+  ASSERT(!LOCK_IS_FREE(&SpinLockArray[lock]));
 
-  // TODO(gc): fix this.
-  // PROC_DECR_SLOCK(lock);
-  ipc_semaphore_unlock(SpinLockId, lock, IPC_EXCLUSIVE_LOCK);
-}
\ No newline at end of file
+  LOCK_RELEASE(&SpinLockArray[lock]);
+}
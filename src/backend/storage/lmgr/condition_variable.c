@@ -0,0 +1,108 @@
+//===----------------------------------------------------------------------===//
+//
+// condition_variable.c
+//  Condition variables for processes sharing memory.
+//
+//  A waiter registers itself and notes the broadcast sequence number,
+//  checks its condition, and if it still has to wait, sleeps on the
+//  sequence number with a futex:
+//
+//    seq = condition_variable_prepare_to_sleep(cv);
+//    if (condition holds) {
+//      condition_variable_cancel_sleep(cv);
+//    } else {
+//      condition_variable_sleep(cv, seq);
+//    }
+//
+//  and checks again after waking. Whoever makes the condition true
+//  changes the shared state first and then broadcasts, which bumps the
+//  sequence number and wakes every sleeper. A broadcast that comes after
+//  the waiter noted the sequence number makes the futex wait return at
+//  once, so a wakeup can't be lost between the check and the sleep. The
+//  system call is skipped when nobody is registered, so broadcasting on
+//  a variable nobody waits on is two atomic operations.
+//
+//  The futexes are shared between processes (no FUTEX_PRIVATE_FLAG), as
+//  the variables live in shared memory mapped at different addresses. On
+//  systems without futexes waiters poll instead.
+//
+// Portions Copyright (c) 1996-2001, PostgreSQL Global Development Group
+// Portions Copyright (c) 1994, Regents of the University of California
+//
+//===----------------------------------------------------------------------===//
+
+#include "rdbms/storage/condition_variable.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "rdbms/postgres.h"
+#include "rdbms/utils/elog.h"
+
+// Microseconds to sleep between checks without futexes.
+#define CV_POLL_DELAY 1000
+
+void condition_variable_init(ConditionVariable* cv) {
+  atomic_init_u32(&cv->seq, 0);
+  atomic_init_u32(&cv->nwaiters, 0);
+}
+
+// Register as a waiter and return the sequence number to pass to
+// condition_variable_sleep(). The caller must then check its condition
+// and either sleep or cancel.
+uint32 condition_variable_prepare_to_sleep(ConditionVariable* cv) {
+  // The increment is a full barrier: the caller's check of its condition
+  // can't be moved before it, and a broadcaster that misses us in
+  // nwaiters has already bumped seq.
+  atomic_fetch_add_u32(&cv->nwaiters, 1);
+  return atomic_read_acquire_u32(&cv->seq);
+}
+
+// Sleep until a broadcast after the one that set seq, then deregister.
+// May return early; callers must recheck their condition.
+void condition_variable_sleep(ConditionVariable* cv, uint32 seq) {
+#ifdef __linux__
+  if (syscall(SYS_futex, &cv->seq.value, FUTEX_WAIT, seq, NULL, NULL, 0) < 0 && errno != EAGAIN && errno != EINTR) {
+    elog(FATAL, "%s: futex wait failed: %s", __func__, strerror(errno));
+  }
+#else
+  struct timeval delay;
+
+  while (atomic_read_acquire_u32(&cv->seq) == seq) {
+    delay.tv_sec = 0;
+    delay.tv_usec = CV_POLL_DELAY;
+    (void)select(0, NULL, NULL, NULL, &delay);
+  }
+#endif
+
+  atomic_fetch_sub_u32(&cv->nwaiters, 1);
+}
+
+// Deregister without sleeping, the condition having become true.
+void condition_variable_cancel_sleep(ConditionVariable* cv) { atomic_fetch_sub_u32(&cv->nwaiters, 1); }
+
+// Wake everybody sleeping on cv. The caller must already have made the
+// change the waiters are waiting for visible.
+void condition_variable_broadcast(ConditionVariable* cv) {
+  atomic_fetch_add_u32(&cv->seq, 1);
+
+  // An atomic read-modify-write rather than a plain read, so that a
+  // waiter registering after it is ordered after it and sees the new seq.
+  if (atomic_fetch_add_u32(&cv->nwaiters, 0) == 0) {
+    return;
+  }
+
+#ifdef __linux__
+  if (syscall(SYS_futex, &cv->seq.value, FUTEX_WAKE, INT_MAX, NULL, NULL, 0) < 0) {
+    elog(FATAL, "%s: futex wake failed: %s", __func__, strerror(errno));
+  }
+#endif
+}
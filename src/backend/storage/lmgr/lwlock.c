@@ -0,0 +1,285 @@
+//===----------------------------------------------------------------------===//
+//
+// lwlock.c
+//  Lightweight reader/writer locks.
+//
+//  An LWLock is a single state word plus a queue of waiting processes.
+//  The state word counts the shared holders, has a bit for an exclusive
+//  holder, and two flags: one saying that the queue is not empty, and
+//  one that locks the queue. Taking or dropping the lock when nobody
+//  waits is a single compare-and-swap or atomic subtraction, so readers
+//  never block each other, however many of them there are.
+//
+//  A process that can't get the lock puts its Proc on the queue and
+//  sleeps on its semaphore. Releasing the last hold on a lock with
+//  waiters wakes the first exclusive waiter, or all the shared waiters
+//  at the head of the queue. Woken processes compete for the lock again
+//  and go back to sleep if somebody beat them to it.
+//
+//  Processes without a semaphore (a standalone backend) poll instead of
+//  sleeping, as do processes without a Proc at all.
+//
+// Portions Copyright (c) 1996-2001, PostgreSQL Global Development Group
+// Portions Copyright (c) 1994, Regents of the University of California
+//
+//===----------------------------------------------------------------------===//
+
+#include "rdbms/storage/lwlock.h"
+
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "rdbms/postgres.h"
+#include "rdbms/storage/ipc.h"
+#include "rdbms/storage/proc.h"
+#include "rdbms/storage/s_lock.h"
+
+// State word layout.
+#define LW_VAL_SHARED       1
+#define LW_VAL_EXCLUSIVE    (1U << 24)
+#define LW_LOCK_MASK        ((1U << 25) - 1)  // Shared count and exclusive bit
+#define LW_FLAG_LOCKED      (1U << 29)        // Wait queue is being changed
+#define LW_FLAG_HAS_WAITERS (1U << 30)
+
+// Microseconds to sleep between checks when we can't use a semaphore.
+#define LW_POLL_DELAY 1000
+
+static bool lwlock_attempt_lock(LWLock* lock, LWLockMode mode);
+static void lwlock_wait_list_lock(LWLock* lock);
+static void lwlock_wait_list_unlock(LWLock* lock, uint32 clear_flags);
+static void lwlock_queue_self(LWLock* lock, LWLockMode mode);
+static void lwlock_dequeue_self(LWLock* lock);
+static void lwlock_sleep(void);
+static void lwlock_wake_up(LWLock* lock);
+static void lwlock_poll_delay(void);
+
+void lwlock_init(LWLock* lock) {
+  atomic_init_u32(&lock->state, 0);
+  lock->head = INVALID_OFFSET;
+  lock->tail = INVALID_OFFSET;
+}
+
+// Acquire the lock in the given mode, sleeping as long as necessary.
+void lwlock_acquire(LWLock* lock, LWLockMode mode) {
+  for (;;) {
+    if (lwlock_attempt_lock(lock, mode)) {
+      return;
+    }
+
+    if (MyProc == NULL) {
+      lwlock_poll_delay();
+      continue;
+    }
+
+    lwlock_queue_self(lock, mode);
+
+    // The lock may have been released between our first attempt and
+    // getting on the queue, and then nobody is going to wake us. So try
+    // once more now that any later release will see us waiting.
+    if (lwlock_attempt_lock(lock, mode)) {
+      lwlock_dequeue_self(lock);
+      return;
+    }
+
+    lwlock_sleep();
+  }
+}
+
+// Take the lock in the given mode if that can be done without waiting.
+// Returns true if we got it.
+bool lwlock_conditional_acquire(LWLock* lock, LWLockMode mode) { return lwlock_attempt_lock(lock, mode); }
+
+// Release a lock held in either mode.
+void lwlock_release(LWLock* lock) {
+  uint32 old_state;
+  uint32 sub;
+
+  // Nobody else can set or clear the exclusive bit while we hold the
+  // lock, so it tells us which mode we hold it in.
+  old_state = atomic_read_u32(&lock->state);
+  sub = (old_state & LW_VAL_EXCLUSIVE) ? LW_VAL_EXCLUSIVE : LW_VAL_SHARED;
+
+  ASSERT((old_state & LW_LOCK_MASK) != 0);
+
+  old_state = atomic_fetch_sub_u32(&lock->state, sub);
+
+  if ((old_state & LW_FLAG_HAS_WAITERS) && ((old_state - sub) & LW_LOCK_MASK) == 0) {
+    lwlock_wake_up(lock);
+  }
+}
+
+// Take the lock if it is free for mode. Doesn't wait.
+static bool lwlock_attempt_lock(LWLock* lock, LWLockMode mode) {
+  uint32 old_state = atomic_read_u32(&lock->state);
+  uint32 new_state;
+
+  for (;;) {
+    if (mode == LW_EXCLUSIVE) {
+      if (old_state & LW_LOCK_MASK) {
+        return false;
+      }
+      new_state = old_state + LW_VAL_EXCLUSIVE;
+    } else {
+      if (old_state & LW_VAL_EXCLUSIVE) {
+        return false;
+      }
+      new_state = old_state + LW_VAL_SHARED;
+    }
+
+    if (atomic_compare_exchange_u32(&lock->state, &old_state, new_state)) {
+      return true;
+    }
+  }
+}
+
+static void lwlock_wait_list_lock(LWLock* lock) {
+  unsigned spins = 0;
+
+  while (atomic_fetch_or_u32(&lock->state, LW_FLAG_LOCKED) & LW_FLAG_LOCKED) {
+    s_lock_delay(spins++, &lock->state, __FILE__, __LINE__);
+  }
+}
+
+static void lwlock_wait_list_unlock(LWLock* lock, uint32 clear_flags) {
+  atomic_fetch_and_u32(&lock->state, ~(LW_FLAG_LOCKED | clear_flags));
+}
+
+// Append MyProc to the lock's queue.
+static void lwlock_queue_self(LWLock* lock, LWLockMode mode) {
+  ShmemOffset my_offset = MAKE_OFFSET(MyProc);
+
+  ASSERT(!atomic_read_u32(&MyProc->lw_waiting));
+
+  atomic_write_u32(&MyProc->lw_waiting, true);
+  MyProc->lw_wait_mode = mode;
+  MyProc->lw_wait_link = INVALID_OFFSET;
+
+  lwlock_wait_list_lock(lock);
+
+  if (lock->tail == INVALID_OFFSET) {
+    lock->head = my_offset;
+  } else {
+    ((Proc*)MAKE_PTR(lock->tail))->lw_wait_link = my_offset;
+  }
+  lock->tail = my_offset;
+
+  atomic_fetch_or_u32(&lock->state, LW_FLAG_HAS_WAITERS);
+
+  lwlock_wait_list_unlock(lock, 0);
+}
+
+// Take MyProc off the lock's queue after all, having got the lock.
+//
+// If a releaser has already taken us off, it is going to post our
+// semaphore, and we must absorb that wakeup now or the next sleep would
+// return early.
+static void lwlock_dequeue_self(LWLock* lock) {
+  ShmemOffset my_offset = MAKE_OFFSET(MyProc);
+  ShmemOffset prev = INVALID_OFFSET;
+  ShmemOffset cur;
+  bool found = false;
+
+  lwlock_wait_list_lock(lock);
+
+  for (cur = lock->head; cur != INVALID_OFFSET; prev = cur, cur = ((Proc*)MAKE_PTR(cur))->lw_wait_link) {
+    if (cur == my_offset) {
+      found = true;
+      break;
+    }
+  }
+
+  if (found) {
+    if (prev == INVALID_OFFSET) {
+      lock->head = MyProc->lw_wait_link;
+    } else {
+      ((Proc*)MAKE_PTR(prev))->lw_wait_link = MyProc->lw_wait_link;
+    }
+
+    if (lock->tail == my_offset) {
+      lock->tail = prev;
+    }
+
+    atomic_write_u32(&MyProc->lw_waiting, false);
+  }
+
+  lwlock_wait_list_unlock(lock, lock->head == INVALID_OFFSET ? LW_FLAG_HAS_WAITERS : 0);
+
+  if (!found) {
+    lwlock_sleep();
+  }
+}
+
+// Sleep until somebody takes us off a wait queue.
+//
+// Every process taken off a queue gets exactly one semaphore post, and
+// posts are not used for anything else, so one semaphore lock per wakeup
+// keeps the count balanced.
+static void lwlock_sleep(void) {
+  if (MyProc->sem.sem_id < 0) {
+    while (atomic_read_acquire_u32(&MyProc->lw_waiting)) {
+      lwlock_poll_delay();
+    }
+    return;
+  }
+
+  do {
+    ipc_semaphore_lock(MyProc->sem.sem_id, MyProc->sem.sem_num, false);
+  } while (atomic_read_acquire_u32(&MyProc->lw_waiting));
+}
+
+// Wake the first exclusive waiter, or all shared waiters at the head of
+// the queue.
+static void lwlock_wake_up(LWLock* lock) {
+  ShmemOffset wake_head;
+  ShmemOffset cur;
+  ShmemOffset last = INVALID_OFFSET;
+  Proc* proc;
+
+  lwlock_wait_list_lock(lock);
+
+  wake_head = lock->head;
+
+  for (cur = lock->head; cur != INVALID_OFFSET; cur = proc->lw_wait_link) {
+    proc = (Proc*)MAKE_PTR(cur);
+
+    if (last != INVALID_OFFSET && (proc->lw_wait_mode == LW_EXCLUSIVE ||
+                                   ((Proc*)MAKE_PTR(last))->lw_wait_mode == LW_EXCLUSIVE)) {
+      break;
+    }
+
+    last = cur;
+  }
+
+  // Detach the ones to wake.
+  lock->head = cur;
+  if (cur == INVALID_OFFSET) {
+    lock->tail = INVALID_OFFSET;
+  }
+  if (last != INVALID_OFFSET) {
+    ((Proc*)MAKE_PTR(last))->lw_wait_link = INVALID_OFFSET;
+  }
+
+  lwlock_wait_list_unlock(lock, lock->head == INVALID_OFFSET ? LW_FLAG_HAS_WAITERS : 0);
+
+  // Once lw_waiting is clear the process may queue up again and reuse
+  // its link, so read the link first.
+  for (cur = wake_head; cur != INVALID_OFFSET;) {
+    proc = (Proc*)MAKE_PTR(cur);
+    cur = proc->lw_wait_link;
+
+    proc->lw_wait_link = INVALID_OFFSET;
+    atomic_unlocked_write_u32(&proc->lw_waiting, false);
+
+    if (proc->sem.sem_id >= 0) {
+      ipc_semaphore_unlock(proc->sem.sem_id, proc->sem.sem_num);
+    }
+  }
+}
+
+static void lwlock_poll_delay(void) {
+  struct timeval delay;
+
+  delay.tv_sec = 0;
+  delay.tv_usec = LW_POLL_DELAY;
+  (void)select(0, NULL, NULL, NULL, &delay);
+}
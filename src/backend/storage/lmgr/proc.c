@@ -68,7 +68,6 @@ int DeadlockTimeout = 1000;
 // hack to get around reading and updating this structure in shared
 // memory. -mer 17 July 1991
 SpinLock ProcStructLock;
-Proc* MyProc = NULL;
 
 static ProcHeader* ProcGlobal = NULL;
 static bool WaitingForLock = false;
@@ -199,6 +198,8 @@ void init_process() {
   MyProc->wait_lock = NULL;
   MyProc->wait_holder = NULL;
   shm_queue_init(&MyProc->proc_holders);
+  atomic_init_u32(&MyProc->lw_waiting, false);
+  MyProc->lw_wait_link = INVALID_OFFSET;
 
   // Release the lock.
   spin_release(ProcStructLock);
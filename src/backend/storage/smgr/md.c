@@ -13,23 +13,50 @@
 //  v 1.83 2001/04/02 23:20:24 tgl Exp $
 //
 //===----------------------------------------------------------------------===//
+#define _GNU_SOURCE  // For O_DIRECT
+
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/file.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "rdbms/catalog/catalog.h"
 #include "rdbms/miscadmin.h"
 #include "rdbms/postgres.h"
+#include "rdbms/postmaster/bgwriter.h"
+#include "rdbms/storage/aio.h"
 #include "rdbms/storage/smgr.h"
 #include "rdbms/utils/elog.h"
+#include "rdbms/utils/hashfn.h"
+#include "rdbms/utils/hsearch.h"
 #include "rdbms/utils/memutils.h"
 #include "rdbms/utils/rel.h"
 
 #undef DIAGNOSTIC
 
 // These are the assigned bits in mdfd_flags:.
-#define MD_FD_FREE (1 << 0)  // Unused entry.
+#define MD_FD_FREE        (1 << 0)  // Unused entry.
+#define MD_FD_SYNC_QUEUED (1 << 1)  // fsync requested in md_fd_sync_cycle
+
+// The segment a block is in.
+#ifndef LET_OS_MANAGE_FILESIZE
+#define MD_SEG_NO(block_num) ((BlockNumber)(block_num) / RELSEG_SIZE)
+#else
+#define MD_SEG_NO(block_num) 0
+#endif
+
+// Most blocks md_readv() and friends move in one system call.
+#define MD_MAX_IOV 64
+
+// With direct I/O (EnableDirectIo) relation files are opened O_DIRECT,
+// so that pages are cached once, in the shared buffers, rather than in
+// the kernel's page cache as well. The kernel then only accepts buffers
+// aligned to IO_ALIGN_SIZE. Shared buffers are; local buffers and
+// scratch pages need not be, and go through an aligned bounce page.
+#define MD_NEEDS_BOUNCE(buffer) (EnableDirectIo && ((long)(buffer) & (IO_ALIGN_SIZE - 1)) != 0)
+
+_Static_assert(BLCKSZ % IO_ALIGN_SIZE == 0, "BLCKSZ must be a multiple of IO_ALIGN_SIZE");
 
 // The magnetic disk storage manager keeps track of open file descriptors
 // in its own descriptor pool. This happens for two reasons. First, at
@@ -53,6 +80,7 @@ typedef struct MdfdVec {
   int md_fd_flags;      // fd status flags
   int md_fd_lst_bcnt;   // Most recent block count
   int md_fd_next_free;  // Next free vector
+  uint32 md_fd_sync_cycle;  // fsync_request_cycle() of the last request
 
 #ifndef LET_OS_MANAGE_FILESIZE
   struct MdfdVec* md_fd_chain;  // For large relations
@@ -65,14 +93,48 @@ static int MdFree = -1;      // Head of freelist of unused fdvec entries
 static int CurFd = 0;        // First never-used fdvec index
 static MemoryContext MdCxt;  // Context for all my allocations
 
+// Segments written to and not yet fsync'd. The background writer
+// fsyncs each written segment once per checkpoint (see md_sync()), and
+// this table holds what it has been asked to. A backend keeps the
+// segments it wrote here too, and fsyncs them at commit: there is no log
+// to replay what a commit left in the kernel's cache after a crash.
+//
+// With defer_commit_fsync on, a backend leaves its segments to the
+// background writer, and a commit returns without any fsync. Committed
+// changes can then be lost in a crash until the next checkpoint, so this
+// is only for those who prefer speed to durability. A backend running
+// without a background writer always fsyncs at commit.
+bool DeferCommitFsync = false;
+
+typedef struct PendingFsyncTag {
+  RelFileNode rnode;
+  BlockNumber seg_no;
+} PendingFsyncTag;
+
+typedef struct PendingFsync {
+  PendingFsyncTag tag;
+} PendingFsync;
+
+#define PENDING_FSYNC_HASH_SIZE 256
+
+static HashTable* PendingFsyncHash = NULL;
+
 static void md_close_fd(int fd);
 static int md_fd_get_reln_fd(Relation relation);
 static MdfdVec* md_fd_open_seg(Relation relation, int seg_no, int oflags);
 static MdfdVec* md_fd_get_seg(Relation relation, int blk_no);
+static MdfdVec* md_fd_find_seg(Relation relation, int blk_no);
 static int md_fd_blind_get_seg(RelFileNode rnode, int blk_no);
 static int fdvec_alloc();
-static int fdvec_free(int);
+static void fdvec_free(int);
 static BlockNumber md_nblocks_aux(File file, Size blck_sz);
+static int md_count_blocks(Relation relation);
+static File md_open_file(char* path, int oflags);
+static char* md_bounce_page(void);
+static char* md_write_buffer(char* buffer);
+static bool md_buffers_aligned(char** buffers, int nblocks);
+static void md_register_dirty_segment(RelFileNode rnode, BlockNumber seg_no, MdfdVec* v);
+static int md_sync_pending(void);
 
 // Initialize private state for magnetic disk storage manager.
 //
@@ -112,7 +174,7 @@ int md_create(Relation relation) {
   ASSERT(relation->rd_fd < 0);
 
   path = relpath(relation->rd_node);
-  fd = file_name_open_file(path, O_RDWR | O_CREAT | O_EXCL | PG_BINARY, 0600);
+  fd = md_open_file(path, O_RDWR | O_CREAT | O_EXCL | PG_BINARY);
 
   if (fd < 0) {
     int save_errno = errno;
@@ -123,7 +185,7 @@ int md_create(Relation relation) {
     // file to exist already, but in bootstrap mode only. (See also
     // mdopen)
     if (IS_BOOTSTRAP_PROCESSING_MODE()) {
-      fd = file_name_open_file(path, O_RDWR | PG_BINARY, 0600);
+      fd = md_open_file(path, O_RDWR | PG_BINARY);
     }
 
     if (fd < 0) {
@@ -143,14 +205,21 @@ int md_create(Relation relation) {
     return -1;
   }
 
+  // A relation that had this file node before may still be cached.
+  relsize_cache_forget(relation->rd_node);
+
   Md_fdvec[vfd].md_fd_vfd = fd;
   Md_fdvec[vfd].md_fd_flags = 0;
   Md_fdvec[vfd].md_fd_lst_bcnt = 0;
+  Md_fdvec[vfd].md_fd_sync_cycle = 0;
 
 #ifndef LET_OS_MANAGE_FILESIZE
   Md_fdvec[vfd].md_fd_chain = NULL;
 #endif
 
+  // The new file has to be on disk by the next checkpoint too.
+  md_register_dirty_segment(relation->rd_node, 0, &Md_fdvec[vfd]);
+
   return vfd;
 }
 
@@ -162,6 +231,8 @@ int md_unlink(RelFileNode rnode) {
 
   path = relpath(rnode);
 
+  relsize_cache_forget(rnode);
+
   // Delete the first segment, or only segment if not doing segmenting.
   if (unlink(path) < 0) {
     status = SM_FAIL;
@@ -211,26 +282,21 @@ int md_extend(Relation relation, char* buffer) {
   nblocks = md_nblocks(relation);
   v = md_fd_get_seg(relation, nblocks);
 
-  if ((pos = file_seek(v->md_fd_vfd, 0L, SEEK_END)) < 0) {
-    return SM_FAIL;
-  }
-
-  // The last block is incomplete.
-  if (pos % BLCKSZ != 0) {
-    pos -= pos % BLCKSZ;
-
-    if (file_seek(v->md_fd_vfd, pos, SEEK_SET) < 0) {
-      return SM_FAIL;
-    }
-  }
+  // md_nblocks() rounds the size of the file down, so an incomplete
+  // last block gets overwritten.
+#ifndef LET_OS_MANAGE_FILESIZE
+  pos = (long)(BLCKSZ * (nblocks % RELSEG_SIZE));
+#else
+  pos = (long)(BLCKSZ * (nblocks));
+#endif
 
   // TODO(gc): 这里为什么没有考虑缓冲区溢出？
-  if ((nbytes = file_write(v->md_fd_vfd, buffer, BLCKSZ)) != BLCKSZ) {
+  if ((nbytes = file_pwrite(v->md_fd_vfd, md_write_buffer(buffer), BLCKSZ, pos)) != BLCKSZ) {
     if (nbytes > 0) {
       file_truncate(v->md_fd_vfd, pos);
-      file_seek(v->md_fd_vfd, pos, SEEK_SET);
     }
 
+    relsize_cache_forget(relation->rd_node);
     return SM_FAIL;
   }
 
@@ -256,6 +322,55 @@ int md_extend(Relation relation, char* buffer) {
 
 #endif
 
+  md_register_dirty_segment(relation->rd_node, MD_SEG_NO(nblocks - 1), v);
+  relsize_cache_extend(relation->rd_node, nblocks);
+
+  return SM_SUCCESS;
+}
+
+// Add nblocks zeroed blocks to the end of the relation at once.
+//
+// Instead of writing the blocks one by one like md_extend(), reserve
+// their space with one file_allocate() per segment touched, which lets
+// the file system lay the new extent out in one piece.
+//
+// Returns SM_SUCCESS or SM_FAIL, with errno set as appropriate.
+int md_extend_by(Relation relation, int nblocks) {
+  BlockNumber block_num;
+  long seek_pos;
+  int count;
+  MdfdVec* v;
+
+  block_num = md_nblocks(relation);
+
+  while (nblocks > 0) {
+    v = md_fd_get_seg(relation, block_num);
+
+#ifndef LET_OS_MANAGE_FILESIZE
+    seek_pos = (long)(BLCKSZ * (block_num % RELSEG_SIZE));
+    count = MIN(nblocks, RELSEG_SIZE - block_num % RELSEG_SIZE);
+#else
+    seek_pos = (long)(BLCKSZ * (block_num));
+    count = nblocks;
+#endif
+
+    if (file_allocate(v->md_fd_vfd, seek_pos, (long)count * BLCKSZ) < 0) {
+      // Some of it may have been allocated, or written.
+      relsize_cache_forget(relation->rd_node);
+      return SM_FAIL;
+    }
+
+    // Keep the last block count current, as md_extend() does.
+    v->md_fd_lst_bcnt = seek_pos / BLCKSZ + count;
+    md_register_dirty_segment(relation->rd_node, MD_SEG_NO(block_num), v);
+
+    block_num += count;
+    nblocks -= count;
+
+    // The new blocks are nobody's yet.
+    relsize_cache_grow(relation->rd_node, block_num);
+  }
+
   return SM_SUCCESS;
 }
 
@@ -268,13 +383,13 @@ int md_open(Relation relation) {
   ASSERT(relation->rd_fd < 0);
 
   // 找到这张表路径
-  path = rel_path(relation->rd_node);
-  fd = file_name_open_file(path, O_RDWR, 0600);
+  path = relpath(relation->rd_node);
+  fd = md_open_file(path, O_RDWR);
 
   if (fd < 0) {
     // In bootstrap mode, accept mdopen as substitute for mdcreate.
     if (IS_BOOTSTRAP_PROCESSING_MODE()) {
-      fd = file_name_open_file(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+      fd = md_open_file(path, O_RDWR | O_CREAT | O_EXCL);
     }
 
     if (fd < 0) {
@@ -295,6 +410,7 @@ int md_open(Relation relation) {
   Md_fdvec[vfd].md_fd_vfd = fd;
   Md_fdvec[vfd].md_fd_flags = 0;
   Md_fdvec[vfd].md_fd_lst_bcnt = md_nblocks_aux(fd, BLCKSZ);
+  Md_fdvec[vfd].md_fd_sync_cycle = 0;
 
 #ifndef LET_OS_MANAGE_FILESIZE
 
@@ -339,6 +455,7 @@ int md_read(Relation relation, BlockNumber block_num, char* buffer) {
   int status;
   long seek_pos;
   int nbytes;
+  char* io_buffer;
   MdfdVec* v;
 
   v = md_fd_get_seg(relation, block_num);
@@ -357,13 +474,16 @@ int md_read(Relation relation, BlockNumber block_num, char* buffer) {
   seekpos = (long)(BLCKSZ * (blocknum));
 #endif
 
-  if (file_seek(v->md_fd_vfd, seek_pos, SEEK_SET) != seek_pos) {
-    return SM_FAIL;
-  }
-
   status = SM_SUCCESS;
 
-  if ((nbytes = file_read(v->md_fd_vfd, buffer, BLCKSZ)) != BLCKSZ) {
+  io_buffer = MD_NEEDS_BOUNCE(buffer) ? md_bounce_page() : buffer;
+  nbytes = file_pread(v->md_fd_vfd, io_buffer, BLCKSZ, seek_pos);
+
+  if (io_buffer != buffer && nbytes > 0) {
+    memcpy(buffer, io_buffer, nbytes);
+  }
+
+  if (nbytes != BLCKSZ) {
     if (nbytes == 0) {
       MEMSET(buffer, 0, BLCKSZ);
     } else if (block_num == 0 && nbytes > 0 && md_nblocks(relation) == 0) {
@@ -377,6 +497,136 @@ int md_read(Relation relation, BlockNumber block_num, char* buffer) {
   return status;
 }
 
+// Read nblocks consecutive blocks, starting at block_num, into the
+// supplied buffers.
+//
+// The run is split where it crosses a segment boundary, and each piece
+// is read with a single file_readv(). As in md_read(), blocks past the
+// end of the file read as zeroes. Returns SM_SUCCESS or SM_FAIL.
+int md_readv(Relation relation, BlockNumber block_num, char** buffers, int nblocks) {
+  struct iovec iov[MD_MAX_IOV];
+  long seek_pos;
+  int nbytes;
+  int count;
+  int i;
+  MdfdVec* v;
+
+  if (!md_buffers_aligned(buffers, nblocks)) {
+    for (i = 0; i < nblocks; i++) {
+      if (md_read(relation, block_num + i, buffers[i]) == SM_FAIL) {
+        return SM_FAIL;
+      }
+    }
+
+    return SM_SUCCESS;
+  }
+
+  while (nblocks > 0) {
+    v = md_fd_get_seg(relation, block_num);
+
+#ifndef LET_OS_MANAGE_FILESIZE
+    seek_pos = (long)(BLCKSZ * (block_num % RELSEG_SIZE));
+    count = MIN(nblocks, RELSEG_SIZE - block_num % RELSEG_SIZE);
+#else
+    seek_pos = (long)(BLCKSZ * (block_num));
+    count = nblocks;
+#endif
+    count = MIN(count, MD_MAX_IOV);
+
+    for (i = 0; i < count; i++) {
+      iov[i].iov_base = buffers[i];
+      iov[i].iov_len = BLCKSZ;
+    }
+
+    if ((nbytes = file_readv(v->md_fd_vfd, iov, count, seek_pos)) < 0) {
+      return SM_FAIL;
+    }
+
+    // A short read stops at the end of the file, which must fall on a
+    // block boundary (but see md_read() about block 0).
+    if (nbytes % BLCKSZ != 0 && !(block_num == 0 && nbytes < BLCKSZ && md_nblocks(relation) == 0)) {
+      return SM_FAIL;
+    }
+
+    for (i = nbytes / BLCKSZ; i < count; i++) {
+      MEMSET(buffers[i], 0, BLCKSZ);
+    }
+
+    block_num += count;
+    buffers += count;
+    nblocks -= count;
+  }
+
+  return SM_SUCCESS;
+}
+
+// Initiate asynchronous read of the specified block of a relation.
+//
+// Unlike md_read(), this never creates a segment: a block beyond the
+// end of the relation is simply not prefetched. Returns SM_SUCCESS, or
+// SM_FAIL if the kernel rejected the hint.
+int md_prefetch(Relation relation, BlockNumber block_num) {
+  long seek_pos;
+  MdfdVec* v;
+
+  // Reading ahead into the page cache is no use to us with direct I/O.
+  if (EnableDirectIo) {
+    return SM_SUCCESS;
+  }
+
+  v = md_fd_find_seg(relation, block_num);
+  if (v == NULL) {
+    return SM_SUCCESS;  // Past the end, nothing to prefetch.
+  }
+
+#ifndef LET_OS_MANAGE_FILESIZE
+  seek_pos = (long)(BLCKSZ * (block_num % RELSEG_SIZE));
+#else
+  seek_pos = (long)(BLCKSZ * (block_num));
+#endif
+
+  if (file_prefetch(v->md_fd_vfd, seek_pos, BLCKSZ) < 0) {
+    return SM_FAIL;
+  }
+
+  return SM_SUCCESS;
+}
+
+// Start reading the specified block into buffer through aio.c, without
+// waiting for it. The caller reaps the result, tagged with id, with
+// aio_reap(): BLCKSZ bytes, or 0 past the end of the file, where md_read()
+// would have zeroed the page.
+//
+// Like md_prefetch(), this never creates a segment. Returns SM_FAIL,
+// without complaint, if the read could not be started (no io_uring, too
+// many reads in flight, or no such segment), in which case the caller
+// reads the block synchronously.
+int md_start_read(Relation relation, BlockNumber block_num, char* buffer, uint64 id) {
+  long seek_pos;
+  MdfdVec* v;
+
+  if (MD_NEEDS_BOUNCE(buffer)) {
+    return SM_FAIL;
+  }
+
+  v = md_fd_find_seg(relation, block_num);
+  if (v == NULL) {
+    return SM_FAIL;
+  }
+
+#ifndef LET_OS_MANAGE_FILESIZE
+  seek_pos = (long)(BLCKSZ * (block_num % RELSEG_SIZE));
+#else
+  seek_pos = (long)(BLCKSZ * (block_num));
+#endif
+
+  if (file_aio_read(v->md_fd_vfd, buffer, BLCKSZ, seek_pos, id) < 0) {
+    return SM_FAIL;
+  }
+
+  return SM_SUCCESS;
+}
+
 // Write the supplied block at the appropriate location.
 // Returns SM_SUCCESS or SM_FAIL.
 int md_write(Relation relation, BlockNumber block_num, char* buffer) {
@@ -386,7 +636,7 @@ int md_write(Relation relation, BlockNumber block_num, char* buffer) {
 
   v = md_fd_get_seg(relation, block_num);
 
-#ifndef LET_OS_MANAGE_FILESIZE、
+#ifndef LET_OS_MANAGE_FILESIZE
   seek_pos = (long)(BLCKSZ * (block_num % RELSEG_SIZE));
 
 #ifdef DIAGNOSTIC
@@ -399,19 +649,70 @@ int md_write(Relation relation, BlockNumber block_num, char* buffer) {
   seek_pos = (long)(BLCKSZ * (block_num));
 #endif
 
-  if (file_seek(v->md_fd_vfd, seek_pos, SEEK_SET) != seek_pos) {
-    return SM_FAIL;
-  }
-
   status = SM_SUCCESS;
 
-  if (file_write(v->md_fd_vfd, buffer, BLCKSZ) != BLCKSZ) {
+  if (file_pwrite(v->md_fd_vfd, md_write_buffer(buffer), BLCKSZ, seek_pos) != BLCKSZ) {
     status = SM_FAIL;
+  } else {
+    md_register_dirty_segment(relation->rd_node, MD_SEG_NO(block_num), v);
+    relsize_cache_note_write(relation->rd_node, block_num + 1);
   }
 
   return status;
 }
 
+// Write nblocks consecutive blocks, starting at block_num, from the
+// supplied buffers, with one file_writev() per segment touched.
+// Returns SM_SUCCESS or SM_FAIL.
+int md_writev(Relation relation, BlockNumber block_num, char** buffers, int nblocks) {
+  struct iovec iov[MD_MAX_IOV];
+  long seek_pos;
+  int count;
+  int i;
+  MdfdVec* v;
+
+  if (!md_buffers_aligned(buffers, nblocks)) {
+    for (i = 0; i < nblocks; i++) {
+      if (md_write(relation, block_num + i, buffers[i]) == SM_FAIL) {
+        return SM_FAIL;
+      }
+    }
+
+    return SM_SUCCESS;
+  }
+
+  while (nblocks > 0) {
+    v = md_fd_get_seg(relation, block_num);
+
+#ifndef LET_OS_MANAGE_FILESIZE
+    seek_pos = (long)(BLCKSZ * (block_num % RELSEG_SIZE));
+    count = MIN(nblocks, RELSEG_SIZE - block_num % RELSEG_SIZE);
+#else
+    seek_pos = (long)(BLCKSZ * (block_num));
+    count = nblocks;
+#endif
+    count = MIN(count, MD_MAX_IOV);
+
+    for (i = 0; i < count; i++) {
+      iov[i].iov_base = buffers[i];
+      iov[i].iov_len = BLCKSZ;
+    }
+
+    if (file_writev(v->md_fd_vfd, iov, count, seek_pos) != count * BLCKSZ) {
+      return SM_FAIL;
+    }
+
+    md_register_dirty_segment(relation->rd_node, MD_SEG_NO(block_num), v);
+    relsize_cache_note_write(relation->rd_node, block_num + count);
+
+    block_num += count;
+    buffers += count;
+    nblocks -= count;
+  }
+
+  return SM_SUCCESS;
+}
+
 // Synchronously write a block to disk.
 //
 // This is exactly like mdwrite(), but doesn't return until the file
@@ -436,16 +737,14 @@ int md_flush(Relation relation, BlockNumber block_num, char* buffer) {
   seek_pos = (long)(BLCKSZ * (blocknum));
 #endif
 
-  if (file_seek(v->md_fd_vfd, seek_pos, SEEK_SET) != seek_pos) {
-    return SM_FAIL;
-  }
-
   // Write and sync the block.
   status = SM_SUCCESS;
 
-  if (file_write(v->md_fd_vfd, buffer, BLCKSZ) != BLCKSZ ||
+  if (file_pwrite(v->md_fd_vfd, md_write_buffer(buffer), BLCKSZ, seek_pos) != BLCKSZ ||
       file_sync(v->md_fd_vfd) < 0) {
     status = SM_FAIL;
+  } else {
+    relsize_cache_note_write(relation->rd_node, block_num + 1);
   }
 
   return status;
@@ -484,19 +783,22 @@ int md_blind_wrt(RelFileNode rnode, BlockNumber block_num, char* buffer,
 
   errno = 0;
 
-  if (lseek(fd, seek_pos, SEEK_SET) != seek_pos) {
-    elog(DEBUG, "%s: lseek(%ld) failed: %m", __func__, seek_pos);
-    close(fd);
-
-    return SM_FAIL;
-  }
-
   status = SM_SUCCESS;
 
   // Write and optionally sync the block.
-  if (write(fd, buffer, BLCKSZ) != BLCKSZ) {
-    elog(DEBUG, "%s: write() failed: %m", __func__);
+  if (pwrite(fd, md_write_buffer(buffer), BLCKSZ, seek_pos) != BLCKSZ) {
+    elog(DEBUG, "%s: pwrite(%ld) failed: %m", __func__, seek_pos);
     status = SM_FAIL;
+  } else {
+    // The block is in the file even if the fsync fails.
+    relsize_cache_note_write(rnode, block_num + 1);
+
+    if (do_fsync && pg_fsync(fd) < 0) {
+      elog(DEBUG, "%s: fsync() failed: %m", __func__);
+      status = SM_FAIL;
+    } else if (!do_fsync) {
+      md_register_dirty_segment(rnode, MD_SEG_NO(block_num), NULL);
+    }
   }
 
   if (close(fd) < 0) {
@@ -507,22 +809,126 @@ int md_blind_wrt(RelFileNode rnode, BlockNumber block_num, char* buffer,
   return status;
 }
 
-// Mark the specified block "dirty" (ie, needs fsync).
+// Write nblocks consecutive blocks to disk blind.
 //
-// Returns SM_SUCCESS or SM_FAIL.
-int md_mark_dirty(Relation relation, BlockNumber block_num) {
-  MdfdVec* v;
+// This is md_blind_wrt() for a run of blocks: each segment the run
+// touches is opened once and written with one pwritev(). If do_fsync is
+// TRUE, each segment is fsync'd before it is closed.
+int md_blind_writev(RelFileNode rnode, BlockNumber block_num, char** buffers, int nblocks, bool do_fsync) {
+  struct iovec iov[MD_MAX_IOV];
+  int status;
+  long seek_pos;
+  int count;
+  int fd;
+  int i;
 
-  v = md_fd_get_seg(relation, block_num);
+  if (!md_buffers_aligned(buffers, nblocks)) {
+    for (i = 0; i < nblocks; i++) {
+      if (md_blind_wrt(rnode, block_num + i, buffers[i], do_fsync) == SM_FAIL) {
+        return SM_FAIL;
+      }
+    }
+
+    return SM_SUCCESS;
+  }
+
+  while (nblocks > 0) {
+    fd = md_fd_blind_get_seg(rnode, block_num);
+
+    if (fd < 0) {
+      return SM_FAIL;
+    }
+
+#ifndef LET_OS_MANAGE_FILESIZE
+    seek_pos = (long)(BLCKSZ * (block_num % RELSEG_SIZE));
+    count = MIN(nblocks, RELSEG_SIZE - block_num % RELSEG_SIZE);
+#else
+    seek_pos = (long)(BLCKSZ * (block_num));
+    count = nblocks;
+#endif
+    count = MIN(count, MD_MAX_IOV);
+
+    for (i = 0; i < count; i++) {
+      iov[i].iov_base = buffers[i];
+      iov[i].iov_len = BLCKSZ;
+    }
 
-  file_mark_dirty(v->md_fd_vfd);
+    status = SM_SUCCESS;
+
+    errno = 0;
+
+    if (pwritev(fd, iov, count, seek_pos) != count * BLCKSZ) {
+      elog(DEBUG, "%s: pwritev(%ld) failed: %m", __func__, seek_pos);
+      status = SM_FAIL;
+    } else {
+      relsize_cache_note_write(rnode, block_num + count);
+
+      if (do_fsync && pg_fsync(fd) < 0) {
+        elog(DEBUG, "%s: fsync() failed: %m", __func__);
+        status = SM_FAIL;
+      } else if (!do_fsync) {
+        md_register_dirty_segment(rnode, MD_SEG_NO(block_num), NULL);
+      }
+    }
+
+    if (close(fd) < 0) {
+      elog(DEBUG, "%s: close() failed: %m", __func__);
+      status = SM_FAIL;
+    }
+
+    if (status == SM_FAIL) {
+      return SM_FAIL;
+    }
+
+    block_num += count;
+    buffers += count;
+    nblocks -= count;
+  }
 
   return SM_SUCCESS;
 }
 
-int md_blind_mark_dirty(RelFileNode rnode, BlockNumber block_num) {
+// Start writing nblocks consecutive blocks blind through aio.c, without
+// waiting for the write; the caller reaps the result, tagged with id,
+// with aio_reap(). The buffers must not go away before then.
+//
+// The write is a single request, so a run that crosses a segment
+// boundary is refused. Returns SM_FAIL, without complaint, if the write
+// could not be started; the caller then writes synchronously. Once the
+// write has completed the caller asks for the segment to be fsync'd,
+// with md_blind_mark_dirty().
+int md_start_blind_writev(RelFileNode rnode, BlockNumber block_num, char** buffers, int nblocks, uint64 id) {
+  struct iovec iov[MD_MAX_IOV];
+  long seek_pos;
   int status;
   int fd;
+  int i;
+
+  if (nblocks > MIN(MD_MAX_IOV, AIO_MAX_IOV) || !md_buffers_aligned(buffers, nblocks)) {
+    return SM_FAIL;
+  }
+
+#ifndef LET_OS_MANAGE_FILESIZE
+  if (block_num / RELSEG_SIZE != (block_num + nblocks - 1) / RELSEG_SIZE) {
+    return SM_FAIL;
+  }
+
+  seek_pos = (long)(BLCKSZ * (block_num % RELSEG_SIZE));
+#else
+  seek_pos = (long)(BLCKSZ * (block_num));
+#endif
+
+  if (!aio_available()) {
+    return SM_FAIL;
+  }
+
+  // Nobody would raise the cached size when the write completes, nor
+  // stop a count or a search for spare blocks from missing it; only a
+  // run inside the known size of the relation, among blocks in use, goes
+  // this way.
+  if (!relsize_cache_covers(rnode, block_num + nblocks)) {
+    return SM_FAIL;
+  }
 
   fd = md_fd_blind_get_seg(rnode, block_num);
 
@@ -530,28 +936,77 @@ int md_blind_mark_dirty(RelFileNode rnode, BlockNumber block_num) {
     return SM_FAIL;
   }
 
+  for (i = 0; i < nblocks; i++) {
+    iov[i].iov_base = buffers[i];
+    iov[i].iov_len = BLCKSZ;
+  }
+
   status = SM_SUCCESS;
 
-  if (pg_fsync(fd) < 0) {
+  if (aio_start_writev(fd, iov, nblocks, seek_pos, id) < 0) {
     status = SM_FAIL;
   }
 
+  // The kernel took its own reference to the file at submission.
   if (close(fd) < 0) {
-    status = SM_FAIL;
+    elog(DEBUG, "%s: close() failed: %m", __func__);
   }
 
   return status;
 }
 
+// Mark the specified block "dirty" (ie, needs fsync): its segment is
+// fsync'd at the next checkpoint.
+//
+// Returns SM_SUCCESS or SM_FAIL.
+int md_mark_dirty(Relation relation, BlockNumber block_num) {
+  MdfdVec* v;
+
+  v = md_fd_get_seg(relation, block_num);
+
+  md_register_dirty_segment(relation->rd_node, MD_SEG_NO(block_num), v);
+
+  return SM_SUCCESS;
+}
+
+// Like md_mark_dirty(), for a block written blind.
+int md_blind_mark_dirty(RelFileNode rnode, BlockNumber block_num) {
+  md_register_dirty_segment(rnode, MD_SEG_NO(block_num), NULL);
+
+  return SM_SUCCESS;
+}
+
 // Get the number of blocks stored in a relation.
 //
+// The size comes from the shared relation size cache (see relsize.c)
+// if it is there, and is otherwise counted by md_count_blocks() and
+// put there.
+//
+// Returns # of blocks, elog's on error.
+int md_nblocks(Relation relation) {
+  BlockNumber nblocks;
+  uint32 ticket;
+
+  nblocks = relsize_cache_get(relation->rd_node);
+
+  if (nblocks == INVALID_BLOCK_NUMBER) {
+    ticket = relsize_cache_start_fill(relation->rd_node);
+    nblocks = md_count_blocks(relation);
+    relsize_cache_fill(relation->rd_node, nblocks, ticket);
+  }
+
+  return nblocks;
+}
+
+// Count the blocks of a relation from the sizes of its segments.
+//
 // Important side effect: all segments of the relation are opened
 // and added to the mdfd_chain list. If this routine has not been
 // called, then only segments up to the last one actually touched
 // are present in the chain...
 //
 // Returns # of blocks, elog's on error.
-int md_nblocks(Relation relation) {
+static int md_count_blocks(Relation relation) {
   int fd;
   MdfdVec* v;
 
@@ -610,17 +1065,18 @@ int md_truncate(Relation relation, int nblocks) {
   int prior_blocks;
 #endif
 
-  // NOTE: mdnblocks makes sure we have opened all existing segments, so
-  // that truncate/delete loop will get them all!
-  cur_nblk = md_nblocks(relation);
+  // NOTE: md_count_blocks makes sure we have opened all existing
+  // segments, so that truncate/delete loop will get them all!
+  cur_nblk = md_count_blocks(relation);
 
   // bogus request.
   if (nblocks < 0 || nblocks > cur_nblk) {
     return -1;
   }
 
-  // No work.
+  // No work, but we have just counted it.
   if (nblocks == cur_nblk) {
+    relsize_cache_set(relation->rd_node, nblocks);
     return nblocks;
   }
 
@@ -654,10 +1110,12 @@ int md_truncate(Relation relation, int nblocks) {
       int lastsegblocks = nblocks - prior_blocks;
 
       if (file_truncate(v->md_fd_vfd, lastsegblocks * BLCKSZ) < 0) {
+        relsize_cache_forget(relation->rd_node);
         return -1;
       }
 
       v->md_fd_lst_bcnt = lastsegblocks;
+      md_register_dirty_segment(relation->rd_node, prior_blocks / RELSEG_SIZE, v);
       v = v->md_fd_chain;
       ov->md_fd_chain = NULL;
     } else {
@@ -671,48 +1129,68 @@ int md_truncate(Relation relation, int nblocks) {
 
 #else
   if (file_truncate(v->md_fd_vfd, nblocks * BLCKSZ) < 0) {
+    relsize_cache_forget(relation->rd_node);
     return -1;
   }
 
   v->mdfd_lst_bcnt = nblocks;
+  md_register_dirty_segment(relation->rd_node, 0, v);
 
 #endif
 
+  relsize_cache_set(relation->rd_node, nblocks);
+
   return nblocks;
 }
 
 // Commit a transaction.
 //
-// All changes to magnetic disk relations must be forced to stable
-// storage.  This routine makes a pass over the private table of
-// file descriptors.  Any descriptors to which we have done writes,
-// but not synced, are synced here.
+// The segments this backend has written are forced to stable storage
+// here, unless DeferCommitFsync leaves them to the next checkpoint.
 //
 // Returns SM_SUCCESS or SM_FAIL with errno set as appropriate.
-int md_commit() {
-  int i;
-  MdfdVec* v;
+int md_commit() { return md_sync_pending(); }
 
-  for (i = 0; i < CurFd; i++) {
-    v = &Md_fdvec[i];
-    if (v->md_fd_flags & MD_FD_FREE) {
-      continue;
-    }
+// Fsync every segment that has been written since it was last fsync'd,
+// each once; called at the end of a checkpoint, after all the buffers
+// have been written. The requests other backends have queued for the
+// background writer are collected first.
+//
+// Returns SM_SUCCESS; a failed fsync is fatal (see md_sync_pending()).
+int md_sync() {
+  absorb_fsync_requests();
 
-    // Sync the file entry.
-#ifndef LET_OS_MANAGE_FILESIZE
-    for (; v != (MdfdVec*)NULL; v = v->md_fd_chain)
-#else
-    if (v != (MdfdVec*)NULL)
-#endif
-    {
-      if (file_sync(v->md_fd_vfd) < 0) {
-        return SM_FAIL;
-      }
+  return md_sync_pending();
+}
+
+// Remember that segment seg_no of rnode has to be fsync'd by md_sync().
+void remember_fsync_request(RelFileNode rnode, BlockNumber seg_no) {
+  PendingFsyncTag tag;
+  PendingFsync* entry;
+  HashCtrl info;
+  bool found;
+
+  if (PendingFsyncHash == NULL) {
+    info.keysize = sizeof(PendingFsyncTag);
+    info.datasize = sizeof(PendingFsync) - sizeof(PendingFsyncTag);
+    info.hash = tag_hash;
+
+    PendingFsyncHash = hash_create(PENDING_FSYNC_HASH_SIZE, &info, HASH_ELEM | HASH_FUNCTION);
+
+    if (!PendingFsyncHash) {
+      elog(ERROR, "%s: could not initialize pending fsync hash table", __func__);
     }
   }
 
-  return SM_SUCCESS;
+  MEMSET(&tag, 0, sizeof(tag));
+  tag.rnode = rnode;
+  tag.seg_no = seg_no;
+
+  entry = (PendingFsync*)hash_search(PendingFsyncHash, (char*)&tag, HASH_ENTER, &found);
+
+  if (entry == NULL) {
+    elog(ERROR, "%s: pending fsync hash table out of memory", __func__);
+  }
 }
 
 // Abort a transaction.
@@ -805,7 +1283,7 @@ static MdfdVec* md_fd_open_seg(Relation relation, int seg_no, int oflags) {
   }
 
   // Open the file.
-  fd = file_name_open_file(full_path, O_RDWR | PG_BINARY | oflags, 0600);
+  fd = md_open_file(full_path, O_RDWR | PG_BINARY | oflags);
   pfree(full_path);
 
   if (fd < 0) {
@@ -819,6 +1297,7 @@ static MdfdVec* md_fd_open_seg(Relation relation, int seg_no, int oflags) {
   v->md_fd_vfd = fd;
   v->md_fd_flags = 0;
   v->md_fd_lst_bcnt = md_nblocks_aux(fd, BLCKSZ);
+  v->md_fd_sync_cycle = 0;
 
 #ifndef LET_OS_MANAGE_FILESIZE
 
@@ -875,6 +1354,37 @@ static MdfdVec* md_fd_get_seg(Relation relation, int block_num) {
   return v;
 }
 
+// Like md_fd_get_seg(), but returns NULL instead of creating a segment
+// the block would be in.
+static MdfdVec* md_fd_find_seg(Relation relation, int block_num) {
+  MdfdVec* v;
+  int fd;
+
+  fd = md_fd_get_reln_fd(relation);
+  v = &Md_fdvec[fd];
+
+#ifndef LET_OS_MANAGE_FILESIZE
+  {
+    int seg_no;
+    int i;
+
+    for (seg_no = block_num / RELSEG_SIZE, i = 1; seg_no > 0; i++, seg_no--) {
+      if (v->md_fd_chain == NULL) {
+        v->md_fd_chain = md_fd_open_seg(relation, i, 0);
+
+        if (v->md_fd_chain == NULL) {
+          return NULL;
+        }
+      }
+
+      v = v->md_fd_chain;
+    }
+  }
+#endif
+
+  return v;
+}
+
 static int md_fd_blind_get_seg(RelFileNode rnode, int block_num) {
   char* path;
   int fd;
@@ -898,9 +1408,22 @@ static int md_fd_blind_get_seg(RelFileNode rnode, int block_num) {
 #endif
 
   // Call fd.c to allow other FDs to be closed if needed.
-  fd = basic_open_file(path, O_RDWR | PG_BINARY, 0600);
+  fd = -1;
+
+#ifdef O_DIRECT
+  if (EnableDirectIo) {
+    fd = basic_open_file(path, O_RDWR | PG_BINARY | O_DIRECT, 0600);
+  }
+  if (fd < 0 && (!EnableDirectIo || errno == EINVAL))
+#endif
+  {
+    fd = basic_open_file(path, O_RDWR | PG_BINARY, 0600);
+  }
   if (fd < 0) {
+    int save_errno = errno;
+
     elog(DEBUG, "%s: couldn't open %s: %m", __func__, path);
+    errno = save_errno;
   }
 
   pfree(path);
@@ -960,7 +1483,7 @@ static int fdvec_alloc() {
 }
 
 // Free md file descriptor vector.
-static int fdvec_free(int fdvec) {
+static void fdvec_free(int fdvec) {
   ASSERT(MdFree < 0 || Md_fdvec[MdFree].md_fd_flags == MD_FD_FREE);
   ASSERT(Md_fdvec[fdvec].md_fd_flags != MD_FD_FREE);
 
@@ -981,4 +1504,181 @@ static BlockNumber md_nblocks_aux(File file, Size blck_sz) {
   }
 
   return len / blck_sz;
-}
\ No newline at end of file
+}
+
+// Open a relation file through fd.c, with O_DIRECT if direct I/O is on.
+// File systems that can't do direct I/O refuse the flag with EINVAL, and
+// then we settle for opening the file normally. md.c only does positional
+// I/O, so it can share the VFD with other opens of the same segment.
+static File md_open_file(char* path, int oflags) {
+  File fd;
+
+#ifdef O_DIRECT
+  if (EnableDirectIo) {
+    fd = file_name_open_shared_file(path, oflags | O_DIRECT, 0600);
+
+    if (fd >= 0 || errno != EINVAL) {
+      return fd;
+    }
+
+    elog(DEBUG, "%s: no direct I/O for %s", __func__, path);
+  }
+#endif
+
+  fd = file_name_open_shared_file(path, oflags, 0600);
+
+  return fd;
+}
+
+// An aligned page to do direct I/O through for a buffer that isn't.
+static char* md_bounce_page(void) {
+  static char* page = NULL;
+
+  if (page == NULL) {
+    page = (char*)TYPE_ALIGN(IO_ALIGN_SIZE, memory_context_alloc(MdCxt, BLCKSZ + IO_ALIGN_SIZE));
+  }
+
+  return page;
+}
+
+// Return buffer, or if direct I/O can't write it from where it is, a
+// copy in the bounce page.
+static char* md_write_buffer(char* buffer) {
+  char* page;
+
+  if (!MD_NEEDS_BOUNCE(buffer)) {
+    return buffer;
+  }
+
+  page = md_bounce_page();
+  memcpy(page, buffer, BLCKSZ);
+
+  return page;
+}
+
+// Can direct I/O use all of buffers where they are? The vectored
+// routines do the blocks one at a time, through the bounce page, if not.
+static bool md_buffers_aligned(char** buffers, int nblocks) {
+  int i;
+
+  for (i = 0; i < nblocks; i++) {
+    if (MD_NEEDS_BOUNCE(buffers[i])) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Ask for the segment of rnode that was just written to, seg_no, to be
+// fsync'd at the next checkpoint. v is its open segment, if any: a
+// request it already made that the background writer hasn't collected
+// yet needn't be repeated.
+//
+// If the request queue is full, the segment is fsync'd here and now, and
+// a failure to do so is as fatal as in md_sync_pending().
+static void md_register_dirty_segment(RelFileNode rnode, BlockNumber seg_no, MdfdVec* v) {
+  uint32 cycle;
+  int fd;
+
+  if (!EnableFsync) {
+    return;
+  }
+
+  // For our commit to fsync, see DeferCommitFsync.
+  if (!DeferCommitFsync || !bgwriter_takes_fsync_requests()) {
+    remember_fsync_request(rnode, seg_no);
+  }
+
+  if (!bgwriter_takes_fsync_requests()) {
+    return;
+  }
+
+  cycle = fsync_request_cycle();
+
+  if (v != NULL && (v->md_fd_flags & MD_FD_SYNC_QUEUED) && v->md_fd_sync_cycle == cycle) {
+    return;
+  }
+
+  if (!forward_fsync_request(rnode, seg_no)) {
+    elog(DEBUG, "%s: fsync request queue is full, doing the fsync myself", __func__);
+
+    fd = md_fd_blind_get_seg(rnode, seg_no * RELSEG_SIZE);
+
+    // The relation may have been dropped or truncated since the write.
+    if (fd < 0 && errno != ENOENT) {
+      elog(STOP, "%s: couldn't open segment %u of relation %u/%u to fsync it: %m", __func__, seg_no,
+           rnode.tbl_node, rnode.rel_node);
+    }
+
+    if (fd >= 0) {
+      if (pg_fsync(fd) < 0) {
+        elog(STOP, "%s: couldn't fsync segment %u of relation %u/%u: %m", __func__, seg_no, rnode.tbl_node,
+             rnode.rel_node);
+      }
+
+      close(fd);
+    }
+  }
+
+  if (v != NULL) {
+    v->md_fd_flags |= MD_FD_SYNC_QUEUED;
+    v->md_fd_sync_cycle = cycle;
+  }
+}
+
+// Fsync the segments in PendingFsyncHash and forget them.
+//
+// A failed fsync is not retried. The kernel may already have dropped the
+// dirty pages it could not write, and report the segment clean the next
+// time, so we would be none the wiser; all we can do is stop, with the
+// changes still in the shared buffers, rather than carry on as if they
+// were safe.
+static int md_sync_pending(void) {
+  PendingFsyncTag* tags;
+  PendingFsync* entry;
+  HashSeqStatus seq_status;
+  bool found;
+  int ntags = 0;
+  int fd;
+  int i;
+
+  if (PendingFsyncHash == NULL || PendingFsyncHash->hctl->nkeys == 0) {
+    return SM_SUCCESS;
+  }
+
+  // Take a copy of the keys, as we remove entries along the way.
+  tags = (PendingFsyncTag*)palloc(PendingFsyncHash->hctl->nkeys * sizeof(PendingFsyncTag));
+
+  hash_seq_init(&seq_status, PendingFsyncHash);
+
+  while ((entry = (PendingFsync*)hash_seq_search(&seq_status)) != NULL) {
+    tags[ntags++] = entry->tag;
+  }
+
+  for (i = 0; i < ntags; i++) {
+    fd = md_fd_blind_get_seg(tags[i].rnode, tags[i].seg_no * RELSEG_SIZE);
+
+    // A segment that is gone belonged to a relation dropped or truncated
+    // since, whose writes nobody cares about any more.
+    if (fd < 0 && errno != ENOENT) {
+      elog(STOP, "%s: couldn't open segment %u of relation %u/%u to fsync it: %m", __func__, tags[i].seg_no,
+           tags[i].rnode.tbl_node, tags[i].rnode.rel_node);
+    }
+
+    if (fd >= 0) {
+      if (pg_fsync(fd) < 0) {
+        elog(STOP, "%s: couldn't fsync segment %u of relation %u/%u: %m", __func__, tags[i].seg_no,
+             tags[i].rnode.tbl_node, tags[i].rnode.rel_node);
+      }
+
+      close(fd);
+    }
+
+    hash_search(PendingFsyncHash, (char*)&tags[i], HASH_REMOVE, &found);
+  }
+
+  pfree(tags);
+
+  return SM_SUCCESS;
+}
@@ -0,0 +1,443 @@
+//===----------------------------------------------------------------------===//
+//
+// mm.c
+//  Main memory storage manager.
+//
+//  This storage manager keeps relations in shared memory instead of
+//  files. Every block lives in a pool of MemStorageBlocks pages; a hash
+//  table maps (rnode, block number) to the page that holds it, and
+//  another one keeps the number of blocks of each relation. Nothing ever
+//  reaches the disk, so the contents are lost at shutdown.
+//
+//  With memory_storage on, all relations are kept here (see DEFAULT_SMGR
+//  in smgr.h). That is meant for temporary databases, scratch work and
+//  benchmarks, where it takes the file system out of the picture and
+//  leaves what the buffer manager itself costs.
+//
+//  One LWLock protects all of it. Reads take it shared.
+//
+// Portions Copyright (c) 1996-2001, PostgreSQL Global Development Group
+// Portions Copyright (c) 1994, Regents of the University of California
+//
+//===----------------------------------------------------------------------===//
+
+#include <errno.h>
+#include <string.h>
+
+#include "rdbms/miscadmin.h"
+#include "rdbms/postgres.h"
+#include "rdbms/storage/lwlock.h"
+#include "rdbms/storage/shmem.h"
+#include "rdbms/storage/smgr.h"
+#include "rdbms/utils/elog.h"
+#include "rdbms/utils/hashfn.h"
+#include "rdbms/utils/hsearch.h"
+
+#ifdef STABLE_MEMORY_STORAGE
+
+// GUC parameters.
+bool EnableMemoryStorage = false;  // Keep all relations in memory
+int MemStorageBlocks = 1024;       // Size of the page pool
+
+typedef struct MmCacheTag {
+  RelFileNode rnode;
+  BlockNumber block_num;
+} MmCacheTag;
+
+// Where a block of a relation is.
+typedef struct MmCacheEnt {
+  MmCacheTag tag;
+  int block_id;  // Index into MmBlocks
+} MmCacheEnt;
+
+// How long a relation is.
+typedef struct MmRelEnt {
+  RelFileNode rnode;
+  BlockNumber nblocks;
+} MmRelEnt;
+
+typedef struct MmHeader {
+  LWLock lock;        // Protects everything in mm.c's shared memory
+  int free_head;      // First unused page, or -1
+  int num_free;       // Number of unused pages
+  int free_next[];    // Next unused page after each one, or -1
+} MmHeader;
+
+static MmHeader* MmHdr = NULL;
+static char* MmBlocks = NULL;
+static HashTable* MmCacheHash = NULL;
+static HashTable* MmRelHash = NULL;
+
+#define MM_BLOCK(block_id) (MmBlocks + (long)(block_id) * BLCKSZ)
+
+static MmRelEnt* mm_find_rel(RelFileNode rnode, bool create);
+static char* mm_find_block(RelFileNode rnode, BlockNumber block_num);
+static int mm_write_block(RelFileNode rnode, BlockNumber block_num, char* buffer);
+static void mm_drop_blocks(RelFileNode rnode, BlockNumber first_block, BlockNumber nblocks);
+
+// Estimate the shared memory needed by mm_shmem_init().
+Size mm_shmem_size(void) {
+  Size size = 0;
+
+  if (!EnableMemoryStorage) {
+    return 0;
+  }
+
+  size += MAX_ALIGN(sizeof(MmHeader) + MemStorageBlocks * sizeof(int));
+  size += MAX_ALIGN((Size)MemStorageBlocks * BLCKSZ);
+  size += hash_estimate_size(MemStorageBlocks, sizeof(MmCacheTag), sizeof(MmCacheEnt) - sizeof(MmCacheTag));
+  size += hash_estimate_size(MemStorageBlocks, sizeof(RelFileNode), sizeof(MmRelEnt) - sizeof(RelFileNode));
+
+  return size;
+}
+
+// Set up (or attach to) the page pool and its tables. Nothing is
+// allocated unless memory_storage is on.
+void mm_shmem_init(void) {
+  HashCtrl info;
+  bool found;
+  int i;
+
+  if (!EnableMemoryStorage) {
+    return;
+  }
+
+  MmHdr = (MmHeader*)shmem_init_struct("Memory Storage Header", sizeof(MmHeader) + MemStorageBlocks * sizeof(int),
+                                       &found);
+  MmBlocks = (char*)shmem_init_struct("Memory Storage Blocks", (Size)MemStorageBlocks * BLCKSZ, &found);
+
+  if (!MmHdr || !MmBlocks) {
+    elog(FATAL, "%s: couldn't initialize memory storage", __func__);
+  }
+
+  if (!found) {
+    lwlock_init(&MmHdr->lock);
+
+    for (i = 0; i < MemStorageBlocks; i++) {
+      MmHdr->free_next[i] = i + 1;
+    }
+
+    MmHdr->free_next[MemStorageBlocks - 1] = -1;
+    MmHdr->free_head = 0;
+    MmHdr->num_free = MemStorageBlocks;
+  }
+
+  info.keysize = sizeof(MmCacheTag);
+  info.datasize = sizeof(MmCacheEnt) - sizeof(MmCacheTag);
+  info.hash = tag_hash;
+
+  MmCacheHash =
+      shmem_init_hash("Memory Storage Block Table", MemStorageBlocks, MemStorageBlocks, &info, HASH_ELEM | HASH_FUNCTION);
+
+  // A relation normally has a block at least, so this many will do.
+  info.keysize = sizeof(RelFileNode);
+  info.datasize = sizeof(MmRelEnt) - sizeof(RelFileNode);
+
+  MmRelHash = shmem_init_hash("Memory Storage Relation Table", MemStorageBlocks, MemStorageBlocks, &info,
+                              HASH_ELEM | HASH_FUNCTION);
+
+  if (!MmCacheHash || !MmRelHash) {
+    elog(FATAL, "%s: couldn't initialize memory storage hash tables", __func__);
+  }
+}
+
+int mm_create(Relation relation) {
+  MmRelEnt* entry;
+  bool found;
+
+  lwlock_acquire(&MmHdr->lock, LW_EXCLUSIVE);
+
+  entry = (MmRelEnt*)hash_search(MmRelHash, (char*)&relation->rd_node, HASH_FIND, &found);
+
+  // As md_create(), allow it to exist already in bootstrap mode only.
+  if (found && !IS_BOOTSTRAP_PROCESSING_MODE()) {
+    lwlock_release(&MmHdr->lock);
+    errno = EEXIST;
+    return -1;
+  }
+
+  entry = mm_find_rel(relation->rd_node, true);
+
+  lwlock_release(&MmHdr->lock);
+
+  return entry != NULL ? 0 : -1;
+}
+
+// Unlink a relation, giving its pages back.
+int mm_unlink(RelFileNode rnode) {
+  MmRelEnt* entry;
+  bool found;
+
+  lwlock_acquire(&MmHdr->lock, LW_EXCLUSIVE);
+
+  entry = mm_find_rel(rnode, false);
+
+  if (entry != NULL) {
+    mm_drop_blocks(rnode, 0, entry->nblocks);
+    hash_search(MmRelHash, (char*)&rnode, HASH_REMOVE, &found);
+  }
+
+  lwlock_release(&MmHdr->lock);
+
+  return SM_SUCCESS;
+}
+
+// Add a block to the relation. Returns SM_FAIL when the pool is full.
+int mm_extend(Relation relation, char* buffer) {
+  MmRelEnt* entry;
+  int status = SM_FAIL;
+
+  lwlock_acquire(&MmHdr->lock, LW_EXCLUSIVE);
+
+  entry = mm_find_rel(relation->rd_node, true);
+
+  if (entry != NULL) {
+    status = mm_write_block(relation->rd_node, entry->nblocks, buffer);
+  }
+
+  lwlock_release(&MmHdr->lock);
+
+  return status;
+}
+
+// Add nblocks zeroed blocks to the relation, all or none.
+int mm_extend_by(Relation relation, int nblocks) {
+  MmRelEnt* entry;
+  BlockNumber block_num;
+  int status = SM_FAIL;
+
+  lwlock_acquire(&MmHdr->lock, LW_EXCLUSIVE);
+
+  entry = mm_find_rel(relation->rd_node, true);
+
+  if (entry != NULL && MmHdr->num_free < nblocks) {
+    elog(NOTICE, "%s: out of memory storage (%d blocks)", __func__, MemStorageBlocks);
+  } else if (entry != NULL) {
+    block_num = entry->nblocks;
+    status = SM_SUCCESS;
+
+    while (nblocks-- > 0 && status == SM_SUCCESS) {
+      status = mm_write_block(relation->rd_node, block_num++, NULL);
+    }
+  }
+
+  lwlock_release(&MmHdr->lock);
+
+  return status;
+}
+
+// There are no files to open; the relation springs into being when it
+// is first written to.
+int mm_open(Relation relation) { return 0; }
+
+int mm_close(Relation relation) { return SM_SUCCESS; }
+
+// Read a block. Like a read past the end of a file, a block that was
+// never written reads as zeroes.
+int mm_read(Relation relation, BlockNumber block_num, char* buffer) {
+  char* block;
+
+  lwlock_acquire(&MmHdr->lock, LW_SHARED);
+
+  block = mm_find_block(relation->rd_node, block_num);
+
+  if (block != NULL) {
+    memcpy(buffer, block, BLCKSZ);
+  } else {
+    MEMSET(buffer, 0, BLCKSZ);
+  }
+
+  lwlock_release(&MmHdr->lock);
+
+  return SM_SUCCESS;
+}
+
+int mm_write(Relation relation, BlockNumber block_num, char* buffer) {
+  int status;
+
+  lwlock_acquire(&MmHdr->lock, LW_EXCLUSIVE);
+  status = mm_write_block(relation->rd_node, block_num, buffer);
+  lwlock_release(&MmHdr->lock);
+
+  return status;
+}
+
+// Everything is as stable as it will ever get once it's written.
+int mm_flush(Relation relation, BlockNumber block_num, char* buffer) { return mm_write(relation, block_num, buffer); }
+
+int mm_blind_wrt(RelFileNode rnode, BlockNumber block_num, char* buffer, bool do_fsync) {
+  int status;
+
+  lwlock_acquire(&MmHdr->lock, LW_EXCLUSIVE);
+  status = mm_write_block(rnode, block_num, buffer);
+  lwlock_release(&MmHdr->lock);
+
+  return status;
+}
+
+int mm_mark_dirty(Relation relation, BlockNumber block_num) { return SM_SUCCESS; }
+
+int mm_blind_mark_dirty(RelFileNode rnode, BlockNumber block_num) { return SM_SUCCESS; }
+
+int mm_nblocks(Relation relation) {
+  MmRelEnt* entry;
+  int nblocks;
+
+  lwlock_acquire(&MmHdr->lock, LW_SHARED);
+
+  entry = mm_find_rel(relation->rd_node, false);
+  nblocks = entry != NULL ? (int)entry->nblocks : 0;
+
+  lwlock_release(&MmHdr->lock);
+
+  return nblocks;
+}
+
+// Truncate the relation to nblocks blocks, giving the rest back.
+int mm_truncate(Relation relation, int nblocks) {
+  MmRelEnt* entry;
+  BlockNumber cur_nblk;
+
+  lwlock_acquire(&MmHdr->lock, LW_EXCLUSIVE);
+
+  entry = mm_find_rel(relation->rd_node, false);
+  cur_nblk = entry != NULL ? entry->nblocks : 0;
+
+  // bogus request.
+  if (nblocks < 0 || (BlockNumber)nblocks > cur_nblk) {
+    lwlock_release(&MmHdr->lock);
+    return -1;
+  }
+
+  if (entry != NULL) {
+    mm_drop_blocks(relation->rd_node, nblocks, cur_nblk - nblocks);
+    entry->nblocks = nblocks;
+  }
+
+  lwlock_release(&MmHdr->lock);
+
+  return nblocks;
+}
+
+// Find the entry of rnode in MmRelHash, making one if create is set and
+// there is room. The caller holds the lock, exclusively to create.
+static MmRelEnt* mm_find_rel(RelFileNode rnode, bool create) {
+  MmRelEnt* entry;
+  bool found;
+
+  entry = (MmRelEnt*)hash_search(MmRelHash, (char*)&rnode, create ? HASH_ENTER : HASH_FIND, &found);
+
+  if (!found) {
+    if (!create) {
+      return NULL;
+    }
+
+    if (entry == NULL) {
+      elog(NOTICE, "%s: memory storage relation table is full", __func__);
+      return NULL;
+    }
+
+    entry->nblocks = 0;
+  }
+
+  return entry;
+}
+
+// Return the page holding a block, or NULL if it has none. The caller
+// holds the lock.
+static char* mm_find_block(RelFileNode rnode, BlockNumber block_num) {
+  MmCacheTag tag;
+  MmCacheEnt* entry;
+  bool found;
+
+  MEMSET(&tag, 0, sizeof(tag));
+  tag.rnode = rnode;
+  tag.block_num = block_num;
+
+  entry = (MmCacheEnt*)hash_search(MmCacheHash, (char*)&tag, HASH_FIND, &found);
+
+  return found ? MM_BLOCK(entry->block_id) : NULL;
+}
+
+// Store buffer (zeroes, if NULL) as a block of rnode, taking a page for
+// it if it has none. Writing past the end makes the relation longer.
+// The caller holds the lock exclusively.
+static int mm_write_block(RelFileNode rnode, BlockNumber block_num, char* buffer) {
+  MmCacheTag tag;
+  MmCacheEnt* entry;
+  MmRelEnt* rel;
+  bool found;
+
+  rel = mm_find_rel(rnode, true);
+
+  if (rel == NULL) {
+    return SM_FAIL;
+  }
+
+  MEMSET(&tag, 0, sizeof(tag));
+  tag.rnode = rnode;
+  tag.block_num = block_num;
+
+  entry = (MmCacheEnt*)hash_search(MmCacheHash, (char*)&tag, HASH_FIND, &found);
+
+  if (!found) {
+    if (MmHdr->free_head < 0) {
+      elog(NOTICE, "%s: out of memory storage (%d blocks)", __func__, MemStorageBlocks);
+      return SM_FAIL;
+    }
+
+    entry = (MmCacheEnt*)hash_search(MmCacheHash, (char*)&tag, HASH_ENTER, &found);
+
+    if (entry == NULL) {
+      elog(NOTICE, "%s: memory storage block table is full", __func__);
+      return SM_FAIL;
+    }
+
+    entry->block_id = MmHdr->free_head;
+    MmHdr->free_head = MmHdr->free_next[entry->block_id];
+    MmHdr->num_free--;
+  }
+
+  if (buffer != NULL) {
+    memcpy(MM_BLOCK(entry->block_id), buffer, BLCKSZ);
+  } else {
+    MEMSET(MM_BLOCK(entry->block_id), 0, BLCKSZ);
+  }
+
+  if (block_num >= rel->nblocks) {
+    rel->nblocks = block_num + 1;
+  }
+
+  return SM_SUCCESS;
+}
+
+// Give back the pages of nblocks blocks of rnode from first_block on.
+// Blocks that were never written have none. The caller holds the lock
+// exclusively.
+static void mm_drop_blocks(RelFileNode rnode, BlockNumber first_block, BlockNumber nblocks) {
+  MmCacheTag tag;
+  MmCacheEnt* entry;
+  bool found;
+  BlockNumber i;
+
+  MEMSET(&tag, 0, sizeof(tag));
+  tag.rnode = rnode;
+
+  for (i = 0; i < nblocks; i++) {
+    tag.block_num = first_block + i;
+
+    entry = (MmCacheEnt*)hash_search(MmCacheHash, (char*)&tag, HASH_FIND, &found);
+
+    if (!found) {
+      continue;
+    }
+
+    MmHdr->free_next[entry->block_id] = MmHdr->free_head;
+    MmHdr->free_head = entry->block_id;
+    MmHdr->num_free++;
+
+    hash_search(MmCacheHash, (char*)&tag, HASH_REMOVE, &found);
+  }
+}
+
+#endif  // STABLE_MEMORY_STORAGE
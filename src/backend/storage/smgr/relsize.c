@@ -0,0 +1,558 @@
+//===----------------------------------------------------------------------===//
+//
+// relsize.c
+//  Shared cache of relation sizes.
+//
+//  md_nblocks() has to find the length of every segment of a relation
+//  with an lseek(), which for a large relation is hundreds of system
+//  calls, and the size is asked for all the time. Instead the sizes are
+//  kept in a fixed-size open-addressing table in shared memory, keyed by
+//  RelFileNode. md.c fills an entry in when it has counted the blocks,
+//  and md_extend(), md_extend_by() and md_truncate() keep it current, so
+//  a relation is only counted again after its entry has been evicted.
+//  A write may land past the end too (local buffers hand out new blocks
+//  without extending the file), so the md.c write routines raise the
+//  size after every write.
+//
+//  Counting takes a while, and the relation may change meanwhile. So
+//  md_nblocks() first gives the relation a slot, with the size unknown,
+//  and notes the slot's sequence number. The count is only filled in if
+//  the number is still the same afterwards; any change to the slot in
+//  between makes it a stale count, and it is dropped.
+//
+//  Lookups take no lock. Each slot has a sequence number that is odd
+//  while the slot is being changed; a reader copies the slot and tries
+//  again if the number was odd or has changed meanwhile. Changing the
+//  size of a relation that has a slot locks only that slot, by making
+//  its number odd. Only claiming a slot for a relation (and evicting
+//  whoever had it) is serialized, by a spinlock, so that two backends
+//  can't give one relation two slots.
+//
+//  A relation's slot is one of the RELSIZE_CACHE_PROBES slots following
+//  its hash. Slots are never emptied, only reused, so a lookup can stop
+//  at the first slot that has never been used.
+//
+//  The slot also says how many of the relation's blocks have been handed
+//  out. md_extend_by() adds blocks nobody has yet, and read_buffer(P_NEW)
+//  and extend_buffers() take them with relsize_cache_take(), so every
+//  backend extending a relation uses up the spare blocks at its end
+//  before adding more. A new slot doesn't know which blocks are spare:
+//  the buffer manager finds out by looking for zero pages at the end of
+//  the relation that nobody has in the pool (see reclaim_spare_blocks()
+//  in bufmgr.c). Meanwhile every write that may land among them changes
+//  the slot's sequence number, so that it can tell whether one has.
+//
+// Portions Copyright (c) 1996-2001, PostgreSQL Global Development Group
+// Portions Copyright (c) 1994, Regents of the University of California
+//
+//===----------------------------------------------------------------------===//
+
+#include "rdbms/postgres.h"
+#include "rdbms/storage/atomics.h"
+#include "rdbms/storage/s_lock.h"
+#include "rdbms/storage/shmem.h"
+#include "rdbms/storage/smgr.h"
+#include "rdbms/utils/elog.h"
+#include "rdbms/utils/hashfn.h"
+
+// Number of slots in the table. Must be a power of 2.
+#define RELSIZE_CACHE_SLOTS 4096
+
+// Slots a relation may be in, starting at its hash.
+#define RELSIZE_CACHE_PROBES 8
+
+typedef struct RelSizeSlot {
+  AtomicUint32 seq;      // Odd while the slot is being changed
+  RelFileNode rnode;     // INVALID_OID rel_node if never used
+  BlockNumber nblocks;   // INVALID_BLOCK_NUMBER if not known
+  BlockNumber nused;     // Blocks handed out; INVALID_BLOCK_NUMBER if not known
+  bool reclaiming;       // Somebody is looking for spare blocks
+} RelSizeSlot;
+
+// What a lookup saw in a relation's slot.
+typedef struct RelSizeInfo {
+  BlockNumber nblocks;
+  BlockNumber nused;
+  bool reclaiming;
+  uint32 seq;
+} RelSizeInfo;
+
+typedef struct RelSizeCacheData {
+  TasLock insert_lock;       // Serializes claiming slots
+  AtomicUint32 next_victim;  // Spreads evictions over the probe window
+  RelSizeSlot slots[RELSIZE_CACHE_SLOTS];
+} RelSizeCacheData;
+
+// What relsize_cache_update() does to a relation's size.
+typedef enum RelSizeUpdate {
+  RELSIZE_SET,      // Replace it
+  RELSIZE_EXTEND,   // Raise it, if lower, and hand the new blocks out
+  RELSIZE_GROW,     // Raise it, if lower, with spare blocks
+  RELSIZE_RAISE,    // Raise it, if known and lower
+  RELSIZE_RESERVE,  // Nothing, but give the relation a slot
+  RELSIZE_FORGET    // Make it unknown
+} RelSizeUpdate;
+
+static RelSizeCacheData* RelSizeCache = NULL;
+
+static RelSizeSlot* relsize_cache_lookup(RelFileNode rnode, RelSizeInfo* info);
+static bool relsize_info_covers(RelSizeInfo* info, BlockNumber nblocks);
+static void relsize_cache_update(RelFileNode rnode, BlockNumber nblocks, RelSizeUpdate how);
+static bool relsize_update_slot(RelSizeSlot* slot, RelFileNode rnode, BlockNumber nblocks, RelSizeUpdate how);
+static uint32 relsize_lock_slot(RelSizeSlot* slot);
+
+// Estimate the shared memory needed by relsize_cache_shmem_init().
+Size relsize_cache_shmem_size(void) { return MAX_ALIGN(sizeof(RelSizeCacheData)); }
+
+// Allocate (or attach to) the shared table.
+void relsize_cache_shmem_init(void) {
+  bool found;
+  int i;
+
+  RelSizeCache = (RelSizeCacheData*)shmem_init_struct("Relation Size Cache", sizeof(RelSizeCacheData), &found);
+
+  if (!RelSizeCache) {
+    elog(FATAL, "%s: couldn't initialize relation size cache", __func__);
+  }
+
+  if (!found) {
+    INIT_LOCK(&RelSizeCache->insert_lock);
+    atomic_init_u32(&RelSizeCache->next_victim, 0);
+
+    for (i = 0; i < RELSIZE_CACHE_SLOTS; i++) {
+      atomic_init_u32(&RelSizeCache->slots[i].seq, 0);
+      RelSizeCache->slots[i].rnode.tbl_node = INVALID_OID;
+      RelSizeCache->slots[i].rnode.rel_node = INVALID_OID;
+      RelSizeCache->slots[i].nblocks = INVALID_BLOCK_NUMBER;
+      RelSizeCache->slots[i].nused = INVALID_BLOCK_NUMBER;
+      RelSizeCache->slots[i].reclaiming = false;
+    }
+  }
+}
+
+// Return the cached number of blocks of rnode, or INVALID_BLOCK_NUMBER
+// if it isn't known. Without shared memory nothing is.
+BlockNumber relsize_cache_get(RelFileNode rnode) {
+  RelSizeInfo info;
+
+  if (RelSizeCache == NULL || relsize_cache_lookup(rnode, &info) == NULL) {
+    return INVALID_BLOCK_NUMBER;
+  }
+
+  return info.nblocks;
+}
+
+// Whether rnode is known to have at least nblocks blocks, all in use, so
+// that a write below there changes nothing here.
+bool relsize_cache_covers(RelFileNode rnode, BlockNumber nblocks) {
+  RelSizeInfo info;
+
+  if (RelSizeCache == NULL || relsize_cache_lookup(rnode, &info) == NULL) {
+    return false;
+  }
+
+  return relsize_info_covers(&info, nblocks);
+}
+
+// Get ready to count the blocks of rnode: give it a slot if it has none,
+// and return a ticket to hand to relsize_cache_fill() with the count.
+uint32 relsize_cache_start_fill(RelFileNode rnode) {
+  RelSizeInfo info;
+
+  if (RelSizeCache == NULL) {
+    return 0;
+  }
+
+  relsize_cache_update(rnode, INVALID_BLOCK_NUMBER, RELSIZE_RESERVE);
+
+  // A slot that has been claimed has a nonzero number, so 0 can stand
+  // for no slot.
+  if (relsize_cache_lookup(rnode, &info) == NULL) {
+    return 0;
+  }
+
+  return info.seq;
+}
+
+// Record the size of a relation whose blocks have just been counted,
+// unless its slot has changed since relsize_cache_start_fill() gave out
+// the ticket: the relation may have changed size while it was counted,
+// or somebody has recorded a size meanwhile, and they know better.
+void relsize_cache_fill(RelFileNode rnode, BlockNumber nblocks, uint32 ticket) {
+  RelSizeSlot* slot;
+  RelSizeInfo info;
+  uint32 seq;
+
+  if (RelSizeCache == NULL || ticket == 0) {
+    return;
+  }
+
+  slot = relsize_cache_lookup(rnode, &info);
+
+  if (slot == NULL) {
+    return;
+  }
+
+  // Lock the slot only if its number is still the ticket; then nobody
+  // has touched it since, and it is still rnode's.
+  seq = ticket;
+
+  if (!atomic_compare_exchange_u32(&slot->seq, &seq, ticket + 1)) {
+    return;
+  }
+
+  if (slot->nblocks == INVALID_BLOCK_NUMBER) {
+    slot->nblocks = nblocks;
+  }
+
+  atomic_unlocked_write_u32(&slot->seq, ticket + 2);
+}
+
+// Record that a relation now has (at least) nblocks blocks, the new ones
+// written by whoever extended it. Backends extending a relation at the
+// same time may get here in any order.
+void relsize_cache_extend(RelFileNode rnode, BlockNumber nblocks) {
+  relsize_cache_update(rnode, nblocks, RELSIZE_EXTEND);
+}
+
+// Record that a relation now has (at least) nblocks blocks, the new ones
+// zero pages for relsize_cache_take() to hand out.
+void relsize_cache_grow(RelFileNode rnode, BlockNumber nblocks) { relsize_cache_update(rnode, nblocks, RELSIZE_GROW); }
+
+// Record that blocks up to nblocks have been written. A size that isn't
+// known stays unknown, as the write says nothing of the rest of the file,
+// but a count being made meanwhile is dropped: it may have missed the
+// write. So is a search for spare blocks. Most writes land inside the
+// relation, among blocks in use, and take no lock.
+void relsize_cache_note_write(RelFileNode rnode, BlockNumber nblocks) {
+  RelSizeSlot* slot;
+  RelSizeInfo info;
+
+  if (RelSizeCache == NULL) {
+    return;
+  }
+
+  slot = relsize_cache_lookup(rnode, &info);
+
+  if (slot == NULL || relsize_info_covers(&info, nblocks)) {
+    return;
+  }
+
+  // If the slot has changed hands, no count of ours can be filled in.
+  relsize_update_slot(slot, rnode, nblocks, RELSIZE_RAISE);
+}
+
+// Record that a relation has been truncated to nblocks blocks.
+void relsize_cache_set(RelFileNode rnode, BlockNumber nblocks) { relsize_cache_update(rnode, nblocks, RELSIZE_SET); }
+
+// Forget the size of a relation that has been created, dropped, or
+// changed in a way we could not follow.
+void relsize_cache_forget(RelFileNode rnode) { relsize_cache_update(rnode, INVALID_BLOCK_NUMBER, RELSIZE_FORGET); }
+
+// Hand out nblocks consecutive spare blocks of rnode, ones it has been
+// extended by but nobody has been given. Returns the first of them, or
+// INVALID_BLOCK_NUMBER if there aren't that many. *known is false if
+// which blocks are spare isn't known; see relsize_cache_start_reclaim().
+BlockNumber relsize_cache_take(RelFileNode rnode, int nblocks, bool* known) {
+  RelSizeSlot* slot;
+  RelSizeInfo info;
+  BlockNumber first;
+  uint32 seq;
+
+  *known = false;
+
+  if (RelSizeCache == NULL) {
+    return INVALID_BLOCK_NUMBER;
+  }
+
+  slot = relsize_cache_lookup(rnode, &info);
+
+  if (slot == NULL || info.nblocks == INVALID_BLOCK_NUMBER || info.nused == INVALID_BLOCK_NUMBER) {
+    return INVALID_BLOCK_NUMBER;
+  }
+
+  *known = true;
+
+  if (info.nblocks - info.nused < (BlockNumber)nblocks) {
+    return INVALID_BLOCK_NUMBER;
+  }
+
+  // Somebody may have taken them meanwhile, or evicted rnode.
+  first = INVALID_BLOCK_NUMBER;
+  seq = relsize_lock_slot(slot);
+
+  if (REL_FILE_NODE_EQUALS(slot->rnode, rnode) && slot->nblocks != INVALID_BLOCK_NUMBER &&
+      slot->nused != INVALID_BLOCK_NUMBER && slot->nblocks - slot->nused >= (BlockNumber)nblocks) {
+    first = slot->nused;
+    slot->nused += nblocks;
+  }
+
+  atomic_unlocked_write_u32(&slot->seq, seq + 1);
+
+  return first;
+}
+
+// Get ready to find out which blocks at the end of rnode are spare, when
+// its slot doesn't know. Returns a ticket to hand to
+// relsize_cache_finish_reclaim(), with the size of the relation in
+// *nblocks, or 0 if the size isn't known or the spare blocks are.
+//
+// Until then every write that may land among the relation's blocks
+// spoils the ticket, so a block somebody writes while the caller looks
+// at it isn't given out again.
+uint32 relsize_cache_start_reclaim(RelFileNode rnode, BlockNumber* nblocks) {
+  RelSizeSlot* slot;
+  RelSizeInfo info;
+  uint32 ticket;
+  uint32 seq;
+
+  if (RelSizeCache == NULL) {
+    return 0;
+  }
+
+  slot = relsize_cache_lookup(rnode, &info);
+
+  if (slot == NULL || info.nblocks == INVALID_BLOCK_NUMBER || info.nused != INVALID_BLOCK_NUMBER) {
+    return 0;
+  }
+
+  ticket = 0;
+  seq = relsize_lock_slot(slot);
+
+  if (REL_FILE_NODE_EQUALS(slot->rnode, rnode) && slot->nblocks != INVALID_BLOCK_NUMBER &&
+      slot->nused == INVALID_BLOCK_NUMBER) {
+    slot->reclaiming = true;
+    *nblocks = slot->nblocks;
+    ticket = seq + 1;
+  }
+
+  atomic_unlocked_write_u32(&slot->seq, seq + 1);
+
+  return ticket;
+}
+
+// Record that the blocks of rnode from nused on are spare, unless its
+// slot has changed since relsize_cache_start_reclaim() gave out the
+// ticket. Returns whether it was recorded.
+bool relsize_cache_finish_reclaim(RelFileNode rnode, BlockNumber nused, uint32 ticket) {
+  RelSizeSlot* slot;
+  RelSizeInfo info;
+  uint32 seq;
+
+  if (RelSizeCache == NULL || ticket == 0) {
+    return false;
+  }
+
+  slot = relsize_cache_lookup(rnode, &info);
+
+  if (slot == NULL) {
+    return false;
+  }
+
+  // Writes go on taking the slow path after a failure, as somebody who
+  // started looking later may still be at it.
+  seq = ticket;
+
+  if (!atomic_compare_exchange_u32(&slot->seq, &seq, ticket + 1)) {
+    return false;
+  }
+
+  slot->nused = nused;
+  slot->reclaiming = false;
+  atomic_unlocked_write_u32(&slot->seq, ticket + 2);
+
+  return true;
+}
+
+// Find rnode's slot without locking, and copy what it says to *info,
+// along with the sequence number it had then. Returns NULL if it has
+// none.
+static RelSizeSlot* relsize_cache_lookup(RelFileNode rnode, RelSizeInfo* info) {
+  volatile RelSizeSlot* slot;
+  RelFileNode slot_rnode;
+  BlockNumber slot_nblocks;
+  BlockNumber slot_nused;
+  bool slot_reclaiming;
+  uint32 start;
+  uint32 seq;
+  int i;
+
+  start = (uint32)tag_hash((int*)&rnode, sizeof(RelFileNode));
+
+  for (i = 0; i < RELSIZE_CACHE_PROBES; i++) {
+    slot = &RelSizeCache->slots[(start + i) & (RELSIZE_CACHE_SLOTS - 1)];
+
+    for (;;) {
+      seq = atomic_read_acquire_u32(&slot->seq);
+
+      if (seq & 1) {
+        continue;
+      }
+
+      slot_rnode = slot->rnode;
+      slot_nblocks = slot->nblocks;
+      slot_nused = slot->nused;
+      slot_reclaiming = slot->reclaiming;
+
+      atomic_read_barrier();
+
+      if (atomic_read_u32(&slot->seq) == seq) {
+        break;
+      }
+    }
+
+    if (REL_FILE_NODE_EQUALS(slot_rnode, rnode)) {
+      info->nblocks = slot_nblocks;
+      info->nused = slot_nused;
+      info->reclaiming = slot_reclaiming;
+      info->seq = seq;
+
+      return (RelSizeSlot*)slot;
+    }
+
+    if (slot_rnode.rel_node == INVALID_OID) {
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+// Whether a write of the blocks below nblocks can go unrecorded: they
+// are inside the relation and have been handed out, or nobody is
+// looking for spare blocks.
+static bool relsize_info_covers(RelSizeInfo* info, BlockNumber nblocks) {
+  if (info->nblocks == INVALID_BLOCK_NUMBER || info->nblocks < nblocks) {
+    return false;
+  }
+
+  return info->nused != INVALID_BLOCK_NUMBER ? info->nused >= nblocks : !info->reclaiming;
+}
+
+static void relsize_cache_update(RelFileNode rnode, BlockNumber nblocks, RelSizeUpdate how) {
+  RelSizeSlot* slot;
+  RelSizeSlot* victim;
+  RelSizeInfo info;
+  uint32 start;
+  uint32 seq;
+  int i;
+
+  if (RelSizeCache == NULL) {
+    return;
+  }
+
+  // Usually the relation has a slot already. Reserving it then leaves
+  // it alone, so as not to spoil a count somebody else is making.
+  slot = relsize_cache_lookup(rnode, &info);
+
+  if (slot != NULL && (how == RELSIZE_RESERVE || relsize_update_slot(slot, rnode, nblocks, how))) {
+    return;
+  }
+
+  LOCK_ACQUIRE(&RelSizeCache->insert_lock);
+
+  // Somebody may have given it one while we weren't looking.
+  slot = relsize_cache_lookup(rnode, &info);
+
+  if (slot != NULL) {
+    // Slots only change hands under insert_lock, so this can't fail.
+    if (how != RELSIZE_RESERVE) {
+      relsize_update_slot(slot, rnode, nblocks, how);
+    }
+  } else if (how != RELSIZE_FORGET) {
+    // Take a slot nobody needs, before the first unused one so lookups
+    // still find it; failing that, evict somebody.
+    start = (uint32)tag_hash((int*)&rnode, sizeof(RelFileNode));
+    victim = NULL;
+
+    for (i = 0; i < RELSIZE_CACHE_PROBES; i++) {
+      slot = &RelSizeCache->slots[(start + i) & (RELSIZE_CACHE_SLOTS - 1)];
+
+      if (slot->rnode.rel_node == INVALID_OID || slot->nblocks == INVALID_BLOCK_NUMBER) {
+        victim = slot;
+        break;
+      }
+    }
+
+    if (victim == NULL) {
+      i = atomic_fetch_add_u32(&RelSizeCache->next_victim, 1) % RELSIZE_CACHE_PROBES;
+      victim = &RelSizeCache->slots[(start + i) & (RELSIZE_CACHE_SLOTS - 1)];
+    }
+
+    seq = relsize_lock_slot(victim);
+    victim->rnode = rnode;
+    victim->nblocks = nblocks;
+    victim->nused = INVALID_BLOCK_NUMBER;
+    victim->reclaiming = false;
+    atomic_unlocked_write_u32(&victim->seq, seq + 1);
+  }
+
+  LOCK_RELEASE(&RelSizeCache->insert_lock);
+}
+
+// Change the size in slot, if it still belongs to rnode. Returns false
+// if it was given to another relation after we looked it up.
+static bool relsize_update_slot(RelSizeSlot* slot, RelFileNode rnode, BlockNumber nblocks, RelSizeUpdate how) {
+  uint32 seq;
+  bool ours;
+
+  seq = relsize_lock_slot(slot);
+  ours = REL_FILE_NODE_EQUALS(slot->rnode, rnode);
+
+  if (ours) {
+    switch (how) {
+      case RELSIZE_SET:
+        slot->nblocks = nblocks;
+        if (slot->nused != INVALID_BLOCK_NUMBER && slot->nused > nblocks) {
+          slot->nused = nblocks;
+        }
+        break;
+      case RELSIZE_FORGET:
+        slot->nblocks = INVALID_BLOCK_NUMBER;
+        slot->nused = INVALID_BLOCK_NUMBER;
+        break;
+      case RELSIZE_EXTEND:
+      case RELSIZE_GROW:
+        if (slot->nblocks == INVALID_BLOCK_NUMBER || slot->nblocks < nblocks) {
+          slot->nblocks = nblocks;
+        }
+        // Blocks written by md_extend() are somebody's, and so are any
+        // spare ones before them.
+        if (how == RELSIZE_EXTEND && slot->nused != INVALID_BLOCK_NUMBER && slot->nused < nblocks) {
+          slot->nused = nblocks;
+        }
+        break;
+      case RELSIZE_RAISE:
+        if (slot->nblocks != INVALID_BLOCK_NUMBER && slot->nblocks < nblocks) {
+          slot->nblocks = nblocks;
+        }
+        if (slot->nused != INVALID_BLOCK_NUMBER && slot->nused < nblocks) {
+          slot->nused = nblocks;
+        }
+        break;
+      case RELSIZE_RESERVE:
+        break;
+    }
+  }
+
+  atomic_unlocked_write_u32(&slot->seq, seq + 1);
+
+  return ours;
+}
+
+// Make slot's sequence number odd, waiting for whoever has it odd now.
+// Returns the new, odd, number.
+static uint32 relsize_lock_slot(RelSizeSlot* slot) {
+  unsigned spins = 0;
+  uint32 seq;
+
+  for (;;) {
+    seq = atomic_read_u32(&slot->seq);
+
+    if (!(seq & 1) && atomic_compare_exchange_u32(&slot->seq, &seq, seq + 1)) {
+      return seq + 1;
+    }
+
+    s_lock_delay(spins++, &slot->seq, __FILE__, __LINE__);
+  }
+}
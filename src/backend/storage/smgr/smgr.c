@@ -27,38 +27,58 @@ typedef struct f_smgr {
   int (*smgr_init)();      // May be NULL.
   int (*smgr_shutdown)();  // May be NULL.
   int (*smgr_create)(Relation relation);
-  int (*smgr_unlink)(Relation relation);
+  int (*smgr_unlink)(RelFileNode rnode);
   int (*smgr_extend)(Relation relation, char* buffer);
+  int (*smgr_extend_by)(Relation relation, int nblocks);  // May be NULL.
   int (*smgr_open)(Relation relation);
   int (*smgr_close)(Relation relation);
   int (*smgr_read)(Relation relation, BlockNumber block_num, char* buffer);
+  int (*smgr_readv)(Relation relation, BlockNumber block_num, char** buffers, int nblocks);  // May be NULL.
+  int (*smgr_prefetch)(Relation relation, BlockNumber block_num);  // May be NULL.
+  int (*smgr_start_read)(Relation relation, BlockNumber block_num, char* buffer, uint64 id);  // May be NULL.
+  int (*smgr_write)(Relation relation, BlockNumber block_num, char* buffer);
+  int (*smgr_writev)(Relation relation, BlockNumber block_num, char** buffers, int nblocks);  // May be NULL.
   int (*smgr_flush)(Relation relation, BlockNumber block_num, char* buffer);
-  int (*smgr_blind_wrt)(char* db_name, char* rel_name, Oid db_id, Oid rel_id, BlockNumber blk_no, char* buffer,
-                        bool do_fsync);
+  int (*smgr_blind_wrt)(RelFileNode rnode, BlockNumber block_num, char* buffer, bool do_fsync);
+  int (*smgr_blind_writev)(RelFileNode rnode, BlockNumber block_num, char** buffers, int nblocks,
+                           bool do_fsync);  // May be NULL.
+  int (*smgr_start_blind_writev)(RelFileNode rnode, BlockNumber block_num, char** buffers, int nblocks,
+                                 uint64 id);  // May be NULL.
   int (*smgr_mark_dirty)(Relation relation, BlockNumber block_num);
-  int (*smgr_blind_mark_dirty)(char* db_name, char* rel_name, Oid db_id, Oid rel_id, BlockNumber blk_no);
-  int (*smgr_blocks)(Relation relation);
+  int (*smgr_blind_mark_dirty)(RelFileNode rnode, BlockNumber block_num);
+  int (*smgr_nblocks)(Relation relation);
   int (*smgr_truncate)(Relation relation, int nblocks);
   int (*smgr_commit)();  // May be NULL.
   int (*smgr_abort)();   // May be NULL.
+  int (*smgr_sync)();    // May be NULL.
 } f_smgr;
 
 // The weird placement of commas in this init block is to keep the compiler
 // happy, regardless of what storage managers we have (or don't have).
 static f_smgr SmgrSW[] = {
     // Magnetic disk.
-    {md_init, NULL, md_create, md_unlink, md_extend, md_open, md_close, md_read, md_write, md_flush, md_blind_wrt,
-     md_mark_dirty, md_blind_mark_dirty, md_nblocks, md_truncate, md_commit, md_abort},
+    {md_init, NULL, md_create, md_unlink, md_extend, md_extend_by, md_open, md_close, md_read, md_readv, md_prefetch,
+     md_start_read, md_write, md_writev, md_flush, md_blind_wrt, md_blind_writev, md_start_blind_writev, md_mark_dirty,
+     md_blind_mark_dirty, md_nblocks, md_truncate, md_commit, md_abort, md_sync},
 
 #ifdef STABLE_MEMORY_STORAGE
 
     // Main memory.
-    {mminit, mmshutdown, mmcreate, mmunlink, mmextend, mmopen, mmclose, mmread, mmwrite, mmflush, mmblindwrt,
-     mmmarkdirty, mmblindmarkdirty, mmnblocks, NULL, mmcommit, mmabort},
+    {NULL, NULL, mm_create, mm_unlink, mm_extend, mm_extend_by, mm_open, mm_close, mm_read, NULL, NULL, NULL, mm_write,
+     NULL, mm_flush, mm_blind_wrt, NULL, NULL, mm_mark_dirty, mm_blind_mark_dirty, mm_nblocks, mm_truncate, NULL, NULL,
+     NULL},
 
 #endif
 };
 
+// Names of the storage managers above, for error messages.
+static char* SmgrNames[] = {
+    "magnetic disk",
+#ifdef STABLE_MEMORY_STORAGE
+    "main memory",
+#endif
+};
+
 static int NSmgr = LENGTH_OF(SmgrSW);
 
 // Initialize or shut down all storage managers.
@@ -68,17 +88,29 @@ int smgr_init() {
   for (i = 0; i < NSmgr; i++) {
     if (SmgrSW[i].smgr_init) {
       if ((*(SmgrSW[i].smgr_init))() == SM_FAIL) {
-        elog(FATAL, "%s: initialization failed on %s", __func__, smgrout(i));
+        elog(FATAL, "%s: initialization failed on %s", __func__, SmgrNames[i]);
       }
     }
   }
 
   // Register the shutdown proc.
-  on_proc_exit(smgr_shutdown, NULL);
+  on_proc_exit(smgr_shutdown, 0);
 
   return SM_SUCCESS;
 }
 
+static void smgr_shutdown(int dummy) {
+  int i;
+
+  for (i = 0; i < NSmgr; i++) {
+    if (SmgrSW[i].smgr_shutdown) {
+      if ((*(SmgrSW[i].smgr_shutdown))() == SM_FAIL) {
+        elog(FATAL, "%s: shutdown failed on %s", __func__, SmgrNames[i]);
+      }
+    }
+  }
+}
+
 // Create a new relation.
 //
 // This routine takes a reldesc, creates the relation on the appropriate
@@ -99,13 +131,364 @@ int smgr_create(int16 which, Relation relation) {
 int smgr_unlink(int16 which, Relation relation) {
   int status;
 
-  if ((status = (*(SmgrSW[which].smgr_unlink))(relation)) == SM_FAIL) {
+  if ((status = (*(SmgrSW[which].smgr_unlink))(relation->rd_node)) == SM_FAIL) {
     elog(ERROR, "%s: cannot unlink %s", __func__, RELATION_GET_RELATION_NAME(relation));
   }
 
   return status;
 }
 
+// Add a new block to a file.
+//
+// The new block is appended to the relation, and its contents are
+// taken from buffer. Returns SM_SUCCESS; elog's on failure.
 int smgr_extend(int16 which, Relation relation, char* buffer) {
-    
-}
\ No newline at end of file
+  int status;
+
+  status = (*(SmgrSW[which].smgr_extend))(relation, buffer);
+
+  if (status == SM_FAIL) {
+    elog(ERROR, "%s: cannot extend %s", __func__, RELATION_GET_RELATION_NAME(relation));
+  }
+
+  return status;
+}
+
+// Add nblocks zeroed blocks to a file at once.
+//
+// Storage managers that can't do better get the blocks appended one at a
+// time with smgr_extend. Returns SM_SUCCESS; elog's on failure.
+int smgr_extend_by(int16 which, Relation relation, int nblocks) {
+  int status = SM_SUCCESS;
+  char* zeros;
+  int i;
+
+  if (SmgrSW[which].smgr_extend_by) {
+    status = (*(SmgrSW[which].smgr_extend_by))(relation, nblocks);
+  } else {
+    zeros = (char*)palloc(BLCKSZ);
+    MEMSET(zeros, 0, BLCKSZ);
+
+    for (i = 0; i < nblocks && status == SM_SUCCESS; i++) {
+      status = (*(SmgrSW[which].smgr_extend))(relation, zeros);
+    }
+
+    pfree(zeros);
+  }
+
+  if (status == SM_FAIL) {
+    elog(ERROR, "%s: cannot extend %s by %d blocks", __func__, RELATION_GET_RELATION_NAME(relation), nblocks);
+  }
+
+  return status;
+}
+
+// Open a relation using a particular storage manager.
+//
+// Returns the fd for the open relation on success. On failure, returns
+// -1 if fail_ok, else elog's.
+int smgr_open(int16 which, Relation relation, bool fail_ok) {
+  int fd;
+
+  if ((fd = (*(SmgrSW[which].smgr_open))(relation)) < 0 && !fail_ok) {
+    elog(ERROR, "%s: cannot open %s", __func__, RELATION_GET_RELATION_NAME(relation));
+  }
+
+  return fd;
+}
+
+// Close a relation.
+int smgr_close(int16 which, Relation relation) {
+  if ((*(SmgrSW[which].smgr_close))(relation) == SM_FAIL) {
+    elog(ERROR, "%s: cannot close %s", __func__, RELATION_GET_RELATION_NAME(relation));
+  }
+
+  return SM_SUCCESS;
+}
+
+// Read a particular block from a relation into the supplied buffer.
+//
+// This routine is called from the buffer manager in order to
+// instantiate pages in the shared buffer cache. All storage managers
+// return pages in the format that POSTGRES expects.
+int smgr_read(int16 which, Relation relation, BlockNumber block_num, char* buffer) {
+  int status;
+
+  status = (*(SmgrSW[which].smgr_read))(relation, block_num, buffer);
+
+  if (status == SM_FAIL) {
+    elog(ERROR, "%s: cannot read block %u of %s", __func__, block_num, RELATION_GET_RELATION_NAME(relation));
+  }
+
+  return status;
+}
+
+// Read nblocks consecutive blocks, starting at block_num, into the
+// supplied buffers.
+//
+// Storage managers that can move a run of blocks at once provide
+// smgr_readv; for the others we read the blocks one by one.
+int smgr_readv(int16 which, Relation relation, BlockNumber block_num, char** buffers, int nblocks) {
+  int status = SM_SUCCESS;
+  int i;
+
+  if (SmgrSW[which].smgr_readv) {
+    status = (*(SmgrSW[which].smgr_readv))(relation, block_num, buffers, nblocks);
+  } else {
+    for (i = 0; i < nblocks && status == SM_SUCCESS; i++) {
+      status = (*(SmgrSW[which].smgr_read))(relation, block_num + i, buffers[i]);
+    }
+  }
+
+  if (status == SM_FAIL) {
+    elog(ERROR, "%s: cannot read blocks %u..%u of %s", __func__, block_num, block_num + nblocks - 1,
+         RELATION_GET_RELATION_NAME(relation));
+  }
+
+  return status;
+}
+
+// Initiate asynchronous read of a block of a relation.
+//
+// This is only a hint to the storage manager that the block will be read
+// soon; storage managers that cannot make use of it leave it NULL.
+int smgr_prefetch(int16 which, Relation relation, BlockNumber block_num) {
+  int status;
+
+  if (SmgrSW[which].smgr_prefetch == NULL) {
+    return SM_SUCCESS;
+  }
+
+  status = (*(SmgrSW[which].smgr_prefetch))(relation, block_num);
+
+  if (status == SM_FAIL) {
+    elog(NOTICE, "%s: cannot prefetch block %u of %s", __func__, block_num, RELATION_GET_RELATION_NAME(relation));
+  }
+
+  return status;
+}
+
+// Start reading a block into buffer without waiting for it; the result
+// comes back tagged with id from aio_reap().
+//
+// Returns SM_FAIL if the storage manager can't (or can't right now), and
+// the caller should read the block with smgr_read() instead. That is not
+// an error, so nothing is reported.
+int smgr_start_read(int16 which, Relation relation, BlockNumber block_num, char* buffer, uint64 id) {
+  if (SmgrSW[which].smgr_start_read == NULL) {
+    return SM_FAIL;
+  }
+
+  return (*(SmgrSW[which].smgr_start_read))(relation, block_num, buffer, id);
+}
+
+// Write the supplied buffer out.
+//
+// This is not a synchronous write -- the block is not necessarily
+// on disk at return, only dumped out to the kernel.
+int smgr_write(int16 which, Relation relation, BlockNumber block_num, char* buffer) {
+  int status;
+
+  status = (*(SmgrSW[which].smgr_write))(relation, block_num, buffer);
+
+  if (status == SM_FAIL) {
+    elog(ERROR, "%s: cannot write block %u of %s", __func__, block_num, RELATION_GET_RELATION_NAME(relation));
+  }
+
+  return status;
+}
+
+// Write nblocks consecutive blocks, starting at block_num, from the
+// supplied buffers. Like smgr_write(), this is not a synchronous write.
+int smgr_writev(int16 which, Relation relation, BlockNumber block_num, char** buffers, int nblocks) {
+  int status = SM_SUCCESS;
+  int i;
+
+  if (SmgrSW[which].smgr_writev) {
+    status = (*(SmgrSW[which].smgr_writev))(relation, block_num, buffers, nblocks);
+  } else {
+    for (i = 0; i < nblocks && status == SM_SUCCESS; i++) {
+      status = (*(SmgrSW[which].smgr_write))(relation, block_num + i, buffers[i]);
+    }
+  }
+
+  if (status == SM_FAIL) {
+    elog(ERROR, "%s: cannot write blocks %u..%u of %s", __func__, block_num, block_num + nblocks - 1,
+         RELATION_GET_RELATION_NAME(relation));
+  }
+
+  return status;
+}
+
+// A synchronous smgr_write().
+int smgr_flush(int16 which, Relation relation, BlockNumber block_num, char* buffer) {
+  int status;
+
+  status = (*(SmgrSW[which].smgr_flush))(relation, block_num, buffer);
+
+  if (status == SM_FAIL) {
+    elog(ERROR, "%s: cannot flush block %u of %s to stable store", __func__, block_num,
+         RELATION_GET_RELATION_NAME(relation));
+  }
+
+  return status;
+}
+
+// Write a page out blind.
+//
+// In some cases, we may find a page in the buffer cache that we
+// can't make a reldesc for. This happens, for example, when we
+// want to reuse a dirty page that was written by a transaction
+// that has not yet committed, which created a new relation. In
+// this case, the buffer manager will call smgr_blind_wrt() with
+// the RelFileNode of the relation.
+//
+// do_fsync indicates whether to fsync the file before returning.
+int smgr_blind_wrt(int16 which, RelFileNode rnode, BlockNumber block_num, char* buffer, bool do_fsync) {
+  int status;
+
+  status = (*(SmgrSW[which].smgr_blind_wrt))(rnode, block_num, buffer, do_fsync);
+
+  if (status == SM_FAIL) {
+    elog(ERROR, "%s: cannot write block %u of %u/%u blind", __func__, block_num, rnode.tbl_node, rnode.rel_node);
+  }
+
+  return status;
+}
+
+// Write nblocks consecutive blocks out blind; see smgr_blind_wrt().
+int smgr_blind_writev(int16 which, RelFileNode rnode, BlockNumber block_num, char** buffers, int nblocks,
+                      bool do_fsync) {
+  int status = SM_SUCCESS;
+  int i;
+
+  if (SmgrSW[which].smgr_blind_writev) {
+    status = (*(SmgrSW[which].smgr_blind_writev))(rnode, block_num, buffers, nblocks, do_fsync);
+  } else {
+    for (i = 0; i < nblocks && status == SM_SUCCESS; i++) {
+      status = (*(SmgrSW[which].smgr_blind_wrt))(rnode, block_num + i, buffers[i], do_fsync);
+    }
+  }
+
+  if (status == SM_FAIL) {
+    elog(ERROR, "%s: cannot write blocks %u..%u of %u/%u blind", __func__, block_num, block_num + nblocks - 1,
+         rnode.tbl_node, rnode.rel_node);
+  }
+
+  return status;
+}
+
+// Start writing nblocks consecutive blocks blind without waiting for the
+// write; see smgr_start_read(). SM_FAIL means the caller should write
+// them with smgr_blind_writev().
+int smgr_start_blind_writev(int16 which, RelFileNode rnode, BlockNumber block_num, char** buffers, int nblocks,
+                            uint64 id) {
+  if (SmgrSW[which].smgr_start_blind_writev == NULL) {
+    return SM_FAIL;
+  }
+
+  return (*(SmgrSW[which].smgr_start_blind_writev))(rnode, block_num, buffers, nblocks, id);
+}
+
+// Mark a page dirty ("needs fsync").
+int smgr_mark_dirty(int16 which, Relation relation, BlockNumber block_num) {
+  int status;
+
+  status = (*(SmgrSW[which].smgr_mark_dirty))(relation, block_num);
+
+  if (status == SM_FAIL) {
+    elog(ERROR, "%s: cannot mark block %u of %s", __func__, block_num, RELATION_GET_RELATION_NAME(relation));
+  }
+
+  return status;
+}
+
+// Mark a page dirty, "blind".
+int smgr_blind_mark_dirty(int16 which, RelFileNode rnode, BlockNumber block_num) {
+  int status;
+
+  status = (*(SmgrSW[which].smgr_blind_mark_dirty))(rnode, block_num);
+
+  if (status == SM_FAIL) {
+    elog(ERROR, "%s: cannot mark block %u of %u/%u blind", __func__, block_num, rnode.tbl_node, rnode.rel_node);
+  }
+
+  return status;
+}
+
+// Calculate the number of POSTGRES blocks in the supplied relation.
+//
+// Returns the number of blocks on success, aborts the current
+// transaction on failure.
+int smgr_nblocks(int16 which, Relation relation) {
+  int nblocks;
+
+  if ((nblocks = (*(SmgrSW[which].smgr_nblocks))(relation)) < 0) {
+    elog(ERROR, "%s: cannot count blocks for %s", __func__, RELATION_GET_RELATION_NAME(relation));
+  }
+
+  return nblocks;
+}
+
+// Truncate relation to specified number of blocks.
+//
+// Returns the number of blocks on success, aborts the current
+// transaction on failure.
+int smgr_truncate(int16 which, Relation relation, int nblocks) {
+  int new_blks;
+
+  new_blks = nblocks;
+
+  if (SmgrSW[which].smgr_truncate) {
+    if ((new_blks = (*(SmgrSW[which].smgr_truncate))(relation, nblocks)) < 0) {
+      elog(ERROR, "%s: cannot truncate %s to %d blocks", __func__, RELATION_GET_RELATION_NAME(relation), nblocks);
+    }
+  }
+
+  return new_blks;
+}
+
+// Commit changes made during the current transaction.
+int smgr_commit() {
+  int i;
+
+  for (i = 0; i < NSmgr; i++) {
+    if (SmgrSW[i].smgr_commit) {
+      if ((*(SmgrSW[i].smgr_commit))() == SM_FAIL) {
+        elog(FATAL, "%s: transaction commit failed on %s", __func__, SmgrNames[i]);
+      }
+    }
+  }
+
+  return SM_SUCCESS;
+}
+
+// Abort changes made during the current transaction.
+int smgr_abort() {
+  int i;
+
+  for (i = 0; i < NSmgr; i++) {
+    if (SmgrSW[i].smgr_abort) {
+      if ((*(SmgrSW[i].smgr_abort))() == SM_FAIL) {
+        elog(FATAL, "%s: transaction abort failed on %s", __func__, SmgrNames[i]);
+      }
+    }
+  }
+
+  return SM_SUCCESS;
+}
+
+// Force everything written since the last checkpoint to stable storage.
+int smgr_sync() {
+  int i;
+
+  for (i = 0; i < NSmgr; i++) {
+    if (SmgrSW[i].smgr_sync) {
+      if ((*(SmgrSW[i].smgr_sync))() == SM_FAIL) {
+        elog(ERROR, "%s: sync failed on %s: %m", __func__, SmgrNames[i]);
+      }
+    }
+  }
+
+  return SM_SUCCESS;
+}
@@ -15,6 +15,7 @@
 //===----------------------------------------------------------------------===//
 #include "rdbms/utils/temprel.h"
 
+#include <string.h>
 #include <sys/types.h>
 
 #include "rdbms/catalog/pg_class.h"
@@ -57,4 +58,23 @@ typedef struct TempTable {
 void create_temp_relation(const char* rel_name, HeapTuple pg_class_tuple) {
   Form_pg_class pg_class_form = (Form_pg_class)GET_STRUCT(pg_class_tuple);
   MemoryContext old_cxt;
-}
\ No newline at end of file
+}
+// Map a temp table's physical name to the logical name the user knows it
+// by. Any other name is returned unchanged.
+char* get_temp_rel_by_physicalname(const char* rel_name) {
+  List* l;
+
+  FOR_EACH(l, TempRels) {
+    TempTable* temp_rel = (TempTable*)LFIRST(l);
+
+    if (temp_rel->deleted_in_cur_xact) {
+      continue;
+    }
+
+    if (strcmp(NAME_STR(temp_rel->rel_name), rel_name) == 0) {
+      return NAME_STR(temp_rel->user_rel_name);
+    }
+  }
+
+  return (char*)rel_name;
+}
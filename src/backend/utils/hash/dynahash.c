@@ -40,23 +40,24 @@
 
 #include "rdbms/c.h"
 #include "rdbms/utils/hashfn.h"
+#include "rdbms/utils/dynahash.h"
 #include "rdbms/utils/hsearch.h"
-#include "rdbms/utils/mctx.h"
 #include "rdbms/utils/memutils.h"
 
 #define MOD(x, y) ((x) & ((y)-1))
 
-static long* dyna_hash_alloc(unsigned int size);
+static void* dyna_hash_alloc(Size size);
 static void dyna_hash_free(Pointer ptr);
-static uint32 call_hash(HTAB* hashp, char* k);
-static SEG_OFFSET seg_alloc(HTAB* hashp);
-static int bucket_alloc(HTAB* hashp);
-static int dir_realloc(HTAB* hashp);
-static int expand_table(HTAB* hashp);
-static int hdefault(HTAB* hashp);
-static int init_htab(HTAB* hashp, int nelem);
+static uint32 call_hash(HashTable* hashp, char* k);
+static uint32 calc_bucket(HashHeader* hctl, uint32 hash_val);
+static SegOffset seg_alloc(HashTable* hashp);
+static int bucket_alloc(HashTable* hashp);
+static int dir_realloc(HashTable* hashp);
+static int expand_table(HashTable* hashp);
+static int hdefault(HashTable* hashp);
+static int init_htab(HashTable* hashp, int nelem);
 
-typedef long*((*dhalloc_ptr)());
+typedef void* (*dhalloc_ptr)(Size);
 
 // memory allocation routines
 //
@@ -71,24 +72,28 @@ typedef long*((*dhalloc_ptr)());
 //  hash routines.  For now I have modified this code to
 //  do the latter -cim 1/19/91
 
-GlobalMemory DynaHashCxt = (GlobalMemory)NULL;
+//
+// Each private table keeps its directory, segments and buckets in a
+// context of its own, so hash_destroy() can free them all at once;
+// buckets are allocated in groups and can't be pfree'd one by one.
+// CurrentDynaHashCxt says which context dyna_hash_alloc() is to use.
+static MemoryContext DynaHashCxt = NULL;
+static MemoryContext CurrentDynaHashCxt = NULL;
 
-static long* dyna_hash_alloc(unsigned int size) {
-  if (!DynaHashCxt) {
-    DynaHashCxt = create_global_memory("DynaHash");
-  }
+static void* dyna_hash_alloc(Size size) {
+  ASSERT(CurrentDynaHashCxt != NULL);
 
-  return (long*)memory_context_alloc((MemoryContext)DynaHashCxt, size);
+  return memory_context_alloc(CurrentDynaHashCxt, size);
 }
 
-static void dyna_hash_free(Pointer ptr) { memory_context_free((MemoryContext)DynaHashCxt, ptr); }
+static void dyna_hash_free(Pointer ptr) { pfree(ptr); }
 
-static uint32 call_hash(HTAB* hashp, char* k) {
-  HHDR* hctl = hashp->hctl;
-  long hash_val;
-  long bucket;
+static uint32 call_hash(HashTable* hashp, char* k) { return calc_bucket(hashp->hctl, get_hash_value(hashp, k)); }
+
+// Convert a hash value to a bucket number.
+static uint32 calc_bucket(HashHeader* hctl, uint32 hash_val) {
+  uint32 bucket;
 
-  hash_val = hashp->hash(k, (int)hctl->keysize);
   bucket = hash_val & hctl->high_mask;
 
   if (bucket > hctl->max_bucket) {
@@ -107,20 +112,28 @@ static uint32 call_hash(HTAB* hashp, char* k) {
 // these macros convert offsets to pointers and pointers to offsets.
 // Shared memory need not be contiguous, but all addresses must be
 // calculated relative to some offset (segbase).
-#define GET_SEG(hp, seg_num)        (SEGMENT)(((unsigned long)(hp)->segbase) + (hp)->dir[seg_num])
-#define GET_BUCKET(hp, bucket_offs) (ELEMENT*)(((unsigned long)(hp)->segbase) + bucket_offs)
+#define GET_SEG(hp, seg_num)        (Segment)(((unsigned long)(hp)->segbase) + (hp)->dir[seg_num])
+#define GET_BUCKET(hp, bucket_offs) (Element*)(((unsigned long)(hp)->segbase) + bucket_offs)
 #define MAKE_HASHOFFSET(hp, ptr)    (((unsigned long)ptr) - ((unsigned long)(hp)->segbase))
 
+#if HASH_STATISTICS
 static long HashAccesses;
 static long HashCollisions;
 static long HashExpansions;
+#endif
+
+HashTable* hash_create(int nelem, HashCtrl* info, int flags) {
+  HashHeader* hctl;
+  HashTable* hashp;
 
-HTAB* hash_create(int nelem, HASHCTL* info, int flags) {
-  HHDR* hctl;
-  HTAB* hashp;
+  if (!DynaHashCxt) {
+    DynaHashCxt = alloc_set_context_create(TopMemoryContext, "DynaHash", ALLOCSET_DEFAULT_MIN_SIZE,
+                                           ALLOCSET_DEFAULT_INIT_SIZE, ALLOCSET_DEFAULT_MAX_SIZE);
+  }
 
-  hashp = (HTAB*)MEM_ALLOC(sizeof(HTAB));
-  MemSet(hashp, 0, sizeof(HTAB));
+  CurrentDynaHashCxt = DynaHashCxt;
+  hashp = (HashTable*)MEM_ALLOC(sizeof(HashTable));
+  MEMSET(hashp, 0, sizeof(HashTable));
 
   if (flags & HASH_FUNCTION) {
     hashp->hash = info->hash;
@@ -131,10 +144,10 @@ HTAB* hash_create(int nelem, HASHCTL* info, int flags) {
   if (flags & HASH_SHARED_MEM) {
     // ctl structure is preallocated for shared memory tables. Note
     // that HASH_DIRSIZE had better be set as well.
-    hashp->hctl = (HHDR*)info->hctl;
+    hashp->hctl = (HashHeader*)info->hctl;
     hashp->segbase = (char*)info->segbase;
     hashp->alloc = info->alloc;
-    hashp->dir = (SEG_OFFSET*)info->dir;
+    hashp->dir = (SegOffset*)info->dir;
 
     // Hash table already exists, we're just attaching to it.
     if (flags & HASH_ATTACH) {
@@ -145,10 +158,12 @@ HTAB* hash_create(int nelem, HASHCTL* info, int flags) {
     hashp->alloc = (dhalloc_ptr)MEM_ALLOC;
     hashp->dir = NULL;
     hashp->segbase = NULL;
+    hashp->hcxt = alloc_set_context_create(DynaHashCxt, "DynaHashTable", ALLOCSET_DEFAULT_MIN_SIZE,
+                                           ALLOCSET_DEFAULT_INIT_SIZE, ALLOCSET_DEFAULT_MAX_SIZE);
   }
 
   if (!hashp->hctl) {
-    hashp->hctl = (HHDR*)hashp->alloc(sizeof(HHDR));
+    hashp->hctl = (HashHeader*)hashp->alloc(sizeof(HashHeader));
 
     // TODO(gc): need to log this information.
     if (!hashp->hctl) {
@@ -168,7 +183,7 @@ HTAB* hash_create(int nelem, HASHCTL* info, int flags) {
     hctl->ssize = info->ssize;
     hctl->sshift = my_log2(info->ssize);
 
-    assert(hctl->ssize == (1L << hctl->sshift));
+    ASSERT(hctl->ssize == (1L << hctl->sshift));
   }
 
   if (flags & HASH_FFACTOR) {
@@ -201,62 +216,37 @@ HTAB* hash_create(int nelem, HASHCTL* info, int flags) {
   return hashp;
 }
 
-// XXX this sure looks thoroughly broken to me --- tgl 2/99.
-// It's freeing every entry individually --- but they weren't
-// allocated individually, see bucket_alloc!!  Why doesn't it crash?
-// ANSWER: it probably does crash, but is never invoked in normal
-// operations...
-// TODO(gc): double check this.
-void hash_destroy(HTAB* hashp) {
+// Free a private hash table. Its contents go with its memory context;
+// the HashTable and its control block were allocated in DynaHashCxt.
+void hash_destroy(HashTable* hashp) {
   if (hashp == NULL) {
     return;
   }
 
-  SEG_OFFSET seg_num;
-  SEGMENT segp;
-  int nsegs = hashp->hctl->nsegs;
-  int j;
-  BUCKET_INDEX* elp;
-  BUCKET_INDEX p;
-  BUCKET_INDEX q;
-  ELEMENT* curr;
-
   // Can't destroy a shared memory hash table.
-  assert(!hashp->segbase);
-  // Allocation method must be one we know how to free, too。
-  assert(hashp->alloc == (dhalloc_ptr)MEM_ALLOC);
+  ASSERT(!hashp->segbase);
+  // Allocation method must be one we know how to free, too.
+  ASSERT(hashp->alloc == (dhalloc_ptr)MEM_ALLOC);
+  ASSERT(hashp->hcxt != NULL);
 
   hash_stats("destroy", hashp);
 
-  for (seg_num = 0; nsegs > 0; nsegs--, seg_num++) {
-    segp = GET_SEG(hashp, seg_num);
-
-    for (j = 0, elp = segp; j < hashp->hctl->ssize; j++, elp++) {
-      for (p = *elp; p != INVALID_INDEX; p = q) {
-        curr = GET_BUCKET(hashp, p);
-        q = curr->next;
-        MEM_FREE((char*)curr);
-      }
-    }
-
-    MEM_FREE((char*)segp);
-  }
+  memory_context_delete(hashp->hcxt);
 
-  MEM_FREE((char*)hashp->dir);
   MEM_FREE((char*)hashp->hctl);
   MEM_FREE((char*)hashp);
 }
 
-void hash_stats(char* where, HTAB* hashp) {
+void hash_stats(char* where, HashTable* hashp) {
 #if HASH_STATISTICS
 
-  fprintf(stderr, "%s: this HTAB -- accesses %ld collisions %ld\n", where, hashp->hctl->accesses,
+  fprintf(stderr, "%s: this HashTable -- accesses %ld collisions %ld\n", where, hashp->hctl->accesses,
           hashp->hctl->collisions);
 
   fprintf(stderr, "hash_stats: keys %ld keysize %ld maxp %d segmentcount %d\n", hashp->hctl->nkeys,
           hashp->hctl->keysize, hashp->hctl->max_bucket, hashp->hctl->nsegs);
-  fprintf(stderr, "%s: total accesses %ld total collisions %ld\n", where, hash_accesses, hash_collisions);
-  fprintf(stderr, "hash_stats: total expansions %ld\n", hash_expansions);
+  fprintf(stderr, "%s: total accesses %ld total collisions %ld\n", where, HashAccesses, HashCollisions);
+  fprintf(stderr, "hash_stats: total expansions %ld\n", HashExpansions);
 
 #endif
 }
@@ -269,42 +259,64 @@ void hash_stats(char* where, HTAB* hashp) {
 //  found/removed/entered if applicable, TRUE otherwise.
 //  foundPtr is TRUE if we found an element in the table
 //  (FALSE if we entered one).
-long* hash_search(HTAB* hashp, char* key_ptr, HASHACTION action, bool* found_ptr) {
-  assert(PointerIsValid(hashp) && PointerIsValid(key_ptr));
-  assert((action == HASH_FIND) || (action == HASH_REMOVE) || (action == HASH_ENTER) || (action == HASH_FIND_SAVE) ||
+long* hash_search(HashTable* hashp, char* key_ptr, HashAction action, bool* found_ptr) {
+  return hash_search_with_hash_value(hashp, key_ptr, get_hash_value(hashp, key_ptr), action, found_ptr);
+}
+
+// Compute the hash value of a key, as used by the table's hash function.
+//
+// Callers that need the hash for their own purposes (for example to pick
+// a lock partition) can compute it once here and then pass it to
+// hash_search_with_hash_value() instead of having it recomputed.
+uint32 get_hash_value(HashTable* hashp, char* key_ptr) { return (uint32)hashp->hash(key_ptr, (int)hashp->hctl->keysize); }
+
+// Same as hash_search(), but the caller supplies the hash value of the
+// key. It must be the value get_hash_value() would return for this key,
+// since the table will rehash entries with its own function when it
+// expands.
+long* hash_search_with_hash_value(HashTable* hashp, char* key_ptr, uint32 hash_value, HashAction action,
+                                  bool* found_ptr) {
+  ASSERT(POINTER_IS_VALID(hashp) && POINTER_IS_VALID(key_ptr));
+  ASSERT((action == HASH_FIND) || (action == HASH_REMOVE) || (action == HASH_ENTER) || (action == HASH_FIND_SAVE) ||
          (action == HASH_REMOVE_SAVED));
 
   uint32 bucket;
   long segment_num;
   long segment_ndx;
-  SEGMENT segp;
-  ELEMENT* curr;
-  HHDR* hctl;
-  BUCKET_INDEX curr_index;
-  BUCKET_INDEX* prev_index_ptr;
+  Segment segp;
+  Element* curr;
+  HashHeader* hctl;
+  BucketIndex curr_index;
+  BucketIndex* prev_index_ptr;
   char* dest_addr;
 
   static struct State {
-    ELEMENT* curr_elem;
-    BUCKET_INDEX curr_index;
-    BUCKET_INDEX* prev_index;
+    Element* curr_elem;
+    BucketIndex curr_index;
+    BucketIndex* prev_index;
   } save_state;
 
   hctl = hashp->hctl;
 
 #if HASH_STATISTICS
-  hash_accesses++;
+  HashAccesses++;
   hashp->hctl->accesses++;
 #endif
 
   if (action == HASH_REMOVE_SAVED) {
+    curr = save_state.curr_elem;
+    curr_index = save_state.curr_index;
+    prev_index_ptr = save_state.prev_index;
+
+    // Should not get here unless HASH_FIND_SAVE found the element.
+    ASSERT(curr != NULL);
   } else {
-    bucket = call_hash(hashp, key_ptr);
+    bucket = calc_bucket(hctl, hash_value);
     segment_num = bucket >> hctl->sshift;
     segment_ndx = MOD(bucket, hctl->ssize);
     segp = GET_SEG(hashp, segment_num);
 
-    assert(segp != NULL);
+    ASSERT(segp != NULL);
 
     prev_index_ptr = &segp[segment_ndx];
     curr_index = *prev_index_ptr;
@@ -323,7 +335,7 @@ long* hash_search(HTAB* hashp, char* key_ptr, HASHACTION action, bool* found_ptr
       curr_index = *prev_index_ptr;
 
 #if HASH_STATISTICS
-      hash_collisions++;
+      HashCollisions++;
       hashp->hctl->collisions++;
 #endif
     }
@@ -343,7 +355,7 @@ long* hash_search(HTAB* hashp, char* key_ptr, HASHACTION action, bool* found_ptr
     case HASH_REMOVE:
     case HASH_REMOVE_SAVED:
       if (curr_index != INVALID_INDEX) {
-        assert(hctl->nkeys > 0);
+        ASSERT(hctl->nkeys > 0);
         hctl->nkeys--;
 
         // Remove record from hash bucket's chain.
@@ -384,7 +396,7 @@ long* hash_search(HTAB* hashp, char* key_ptr, HASHACTION action, bool* found_ptr
 
   //  If we got here, then we didn't find the element and we have to
   // Insert it into the hash table.
-  assert(curr_index == INVALID_INDEX);
+  ASSERT(curr_index == INVALID_INDEX);
 
   // Get the next free bucket.
   curr_index = hctl->free_bucket_index;
@@ -397,7 +409,7 @@ long* hash_search(HTAB* hashp, char* key_ptr, HASHACTION action, bool* found_ptr
     curr_index = hctl->free_bucket_index;
   }
 
-  assert(curr_index == INVALID_INDEX);
+  ASSERT(curr_index != INVALID_INDEX);
 
   curr = GET_BUCKET(hashp, curr_index);
   hctl->free_bucket_index = curr->next;
@@ -424,14 +436,14 @@ long* hash_search(HTAB* hashp, char* key_ptr, HASHACTION action, bool* found_ptr
 //  sequentially search through hash table and return
 //  all the elements one by one, return NULL on error and
 //  return TRUE in the end.
-long* hash_seq(HTAB* hashp) {
+long* hash_seq(HashTable* hashp) {
   static long S_CurBucket = 0;
-  static BUCKET_INDEX S_CurIndex;
-  ELEMENT* cur_elem;
+  static BucketIndex S_CurIndex;
+  Element* cur_elem;
   long segment_num;
   long segment_ndx;
-  SEGMENT segp;
-  HHDR* hctl;
+  Segment segp;
+  HashHeader* hctl;
 
   if (hashp == NULL) {
     S_CurBucket = 0;
@@ -481,6 +493,47 @@ long* hash_seq(HTAB* hashp) {
   return (long*)true;
 }
 
+// hash_seq_init/hash_seq_search
+//
+//  Same as hash_seq, but the scan state is kept by the caller, so that
+//  more than one scan can be going on at once. hash_seq_search returns
+//  NULL at the end. The element just returned may be removed during
+//  the scan; no other element may be.
+void hash_seq_init(HashSeqStatus* status, HashTable* hashp) {
+  status->hashp = hashp;
+  status->cur_bucket = 0;
+  status->cur_index = INVALID_INDEX;
+}
+
+long* hash_seq_search(HashSeqStatus* status) {
+  HashTable* hashp = status->hashp;
+  HashHeader* hctl = hashp->hctl;
+  Element* cur_elem;
+  Segment segp;
+
+  while (status->cur_bucket <= hctl->max_bucket) {
+    if (status->cur_index != INVALID_INDEX) {
+      cur_elem = GET_BUCKET(hashp, status->cur_index);
+      status->cur_index = cur_elem->next;
+
+      if (status->cur_index == INVALID_INDEX) {
+        ++status->cur_bucket;
+      }
+
+      return &(cur_elem->key);
+    }
+
+    segp = GET_SEG(hashp, status->cur_bucket >> hctl->sshift);
+    status->cur_index = segp[MOD(status->cur_bucket, hctl->ssize)];
+
+    if (status->cur_index == INVALID_INDEX) {
+      ++status->cur_bucket;
+    }
+  }
+
+  return NULL;
+}
+
 long hash_estimate_size(long num_entries, long keysize, long datasize) {
   long size = 0;
   long nbuckets;
@@ -501,14 +554,14 @@ long hash_estimate_size(long num_entries, long keysize, long datasize) {
   }
 
   // Dixed control info.
-  size += MAXALIGN(sizeof(HHDR));  // But not HTAB, per above.
+  size += MAX_ALIGN(sizeof(HashHeader));  // But not HashTable, per above.
   // Directory.
-  size += MAXALIGN(ndir_entries * sizeof(SEG_OFFSET));
+  size += MAX_ALIGN(ndir_entries * sizeof(SegOffset));
   // Segments.
-  size += nsegments * MAXALIGN(DEF_SEGSIZE * sizeof(BUCKET_INDEX));
+  size += nsegments * MAX_ALIGN(DEF_SEGSIZE * sizeof(BucketIndex));
   // Records --- allocated in groups of BUCKET_ALLOC_INCR.
-  record_size = sizeof(BUCKET_INDEX) + keysize + datasize;
-  record_size = MAXALIGN(record_size);
+  record_size = sizeof(BucketIndex) + keysize + datasize;
+  record_size = MAX_ALIGN(record_size);
   nrecord_allocs = (num_entries - 1) / BUCKET_ALLOC_INCR + 1;
   size += nrecord_allocs * BUCKET_ALLOC_INCR * record_size;
 
@@ -538,34 +591,36 @@ long hash_select_dirsize(long num_entries) {
   return ndir_entries;
 }
 
-static SEG_OFFSET seg_alloc(HTAB* hashp) {
-  SEGMENT segp;
-  SEG_OFFSET seg_offset;
+static SegOffset seg_alloc(HashTable* hashp) {
+  Segment segp;
+  SegOffset seg_offset;
 
-  segp = (SEGMENT)hashp->alloc(sizeof(BUCKET_INDEX) * hashp->hctl->ssize);
+  CurrentDynaHashCxt = hashp->hcxt;
+  segp = (Segment)hashp->alloc(sizeof(BucketIndex) * hashp->hctl->ssize);
 
   if (!segp) {
-    return NULL;
+    return 0;
   }
 
-  MemSet((char*)segp, 0, (long)sizeof(BUCKET_INDEX) * hashp->hctl->ssize);
+  MEMSET((char*)segp, 0, (long)sizeof(BucketIndex) * hashp->hctl->ssize);
   seg_offset = MAKE_HASHOFFSET(hashp, segp);
 
   return seg_offset;
 }
 
-static int bucket_alloc(HTAB* hashp) {
+static int bucket_alloc(HashTable* hashp) {
   int i;
-  ELEMENT* tmp_bucket;
+  Element* tmp_bucket;
   long bucket_size;
-  BUCKET_INDEX tmp_index;
-  BUCKET_INDEX last_index;
+  BucketIndex tmp_index;
+  BucketIndex last_index;
 
-  // Each bucket has a BUCKET_INDEX header plus user data.
-  bucket_size = sizeof(BUCKET_INDEX) + hashp->hctl->keysize + hashp->hctl->datasize;
+  // Each bucket has a BucketIndex header plus user data.
+  bucket_size = sizeof(BucketIndex) + hashp->hctl->keysize + hashp->hctl->datasize;
   // Make sure its aligned correctly.
-  bucket_size = MAXALIGN(bucket_size);
-  tmp_bucket = (ELEMENT*)hashp->alloc((unsigned long)BUCKET_ALLOC_INCR * bucket_size);
+  bucket_size = MAX_ALIGN(bucket_size);
+  CurrentDynaHashCxt = hashp->hcxt;
+  tmp_bucket = (Element*)hashp->alloc((unsigned long)BUCKET_ALLOC_INCR * bucket_size);
 
   if (!tmp_bucket) {
     return 0;
@@ -592,7 +647,7 @@ static int bucket_alloc(HTAB* hashp) {
   return 1;
 }
 
-static int dir_realloc(HTAB* hashp) {
+static int dir_realloc(HashTable* hashp) {
   char* p;
   char* old_p;
   long new_dsize;
@@ -605,17 +660,18 @@ static int dir_realloc(HTAB* hashp) {
 
   /* Reallocate directory */
   new_dsize = hashp->hctl->dsize << 1;
-  old_dirsize = hashp->hctl->dsize * sizeof(SEG_OFFSET);
-  new_dirsize = new_dsize * sizeof(SEG_OFFSET);
+  old_dirsize = hashp->hctl->dsize * sizeof(SegOffset);
+  new_dirsize = new_dsize * sizeof(SegOffset);
 
   old_p = (char*)hashp->dir;
+  CurrentDynaHashCxt = hashp->hcxt;
   p = (char*)hashp->alloc((unsigned long)new_dirsize);
 
   if (p != NULL) {
     memmove(p, old_p, old_dirsize);
-    MemSet(p + old_dirsize, 0, new_dirsize - old_dirsize);
+    MEMSET(p + old_dirsize, 0, new_dirsize - old_dirsize);
     MEM_FREE((char*)old_p);
-    hashp->dir = (SEG_OFFSET*)p;
+    hashp->dir = (SegOffset*)p;
     hashp->hctl->dsize = new_dsize;
     return 1;
   }
@@ -624,24 +680,24 @@ static int dir_realloc(HTAB* hashp) {
 }
 
 // Expand the table by adding one more hash bucket.
-static int expand_table(HTAB* hashp) {
-  HHDR* hctl;
-  SEGMENT old_seg;
-  SEGMENT new_seg;
+static int expand_table(HashTable* hashp) {
+  HashHeader* hctl;
+  Segment old_seg;
+  Segment new_seg;
   long old_bucket;
   long new_bucket;
   long new_segnum;
   long new_segndx;
   long old_segnum;
   long old_segndx;
-  ELEMENT* chain;
-  BUCKET_INDEX* old;
-  BUCKET_INDEX* newbi;
-  BUCKET_INDEX* chain_index;
-  BUCKET_INDEX* next_index;
-
-#ifdef HASH_STATISTICS
-  hash_expansions++;
+  Element* chain;
+  BucketIndex* old;
+  BucketIndex* newbi;
+  BucketIndex chain_index;
+  BucketIndex next_index;
+
+#if HASH_STATISTICS
+  HashExpansions++;
 #endif
 
   hctl = hashp->hctl;
@@ -712,11 +768,11 @@ static int expand_table(HTAB* hashp) {
   return 1;
 }
 
-// Set default HHDR parameters.
-static int hdefault(HTAB* hashp) {
-  HHDR* hctl;
+// Set default HashHeader parameters.
+static int hdefault(HashTable* hashp) {
+  HashHeader* hctl;
 
-  MemSet(hashp->hctl, 0, sizeof(HHDR));
+  MEMSET(hashp->hctl, 0, sizeof(HashHeader));
 
   hctl = hashp->hctl;
   hctl->ssize = DEF_SEGSIZE;
@@ -738,12 +794,12 @@ static int hdefault(HTAB* hashp) {
   return 1;
 }
 
-static int init_htab(HTAB* hashp, int nelem) {
-  SEG_OFFSET* segp;
+static int init_htab(HashTable* hashp, int nelem) {
+  SegOffset* segp;
 
   int nbuckets;
   int nsegs;
-  HHDR* hctl;
+  HashHeader* hctl;
 
   hctl = hashp->hctl;
 
@@ -773,7 +829,8 @@ static int init_htab(HTAB* hashp, int nelem) {
 
   // Allocate a directory.
   if (!(hashp->dir)) {
-    hashp->dir = (SEG_OFFSET*)hashp->alloc(hctl->dsize * sizeof(SEG_OFFSET));
+    CurrentDynaHashCxt = hashp->hcxt;
+    hashp->dir = (SegOffset*)hashp->alloc(hctl->dsize * sizeof(SegOffset));
 
     if (!hashp->dir) {
       return -1;
@@ -784,14 +841,14 @@ static int init_htab(HTAB* hashp, int nelem) {
   for (segp = hashp->dir; hctl->nsegs < nsegs; hctl->nsegs++, segp++) {
     *segp = seg_alloc(hashp);
 
-    if (*segp == (SEG_OFFSET)0) {
+    if (*segp == (SegOffset)0) {
       return -1;
     }
   }
 
 #if HASH_DEBUG
   fprintf(stderr, "%s\n%s%x\n%s%d\n%s%d\n%s%d\n%s%d\n%s%d\n%s%x\n%s%x\n%s%d\n%s%d\n", "init_htab:", "TABLE POINTER   ",
-          hashp, "DIRECTORY SIZE  ", hctl->dsize, "SEGMENT SIZE    ", hctl->ssize, "SEGMENT SHIFT   ", hctl->sshift,
+          hashp, "DIRECTORY SIZE  ", hctl->dsize, "Segment SIZE    ", hctl->ssize, "Segment SHIFT   ", hctl->sshift,
           "FILL FACTOR     ", hctl->ffactor, "MAX BUCKET      ", hctl->max_bucket, "HIGH MASK       ", hctl->high_mask,
           "LOW  MASK       ", hctl->low_mask, "NSEGS           ", hctl->nsegs, "NKEYS           ", hctl->nkeys);
 #endif
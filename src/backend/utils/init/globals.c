@@ -31,6 +31,7 @@
 #include "rdbms/miscadmin.h"
 #include "rdbms/postgres.h"
 #include "rdbms/storage/backendid.h"
+#include "rdbms/storage/proc.h"
 #include "rdbms/utils/rel.h"
 
 ProtocolVersion FrontendProtocol = PG_PROTOCOL_LATEST;
@@ -46,6 +47,7 @@ volatile uint32 InterruptHoldoffCount = 0;
 volatile uint32 CritSectionCount = 0;
 
 int MyProcPid;
+Proc* MyProc = NULL;  // This backend's entry in the proc table
 struct Port* MyProcPort;
 long MyCancelKey;
 
@@ -80,6 +82,7 @@ char DateFormat[20] = "%d-%m-%Y";  // mjl: sizes! or better malloc? XXX.
 char FloatFormat[20] = "%f";
 
 bool EnableFsync = true;
+bool EnableDirectIo = false;
 bool AllowSystemTableMods = false;
 int SortMem = 512;
 int NBuffers = 16;
@@ -18,10 +18,14 @@
 #include <unistd.h>
 
 #include "rdbms/postgres.h"
+#include "rdbms/postmaster/autoprewarm.h"
+#include "rdbms/postmaster/bgwriter.h"
+#include "rdbms/storage/bufmgr.h"
+#include "rdbms/storage/fd.h"
+#include "rdbms/storage/smgr.h"
 
 // XXX these should be in other modules' header files.
 extern bool LogConnections;
-extern int CheckPointTimeout;
 extern int CommitDelay;
 extern int CommitSiblings;
 extern bool FixBTree;
@@ -133,6 +137,11 @@ static struct ConfigBool ConfigureNamesBool[] = {{"enable_seqscan", PGC_USERSET,
                                                  {"tcpip_socket", PGC_POSTMASTER, &NetServer, false},
                                                  {"ssl", PGC_POSTMASTER, &EnableSSL, false},
                                                  {"fsync", PGC_SIGHUP, &enableFsync, true},
+                                                 {"direct_io", PGC_POSTMASTER, &EnableDirectIo, false},
+                                                 {"defer_commit_fsync", PGC_SIGHUP, &DeferCommitFsync, false},
+#ifdef STABLE_MEMORY_STORAGE
+                                                 {"memory_storage", PGC_POSTMASTER, &EnableMemoryStorage, false},
+#endif
                                                  {"silent_mode", PGC_POSTMASTER, &SilentMode, false},
 
                                                  {"log_connections", PGC_SIGHUP, &Log_connections, false},
@@ -173,6 +182,8 @@ static struct ConfigBool ConfigureNamesBool[] = {{"enable_seqscan", PGC_USERSET,
 
                                                  {"fixbtree", PGC_POSTMASTER, &FixBTree, true},
 
+                                                 {"autoprewarm", PGC_POSTMASTER, &AutoPrewarm, false},
+
                                                  {NULL, 0, NULL, false}};
 
 static struct ConfigInt ConfigureNamesInt[] = {
@@ -195,10 +206,22 @@ static struct ConfigInt ConfigureNamesInt[] = {
      */
     {"max_connections", PGC_POSTMASTER, &MaxBackends, DEF_MAXBACKENDS, 1, MAXBACKENDS},
     {"shared_buffers", PGC_POSTMASTER, &NBuffers, DEF_NBUFFERS, 16, INT_MAX},
+    {"temp_buffers", PGC_USERSET, &NumTempBuffers, 1000, 100, INT_MAX},
+    {"async_io_depth", PGC_USERSET, &AsyncIoDepth, 32, 0, MAX_ASYNC_BUFS},
+    {"max_files_per_process", PGC_POSTMASTER, &MaxFilesPerProcess, 1000, 25, INT_MAX},
+#ifdef STABLE_MEMORY_STORAGE
+    {"memory_storage_blocks", PGC_POSTMASTER, &MemStorageBlocks, 1024, 16, INT_MAX},
+#endif
     {"port", PGC_POSTMASTER, &PostPortNumber, DEF_PGPORT, 1, 65535},
 
     {"sort_mem", PGC_USERSET, &SortMem, 512, 1, INT_MAX},
 
+    {"bgwriter_delay", PGC_SIGHUP, &BgWriterDelay, 200, 10, 10000},
+    {"bgwriter_lru_maxpages", PGC_SIGHUP, &BgWriterLruMaxPages, 100, 0, 1000},
+
+    {"autoprewarm_interval", PGC_SIGHUP, &AutoPrewarmInterval, 300, 0, INT_MAX},
+    {"autoprewarm_delay", PGC_SIGHUP, &AutoPrewarmDelay, 10, 0, 10000},
+
     {"debug_level", PGC_USERSET, &DebugLvl, 0, 0, 16},
 
 #ifdef LOCK_DEBUG
@@ -232,6 +255,9 @@ static struct ConfigReal ConfigureNamesReal[] = {
     {"cpu_index_tuple_cost", PGC_USERSET, &cpu_index_tuple_cost, DEFAULT_CPU_INDEX_TUPLE_COST, 0, DBL_MAX},
     {"cpu_operator_cost", PGC_USERSET, &cpu_operator_cost, DEFAULT_CPU_OPERATOR_COST, 0, DBL_MAX},
 
+    {"bgwriter_lru_multiplier", PGC_SIGHUP, &BgWriterLruMultiplier, 2.0, 0.0, 10.0},
+    {"checkpoint_completion_target", PGC_SIGHUP, &CheckPointCompletionTarget, 0.5, 0.0, 1.0},
+
     {"geqo_selection_bias", PGC_USERSET, &Geqo_selection_bias, DEFAULT_GEQO_SELECTION_BIAS, MIN_GEQO_SELECTION_BIAS,
      MAX_GEQO_SELECTION_BIAS},
 
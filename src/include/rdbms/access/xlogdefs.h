@@ -14,6 +14,8 @@
 #ifndef RDBMS_ACCESS_XLOG_DEFS_H_
 #define RDBMS_ACCESS_XLOG_DEFS_H_
 
+#include "rdbms/c.h"
+
 // Pointer to a location in the XLOG. These pointers are 64 bits wide,
 // because we don't want them ever to overflow.
 //
@@ -1,38 +1,24 @@
-/*-------------------------------------------------------------------------
- *
- * catalog.h
- *	  prototypes for functions in lib/catalog/catalog.c
- *
- *
- * Portions Copyright (c) 1996-2001, PostgreSQL Global Development Group
- * Portions Copyright (c) 1994, Regents of the University of California
- *
- * $Id: catalog.h,v 1.16 2001/03/22 04:00:34 momjian Exp $
- *
- *-------------------------------------------------------------------------
- */
-#ifndef CATALOG_H
-#define CATALOG_H
+//===----------------------------------------------------------------------===//
+//
+// catalog.h
+//  prototypes for functions in backend/catalog/catalog.c
+//
+//
+// Portions Copyright (c) 1996-2001, PostgreSQL Global Development Group
+// Portions Copyright (c) 1994, Regents of the University of California
+//
+// $Id: catalog.h,v 1.16 2001/03/22 04:00:34 momjian Exp $
+//
+//===----------------------------------------------------------------------===//
+#ifndef RDBMS_CATALOG_CATALOG_H_
+#define RDBMS_CATALOG_CATALOG_H_
 
-#include "rdbms/access/tupdesc.h"
-
-#ifdef OLD_FILE_NAMING
-
-extern char* relpath(const char* relname);
-extern char* relpath_blind(const char* dbname, const char* relname, Oid dbid,
-                           Oid relid);
-
-#else
 #include "rdbms/storage/relfilenode.h"
 
-extern char* relpath(RelFileNode rnode);
-extern char* GetDatabasePath(Oid tblNode);
-
-#endif
-
-extern bool IsSystemRelationName(const char* relname);
-extern bool IsSharedSystemRelationName(const char* relname);
+char* relpath(RelFileNode rnode);
+char* get_database_path(Oid tbl_node);
 
-extern Oid newoid(void);
+bool is_system_relation_name(const char* relname);
+bool is_shared_system_relation_name(const char* relname);
 
-#endif /* CATALOG_H */
+#endif  // RDBMS_CATALOG_CATALOG_H_
@@ -66,6 +66,14 @@
 
 #define MAX_PG_PATH 1024
 
+// Assumed cache line size. Heavily contended shared structures are padded
+// to this size so that two of them never share a line.
+#define CACHE_LINE_SIZE 64
+
+// Alignment the kernel wants of buffers, file offsets and lengths for
+// direct I/O (see EnableDirectIo). BLCKSZ must be a multiple of it.
+#define IO_ALIGN_SIZE 4096
+
 // Memory context debug.
 #define MEMORY_CONTEXT_CHECKING
 #define HAVE_ALLOC_INFO
@@ -84,4 +92,8 @@
 
 #define SIZEOF_DATUM 8
 
+// Build the main memory storage manager (mm.c), which keeps relations in
+// shared memory instead of files when memory_storage is on.
+#define STABLE_MEMORY_STORAGE
+
 #endif  // RDBMS_CONFIG_H_
\ No newline at end of file
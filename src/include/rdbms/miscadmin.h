@@ -145,6 +145,7 @@ extern char FloatFormat[];
 extern char DateFormat[];
 
 extern bool EnableFsync;
+extern bool EnableDirectIo;
 extern bool AllowSystemTableMods;
 extern int SortMem;
 
@@ -0,0 +1,32 @@
+//===----------------------------------------------------------------------===//
+//
+// autoprewarm.h
+//  Exports from postmaster/autoprewarm.c.
+//
+//
+// Portions Copyright (c) 1996-2001, PostgreSQL Global Development Group
+// Portions Copyright (c) 1994, Regents of the University of California
+//
+//===----------------------------------------------------------------------===//
+#ifndef RDBMS_POSTMASTER_AUTOPREWARM_H_
+#define RDBMS_POSTMASTER_AUTOPREWARM_H_
+
+#include <sys/types.h>
+
+#include "rdbms/c.h"
+
+// Name of the dump file, relative to DataDir.
+#define AUTOPREWARM_FILE "pg_buffer_tags"
+
+// GUC options.
+extern bool AutoPrewarm;
+extern int AutoPrewarmInterval;
+extern int AutoPrewarmDelay;
+
+Size autoprewarm_shmem_size(void);
+void autoprewarm_shmem_init(void);
+int dump_buffer_tags(void);
+pid_t start_buffer_loader(void);
+void buffer_loader_main(void);
+
+#endif  // RDBMS_POSTMASTER_AUTOPREWARM_H_
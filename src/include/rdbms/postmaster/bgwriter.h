@@ -0,0 +1,51 @@
+//===----------------------------------------------------------------------===//
+//
+// bgwriter.h
+//  Exports from postmaster/bgwriter.c.
+//
+//
+// Portions Copyright (c) 1996-2001, PostgreSQL Global Development Group
+// Portions Copyright (c) 1994, Regents of the University of California
+//
+//===----------------------------------------------------------------------===//
+#ifndef RDBMS_POSTMASTER_BGWRITER_H_
+#define RDBMS_POSTMASTER_BGWRITER_H_
+
+#include <sys/types.h>
+
+#include "rdbms/c.h"
+#include "rdbms/storage/block.h"
+#include "rdbms/storage/relfilenode.h"
+
+// Counters for tuning the background writer. They only ever grow; sample
+// them twice and subtract to get rates.
+typedef struct BgWriterStats {
+  uint64 buf_written_clean;    // Buffers written by the background writer
+  uint64 maxwritten_clean;     // Rounds stopped by bgwriter_lru_maxpages
+  uint64 buf_written_backend;  // Dirty victims backends had to write
+  uint64 buf_alloc;            // Buffers allocated from the shared pool
+} BgWriterStats;
+
+// GUC options.
+extern int CheckPointTimeout;
+extern double CheckPointCompletionTarget;
+extern int BgWriterDelay;
+extern int BgWriterLruMaxPages;
+extern double BgWriterLruMultiplier;
+
+Size bgwriter_shmem_size(void);
+void bgwriter_shmem_init(void);
+pid_t start_background_writer(void);
+void background_writer_main(void);
+bool bgwriter_shutdown_requested(void);
+
+void bgwriter_count_backend_write(void);
+void bgwriter_count_clean(int num_written, bool hit_max, uint32 num_allocs);
+void bgwriter_get_stats(BgWriterStats* stats);
+
+bool bgwriter_takes_fsync_requests(void);
+bool forward_fsync_request(RelFileNode rnode, BlockNumber seg_no);
+uint32 fsync_request_cycle(void);
+void absorb_fsync_requests(void);
+
+#endif  // RDBMS_POSTMASTER_BGWRITER_H_
@@ -0,0 +1,34 @@
+//===----------------------------------------------------------------------===//
+//
+// aio.h
+//  Asynchronous I/O through io_uring.
+//
+//
+// Portions Copyright (c) 1996-2001, PostgreSQL Global Development Group
+// Portions Copyright (c) 1994, Regents of the University of California
+//
+//===----------------------------------------------------------------------===//
+#ifndef RDBMS_STORAGE_AIO_H_
+#define RDBMS_STORAGE_AIO_H_
+
+#include <sys/uio.h>
+
+#include "rdbms/c.h"
+
+// Most I/Os a process can have in flight, and most buffers in one I/O.
+#define AIO_MAX_IN_FLIGHT 64
+#define AIO_MAX_IOV       16
+
+// The outcome of an I/O, as aio_reap() returns it.
+typedef struct AioResult {
+  uint64 id;   // What the I/O was started with
+  int result;  // Bytes transferred, or -errno
+} AioResult;
+
+bool aio_available(void);
+int aio_start_readv(int fd, const struct iovec* iov, int iovcnt, long offset, uint64 id);
+int aio_start_writev(int fd, const struct iovec* iov, int iovcnt, long offset, uint64 id);
+int aio_in_flight(void);
+int aio_reap(AioResult* results, int max_results, int min_results);
+
+#endif  // RDBMS_STORAGE_AIO_H_
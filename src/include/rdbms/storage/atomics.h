@@ -0,0 +1,95 @@
+//===----------------------------------------------------------------------===//
+//
+// atomics.h
+//  Atomic operations on shared memory words.
+//
+//  These wrap the compiler's __atomic builtins. All operations are
+//  sequentially consistent, i.e. they act as full memory barriers,
+//  except atomic_read_u32() and atomic_write_u32() which only guarantee
+//  that the access is not torn and not optimized away.
+//
+// Portions Copyright (c) 1996=2000, PostgreSQL, Inc
+// Portions Copyright (c) 1994, Regents of the University of California
+//
+//===----------------------------------------------------------------------===//
+#ifndef RDBMS_STORAGE_ATOMICS_H_
+#define RDBMS_STORAGE_ATOMICS_H_
+
+#include "rdbms/c.h"
+
+typedef struct AtomicUint32 {
+  volatile uint32 value;
+} AtomicUint32;
+
+// Initialize the variable. Not atomic; the variable must not be
+// concurrently accessed yet.
+static inline void atomic_init_u32(volatile AtomicUint32* ptr, uint32 val) { ptr->value = val; }
+
+static inline uint32 atomic_read_u32(volatile AtomicUint32* ptr) {
+  return __atomic_load_n(&ptr->value, __ATOMIC_RELAXED);
+}
+
+static inline void atomic_write_u32(volatile AtomicUint32* ptr, uint32 val) {
+  __atomic_store_n(&ptr->value, val, __ATOMIC_RELAXED);
+}
+
+// Write val with release semantics: stores before it become visible to
+// other processes no later than val itself. Used to release locks.
+static inline void atomic_unlocked_write_u32(volatile AtomicUint32* ptr, uint32 val) {
+  __atomic_store_n(&ptr->value, val, __ATOMIC_RELEASE);
+}
+
+// Read with acquire semantics: loads after it see at least what was
+// stored before the atomic_unlocked_write_u32() that stored the value.
+static inline uint32 atomic_read_acquire_u32(volatile AtomicUint32* ptr) {
+  return __atomic_load_n(&ptr->value, __ATOMIC_ACQUIRE);
+}
+
+// Keep loads before the barrier from being reordered after loads
+// following it. Readers of a sequence lock need one between reading the
+// protected data and reading the sequence number again.
+static inline void atomic_read_barrier(void) { __atomic_thread_fence(__ATOMIC_ACQUIRE); }
+
+// If *ptr equals *expected, replace it with newval and return true.
+// Otherwise store the current value in *expected and return false.
+static inline bool atomic_compare_exchange_u32(volatile AtomicUint32* ptr, uint32* expected, uint32 newval) {
+  return __atomic_compare_exchange_n(&ptr->value, expected, newval, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+// The fetch_* operations return the value before the operation.
+static inline uint32 atomic_fetch_add_u32(volatile AtomicUint32* ptr, int32 add) {
+  return __atomic_fetch_add(&ptr->value, add, __ATOMIC_SEQ_CST);
+}
+
+static inline uint32 atomic_fetch_sub_u32(volatile AtomicUint32* ptr, int32 sub) {
+  return __atomic_fetch_sub(&ptr->value, sub, __ATOMIC_SEQ_CST);
+}
+
+static inline uint32 atomic_fetch_or_u32(volatile AtomicUint32* ptr, uint32 or_) {
+  return __atomic_fetch_or(&ptr->value, or_, __ATOMIC_SEQ_CST);
+}
+
+static inline uint32 atomic_fetch_and_u32(volatile AtomicUint32* ptr, uint32 and_) {
+  return __atomic_fetch_and(&ptr->value, and_, __ATOMIC_SEQ_CST);
+}
+
+// 64-bit counters. Only what statistics need: no compare-and-swap.
+typedef struct AtomicUint64 {
+  volatile uint64 value;
+} AtomicUint64;
+
+static inline void atomic_init_u64(volatile AtomicUint64* ptr, uint64 val) { ptr->value = val; }
+
+static inline uint64 atomic_read_u64(volatile AtomicUint64* ptr) {
+  return __atomic_load_n(&ptr->value, __ATOMIC_RELAXED);
+}
+
+static inline void atomic_write_u64(volatile AtomicUint64* ptr, uint64 val) {
+  __atomic_store_n(&ptr->value, val, __ATOMIC_RELAXED);
+}
+
+static inline uint64 atomic_fetch_add_u64(volatile AtomicUint64* ptr, int64 add) {
+  return __atomic_fetch_add(&ptr->value, add, __ATOMIC_SEQ_CST);
+}
+
+#endif  // RDBMS_STORAGE_ATOMICS_H_
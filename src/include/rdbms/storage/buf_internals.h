@@ -14,30 +14,71 @@
 #define RDBMS_STORAGE_BUF_INTERNALS_H_
 
 #include "rdbms/postgres.h"
+#include "rdbms/storage/atomics.h"
 #include "rdbms/storage/block.h"
 #include "rdbms/storage/buf.h"
+#include "rdbms/storage/bufmgr.h"
+#include "rdbms/storage/condition_variable.h"
+#include "rdbms/storage/lwlock.h"
 #include "rdbms/storage/relfilenode.h"
+#include "rdbms/storage/s_lock.h"
 #include "rdbms/storage/shmem.h"
 #include "rdbms/utils/rel.h"
 
 // bufmgr.c
 extern int DataDescriptors;
-extern int FreeListDescriptors;
 extern int LookupListDescriptors;
 extern int NumDescriptors;
 extern int ShowPinTrace;
 
+// Buffer state is a single 32-bit word holding the reference count, the
+// usage count and the flags, so that a buffer can be pinned with one
+// compare-and-swap:
+//
+//  18 bits refcount
+//   4 bits usage count
+//  10 bits flags
+#define BUF_REFCOUNT_ONE      1
+#define BUF_REFCOUNT_MASK     ((1U << 18) - 1)
+#define BUF_USAGECOUNT_MASK   0x003C0000U
+#define BUF_USAGECOUNT_ONE    (1U << 18)
+#define BUF_USAGECOUNT_SHIFT  18
+#define BUF_FLAG_MASK         0xFFC00000U
+
+// Get refcount and usage_count from buffer state.
+#define BUF_STATE_GET_REFCOUNT(state)   ((state)&BUF_REFCOUNT_MASK)
+#define BUF_STATE_GET_USAGECOUNT(state) (((state)&BUF_USAGECOUNT_MASK) >> BUF_USAGECOUNT_SHIFT)
+
 // Flags for buffer descriptors.
-#define BM_DIRTY          (1 << 0)
-#define BM_PRIVATE        (1 << 1)
-#define BM_VALID          (1 << 2)
-#define BM_DELETED        (1 << 3)
-#define BM_FREE           (1 << 4)
-#define BM_IO_IN_PROGRESS (1 << 5)
-#define BM_IO_ERROR       (1 << 6)
-#define BM_JUST_DIRTIED   (1 << 7)
+//
+// BM_LOCKED is the buffer header lock: while it is set, only the holder
+// may change the state word (or the tag).
+#define BM_LOCKED         (1U << 22)
+#define BM_DIRTY          (1U << 23)
+#define BM_PRIVATE        (1U << 24)
+#define BM_VALID          (1U << 25)
+#define BM_DELETED        (1U << 26)
+#define BM_IO_IN_PROGRESS (1U << 27)
+#define BM_IO_ERROR       (1U << 28)
+#define BM_JUST_DIRTIED   (1U << 29)
+#define BM_CHECKPOINT_NEEDED (1U << 30)  // Must write for checkpoint
+
+typedef uint32 BufFlags;
 
-typedef bits16 BufFlags;
+// The maximum value of usage_count. Every pin bumps the count (up to
+// this limit) and every pass of the clock hand decrements it, so a
+// buffer survives at most BM_MAX_USAGE_COUNT sweeps without being used.
+// Larger values make hot pages stickier but lengthen the search for a
+// victim when the pool is full of them.
+#define BM_MAX_USAGE_COUNT 5
+
+#if BM_MAX_USAGE_COUNT + 1 != BUF_USAGE_HISTOGRAM_SIZE
+#error "BUF_USAGE_HISTOGRAM_SIZE doesn't match BM_MAX_USAGE_COUNT"
+#endif
+
+#if BM_MAX_USAGE_COUNT > (1 << (32 - BUF_USAGECOUNT_SHIFT - 10)) - 1
+#error "BM_MAX_USAGE_COUNT doesn't fit in BUF_USAGECOUNT_MASK"
+#endif
 
 // long* so alignment will be correct.
 typedef long** BufferBlock;
@@ -64,10 +105,79 @@ typedef struct bufblindid {
 #define BAD_BUFFER_ID(bid) ((bid) < 1 || (bid) > NBuffers)
 #define INVALID_DESCRIPTOR (-3)
 
+// Special values for free_next. A buffer that is not on the freelist has
+// FREENEXT_NOT_IN_LIST; the last buffer on the freelist has
+// FREENEXT_END_OF_LIST.
+#define FREENEXT_END_OF_LIST (-1)
+#define FREENEXT_NOT_IN_LIST (-2)
+
+// The shared buffer mapping table is split into NUM_BUFFER_PARTITIONS
+// partitions, each with its own lock. A tag's partition is chosen by the
+// low bits of its hash code (see buf_table_hash_code()), so must be a
+// power of 2 for the division in buf_table.c to leave the rest intact.
+#define NUM_BUFFER_PARTITIONS 16
+
+#define BUF_TABLE_HASH_PARTITION(hash_code) ((hash_code) % NUM_BUFFER_PARTITIONS)
+
+// A mapping partition lock, padded so that neighbouring partitions never
+// share a cache line.
+typedef struct BufMappingLock {
+  TasLock lock;
+  char pad[CACHE_LINE_SIZE - sizeof(TasLock)];
+} BufMappingLock;
+
+#define BUF_MAPPING_PARTITION_LOCK(hash_code) (&BufMappingLocks[BUF_TABLE_HASH_PARTITION(hash_code)].lock)
+
+// The index of the buffers of each relation is partitioned the same way,
+// by the hash code of the RelFileNode (see buf_rel_hash_code()).
+#define BUF_REL_PARTITION_LOCK(hash_code) (&BufRelLocks[BUF_TABLE_HASH_PARTITION(hash_code)].lock)
+
 // BufferDesc
 //  shared buffer cache metadata for a single
 //  shared buffer descriptor.
 //
+//  The freelist only holds buffers that contain nothing useful (never
+//  used, or invalidated by a relation drop). Everything else is found by
+//  the clock sweep in freelist.c, so pinning and unpinning a buffer never
+//  touches the freelist links.
+//
+//  state packs the reference count, the usage count and the flags. Pins
+//  and unpins change it with a compare-and-swap; anything that needs to
+//  change the tag, or several fields consistently, takes the header lock
+//  (BM_LOCKED in state) with lock_buf_hdr(). CAS loops must not change a
+//  locked state word, since unlock_buf_hdr() overwrites it. To change the
+//  tag the buffer's mapping partition lock must be held as well, so a
+//  backend holding either one sees a stable tag.
+//
+//  Only what pins, lookups and the clock sweep need is kept here, padded
+//  to one cache line: the shared array is cache-line aligned (see
+//  init_buffer_pool()), so a scan over the descriptors touches one line
+//  per buffer and no two buffers share a line. Rarely used data lives in
+//  the parallel BufferDescCold array.
+// TODO(gc): buffer是在共享内存中的还是
+typedef union SbufDesc {
+  struct {
+    // Tag and id must be together for table lookup to work
+    BufferTag tag;  // File/block identifier
+    int buf_id;     // Maps global desc to local desc
+
+    AtomicUint32 state;  // Refcount, usage count and flags; see above
+
+    int free_next;     // Link in freelist chain, or FREENEXT_NOT_IN_LIST
+    ShmemOffset data;  // Pointer to data in buf pool
+
+    LWLock content_lock;  // To lock access to buffer contents
+    bool cntx_dirty;      // New way to mark block as dirty
+  };
+
+  char pad[CACHE_LINE_SIZE];
+} BufferDesc;
+
+_Static_assert(sizeof(BufferDesc) == CACHE_LINE_SIZE, "BufferDesc doesn't fit in one cache line");
+
+// BufferDescCold
+//  the rarely used part of a shared buffer descriptor, indexed by buf_id.
+//
 //  We keep the name of the database and relation in which this
 //  buffer appears in order to avoid a catalog lookup on cache
 //  flush if we don't have the reldesc in the cache. It is also
@@ -75,24 +185,7 @@ typedef struct bufblindid {
 //  not visible to all backends at the time that it gets flushed.
 //  Dbname, relname, dbid, and relid are enough to determine where
 //  to put the buffer, for all storage managers.
-// TODO(gc): buffer是在共享内存中的还是
-typedef struct SbufDesc {
-  Buffer free_next;  // Links for freelist chain.
-  Buffer free_prev;
-  ShmemOffset data;  // Pointer to data in buf pool
-
-  // Tag and id must be together for table lookup to work
-  BufferTag tag;  // File/block identifier
-  int buf_id;     // Maps global desc to local desc
-
-  BufFlags flags;      // See bit definitions above
-  unsigned ref_count;  // # of times buffer is pinned
-
-  unsigned r_locks;  // # of shared locks
-  bool ri_lock;      // Read-intent lock
-  bool w_lock;       // Context exclusively locked
-  bool cntx_dirty;   // New way to mark block as dirty
-
+typedef struct BufferDescCold {
   BufferBlindId blind;  // Extra info to support blind write
 
   // When we can't delete item from page (someone else has buffer
@@ -100,19 +193,39 @@ typedef struct SbufDesc {
   // buffer content cleanup function. Buffer will be cleaned up from
   // release buffer functions.
   void (*cleanup_func)(Buffer);
-} BufferDesc;
+
+  // Links in the list of the buffers of the relation in tag, protected
+  // by the relation's BufRelLocks partition lock; see buf_rel_insert().
+  int rel_next;
+  int rel_prev;
+
+  // Broadcast whenever BM_IO_IN_PROGRESS clears; see wait_io().
+  ConditionVariable io_cv;
+} BufferDescCold;
+
+#define BUFFER_DESCRIPTOR_GET_COLD(desc) (&BufferDescriptorsCold[(desc)->buf_id])
 
 #define BUFFER_DESCRIPTOR_GET_BUFFER(desc) ((desc)->buf_id + 1)
 
-// Each backend has its own BufferLocks[] array holding flag bits
-// showing what locks it has set on each buffer.
+// Release the header lock, storing state (which must have BM_LOCKED set,
+// as returned by lock_buf_hdr()) as the new state word.
+#define UNLOCK_BUF_HDR(buf_hdr, s) atomic_unlocked_write_u32(&(buf_hdr)->state, (s) & ~BM_LOCKED)
+
+// Each backend keeps, for every shared buffer it has pinned, its own pin
+// count and flag bits showing what content locks it holds on the buffer;
+// see get_private_refcount_entry().
 //
-// We have to free these locks in elog(ERROR)...
+// We have to free these locks in elog(ERROR); see unlock_buffers().
 #define BL_IO_IN_PROGRESS (1 << 0) /* unimplemented */
 #define BL_R_LOCK         (1 << 1)
-#define BL_RI_LOCK        (1 << 2)
 #define BL_W_LOCK         (1 << 3)
 
+typedef struct PrivateRefCountEntry {
+  Buffer buffer;  // Key; INVALID_BUFFER if the entry is free
+  long refcount;  // Pins this backend holds on the buffer
+  bits8 locks;    // BL_* content lock flags
+} PrivateRefCountEntry;
+
 // Mao tracing buffer allocation.
 #ifdef BMTRACE
 
@@ -135,38 +248,69 @@ typedef struct BufMgrTrace {
 
 // freelist.c
 void add_buffer_to_freelist(BufferDesc* buf_desc);
+uint32 lock_buf_hdr(BufferDesc* buf_desc);
+uint32 wait_buf_hdr_unlocked(BufferDesc* buf_desc);
 void pin_buffer(BufferDesc* buf_desc);
+void pin_buffer_locked(BufferDesc* buf_desc);
 void pin_buffer_debug(char* file, int line, BufferDesc* buf_desc);
 void unpin_buffer(BufferDesc* buf_desc);
-BufferDesc* get_free_buffer(void);
+BufferDesc* get_free_buffer(BufferAccessStrategy strategy, uint32* buf_state);
+int strategy_sync_start(uint32* complete_passes, uint32* num_buffer_allocs);
+void strategy_notify_bgwriter(pid_t bgwriter_pid);
+void strategy_wake_bgwriter(void);
+bool have_free_buffer(void);
+Size strategy_shmem_size(void);
 void init_freelist(bool init);
 
 // buf_table.c.
+extern BufMappingLock* BufMappingLocks;
+extern BufMappingLock* BufRelLocks;
+
+Size buf_table_shmem_size(void);
 void init_buf_table();
-BufferDesc* buf_table_lookup(BufferTag* tag_ptr);
-bool buf_table_delete(BufferDesc* buf_desc);
-bool buf_table_insert(BufferDesc* buf_desc);
+uint32 buf_table_hash_code(BufferTag* tag_ptr);
+BufferDesc* buf_table_lookup(BufferTag* tag_ptr, uint32 hash_code);
+int buf_table_insert(BufferTag* tag_ptr, uint32 hash_code, int buf_id);
+void buf_table_delete(BufferTag* tag_ptr, uint32 hash_code);
+uint32 buf_rel_hash_code(RelFileNode* rnode);
+void buf_rel_insert(BufferDesc* buf_desc, RelFileNode rnode);
+void buf_rel_delete(BufferDesc* buf_desc, RelFileNode rnode);
+int buf_rel_lookup(RelFileNode rnode, int** buf_ids);
+
+// buf_stats.c.
+typedef enum BufStatsCounter {
+  BUF_STATS_HIT,
+  BUF_STATS_READ,
+  BUF_STATS_WRITE,
+  BUF_STATS_NUM_COUNTERS
+} BufStatsCounter;
+
+Size buf_stats_shmem_size(void);
+void init_buf_stats(bool init);
+void buf_stats_count(RelFileNode rnode, BufStatsCounter counter);
+void buf_stats_forget(RelFileNode rnode);
 
 // bufmgr.c.
 extern BufferDesc* BufferDescriptors;
+extern BufferDescCold* BufferDescriptorsCold;
 extern BufferBlock BufferBlocks;
-extern long* PrivateRefCount;
-extern bits8* BufferLocks;
-extern BufferTag* BufferTagLastDirtied;
-extern BufferBlindId* BufferBlindLastDirtied;
-extern bool* BufferDirtiedByMe;
 extern SpinLock BufMgrLock;
 
+void reserve_private_refcount_entry(void);
+PrivateRefCountEntry* get_private_refcount_entry(Buffer buffer, bool create);
+void forget_private_refcount_entry(PrivateRefCountEntry* ref);
+
 // localbuf.c.
 extern long* LocalRefCount;
 extern BufferDesc* LocalBufferDescriptors;
 extern int NLocBuffer;
 
-Buffer* local_buffer_alloc(Relation relation, BlockNumber block_num, bool* found_ptr);
+BufferDesc* local_buffer_alloc(Relation relation, BlockNumber block_num, bool* found_ptr);
 int write_local_buffer(Buffer buffer, bool release);
 int flush_local_buffer(Buffer buffer, bool release);
 void init_local_buffer(void);
 void local_buffer_sync();
 void reset_local_buffer_pool();
+void drop_local_relation_buffers(Relation relation, BlockNumber first_del_block);
 
 #endif  // RDBMS_STORAGE_BUF_INTERNALS_H_
@@ -0,0 +1,32 @@
+//===----------------------------------------------------------------------===//
+//
+// buffile.h
+//  Buffered temporary files.
+//
+//
+// Portions Copyright (c) 1996-2001, PostgreSQL Global Development Group
+// Portions Copyright (c) 1994, Regents of the University of California
+//
+//===----------------------------------------------------------------------===//
+#ifndef RDBMS_STORAGE_BUFFILE_H_
+#define RDBMS_STORAGE_BUFFILE_H_
+
+#include <stddef.h>
+
+#include "rdbms/c.h"
+
+// BufFile is an opaque type whose details are not known outside
+// buffile.c.
+typedef struct BufFile BufFile;
+
+BufFile* buf_file_create_temp(bool compress);
+void buf_file_close(BufFile* file);
+size_t buf_file_read(BufFile* file, void* ptr, size_t size);
+size_t buf_file_write(BufFile* file, void* ptr, size_t size);
+int buf_file_seek(BufFile* file, long offset, int whence);
+long buf_file_tell(BufFile* file);
+int buf_file_seek_block(BufFile* file, long blknum);
+long buf_file_tell_block(BufFile* file);
+long buf_file_size(BufFile* file);
+
+#endif  // RDBMS_STORAGE_BUFFILE_H_
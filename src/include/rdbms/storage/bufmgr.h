@@ -20,14 +20,50 @@
 
 typedef void* Block;
 
+// Possible arguments for get_access_strategy().
+typedef enum BufferAccessStrategyType {
+  BAS_NORMAL,     // Normal random access
+  BAS_BULKREAD,   // Large read-only scan
+  BAS_BULKWRITE,  // Large multi-block write (e.g. COPY IN)
+  BAS_VACUUM      // VACUUM
+} BufferAccessStrategyType;
+
+// A private ring of buffers for a bulk operation; see freelist.c.
+typedef struct BufferAccessStrategyData* BufferAccessStrategy;
+
+// Number of distinct usage counts, 0 .. BM_MAX_USAGE_COUNT.
+#define BUF_USAGE_HISTOGRAM_SIZE 6
+
+// What one relation currently holds in the shared buffer pool; see
+// buffer_usage_by_relation().
+typedef struct BufferRelUsage {
+  RelFileNode rnode;
+  int resident;  // Buffers holding a page of the relation
+  int dirty;     // Of those, how many are dirty
+  int pinned;    // Of those, how many are pinned by some backend
+  int usage_counts[BUF_USAGE_HISTOGRAM_SIZE];  // Resident buffers by usage count
+} BufferRelUsage;
+
+// Shared buffer traffic of one relation since startup (or the last
+// reset); see buffer_rel_stats().
+typedef struct BufferRelStats {
+  RelFileNode rnode;  // INVALID_OID for relations that didn't fit
+  uint64 hits;        // Lookups that found the page in the pool
+  uint64 reads;       // Lookups that had to read the page in
+  uint64 writes;      // Dirty pages written out
+} BufferRelStats;
+
 // globals.c
 extern int NBuffers;
 
 // buf_init.c
 extern Block* BufferBlockPointers;
-extern long* PrivateRefCount;
+
+// bufmgr.c
+extern int AsyncIoDepth;
 
 // localbuf.c
+extern int NumTempBuffers;
 extern int NLocBuffer;
 extern Block* LocalBufferBlockPointers;
 extern long* LocalRefCount;
@@ -35,6 +71,14 @@ extern long* LocalRefCount;
 // Special pageno for bget.
 #define P_NEW INVALID_BLOCK_NUMBER
 
+// Most consecutive blocks read_buffers() reads, or a checkpoint writes,
+// with one storage manager call.
+#define BUFFER_MAX_COMBINE 16
+
+// Most blocks a backend can have being read or written asynchronously;
+// the upper limit of AsyncIoDepth.
+#define MAX_ASYNC_BUFS 64
+
 // Buffer context lock modes
 #define BUFFER_LOCK_UNLOCK    0
 #define BUFFER_LOCK_SHARE     1
@@ -49,7 +93,7 @@ extern long* LocalRefCount;
 
 #define BUFFER_IS_PINNED(bufnum)                                                         \
   (BUFFER_IS_LOCAL(bufnum) ? ((bufnum) >= -NLocBuffer && LocalRefCount[-(bufnum)-1] > 0) \
-                           : (BAD_BUFFER_ID(bufnum) ? false : (PrivateRefCount[(bufnum)-1] > 0)))
+                           : (BAD_BUFFER_ID(bufnum) ? false : (get_private_refcount(bufnum) > 0)))
 
 // Increment the pin count on a buffer that we have *already* pinned
 // at least once.
@@ -61,8 +105,7 @@ extern long* LocalRefCount;
   (BUFFER_IS_LOCAL(buffer)                                                                                 \
        ? ((void)ASSERT_MACRO((buffer) >= -NLocBuffer), (void)ASSERT_MACRO(LocalRefCount[-(buffer)-1] > 0), \
           (void)LocalRefCount[-(buffer)-1]++)                                                              \
-       : ((void)ASSERT_MACRO(!BAD_BUFFER_ID(buffer)), (void)ASSERT_MACRO(PrivateRefCount[(buffer)-1] > 0), \
-          (void)PrivateRefCount[(buffer)-1]++))
+       : ((void)ASSERT_MACRO(!BAD_BUFFER_ID(buffer)), incr_private_refcount(buffer)))
 
 #define BUFFER_GET_BLOCK(buffer)          \
   (ASSERT_MACRO(BUFFER_IS_VALID(buffer)), \
@@ -70,7 +113,35 @@ extern long* LocalRefCount;
 
 // bufmgr.c
 Buffer relation_get_buffer_write_buffer(Relation relation, BlockNumber block_number, Buffer buffer);
+Buffer read_buffer(Relation relation, BlockNumber block_number);
+Buffer read_buffer_extended(Relation relation, BlockNumber block_number, BufferAccessStrategy strategy);
+void prefetch_buffer(Relation relation, BlockNumber block_number);
+int read_buffers(Relation relation, BlockNumber block_number, int nblocks, Buffer* buffers);
+BlockNumber extend_buffers(Relation relation, int nblocks, Buffer* buffers);
+int release_buffer(Buffer buffer);
+int write_buffer(Buffer buffer);
+int write_no_release_buffer(Buffer buffer);
+void abort_buffer_io(void);
+void finish_async_buffer_io(void);
+void lock_buffer(Buffer buffer, int mode);
+void unlock_buffers(void);
+long get_private_refcount(Buffer buffer);
+void incr_private_refcount(Buffer buffer);
+bool bg_buffer_sync(void);
+void checkpoint_buffers(bool immediate);
+void drop_relation_buffers(Relation relation, BlockNumber first_del_block);
 
+Size buffer_shmem_size(void);
 void init_buffer_pool();
 
+// buf_stats.c
+int buffer_usage_by_relation(BufferRelUsage** usage);
+int buffer_rel_stats(BufferRelStats** stats);
+void reset_buffer_rel_stats(void);
+void print_buffer_usage(FILE* statfp);
+
+// freelist.c
+BufferAccessStrategy get_access_strategy(BufferAccessStrategyType btype);
+void free_access_strategy(BufferAccessStrategy strategy);
+
 #endif  // RDBMS_STORAGE_BUFMGR_H_
@@ -0,0 +1,33 @@
+//===----------------------------------------------------------------------===//
+//
+// condition_variable.h
+//  Condition variables for processes sharing memory.
+//
+//
+// Portions Copyright (c) 1996-2001, PostgreSQL Global Development Group
+// Portions Copyright (c) 1994, Regents of the University of California
+//
+//===----------------------------------------------------------------------===//
+#ifndef RDBMS_STORAGE_CONDITION_VARIABLE_H_
+#define RDBMS_STORAGE_CONDITION_VARIABLE_H_
+
+#include "rdbms/c.h"
+#include "rdbms/storage/atomics.h"
+
+// Something processes can sleep on until another process says the
+// condition they wait for may have changed. It lives in shared memory
+// and needs no initialization beyond condition_variable_init(). There is
+// no mutex: waiters check their condition themselves, see
+// condition_variable.c for the protocol.
+typedef struct ConditionVariable {
+  AtomicUint32 seq;       // Bumped by every broadcast; the futex word
+  AtomicUint32 nwaiters;  // Processes between prepare and sleep/cancel
+} ConditionVariable;
+
+void condition_variable_init(ConditionVariable* cv);
+uint32 condition_variable_prepare_to_sleep(ConditionVariable* cv);
+void condition_variable_sleep(ConditionVariable* cv, uint32 seq);
+void condition_variable_cancel_sleep(ConditionVariable* cv);
+void condition_variable_broadcast(ConditionVariable* cv);
+
+#endif  // RDBMS_STORAGE_CONDITION_VARIABLE_H_
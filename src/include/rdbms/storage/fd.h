@@ -34,20 +34,44 @@
 
 #include <stdbool.h>
 #include <stdio.h>
+#include <sys/uio.h>
+
+#include "rdbms/c.h"
 
 // FileSeek uses the standard UNIX lseek(2) flags.
 
 typedef char* FileName;
 typedef int File;
 
+// What the VFD cache of this backend has done since startup (or the
+// last reset); see file_get_stats().
+typedef struct FileStats {
+  uint64 opens;         // open(2) calls made for VFDs, reopens included
+  uint64 reopens;       // Of those, for VFDs the LRU ring had closed
+  uint64 lru_closes;    // Kernel FDs closed to make room for others
+  uint64 shared_opens;  // Opens that found the file open already
+  uint64 open_time_us;  // Total time spent in those open(2) calls
+} FileStats;
+
+// fd.c
+extern int MaxFilesPerProcess;
+
 // Operations on virtual Files --- equivalent to Unix kernel file ops.
 File file_name_open_file(FileName filename, int file_flags, int file_mode);
 File path_name_open_file(FileName filename, int file_flags, int file_mode);
+File file_name_open_shared_file(FileName filename, int file_flags, int file_mode);
 File open_temporary_file();
 void file_close(File file);
 void file_unlink(File file);
 int file_read(File file, char* buffer, int amount);
 int file_write(File file, char* buffer, int amount);
+int file_pread(File file, char* buffer, int amount, long offset);
+int file_pwrite(File file, char* buffer, int amount, long offset);
+int file_readv(File file, const struct iovec* iov, int iovcnt, long offset);
+int file_writev(File file, const struct iovec* iov, int iovcnt, long offset);
+int file_prefetch(File file, long offset, int amount);
+int file_aio_read(File file, char* buffer, int amount, long offset, uint64 id);
+int file_allocate(File file, long offset, long amount);
 long file_seek(File file, long offset, int whence);
 int file_truncate(File file, long offset);
 int file_sync(File file);
@@ -63,6 +87,8 @@ int basic_open_file(FileName filename, int file_flags, int file_mode);
 // Miscellaneous support routines.
 void close_all_vfds();
 void at_eo_xact_files();
+void file_get_stats(FileStats* stats);
+void file_reset_stats(void);
 int pg_fsync(int fd);
 int pg_fdatasync(int fd);
 
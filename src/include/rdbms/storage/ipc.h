@@ -42,6 +42,8 @@ union semun {
 #define IPC_NMAX_SEM   32      // Maximum number of semaphores
 #define PG_SEMA_MAGIC  537     // Must be less than SEMVMX
 
+typedef uint32 IPCKey;
+
 typedef uint32 IpcSemaphoreKey;
 typedef int IpcSemaphoreId;
 
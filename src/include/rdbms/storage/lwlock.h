@@ -0,0 +1,38 @@
+//===----------------------------------------------------------------------===//
+//
+// lwlock.h
+//  Lightweight reader/writer locks.
+//
+//
+// Portions Copyright (c) 1996-2001, PostgreSQL Global Development Group
+// Portions Copyright (c) 1994, Regents of the University of California
+//
+//===----------------------------------------------------------------------===//
+#ifndef RDBMS_STORAGE_LWLOCK_H_
+#define RDBMS_STORAGE_LWLOCK_H_
+
+#include "rdbms/c.h"
+#include "rdbms/storage/atomics.h"
+#include "rdbms/storage/shmem.h"
+
+typedef enum LWLockMode {
+  LW_EXCLUSIVE,
+  LW_SHARED
+} LWLockMode;
+
+// A lock that any number of processes can hold shared, or one process
+// exclusively. It lives in shared memory and needs no initialization
+// beyond lwlock_init(). Processes that have to wait queue up and sleep
+// on their Proc semaphore; see lwlock.c.
+typedef struct LWLock {
+  AtomicUint32 state;  // Holders and flags
+  ShmemOffset head;    // First waiting Proc, or INVALID_OFFSET
+  ShmemOffset tail;    // Last waiting Proc, or INVALID_OFFSET
+} LWLock;
+
+void lwlock_init(LWLock* lock);
+void lwlock_acquire(LWLock* lock, LWLockMode mode);
+bool lwlock_conditional_acquire(LWLock* lock, LWLockMode mode);
+void lwlock_release(LWLock* lock);
+
+#endif  // RDBMS_STORAGE_LWLOCK_H_
@@ -13,8 +13,10 @@
 #ifndef RDBMS_STORAGE_PROC_H_
 #define RDBMS_STORAGE_PROC_H_
 
-#include "rdbms/access/xlog.h"
+#include "rdbms/access/xlogdefs.h"
+#include "rdbms/storage/atomics.h"
 #include "rdbms/storage/lock.h"
+#include "rdbms/storage/lwlock.h"
 
 // Configurable option.
 extern int DeadlockTimeout;
@@ -54,6 +56,12 @@ struct Proc {
   Oid database_id;          // OID of database this backend is using
   short slocks[MAX_SPINS];  // Spin lock stats
   ShmemQueue proc_holders;  // List of HOLDER objects for locks held or awaited by this backend
+
+  // Info about the lightweight lock the process is waiting for, if any.
+  // See lwlock.c.
+  AtomicUint32 lw_waiting;   // True while on an LWLock's wait queue
+  LWLockMode lw_wait_mode;   // Mode we're waiting for
+  ShmemOffset lw_wait_link;  // Next waiter in that queue
 };
 
 extern Proc* MyProc;
@@ -96,7 +104,7 @@ void proc_release_locks(bool is_commit);
 bool proc_remove(int pid);
 
 void proc_queue_init(ProcQueue* queue);
-int proc_sleep(LockMethodTable* lock_method_table, Lockmode lock_mode, Lock* lock, Holder* holder);
+int proc_sleep(LockMethodTable* lock_method_table, LockMode lock_mode, Lock* lock, Holder* holder);
 Proc* proc_wake_up(Proc* proc, int err_type);
 void proc_lock_wake_up(LockMethodTable* lock_method_table, Lock* lock);
 void proc_release_spins(Proc* proc);
@@ -26,15 +26,26 @@
 typedef unsigned char TasLock;
 
 void s_lock(volatile TasLock* lock, const char* file, const int line);
+void s_lock_delay(unsigned spins, volatile void* lock, const char* file, const int line);
 
+// The asm must be volatile and clobber memory: it is the acquire barrier
+// for everything the lock protects, and it reads the lock as well as
+// writing it.
 static inline int tas(volatile TasLock* lock) {
   TasLock res = 1;
 
-  __asm__("lock; xchgb %0, %1" : "=q"(res), "=m"(*lock) : "0"(res));
+  __asm__ __volatile__("lock; xchgb %0, %1" : "+q"(res), "+m"(*lock) : : "memory");
 
   return res;
 }
 
+// Release barrier: keep the compiler from sinking protected stores below
+// the unlock. x86 does not reorder stores with older stores.
+static inline void s_unlock(volatile TasLock* lock) {
+  __asm__ __volatile__("" : : : "memory");
+  *lock = 0;
+}
+
 #define TAS(lock) tas((volatile TasLock*)lock)
 
 #define INIT_LOCK(lock) LOCK_RELEASE(lock)
@@ -42,7 +53,7 @@ static inline int tas(volatile TasLock* lock) {
   do {                                                                                     \
     if (TAS((volatile TasLock*)lock)) s_lock((volatile TasLock*)lock, __FILE__, __LINE__); \
   } while (0)
-#define LOCK_RELEASE(lock) (*(lock) = 0)
+#define LOCK_RELEASE(lock) s_unlock((volatile TasLock*)(lock))
 #define LOCK_IS_FREE(lock) (*(lock) == 0)
 
 #endif  // RDBMS_STORAGE_S_LOCK_H_
@@ -19,30 +19,113 @@
 #define SM_FAIL    0
 #define SM_SUCCESS 1
 
-#define DEFAULT_SMGR 0
+// Storage managers, indexes into SmgrSW.
+#define MAGNETIC_DISK 0
+
+#ifdef STABLE_MEMORY_STORAGE
+#define MAIN_MEMORY 1
+
+extern bool EnableMemoryStorage;
+extern int MemStorageBlocks;
+
+// With memory_storage on, every relation lives in main memory.
+#define DEFAULT_SMGR (EnableMemoryStorage ? MAIN_MEMORY : MAGNETIC_DISK)
+#else
+#define DEFAULT_SMGR MAGNETIC_DISK
+#endif
 
 int smgr_init();
 int smgr_create(int16 which, Relation relation);
 int smgr_unlink(int16 which, Relation relation);
 int smgr_extend(int16 which, Relation relation, char* buffer);
+int smgr_extend_by(int16 which, Relation relation, int nblocks);
+int smgr_open(int16 which, Relation relation, bool fail_ok);
+int smgr_close(int16 which, Relation relation);
+int smgr_read(int16 which, Relation relation, BlockNumber block_num, char* buffer);
+int smgr_readv(int16 which, Relation relation, BlockNumber block_num, char** buffers, int nblocks);
+int smgr_prefetch(int16 which, Relation relation, BlockNumber block_num);
+int smgr_start_read(int16 which, Relation relation, BlockNumber block_num, char* buffer, uint64 id);
+int smgr_write(int16 which, Relation relation, BlockNumber block_num, char* buffer);
+int smgr_writev(int16 which, Relation relation, BlockNumber block_num, char** buffers, int nblocks);
+int smgr_flush(int16 which, Relation relation, BlockNumber block_num, char* buffer);
+int smgr_blind_wrt(int16 which, RelFileNode rnode, BlockNumber block_num, char* buffer, bool do_fsync);
+int smgr_blind_writev(int16 which, RelFileNode rnode, BlockNumber block_num, char** buffers, int nblocks,
+                      bool do_fsync);
+int smgr_start_blind_writev(int16 which, RelFileNode rnode, BlockNumber block_num, char** buffers, int nblocks,
+                            uint64 id);
+int smgr_mark_dirty(int16 which, Relation relation, BlockNumber block_num);
+int smgr_blind_mark_dirty(int16 which, RelFileNode rnode, BlockNumber block_num);
+int smgr_nblocks(int16 which, Relation relation);
+int smgr_truncate(int16 which, Relation relation, int nblocks);
+int smgr_commit();
+int smgr_abort();
+int smgr_sync();
 
 // md.c
+extern bool DeferCommitFsync;
+
 int md_init();
 int md_create(Relation relation);
 int md_unlink(RelFileNode rnode);
 int md_extend(Relation relation, char* buffer);
+int md_extend_by(Relation relation, int nblocks);
 int md_open(Relation relation);
 int md_close(Relation relation);
 int md_read(Relation relation, BlockNumber block_num, char* buffer);
+int md_readv(Relation relation, BlockNumber block_num, char** buffers, int nblocks);
+int md_prefetch(Relation relation, BlockNumber block_num);
+int md_start_read(Relation relation, BlockNumber block_num, char* buffer, uint64 id);
 int md_write(Relation relation, BlockNumber block_num, char* buffer);
+int md_writev(Relation relation, BlockNumber block_num, char** buffers, int nblocks);
 int md_flush(Relation relation, BlockNumber block_num, char* buffer);
 int md_blind_wrt(RelFileNode rnode, BlockNumber block_num, char* buffer,
                  bool do_fsync);
+int md_blind_writev(RelFileNode rnode, BlockNumber block_num, char** buffers, int nblocks,
+                    bool do_fsync);
+int md_start_blind_writev(RelFileNode rnode, BlockNumber block_num, char** buffers, int nblocks, uint64 id);
 int md_mark_dirty(Relation relation, BlockNumber block_num);
 int md_blind_mark_dirty(RelFileNode rnode, BlockNumber block_num);
 int md_nblocks(Relation relation);
 int md_truncate(Relation relation, int bnlocks);
 int md_commit();
 int md_abort();
+int md_sync();
+void remember_fsync_request(RelFileNode rnode, BlockNumber seg_no);
+
+#ifdef STABLE_MEMORY_STORAGE
+// mm.c
+Size mm_shmem_size(void);
+void mm_shmem_init(void);
+int mm_create(Relation relation);
+int mm_unlink(RelFileNode rnode);
+int mm_extend(Relation relation, char* buffer);
+int mm_extend_by(Relation relation, int nblocks);
+int mm_open(Relation relation);
+int mm_close(Relation relation);
+int mm_read(Relation relation, BlockNumber block_num, char* buffer);
+int mm_write(Relation relation, BlockNumber block_num, char* buffer);
+int mm_flush(Relation relation, BlockNumber block_num, char* buffer);
+int mm_blind_wrt(RelFileNode rnode, BlockNumber block_num, char* buffer, bool do_fsync);
+int mm_mark_dirty(Relation relation, BlockNumber block_num);
+int mm_blind_mark_dirty(RelFileNode rnode, BlockNumber block_num);
+int mm_nblocks(Relation relation);
+int mm_truncate(Relation relation, int nblocks);
+#endif
+
+// relsize.c
+Size relsize_cache_shmem_size(void);
+void relsize_cache_shmem_init(void);
+BlockNumber relsize_cache_get(RelFileNode rnode);
+bool relsize_cache_covers(RelFileNode rnode, BlockNumber nblocks);
+uint32 relsize_cache_start_fill(RelFileNode rnode);
+void relsize_cache_fill(RelFileNode rnode, BlockNumber nblocks, uint32 ticket);
+void relsize_cache_extend(RelFileNode rnode, BlockNumber nblocks);
+void relsize_cache_grow(RelFileNode rnode, BlockNumber nblocks);
+void relsize_cache_note_write(RelFileNode rnode, BlockNumber nblocks);
+void relsize_cache_set(RelFileNode rnode, BlockNumber nblocks);
+void relsize_cache_forget(RelFileNode rnode);
+BlockNumber relsize_cache_take(RelFileNode rnode, int nblocks, bool* known);
+uint32 relsize_cache_start_reclaim(RelFileNode rnode, BlockNumber* nblocks);
+bool relsize_cache_finish_reclaim(RelFileNode rnode, BlockNumber nused, uint32 ticket);
 
 #endif  // RDBMS_STORAGE_SMGR_H_
@@ -16,12 +16,8 @@
 
 #include "rdbms/storage/ipc.h"
 
-// Two implementations of spin locks
-//
-// sequent, sparc, sun3: real spin locks. uses a TAS instruction; see
-// src/storage/ipc/s_lock.c for details.
-//
-// default: fake spin locks using semaphores.  see spin.c
+// Spin locks are TAS locks in shared memory; see s_lock.h and spin.c.
+// A SpinLock is the LockId of one of them.
 
 typedef int SpinLock;
 
@@ -29,7 +25,8 @@ typedef int SpinLock;
 extern SpinLock MMCacheLock;
 #endif
 
-void create_spin_locks(IPCKey key);
+Size spin_lock_shmem_size(void);
+void create_spin_locks(PGShmemHeader* seg_hdr);
 void init_spin_locks();
 void spin_acquire(SpinLock lock);
 void spin_release(SpinLock lock);
@@ -17,6 +17,7 @@
 #ifndef RDBMS_UTILS_FMGR_H_
 #define RDBMS_UTILS_FMGR_H_
 
+#include "rdbms/nodes/memnodes.h"
 #include "rdbms/postgres.h"
 
 // All functions that can be called directly by fmgr must have this signature.
@@ -15,6 +15,8 @@
 
 #include <stdbool.h>
 
+#include "rdbms/nodes/memnodes.h"
+
 // Constants
 //
 // A hash table has a top-level "directory", each of whose entries points
@@ -73,6 +75,7 @@ typedef struct HashTable {
   char* segbase;         // Segment base addres for calculating pointer values.
   SegOffset* dir;        // 'directory' of segm starts.
   void* (*alloc)(Size);  // Memory allocator
+  MemoryContext hcxt;    // Context of a private table's contents.
 } HashTable;
 
 typedef struct HashCtrl {
@@ -121,6 +124,9 @@ HashTable* hash_create(int nelem, HashCtrl* info, int flags);
 void hash_destroy(HashTable* hashp);
 void hash_stats(char* where, HashTable* hashp);
 long* hash_search(HashTable* hashp, char* key_ptr, HashAction action, bool* found_ptr);
+uint32 get_hash_value(HashTable* hashp, char* key_ptr);
+long* hash_search_with_hash_value(HashTable* hashp, char* key_ptr, uint32 hash_value, HashAction action,
+                                  bool* found_ptr);
 long* hash_seq(HashTable* hashp);
 void hash_seq_init(HashSeqStatus* status, HashTable* hashp);
 long* hash_seq_search(HashSeqStatus* status);
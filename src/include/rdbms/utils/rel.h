@@ -22,6 +22,7 @@
 #include "rdbms/storage/fd.h"
 #include "rdbms/storage/relfilenode.h"
 #include "rdbms/utils/memutils.h"
+#include "rdbms/utils/temprel.h"
 
 // Added to prevent circular dependency.  bjm 1999/11/15
 char* get_temp_rel_by_physical_name(const char* relation_name);
@@ -77,6 +78,19 @@ typedef struct RelationData {
   File rd_fd;                  // Open file descriptor
   RelFileNode rd_node;         // Relation file node
   int rd_nblocks;              // Number of blocks in relation
+
+  // How hard this backend has been extending the relation lately, which
+  // decides how many blocks read_buffer(P_NEW) extends it by. See
+  // get_new_block() in bufmgr.c; all zero in a fresh entry.
+  int rd_extent_size;   // Blocks added by the last extension
+  long rd_extent_time;  // When that was, in milliseconds
+
+  // Sequential read-ahead with direct I/O, which the kernel no longer
+  // does for us. See read_ahead() in bufmgr.c; all zero in a fresh entry.
+  BlockNumber rd_read_ahead_next;  // Block a sequential reader reads next
+  BlockNumber rd_read_ahead_end;   // One past the last block read ahead
+  int rd_read_ahead_distance;      // Blocks to keep read ahead
+
   uint16 rd_ref_cnt;           // Reference count
   bool rd_my_xact_only;        // Relation uses the local buffer manager
   bool rd_is_nailed;           // Relation is nailed in cache
@@ -16,5 +16,6 @@
 #include "rdbms/access/htup.h"
 
 void create_temp_relation(const char* rel_name, HeapTuple pg_class_tuple);
+char* get_temp_rel_by_physicalname(const char* rel_name);
 
 #endif  // RDBMS_UTILS_TEMP_REL_H_
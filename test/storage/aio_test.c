@@ -0,0 +1,255 @@
+#include "rdbms/storage/aio.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../template.h"
+#include "rdbms/utils/memutils.h"
+
+#define TEST_FILE   "/tmp/aio_test.dat"
+#define TEST_PAGESZ 8192
+#define TEST_PAGES  AIO_MAX_IN_FLIGHT
+
+static char Pages[TEST_PAGES][TEST_PAGESZ];
+
+static int open_test_file(void) {
+  int fd = open(TEST_FILE, O_CREAT | O_TRUNC | O_RDWR, 0600);
+
+  CU_ASSERT_FATAL(fd >= 0);
+  return fd;
+}
+
+static void fill_page(char* page, int page_no) { memset(page, 'a' + page_no % 26, TEST_PAGESZ); }
+
+static bool page_ok(char* page, int page_no) {
+  int i;
+
+  for (i = 0; i < TEST_PAGESZ; i++) {
+    if (page[i] != 'a' + page_no % 26) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Reap everything in flight, checking each I/O moved a whole page.
+static int reap_all(bool* done) {
+  AioResult results[AIO_MAX_IN_FLIGHT];
+  int nreaped = 0;
+  int n;
+  int i;
+
+  while (aio_in_flight() > 0) {
+    n = aio_reap(results, AIO_MAX_IN_FLIGHT, 1);
+    CU_ASSERT(n > 0);
+
+    for (i = 0; i < n; i++) {
+      CU_ASSERT(results[i].result == TEST_PAGESZ);
+      CU_ASSERT(!done[results[i].id]);
+      done[results[i].id] = true;
+    }
+
+    nreaped += n;
+  }
+
+  return nreaped;
+}
+
+// Pages read in the background arrive intact, each tagged with its id.
+static void test_read() {
+  struct iovec iov;
+  bool done[TEST_PAGES] = {false};
+  int fd;
+  int i;
+
+  if (!aio_available()) {
+    printf("io_uring not available, skipped\n");
+    return;
+  }
+
+  fd = open_test_file();
+
+  for (i = 0; i < TEST_PAGES; i++) {
+    fill_page(Pages[i], i);
+    CU_ASSERT(pwrite(fd, Pages[i], TEST_PAGESZ, (long)i * TEST_PAGESZ) == TEST_PAGESZ);
+  }
+
+  memset(Pages, 0, sizeof(Pages));
+
+  // Start them all, then close the file: the reads must not mind.
+  for (i = 0; i < TEST_PAGES; i++) {
+    iov.iov_base = Pages[i];
+    iov.iov_len = TEST_PAGESZ;
+    CU_ASSERT(aio_start_readv(fd, &iov, 1, (long)i * TEST_PAGESZ, i) == 0);
+  }
+
+  CU_ASSERT(aio_in_flight() == TEST_PAGES);
+  close(fd);
+
+  CU_ASSERT(reap_all(done) == TEST_PAGES);
+
+  for (i = 0; i < TEST_PAGES; i++) {
+    CU_ASSERT(done[i]);
+    CU_ASSERT(page_ok(Pages[i], i));
+  }
+}
+
+// Vectored writes land where they should, and only AIO_MAX_IN_FLIGHT
+// I/Os can be in flight at once.
+static void test_write() {
+  struct iovec iov[4];
+  bool done[TEST_PAGES] = {false};
+  char page[TEST_PAGESZ];
+  int fd;
+  int i;
+  int j;
+
+  if (!aio_available()) {
+    printf("io_uring not available, skipped\n");
+    return;
+  }
+
+  fd = open_test_file();
+
+  for (i = 0; i < TEST_PAGES; i++) {
+    fill_page(Pages[i], i);
+  }
+
+  // Four pages per write.
+  for (i = 0; i < TEST_PAGES; i += 4) {
+    for (j = 0; j < 4; j++) {
+      iov[j].iov_base = Pages[i + j];
+      iov[j].iov_len = TEST_PAGESZ;
+    }
+
+    CU_ASSERT(aio_start_writev(fd, iov, 4, (long)i * TEST_PAGESZ, i / 4) == 0);
+  }
+
+  while (aio_in_flight() > 0) {
+    AioResult results[AIO_MAX_IN_FLIGHT];
+    int n = aio_reap(results, AIO_MAX_IN_FLIGHT, 1);
+
+    for (i = 0; i < n; i++) {
+      CU_ASSERT(results[i].result == 4 * TEST_PAGESZ);
+      done[results[i].id] = true;
+    }
+  }
+
+  for (i = 0; i < TEST_PAGES / 4; i++) {
+    CU_ASSERT(done[i]);
+  }
+
+  for (i = 0; i < TEST_PAGES; i++) {
+    CU_ASSERT(pread(fd, page, TEST_PAGESZ, (long)i * TEST_PAGESZ) == TEST_PAGESZ);
+    CU_ASSERT(page_ok(page, i));
+  }
+
+  // Fill every slot; one more is refused.
+  iov[0].iov_base = page;
+  iov[0].iov_len = TEST_PAGESZ;
+
+  for (i = 0; i < AIO_MAX_IN_FLIGHT; i++) {
+    CU_ASSERT(aio_start_readv(fd, iov, 1, 0, i) == 0);
+  }
+
+  CU_ASSERT(aio_start_readv(fd, iov, 1, 0, i) == -1 && errno == EAGAIN);
+
+  memset(done, 0, sizeof(done));
+  CU_ASSERT(reap_all(done) == AIO_MAX_IN_FLIGHT);
+
+  close(fd);
+}
+
+// Polling returns at once, and reads past the end of the file come back
+// empty.
+static void test_poll() {
+  AioResult results[AIO_MAX_IN_FLIGHT];
+  struct iovec iov;
+  int fd;
+  int n = 0;
+
+  if (!aio_available()) {
+    printf("io_uring not available, skipped\n");
+    return;
+  }
+
+  CU_ASSERT(aio_reap(results, AIO_MAX_IN_FLIGHT, 0) == 0);
+  CU_ASSERT(aio_reap(results, AIO_MAX_IN_FLIGHT, 1) == 0);
+
+  fd = open_test_file();
+
+  iov.iov_base = Pages[0];
+  iov.iov_len = TEST_PAGESZ;
+  CU_ASSERT(aio_start_readv(fd, &iov, 1, 0, 42) == 0);
+
+  while (n == 0) {
+    n = aio_reap(results, AIO_MAX_IN_FLIGHT, 0);
+  }
+
+  CU_ASSERT(n == 1);
+  CU_ASSERT(results[0].id == 42 && results[0].result == 0);
+  CU_ASSERT(aio_in_flight() == 0);
+
+  close(fd);
+}
+
+// A forked child gets a ring of its own, and doesn't see its parent's
+// I/O.
+static void test_fork() {
+  struct iovec iov;
+  bool done[TEST_PAGES] = {false};
+  int status;
+  int fd;
+  pid_t pid;
+
+  if (!aio_available()) {
+    printf("io_uring not available, skipped\n");
+    return;
+  }
+
+  fd = open_test_file();
+
+  fill_page(Pages[0], 0);
+  CU_ASSERT(pwrite(fd, Pages[0], TEST_PAGESZ, 0) == TEST_PAGESZ);
+
+  iov.iov_base = Pages[1];
+  iov.iov_len = TEST_PAGESZ;
+  CU_ASSERT(aio_start_readv(fd, &iov, 1, 0, 1) == 0);
+
+  pid = fork();
+  CU_ASSERT_FATAL(pid >= 0);
+
+  if (pid == 0) {
+    AioResult results[1];
+
+    iov.iov_base = Pages[2];
+    if (!aio_available() || aio_in_flight() != 0 || aio_start_readv(fd, &iov, 1, 0, 2) != 0 ||
+        aio_reap(results, 1, 1) != 1 || results[0].id != 2 || !page_ok(Pages[2], 0)) {
+      _exit(1);
+    }
+    _exit(0);
+  }
+
+  CU_ASSERT(waitpid(pid, &status, 0) == pid);
+  CU_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  CU_ASSERT(reap_all(done) == 1);
+  CU_ASSERT(done[1] && page_ok(Pages[1], 0));
+
+  close(fd);
+  unlink(TEST_FILE);
+}
+
+static void register_test() {
+  memory_context_init();
+
+  TEST("Read", test_read);
+  TEST("Write", test_write);
+  TEST("Poll", test_poll);
+  TEST("Fork", test_fork);
+}
+
+MAIN("aio")
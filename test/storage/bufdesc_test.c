@@ -0,0 +1,180 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../template.h"
+#include "rdbms/miscadmin.h"
+#include "rdbms/storage/buf_internals.h"
+
+// Benchmark of scans over the buffer descriptors of a 1M-buffer pool.
+//
+// The clock sweep, the checkpointer and the bgwriter walk every
+// descriptor looking at its state word, and lookups land on random
+// descriptors to check the tag and pin. The old layout kept the
+// blind-write names and cleanup_func in the descriptor, 144 bytes with
+// descriptors straddling cache lines; now those live in the cold array
+// and each descriptor is one aligned line.
+
+#define BENCH_NBUFFERS (1024 * 1024)
+#define BENCH_PASSES   5
+#define BENCH_PROBES   (4 * 1024 * 1024)
+
+// The descriptor as it was before the hot/cold split.
+typedef struct OldBufferDesc {
+  Buffer free_next;
+  ShmemOffset data;
+  BufferTag tag;
+  int buf_id;
+  AtomicUint32 state;
+  LWLock content_lock;
+  bool cntx_dirty;
+  BufferBlindId blind;
+  void (*cleanup_func)(Buffer);
+} OldBufferDesc;
+
+static OldBufferDesc* OldDescs;
+static BufferDesc* NewDescs;
+
+static double elapsed_seconds(struct timespec* start, struct timespec* end) {
+  return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Cache lines the i'th descriptor of an aligned array of size-byte
+// descriptors touches.
+static int lines_touched(size_t size, int i) {
+  return (int)(((i + 1) * size - 1) / CACHE_LINE_SIZE - i * size / CACHE_LINE_SIZE + 1);
+}
+
+// Walk every descriptor the way the clock sweep does, reading the state
+// and the tag. A macro so that each layout gets its own compiled loop.
+#define SWEEP(descs, sum)                                                      \
+  do {                                                                         \
+    int _pass;                                                                 \
+    int _i;                                                                    \
+    for (_pass = 0; _pass < BENCH_PASSES; _pass++) {                           \
+      for (_i = 0; _i < BENCH_NBUFFERS; _i++) {                                \
+        uint32 _state = atomic_read_u32(&(descs)[_i].state);                   \
+        if (_state & BM_VALID) {                                               \
+          (sum) += (descs)[_i].tag.block_num + BUF_STATE_GET_USAGECOUNT(_state); \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+  } while (0)
+
+// Visit descriptors in a scattered order, the way buffer lookups do.
+#define PROBE(descs, sum)                                                   \
+  do {                                                                      \
+    long _i;                                                                \
+    for (_i = 0; _i < BENCH_PROBES; _i++) {                                 \
+      int _b = (int)((_i * 7919) & (BENCH_NBUFFERS - 1));                   \
+      if ((descs)[_b].tag.block_num == (BlockNumber)_b) {                   \
+        (sum) += atomic_read_u32(&(descs)[_b].state) & BUF_REFCOUNT_MASK;   \
+      }                                                                     \
+    }                                                                       \
+  } while (0)
+
+static void test_layout() {
+  int i;
+
+  CU_ASSERT(sizeof(BufferDesc) == CACHE_LINE_SIZE);
+  CU_ASSERT(offsetof(BufferDesc, cntx_dirty) < CACHE_LINE_SIZE);
+  CU_ASSERT((unsigned long)NewDescs % CACHE_LINE_SIZE == 0);
+
+  // Every new descriptor is one line; old ones touched two or three
+  // lines to read the same fields.
+  for (i = 0; i < 8; i++) {
+    CU_ASSERT(lines_touched(sizeof(BufferDesc), i) == 1);
+    CU_ASSERT(lines_touched(sizeof(OldBufferDesc), i) > 1);
+  }
+}
+
+static void test_cold_array() {
+  BufferDesc* buf = &NewDescs[42];
+
+  BufferDescriptorsCold = calloc(BENCH_NBUFFERS, sizeof(BufferDescCold));
+  CU_ASSERT_FATAL(BufferDescriptorsCold != NULL);
+
+  strcpy(BUFFER_DESCRIPTOR_GET_COLD(buf)->blind.rel_name, "pg_class");
+  CU_ASSERT(strcmp(BufferDescriptorsCold[42].blind.rel_name, "pg_class") == 0);
+
+  free(BufferDescriptorsCold);
+  BufferDescriptorsCold = NULL;
+}
+
+static void test_scan() {
+  struct timespec start;
+  struct timespec end;
+  unsigned long old_sum = 0;
+  unsigned long new_sum = 0;
+  double old_sweep;
+  double new_sweep;
+  double old_probe;
+  double new_probe;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  SWEEP(OldDescs, old_sum);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  old_sweep = elapsed_seconds(&start, &end) * 1e9 / ((double)BENCH_PASSES * BENCH_NBUFFERS);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  SWEEP(NewDescs, new_sum);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  new_sweep = elapsed_seconds(&start, &end) * 1e9 / ((double)BENCH_PASSES * BENCH_NBUFFERS);
+
+  CU_ASSERT(old_sum == new_sum);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  PROBE(OldDescs, old_sum);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  old_probe = elapsed_seconds(&start, &end) * 1e9 / BENCH_PROBES;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  PROBE(NewDescs, new_sum);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  new_probe = elapsed_seconds(&start, &end) * 1e9 / BENCH_PROBES;
+
+  CU_ASSERT(old_sum == new_sum);
+
+  printf("\n%8s %10s %12s %12s %12s\n", "layout", "bytes", "pool MB", "sweep ns", "probe ns");
+  printf("%8s %10zu %12zu %12.2f %12.2f\n", "old", sizeof(OldBufferDesc),
+         sizeof(OldBufferDesc) * BENCH_NBUFFERS >> 20, old_sweep, old_probe);
+  printf("%8s %10zu %12zu %12.2f %12.2f\n", "hot", sizeof(BufferDesc), sizeof(BufferDesc) * BENCH_NBUFFERS >> 20,
+         new_sweep, new_probe);
+}
+
+static void register_test() {
+  int i;
+
+  NBuffers = BENCH_NBUFFERS;
+
+  OldDescs = aligned_alloc(CACHE_LINE_SIZE, BENCH_NBUFFERS * sizeof(OldBufferDesc));
+  NewDescs = aligned_alloc(CACHE_LINE_SIZE, BENCH_NBUFFERS * sizeof(BufferDesc));
+
+  if (OldDescs == NULL || NewDescs == NULL) {
+    fprintf(stderr, "bufdesc_test: out of memory\n");
+    exit(1);
+  }
+
+  MEMSET(OldDescs, 0, BENCH_NBUFFERS * sizeof(OldBufferDesc));
+  MEMSET(NewDescs, 0, BENCH_NBUFFERS * sizeof(BufferDesc));
+
+  for (i = 0; i < BENCH_NBUFFERS; i++) {
+    uint32 buf_state = BM_VALID | ((i % (BM_MAX_USAGE_COUNT + 1)) << BUF_USAGECOUNT_SHIFT);
+
+    OldDescs[i].buf_id = i;
+    OldDescs[i].tag.block_num = i;
+    atomic_init_u32(&OldDescs[i].state, buf_state);
+
+    NewDescs[i].buf_id = i;
+    NewDescs[i].tag.block_num = i;
+    atomic_init_u32(&NewDescs[i].state, buf_state);
+  }
+
+  TEST("Descriptor layout", test_layout);
+  TEST("Cold array", test_cold_array);
+  TEST("1M-buffer scan", test_scan);
+}
+
+MAIN("bufdesc")
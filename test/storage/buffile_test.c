@@ -0,0 +1,201 @@
+#include "rdbms/storage/buffile.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "../template.h"
+#include "rdbms/miscadmin.h"
+#include "rdbms/storage/fd.h"
+#include "rdbms/utils/memutils.h"
+
+// Tests of buffered temporary files in buffile.c.
+
+#define TUPLE_SIZE 16
+#define NUM_TUPLES 100000
+
+// Every write fd.c makes goes through here, so that the tests can count
+// them and the bytes they write.
+static long NumWrites = 0;
+static long WrittenBytes = 0;
+
+ssize_t write(int fd, const void* buf, size_t count) {
+  NumWrites++;
+  WrittenBytes += count;
+  return syscall(SYS_write, fd, buf, count);
+}
+
+ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset) {
+  NumWrites++;
+  WrittenBytes += count;
+  return syscall(SYS_pwrite64, fd, buf, count, offset);
+}
+
+// A tuple that says which one it is, and compresses about as well as
+// real ones do.
+static void make_tuple(char* tuple, int i) {
+  memset(tuple, 0, TUPLE_SIZE);
+  memcpy(tuple, &i, sizeof(i));
+  tuple[TUPLE_SIZE - 1] = (char)(i % 7);
+}
+
+// Write tuples, read them back, rewrite some in the middle the way a
+// tape sort reuses blocks, and read them all again.
+static void check_round_trip(bool compress) {
+  char tuple[TUPLE_SIZE];
+  char expected[TUPLE_SIZE];
+  BufFile* file;
+  int i;
+
+  file = buf_file_create_temp(compress);
+
+  for (i = 0; i < NUM_TUPLES; i++) {
+    make_tuple(tuple, i);
+    CU_ASSERT(buf_file_write(file, tuple, TUPLE_SIZE) == TUPLE_SIZE);
+  }
+
+  CU_ASSERT(buf_file_size(file) == (long)NUM_TUPLES * TUPLE_SIZE);
+  CU_ASSERT(buf_file_tell(file) == (long)NUM_TUPLES * TUPLE_SIZE);
+
+  // Nothing past the end, in either sense.
+  CU_ASSERT(buf_file_read(file, tuple, TUPLE_SIZE) == 0);
+  CU_ASSERT(buf_file_seek(file, 1, SEEK_END) == EOF);
+
+  CU_ASSERT(buf_file_seek(file, 0, SEEK_SET) == 0);
+
+  for (i = 0; i < NUM_TUPLES; i++) {
+    make_tuple(expected, i);
+    CU_ASSERT_FATAL(buf_file_read(file, tuple, TUPLE_SIZE) == TUPLE_SIZE);
+    CU_ASSERT(memcmp(tuple, expected, TUPLE_SIZE) == 0);
+  }
+
+  // Overwrite every tenth block with tuples that don't compress as well.
+  for (i = 0; i < NUM_TUPLES * TUPLE_SIZE / BLCKSZ; i += 10) {
+    int j;
+
+    CU_ASSERT(buf_file_seek_block(file, i) == 0);
+    CU_ASSERT(buf_file_tell_block(file) == i);
+
+    for (j = 0; j < BLCKSZ / TUPLE_SIZE; j++) {
+      make_tuple(tuple, -j * 7919);
+      CU_ASSERT(buf_file_write(file, tuple, TUPLE_SIZE) == TUPLE_SIZE);
+    }
+  }
+
+  CU_ASSERT(buf_file_size(file) == (long)NUM_TUPLES * TUPLE_SIZE);
+
+  CU_ASSERT(buf_file_seek(file, 0, SEEK_SET) == 0);
+
+  for (i = 0; i < NUM_TUPLES; i++) {
+    long block = (long)i * TUPLE_SIZE / BLCKSZ;
+
+    if (block % 10 == 0 && block < NUM_TUPLES * TUPLE_SIZE / BLCKSZ) {
+      make_tuple(expected, -(i % (BLCKSZ / TUPLE_SIZE)) * 7919);
+    } else {
+      make_tuple(expected, i);
+    }
+
+    CU_ASSERT_FATAL(buf_file_read(file, tuple, TUPLE_SIZE) == TUPLE_SIZE);
+    CU_ASSERT(memcmp(tuple, expected, TUPLE_SIZE) == 0);
+  }
+
+  // Reading backwards, one tuple at a time, out of the blocks left
+  // alone.
+  CU_ASSERT(buf_file_seek(file, 0, SEEK_END) == 0);
+
+  for (i = NUM_TUPLES - 1; i >= NUM_TUPLES - 1000; i--) {
+    CU_ASSERT(buf_file_seek(file, -TUPLE_SIZE, SEEK_CUR) == 0);
+
+    make_tuple(expected, i);
+    CU_ASSERT(buf_file_read(file, tuple, TUPLE_SIZE) == TUPLE_SIZE);
+    CU_ASSERT(memcmp(tuple, expected, TUPLE_SIZE) == 0);
+
+    CU_ASSERT(buf_file_seek(file, -TUPLE_SIZE, SEEK_CUR) == 0);
+  }
+
+  buf_file_close(file);
+}
+
+static void test_plain() { check_round_trip(false); }
+
+static void test_compressed() { check_round_trip(true); }
+
+// Spilling tuples one at a time through a BufFile makes far fewer system
+// calls than writing them straight to the VFD, and compressing them
+// writes fewer bytes as well.
+static void test_spill_benchmark() {
+  char tuple[TUPLE_SIZE];
+  long raw_writes;
+  long raw_bytes;
+  long plain_writes;
+  long plain_bytes;
+  long compressed_writes;
+  long compressed_bytes;
+  BufFile* buf_file;
+  File file;
+  int i;
+
+  file = open_temporary_file();
+  NumWrites = WrittenBytes = 0;
+
+  for (i = 0; i < NUM_TUPLES; i++) {
+    make_tuple(tuple, i);
+    CU_ASSERT(file_write(file, tuple, TUPLE_SIZE) == TUPLE_SIZE);
+  }
+
+  raw_writes = NumWrites;
+  raw_bytes = WrittenBytes;
+  file_close(file);
+
+  buf_file = buf_file_create_temp(false);
+  NumWrites = WrittenBytes = 0;
+
+  for (i = 0; i < NUM_TUPLES; i++) {
+    make_tuple(tuple, i);
+    buf_file_write(buf_file, tuple, TUPLE_SIZE);
+  }
+
+  // The last of it goes out when the position leaves the buffer.
+  buf_file_seek(buf_file, 0, SEEK_SET);
+  plain_writes = NumWrites;
+  plain_bytes = WrittenBytes;
+  buf_file_close(buf_file);
+
+  buf_file = buf_file_create_temp(true);
+  NumWrites = WrittenBytes = 0;
+
+  for (i = 0; i < NUM_TUPLES; i++) {
+    make_tuple(tuple, i);
+    buf_file_write(buf_file, tuple, TUPLE_SIZE);
+  }
+
+  buf_file_seek(buf_file, 0, SEEK_SET);
+  compressed_writes = NumWrites;
+  compressed_bytes = WrittenBytes;
+  buf_file_close(buf_file);
+
+  CU_ASSERT(raw_writes == NUM_TUPLES);
+  CU_ASSERT(plain_writes * 10 <= raw_writes);
+  CU_ASSERT(plain_bytes == raw_bytes);
+  CU_ASSERT(compressed_writes <= plain_writes);
+  CU_ASSERT(compressed_bytes * 2 <= plain_bytes);
+
+  printf("\n%12s %12s %12s\n", "method", "writes", "bytes");
+  printf("%12s %12ld %12ld\n", "file_write", raw_writes, raw_bytes);
+  printf("%12s %12ld %12ld\n", "buffered", plain_writes, plain_bytes);
+  printf("%12s %12ld %12ld\n", "compressed", compressed_writes, compressed_bytes);
+}
+
+static void register_test() {
+  memory_context_init();
+
+  // Temporary files go in the database directory.
+  DatabasePath = "/tmp";
+
+  TEST("Plain", test_plain);
+  TEST("Compressed", test_compressed);
+  TEST("Spill benchmark", test_spill_benchmark);
+}
+
+MAIN("buffile")
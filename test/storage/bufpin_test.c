@@ -0,0 +1,194 @@
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../template.h"
+#include "rdbms/miscadmin.h"
+#include "rdbms/storage/buf_internals.h"
+#include "rdbms/storage/bufmgr.h"
+
+// Multi-process benchmark of pin_buffer()/unpin_buffer().
+//
+// Every process pins and unpins buffers out of a small hot set, the way
+// backends hammer the root pages of a popular index. The lock-free side
+// runs the real freelist.c code on descriptors in a shared mapping; the
+// locked side models the old scheme where every pin and unpin updated
+// the descriptor under one global spinlock (BufMgrLock).
+
+#define BENCH_NBUFFERS  64
+#define BENCH_HOT       8
+#define BENCH_PAIRS     (1024 * 1024)
+#define BENCH_MAX_PROCS 8
+
+typedef struct SharedBench {
+  TasLock global_lock;  // Stands in for BufMgrLock
+  unsigned ref_count[BENCH_NBUFFERS];
+  unsigned usage_count[BENCH_NBUFFERS];
+} SharedBench;
+
+static SharedBench* Bench;
+
+static double elapsed_seconds(struct timespec* start, struct timespec* end) {
+  return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void locked_pin(int b) {
+  LOCK_ACQUIRE(&Bench->global_lock);
+  Bench->ref_count[b]++;
+  if (Bench->usage_count[b] < BM_MAX_USAGE_COUNT) {
+    Bench->usage_count[b]++;
+  }
+  LOCK_RELEASE(&Bench->global_lock);
+}
+
+static void locked_unpin(int b) {
+  LOCK_ACQUIRE(&Bench->global_lock);
+  Bench->ref_count[b]--;
+  LOCK_RELEASE(&Bench->global_lock);
+}
+
+static void run_child(int proc, bool lock_free) {
+  int i;
+
+  for (i = 0; i < BENCH_PAIRS; i++) {
+    int b = (proc + i) % BENCH_HOT;
+
+    if (lock_free) {
+      pin_buffer(&BufferDescriptors[b]);
+      unpin_buffer(&BufferDescriptors[b]);
+    } else {
+      locked_pin(b);
+      locked_unpin(b);
+    }
+  }
+}
+
+// Run nprocs processes concurrently and return the aggregate number of
+// pin/unpin pairs per second.
+static double run_bench(int nprocs, bool lock_free) {
+  struct timespec start;
+  struct timespec end;
+  int status;
+  int i;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (i = 0; i < nprocs; i++) {
+    pid_t pid = fork();
+
+    CU_ASSERT_FATAL(pid >= 0);
+
+    if (pid == 0) {
+      run_child(i, lock_free);
+      _exit(0);
+    }
+  }
+
+  for (i = 0; i < nprocs; i++) {
+    CU_ASSERT(wait(&status) > 0);
+    CU_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  return (double)nprocs * BENCH_PAIRS / elapsed_seconds(&start, &end);
+}
+
+static void test_scaling() {
+  int nprocs;
+
+  printf("\n%6s %16s %16s\n", "procs", "global lock/s", "atomic state/s");
+
+  for (nprocs = 1; nprocs <= BENCH_MAX_PROCS; nprocs *= 2) {
+    double locked = run_bench(nprocs, false);
+    double lock_free = run_bench(nprocs, true);
+
+    printf("%6d %16.0f %16.0f\n", nprocs, locked, lock_free);
+  }
+}
+
+// Pins from concurrent processes must never be lost: once everybody has
+// unpinned, every reference count is back to zero and no header is left
+// locked.
+static void test_pins_balance() {
+  int i;
+
+  run_bench(BENCH_MAX_PROCS, true);
+
+  for (i = 0; i < BENCH_NBUFFERS; i++) {
+    uint32 buf_state = atomic_read_u32(&BufferDescriptors[i].state);
+
+    CU_ASSERT(BUF_STATE_GET_REFCOUNT(buf_state) == 0);
+    CU_ASSERT(BUF_STATE_GET_USAGECOUNT(buf_state) <= BM_MAX_USAGE_COUNT);
+    CU_ASSERT(!(buf_state & BM_LOCKED));
+    CU_ASSERT((buf_state & BUF_FLAG_MASK) == (BM_DELETED | BM_VALID));
+  }
+}
+
+// A backend's repeated pins of one buffer count once in the shared state.
+static void test_private_pins() {
+  BufferDesc* buf = &BufferDescriptors[BENCH_NBUFFERS - 1];
+
+  pin_buffer(buf);
+  pin_buffer(buf);
+  CU_ASSERT(BUF_STATE_GET_REFCOUNT(atomic_read_u32(&buf->state)) == 1);
+
+  unpin_buffer(buf);
+  CU_ASSERT(BUF_STATE_GET_REFCOUNT(atomic_read_u32(&buf->state)) == 1);
+
+  unpin_buffer(buf);
+  CU_ASSERT(BUF_STATE_GET_REFCOUNT(atomic_read_u32(&buf->state)) == 0);
+}
+
+// Pinning more buffers than fit in the private array moves entries to
+// the overflow hash table, and every pin is still counted once.
+static void test_many_pins() {
+  int i;
+
+  for (i = 0; i < BENCH_NBUFFERS; i++) {
+    pin_buffer(&BufferDescriptors[i]);
+    pin_buffer(&BufferDescriptors[i]);
+  }
+
+  for (i = 0; i < BENCH_NBUFFERS; i++) {
+    CU_ASSERT(get_private_refcount(i + 1) == 2);
+    CU_ASSERT(BUF_STATE_GET_REFCOUNT(atomic_read_u32(&BufferDescriptors[i].state)) == 1);
+    unpin_buffer(&BufferDescriptors[i]);
+  }
+
+  for (i = BENCH_NBUFFERS - 1; i >= 0; i--) {
+    CU_ASSERT(BUFFER_IS_PINNED(i + 1));
+    unpin_buffer(&BufferDescriptors[i]);
+    CU_ASSERT(!BUFFER_IS_PINNED(i + 1));
+    CU_ASSERT(BUF_STATE_GET_REFCOUNT(atomic_read_u32(&BufferDescriptors[i].state)) == 0);
+  }
+}
+
+static void register_test() {
+  int i;
+
+  NBuffers = BENCH_NBUFFERS;
+
+  // Both the descriptors and the locked model live in a shared mapping
+  // so that the forked processes contend on the same cache lines.
+  BufferDescriptors =
+      mmap(NULL, NBuffers * sizeof(BufferDesc), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  Bench = mmap(NULL, sizeof(SharedBench), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  for (i = 0; i < NBuffers; i++) {
+    BufferDescriptors[i].buf_id = i;
+    BufferDescriptors[i].free_next = FREENEXT_NOT_IN_LIST;
+    atomic_init_u32(&BufferDescriptors[i].state, BM_DELETED | BM_VALID);
+  }
+
+  INIT_LOCK(&Bench->global_lock);
+
+  TEST("Pin/unpin scaling", test_scaling);
+  TEST("Concurrent pins balance", test_pins_balance);
+  TEST("Private pins count once", test_private_pins);
+  TEST("Many pins overflow", test_many_pins);
+}
+
+MAIN("bufpin")
@@ -0,0 +1,202 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../template.h"
+#include "rnode.h"
+#include "rdbms/miscadmin.h"
+#include "rdbms/storage/buf_internals.h"
+#include "rdbms/storage/bufmgr.h"
+#include "rdbms/utils/memutils.h"
+
+// Tests of the buffer pool introspection in buf_stats.c.
+
+#define TEST_NBUFFERS   64
+#define COUNT_PROCS     4
+#define COUNT_PER_PROC  100000
+#define MANY_RELATIONS  5000
+
+// Make buffer buf_id hold a block of rnode, with the given usage count
+// and extra state bits.
+static void fake_resident(int buf_id, RelFileNode rnode, BlockNumber block_num, uint32 usage_count, uint32 bits) {
+  BufferDesc* buf_hdr = &BufferDescriptors[buf_id];
+  uint32 buf_state = lock_buf_hdr(buf_hdr);
+
+  buf_hdr->tag.rnode = rnode;
+  buf_hdr->tag.block_num = block_num;
+  buf_state &= ~(BM_DELETED | BUF_USAGECOUNT_MASK | BUF_REFCOUNT_MASK);
+  buf_state |= BM_VALID | usage_count * BUF_USAGECOUNT_ONE | bits;
+  UNLOCK_BUF_HDR(buf_hdr, buf_state);
+}
+
+static void test_usage_by_relation() {
+  RelFileNode big = make_rnode(1, 100);
+  RelFileNode small = make_rnode(1, 200);
+  BufferRelUsage* usage;
+  int num_rels;
+  int i;
+
+  for (i = 0; i < 10; i++) {
+    fake_resident(i, big, i, i % BUF_USAGE_HISTOGRAM_SIZE, i < 3 ? BM_DIRTY : 0);
+  }
+
+  fake_resident(10, small, 0, 1, BUF_REFCOUNT_ONE);
+  fake_resident(11, small, 1, 0, 0);
+
+  num_rels = buffer_usage_by_relation(&usage);
+
+  CU_ASSERT_FATAL(num_rels == 2);
+
+  // Most resident first.
+  CU_ASSERT(REL_FILE_NODE_EQUALS(usage[0].rnode, big));
+  CU_ASSERT(usage[0].resident == 10);
+  CU_ASSERT(usage[0].dirty == 3);
+  CU_ASSERT(usage[0].pinned == 0);
+  CU_ASSERT(usage[0].usage_counts[0] == 2);
+  CU_ASSERT(usage[0].usage_counts[5] == 1);
+
+  CU_ASSERT(REL_FILE_NODE_EQUALS(usage[1].rnode, small));
+  CU_ASSERT(usage[1].resident == 2);
+  CU_ASSERT(usage[1].dirty == 0);
+  CU_ASSERT(usage[1].pinned == 1);
+  CU_ASSERT(usage[1].usage_counts[0] == 1);
+  CU_ASSERT(usage[1].usage_counts[1] == 1);
+
+  pfree(usage);
+}
+
+// Counts from concurrent processes are never lost.
+static void test_concurrent_counts() {
+  BufferRelStats* stats;
+  int num_rels;
+  int status;
+  int i;
+  int j;
+
+  reset_buffer_rel_stats();
+
+  for (i = 0; i < COUNT_PROCS; i++) {
+    pid_t pid = fork();
+
+    CU_ASSERT_FATAL(pid >= 0);
+
+    if (pid == 0) {
+      for (j = 0; j < COUNT_PER_PROC; j++) {
+        // Every process starts with a relation nobody has counted yet,
+        // so the slots are claimed concurrently too.
+        buf_stats_count(make_rnode(2, j % 8), BUF_STATS_HIT);
+      }
+      buf_stats_count(make_rnode(2, 0), BUF_STATS_WRITE);
+      _exit(0);
+    }
+  }
+
+  for (i = 0; i < COUNT_PROCS; i++) {
+    CU_ASSERT(wait(&status) > 0);
+    CU_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+
+  num_rels = buffer_rel_stats(&stats);
+
+  CU_ASSERT(num_rels == 8);
+
+  for (i = 0; i < num_rels; i++) {
+    CU_ASSERT(stats[i].rnode.tbl_node == 2);
+    CU_ASSERT(stats[i].hits == COUNT_PROCS * COUNT_PER_PROC / 8);
+    CU_ASSERT(stats[i].reads == 0);
+    CU_ASSERT(stats[i].writes == (stats[i].rnode.rel_node == 0 ? COUNT_PROCS : 0));
+  }
+
+  pfree(stats);
+}
+
+// Find rnode's counters in a buffer_rel_stats() result.
+static BufferRelStats* find_stats(BufferRelStats* stats, int num_rels, RelFileNode rnode) {
+  int i;
+
+  for (i = 0; i < num_rels; i++) {
+    if (REL_FILE_NODE_EQUALS(stats[i].rnode, rnode)) {
+      return &stats[i];
+    }
+  }
+
+  return NULL;
+}
+
+// A dropped relation gives up its slot, and its counts with it.
+static void test_forget() {
+  RelFileNode dropped = make_rnode(4, 1);
+  RelFileNode kept = make_rnode(4, 2);
+  BufferRelStats* stats;
+  int num_rels;
+
+  reset_buffer_rel_stats();
+
+  buf_stats_count(dropped, BUF_STATS_READ);
+  buf_stats_count(dropped, BUF_STATS_READ);
+  buf_stats_count(kept, BUF_STATS_READ);
+
+  buf_stats_forget(dropped);
+
+  num_rels = buffer_rel_stats(&stats);
+  CU_ASSERT(find_stats(stats, num_rels, dropped) == NULL);
+  CU_ASSERT(find_stats(stats, num_rels, kept) != NULL && find_stats(stats, num_rels, kept)->reads == 1);
+  pfree(stats);
+
+  // Counting it again starts from scratch, in a single slot.
+  buf_stats_count(dropped, BUF_STATS_HIT);
+  buf_stats_count(dropped, BUF_STATS_HIT);
+
+  num_rels = buffer_rel_stats(&stats);
+  CU_ASSERT_FATAL(find_stats(stats, num_rels, dropped) != NULL);
+  CU_ASSERT(find_stats(stats, num_rels, dropped)->hits == 2);
+  CU_ASSERT(find_stats(stats, num_rels, dropped)->reads == 0);
+  pfree(stats);
+
+  buf_stats_forget(dropped);
+  buf_stats_forget(kept);
+}
+
+// More relations than slots: the rest are counted in the overflow entry.
+static void test_overflow() {
+  BufferRelStats* stats;
+  uint64 total = 0;
+  bool saw_overflow = false;
+  int num_rels;
+  int i;
+
+  reset_buffer_rel_stats();
+
+  for (i = 0; i < MANY_RELATIONS; i++) {
+    buf_stats_count(make_rnode(3, i), BUF_STATS_READ);
+  }
+
+  num_rels = buffer_rel_stats(&stats);
+
+  for (i = 0; i < num_rels; i++) {
+    total += stats[i].reads;
+
+    if (stats[i].rnode.rel_node == INVALID_OID) {
+      saw_overflow = true;
+    }
+  }
+
+  CU_ASSERT(total == MANY_RELATIONS);
+  CU_ASSERT(saw_overflow);
+
+  pfree(stats);
+}
+
+static void register_test() {
+  memory_context_init();
+
+  NBuffers = TEST_NBUFFERS;
+  create_shared_memory_and_semaphores(true, 1);
+  init_buffer_pool();
+
+  TEST("Usage by relation", test_usage_by_relation);
+  TEST("Concurrent counts", test_concurrent_counts);
+  TEST("Forget", test_forget);
+  TEST("Overflow", test_overflow);
+}
+
+MAIN("bufstats")
@@ -0,0 +1,153 @@
+#include "rdbms/storage/condition_variable.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../template.h"
+#include "rdbms/miscadmin.h"
+#include "rdbms/storage/ipc.h"
+#include "rdbms/storage/shmem.h"
+#include "rdbms/utils/memutils.h"
+
+// Tests of the futex-based condition variables, with real processes
+// waiting the way readers of a block wait for its I/O in wait_io().
+
+#define TEST_PROCS 8
+
+typedef struct SharedTest {
+  ConditionVariable cv;
+  AtomicUint32 done;     // The condition: set once, then broadcast
+  AtomicUint32 waiting;  // Processes that have checked and are sleeping
+  AtomicUint32 wakeups;  // Returns from condition_variable_sleep()
+} SharedTest;
+
+static SharedTest* Shared;
+
+static void wait_children(int nprocs) {
+  int status;
+  int i;
+
+  for (i = 0; i < nprocs; i++) {
+    CU_ASSERT(wait(&status) > 0);
+    CU_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+}
+
+static void wait_for_done(void) {
+  uint32 seq;
+
+  for (;;) {
+    seq = condition_variable_prepare_to_sleep(&Shared->cv);
+
+    if (atomic_read_u32(&Shared->done)) {
+      condition_variable_cancel_sleep(&Shared->cv);
+      break;
+    }
+
+    atomic_fetch_add_u32(&Shared->waiting, 1);
+    condition_variable_sleep(&Shared->cv, seq);
+    atomic_fetch_add_u32(&Shared->wakeups, 1);
+  }
+}
+
+static void reset(void) {
+  condition_variable_init(&Shared->cv);
+  atomic_init_u32(&Shared->done, 0);
+  atomic_init_u32(&Shared->waiting, 0);
+  atomic_init_u32(&Shared->wakeups, 0);
+}
+
+// Sleepers stay asleep until the broadcast, and one broadcast wakes each
+// of them exactly once.
+static void test_broadcast() {
+  int i;
+
+  reset();
+
+  for (i = 0; i < TEST_PROCS; i++) {
+    pid_t pid = fork();
+
+    CU_ASSERT_FATAL(pid >= 0);
+
+    if (pid == 0) {
+      wait_for_done();
+      _exit(0);
+    }
+  }
+
+  for (i = 0; i < 1000 && atomic_read_u32(&Shared->waiting) < TEST_PROCS; i++) {
+    usleep(1000);
+  }
+
+  // Give them a moment to actually fall asleep; nobody may wake up.
+  usleep(20000);
+  CU_ASSERT(atomic_read_u32(&Shared->waiting) == TEST_PROCS);
+  CU_ASSERT(atomic_read_u32(&Shared->wakeups) == 0);
+
+  atomic_fetch_or_u32(&Shared->done, 1);
+  condition_variable_broadcast(&Shared->cv);
+
+  wait_children(TEST_PROCS);
+
+  CU_ASSERT(atomic_read_u32(&Shared->wakeups) == TEST_PROCS);
+  CU_ASSERT(atomic_read_u32(&Shared->cv.nwaiters) == 0);
+}
+
+// A broadcast racing with waiters getting ready to sleep is never lost:
+// every round ends with all of them through.
+static void test_no_lost_wakeup() {
+  int round;
+  int i;
+
+  for (round = 0; round < 200; round++) {
+    reset();
+
+    for (i = 0; i < TEST_PROCS; i++) {
+      pid_t pid = fork();
+
+      CU_ASSERT_FATAL(pid >= 0);
+
+      if (pid == 0) {
+        wait_for_done();
+        _exit(0);
+      }
+    }
+
+    atomic_fetch_or_u32(&Shared->done, 1);
+    condition_variable_broadcast(&Shared->cv);
+
+    wait_children(TEST_PROCS);
+  }
+
+  CU_ASSERT(atomic_read_u32(&Shared->cv.nwaiters) == 0);
+}
+
+// Broadcasting with nobody waiting only bumps the sequence number.
+static void test_no_waiters() {
+  uint32 seq;
+
+  reset();
+
+  seq = atomic_read_u32(&Shared->cv.seq);
+  condition_variable_broadcast(&Shared->cv);
+  CU_ASSERT(atomic_read_u32(&Shared->cv.seq) == seq + 1);
+
+  // A sleep on a stale sequence number returns at once.
+  condition_variable_prepare_to_sleep(&Shared->cv);
+  condition_variable_sleep(&Shared->cv, seq);
+  CU_ASSERT(atomic_read_u32(&Shared->cv.nwaiters) == 0);
+}
+
+static void register_test() {
+  memory_context_init();
+
+  create_shared_memory_and_semaphores(true, 1);
+
+  Shared = (SharedTest*)shmem_alloc(sizeof(SharedTest));
+
+  TEST("Broadcast", test_broadcast);
+  TEST("No lost wakeup", test_no_lost_wakeup);
+  TEST("No waiters", test_no_waiters);
+}
+
+MAIN("condvar")
@@ -0,0 +1,303 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../template.h"
+#include "rdbms/catalog/catalog.h"
+#include "rdbms/miscadmin.h"
+#include "rdbms/storage/buf_internals.h"
+#include "rdbms/storage/bufmgr.h"
+#include "rdbms/storage/ipc.h"
+#include "rdbms/storage/smgr.h"
+#include "rdbms/utils/rel.h"
+
+// Tests of extending shared relations: extend_buffers(), and
+// read_buffer(P_NEW) taking the spare blocks md_extend_by() adds, from
+// several processes at once. Like real callers, the processes hold a
+// lock while they extend the relation, but not while they fill in the
+// new pages.
+
+#define TEST_NBUFFERS 64
+#define TEST_DB       1
+
+#define EXTEND_PROCS   4
+#define EXTEND_ROUNDS  300
+#define EXTEND_BATCH   4
+#define EXTEND_MAX_BLK 8192
+
+// What the children tell the parent about the blocks they were given.
+typedef struct SharedClaims {
+  TasLock extend_lock;                  // Held to extend the relation
+  AtomicUint32 claims[EXTEND_MAX_BLK];  // Times the block was handed out
+  uint32 owner[EXTEND_MAX_BLK];         // Mark written to it
+} SharedClaims;
+
+static SharedClaims* Claims;
+
+static FormData_pg_class TestForm;
+static RelationData TestRelation;
+
+static Relation create_relation(Oid rel_node) {
+  char* path;
+
+  MEMSET(&TestRelation, 0, sizeof(TestRelation));
+  MEMSET(&TestForm, 0, sizeof(TestForm));
+  sprintf(NAME_STR(TestForm.relname), "extend_test_%u", rel_node);
+
+  TestRelation.rd_rel = &TestForm;
+  TestRelation.rd_fd = -1;
+  TestRelation.rd_node.tbl_node = TEST_DB;
+  TestRelation.rd_node.rel_node = rel_node;
+
+  // Left over from an earlier run, maybe.
+  path = relpath(TestRelation.rd_node);
+  unlink(path);
+  pfree(path);
+
+  TestRelation.rd_fd = smgr_create(DEFAULT_SMGR, &TestRelation);
+
+  return &TestRelation;
+}
+
+static void drop_relation(Relation relation) {
+  drop_relation_buffers(relation, 0);
+  smgr_close(DEFAULT_SMGR, relation);
+  smgr_unlink(DEFAULT_SMGR, relation);
+}
+
+static BlockNumber block_of(Buffer buffer) { return BufferDescriptors[buffer - 1].tag.block_num; }
+
+static char* page_of(Buffer buffer) { return (char*)MAKE_PTR(BufferDescriptors[buffer - 1].data); }
+
+static uint32 get_mark(Buffer buffer) { return *(uint32*)(page_of(buffer) + 64); }
+
+static void set_mark(Buffer buffer, uint32 mark) { *(uint32*)(page_of(buffer) + 64) = mark; }
+
+static bool page_is_zero(Buffer buffer) {
+  char* page = page_of(buffer);
+  int i;
+
+  for (i = 0; i < BLCKSZ; i++) {
+    if (page[i] != 0) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Note that the child got a new block, and write its mark to it.
+static bool claim(Buffer buffer, uint32 mark) {
+  BlockNumber block_num = block_of(buffer);
+
+  if (block_num >= EXTEND_MAX_BLK || !page_is_zero(buffer)) {
+    return false;
+  }
+
+  atomic_fetch_add_u32(&Claims->claims[block_num], 1);
+  Claims->owner[block_num] = mark;
+
+  set_mark(buffer, mark);
+  write_buffer(buffer);
+
+  return true;
+}
+
+// extend_buffers() gives back the new blocks pinned, as zero pages, and
+// P_NEW carries on after them.
+static void test_extend_buffers() {
+  Relation relation = create_relation(100);
+  Buffer buffers[8];
+  Buffer buffer;
+  int i;
+
+  CU_ASSERT(extend_buffers(relation, 8, buffers) == 0);
+  CU_ASSERT(smgr_nblocks(DEFAULT_SMGR, relation) == 8);
+
+  for (i = 0; i < 8; i++) {
+    CU_ASSERT_FATAL(BUFFER_IS_VALID(buffers[i]));
+    CU_ASSERT(block_of(buffers[i]) == (BlockNumber)i);
+    CU_ASSERT(page_is_zero(buffers[i]));
+    release_buffer(buffers[i]);
+  }
+
+  buffer = read_buffer(relation, P_NEW);
+  CU_ASSERT_FATAL(BUFFER_IS_VALID(buffer));
+  CU_ASSERT(block_of(buffer) == 8);
+  CU_ASSERT(smgr_nblocks(DEFAULT_SMGR, relation) == 9);
+  release_buffer(buffer);
+
+  CU_ASSERT(extend_buffers(relation, 3, buffers) == 9);
+  for (i = 0; i < 3; i++) {
+    release_buffer(buffers[i]);
+  }
+
+  drop_relation(relation);
+}
+
+// Processes extending one relation at once, a block at a time and in
+// batches, are each given different blocks, and none of them loses what
+// it wrote to another. Few buffers, so most pages go to disk and are
+// read back. Blocks nobody was given are spare, and still zero.
+static void test_concurrent_extend() {
+  Relation relation = create_relation(200);
+  BlockNumber nblocks;
+  Buffer buffers[EXTEND_BATCH];
+  Buffer buffer;
+  int spare = 0;
+  int status;
+  int b;
+  int i;
+
+  MEMSET(Claims, 0, sizeof(SharedClaims));
+  INIT_LOCK(&Claims->extend_lock);
+
+  for (i = 0; i < EXTEND_PROCS; i++) {
+    pid_t pid = fork();
+
+    CU_ASSERT_FATAL(pid >= 0);
+
+    if (pid == 0) {
+      int round;
+      int j;
+
+      for (round = 0; round < EXTEND_ROUNDS; round++) {
+        uint32 mark = (i + 1) << 16 | (round + 1);
+
+        if (round % 8 == 7) {
+          LOCK_ACQUIRE(&Claims->extend_lock);
+          extend_buffers(relation, EXTEND_BATCH, buffers);
+          LOCK_RELEASE(&Claims->extend_lock);
+
+          for (j = 0; j < EXTEND_BATCH; j++) {
+            if (BUFFER_IS_VALID(buffers[j]) && !claim(buffers[j], mark)) {
+              _exit(1);
+            }
+          }
+        } else {
+          LOCK_ACQUIRE(&Claims->extend_lock);
+          buffer = read_buffer(relation, P_NEW);
+          LOCK_RELEASE(&Claims->extend_lock);
+
+          if (!BUFFER_IS_VALID(buffer) || !claim(buffer, mark)) {
+            _exit(1);
+          }
+        }
+      }
+
+      _exit(0);
+    }
+  }
+
+  for (i = 0; i < EXTEND_PROCS; i++) {
+    CU_ASSERT(wait(&status) > 0);
+    CU_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+
+  nblocks = smgr_nblocks(DEFAULT_SMGR, relation);
+  CU_ASSERT_FATAL(nblocks <= EXTEND_MAX_BLK);
+
+  for (b = 0; b < (int)nblocks; b++) {
+    uint32 claims = atomic_read_u32(&Claims->claims[b]);
+
+    CU_ASSERT(claims <= 1);
+
+    buffer = read_buffer(relation, b);
+    CU_ASSERT_FATAL(BUFFER_IS_VALID(buffer));
+
+    if (claims == 0) {
+      CU_ASSERT(page_is_zero(buffer));
+      spare++;
+    } else {
+      CU_ASSERT(get_mark(buffer) == Claims->owner[b]);
+    }
+
+    release_buffer(buffer);
+  }
+
+  // Every block a child was given is inside the relation.
+  for (b = nblocks; b < EXTEND_MAX_BLK; b++) {
+    CU_ASSERT(atomic_read_u32(&Claims->claims[b]) == 0);
+  }
+
+  CU_ASSERT(nblocks - spare >= EXTEND_PROCS * EXTEND_ROUNDS);
+
+  drop_relation(relation);
+}
+
+// Spare blocks at the end of a relation are used again once nobody
+// remembers them, but not those somebody has in the pool or has written.
+static void test_reclaim() {
+  Relation relation = create_relation(300);
+  char* page;
+  Buffer buffer;
+  int i;
+
+  CU_ASSERT(smgr_extend_by(DEFAULT_SMGR, relation, 10) == SM_SUCCESS);
+
+  buffer = read_buffer(relation, P_NEW);
+  CU_ASSERT(block_of(buffer) == 0);
+  set_mark(buffer, 1);
+  write_buffer(buffer);
+
+  // Block 0 is in the pool.
+  relsize_cache_forget(relation->rd_node);
+  buffer = read_buffer(relation, P_NEW);
+  CU_ASSERT(block_of(buffer) == 1);
+  release_buffer(buffer);
+
+  // Block 5 is on disk.
+  page = (char*)palloc(BLCKSZ);
+  MEMSET(page, 0, BLCKSZ);
+  page[64] = 5;
+  CU_ASSERT(smgr_write(DEFAULT_SMGR, relation, 5, page) == SM_SUCCESS);
+  pfree(page);
+
+  relsize_cache_forget(relation->rd_node);
+  buffer = read_buffer(relation, P_NEW);
+  CU_ASSERT(block_of(buffer) == 6);
+  release_buffer(buffer);
+
+  CU_ASSERT(smgr_nblocks(DEFAULT_SMGR, relation) == 10);
+
+  // Then the rest of them, and then a new one.
+  for (i = 7; i <= 10; i++) {
+    buffer = read_buffer(relation, P_NEW);
+    CU_ASSERT(block_of(buffer) == (BlockNumber)i);
+    release_buffer(buffer);
+  }
+
+  CU_ASSERT(smgr_nblocks(DEFAULT_SMGR, relation) > 10);
+
+  drop_relation(relation);
+}
+
+static void register_test() {
+  char path[MAX_PG_PATH];
+
+  DataDir = "/tmp/pgdata";
+  NBuffers = TEST_NBUFFERS;
+  memory_context_init();
+
+  mkdir(DataDir, 0700);
+  snprintf(path, sizeof(path), "%s/base", DataDir);
+  mkdir(path, 0700);
+  snprintf(path, sizeof(path), "%s/base/%d", DataDir, TEST_DB);
+  mkdir(path, 0700);
+
+  create_shared_memory_and_semaphores(true, 1);
+  init_buffer_pool();
+  smgr_init();
+
+  Claims = mmap(NULL, sizeof(SharedClaims), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  assert(Claims != MAP_FAILED);
+
+  TEST("Extend buffers", test_extend_buffers);
+  TEST("Concurrent extend", test_concurrent_extend);
+  TEST("Reclaim", test_reclaim);
+}
+
+MAIN("extend")
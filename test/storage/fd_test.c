@@ -2,6 +2,9 @@
 
 #include <fcntl.h>
 #include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "../template.h"
 #include "rdbms/utils/memutils.h"
@@ -10,6 +13,26 @@
 #define FILE_MODE 0600
 #define FILE_FLAG O_CREAT | O_RDWR
 
+// Pages in the file the positional I/O benchmark reads, and its page
+// size.
+#define BENCH_PAGES  4096
+#define BENCH_PAGESZ 8192
+#define BENCH_PASSES 8
+
+// Kernel descriptors the VFD cache may use, and files opened at once
+// to make it close some.
+#define MAX_FILES  25
+#define MANY_FILES 60
+
+// Every lseek() fd.c makes goes through here, so that the benchmark can
+// count them.
+static long NumLseeks = 0;
+
+off_t lseek(int fd, off_t offset, int whence) {
+  NumLseeks++;
+  return syscall(SYS_lseek, fd, offset, whence);
+}
+
 static void test_max_file_per_process() {
   struct rlimit limits;
   if (getrlimit(RLIMIT_NOFILE, &limits) == -1) {
@@ -47,11 +70,255 @@ static void test_basic_read_write() {
   file_unlink(fd);
 }
 
+static void test_vectored_read_write() {
+  char path[MAX_BUFF];
+  char out[3][MAX_BUFF];
+  char in[3][MAX_BUFF];
+  struct iovec iov[3];
+  int i;
+
+  snprintf(path, MAX_BUFF, "/tmp/b.txt");
+
+  File fd = path_name_open_file(path, FILE_FLAG, FILE_MODE);
+
+  CU_ASSERT(fd > 0);
+
+  for (i = 0; i < 3; i++) {
+    memset(out[i], 'a' + i, MAX_BUFF);
+    iov[i].iov_base = out[i];
+    iov[i].iov_len = MAX_BUFF;
+  }
+
+  // Leave a hole in front, and check the seek position doesn't move.
+  CU_ASSERT(file_writev(fd, iov, 3, MAX_BUFF) == 3 * MAX_BUFF);
+  CU_ASSERT(file_seek(fd, 0, SEEK_CUR) == 0);
+
+  for (i = 0; i < 3; i++) {
+    iov[i].iov_base = in[i];
+  }
+
+  CU_ASSERT(file_readv(fd, iov, 3, MAX_BUFF) == 3 * MAX_BUFF);
+
+  for (i = 0; i < 3; i++) {
+    CU_ASSERT(memcmp(in[i], out[i], MAX_BUFF) == 0);
+  }
+
+  // A read running past the end of the file comes up short.
+  CU_ASSERT(file_readv(fd, iov, 3, 2 * MAX_BUFF) == 2 * MAX_BUFF);
+  CU_ASSERT(memcmp(in[0], out[1], MAX_BUFF) == 0);
+  CU_ASSERT(memcmp(in[1], out[2], MAX_BUFF) == 0);
+
+  file_unlink(fd);
+}
+
+static double elapsed_us(struct timespec* start, struct timespec* end) {
+  return (end->tv_sec - start->tv_sec) * 1e6 + (end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+// Read pages of a file in scattered order, the way md_read() does for an
+// index scan: once with file_seek() and file_read(), once with
+// file_pread(). Each read is one system call either way; the seeks are
+// the difference.
+static void test_pread_benchmark() {
+  static char page[BENCH_PAGESZ];
+  char path[MAX_BUFF];
+  struct timespec start;
+  struct timespec end;
+  long seek_calls;
+  long pread_calls;
+  double seek_us;
+  double pread_us;
+  int pass;
+  int i;
+
+  snprintf(path, MAX_BUFF, "/tmp/c.txt");
+
+  File fd = path_name_open_file(path, FILE_FLAG, FILE_MODE);
+
+  CU_ASSERT_FATAL(fd > 0);
+
+  for (i = 0; i < BENCH_PAGES; i++) {
+    memset(page, i & 0xFF, BENCH_PAGESZ);
+    CU_ASSERT(file_pwrite(fd, page, BENCH_PAGESZ, (long)i * BENCH_PAGESZ) == BENCH_PAGESZ);
+  }
+
+  // Positional writes leave the seek position alone.
+  CU_ASSERT(file_seek(fd, 0, SEEK_CUR) == 0);
+
+  NumLseeks = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (pass = 0; pass < BENCH_PASSES; pass++) {
+    for (i = 0; i < BENCH_PAGES; i++) {
+      long block = (i * 7919L) % BENCH_PAGES;
+
+      file_seek(fd, block * BENCH_PAGESZ, SEEK_SET);
+      CU_ASSERT(file_read(fd, page, BENCH_PAGESZ) == BENCH_PAGESZ);
+      CU_ASSERT(page[0] == (char)(block & 0xFF));
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  seek_calls = NumLseeks + BENCH_PASSES * BENCH_PAGES;
+  seek_us = elapsed_us(&start, &end);
+
+  NumLseeks = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (pass = 0; pass < BENCH_PASSES; pass++) {
+    for (i = 0; i < BENCH_PAGES; i++) {
+      long block = (i * 7919L) % BENCH_PAGES;
+
+      CU_ASSERT(file_pread(fd, page, BENCH_PAGESZ, block * BENCH_PAGESZ) == BENCH_PAGESZ);
+      CU_ASSERT(page[0] == (char)(block & 0xFF));
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  pread_calls = NumLseeks + BENCH_PASSES * BENCH_PAGES;
+  pread_us = elapsed_us(&start, &end);
+
+  // One lseek() per page, but where the previous read happened to stop,
+  // against none at all.
+  CU_ASSERT(seek_calls >= 2 * pread_calls - BENCH_PASSES);
+  CU_ASSERT(pread_calls == BENCH_PASSES * BENCH_PAGES);
+
+  printf("\n%12s %12s %12s\n", "method", "syscalls", "us per page");
+  printf("%12s %12ld %12.2f\n", "seek+read", seek_calls, seek_us / (BENCH_PASSES * BENCH_PAGES));
+  printf("%12s %12ld %12.2f\n", "pread", pread_calls, pread_us / (BENCH_PASSES * BENCH_PAGES));
+
+  file_unlink(fd);
+}
+
+// Opening a file twice for positional I/O gives the same VFD, which
+// stays until both opens are closed.
+static void test_shared_vfds() {
+  char msg[] = "shared";
+  char buf[MAX_BUFF];
+  FileStats stats;
+  File fd1;
+  File fd2;
+  File fd3;
+  File fd4;
+
+  file_reset_stats();
+
+  fd1 = file_name_open_shared_file("/tmp/d.txt", FILE_FLAG, FILE_MODE);
+  fd2 = file_name_open_shared_file("/tmp/d.txt", O_RDWR, FILE_MODE);
+  CU_ASSERT_FATAL(fd1 > 0);
+  CU_ASSERT(fd2 == fd1);
+
+  // Other flags, other VFD.
+  fd3 = file_name_open_shared_file("/tmp/d.txt", O_RDONLY, FILE_MODE);
+  CU_ASSERT(fd3 > 0 && fd3 != fd1);
+
+  // Nor is anything shared with opens that may use the seek position.
+  fd4 = path_name_open_file("/tmp/d.txt", O_RDWR, FILE_MODE);
+  CU_ASSERT(fd4 > 0 && fd4 != fd1);
+
+  file_get_stats(&stats);
+  CU_ASSERT(stats.opens == 3);
+  CU_ASSERT(stats.shared_opens == 1);
+
+  file_close(fd2);
+  CU_ASSERT(file_pwrite(fd1, msg, sizeof(msg), 0) == sizeof(msg));
+  CU_ASSERT(file_pread(fd3, buf, sizeof(msg), 0) == sizeof(msg));
+  CU_ASSERT(memcmp(buf, msg, sizeof(msg)) == 0);
+
+  file_close(fd4);
+  file_close(fd3);
+  file_unlink(fd1);
+  CU_ASSERT(access("/tmp/d.txt", F_OK) != 0);
+}
+
+// Unlinking a shared VFD leaves the file to the other opens, even when
+// the LRU ring has to reopen it, until the last of them closes it.
+static void test_shared_unlink() {
+  char path[MAX_BUFF];
+  char msg[] = "unlinked";
+  char buf[MAX_BUFF];
+  File fds[MAX_FILES];
+  File fd1;
+  File fd2;
+  int i;
+
+  fd1 = file_name_open_shared_file("/tmp/e.txt", FILE_FLAG, FILE_MODE);
+  fd2 = file_name_open_shared_file("/tmp/e.txt", O_RDWR, FILE_MODE);
+  CU_ASSERT_FATAL(fd1 > 0 && fd2 == fd1);
+  CU_ASSERT(file_pwrite(fd1, msg, sizeof(msg), 0) == sizeof(msg));
+
+  file_unlink(fd1);
+  CU_ASSERT(access("/tmp/e.txt", F_OK) == 0);
+
+  // Nobody finds it by name any more.
+  fd1 = file_name_open_shared_file("/tmp/e.txt", O_RDWR, FILE_MODE);
+  CU_ASSERT(fd1 > 0 && fd1 != fd2);
+  file_close(fd1);
+
+  // Push it out of the LRU ring.
+  for (i = 0; i < MAX_FILES; i++) {
+    snprintf(path, MAX_BUFF, "/tmp/unlink%d.txt", i);
+    fds[i] = path_name_open_file(path, FILE_FLAG, FILE_MODE);
+    CU_ASSERT_FATAL(fds[i] > 0);
+    CU_ASSERT(file_pwrite(fds[i], (char*)&i, sizeof(i), 0) == sizeof(i));
+  }
+
+  CU_ASSERT(file_pread(fd2, buf, sizeof(msg), 0) == sizeof(msg));
+  CU_ASSERT(memcmp(buf, msg, sizeof(msg)) == 0);
+
+  for (i = 0; i < MAX_FILES; i++) {
+    file_unlink(fds[i]);
+  }
+
+  file_close(fd2);
+  CU_ASSERT(access("/tmp/e.txt", F_OK) != 0);
+}
+
+// With more files open than descriptors to go round, the LRU ring
+// closes and reopens them, and says so.
+static void test_lru_stats() {
+  char path[MAX_BUFF];
+  File fds[MANY_FILES];
+  FileStats stats;
+  int i;
+
+  file_reset_stats();
+
+  for (i = 0; i < MANY_FILES; i++) {
+    snprintf(path, MAX_BUFF, "/tmp/lru%d.txt", i);
+    fds[i] = path_name_open_file(path, FILE_FLAG, FILE_MODE);
+    CU_ASSERT_FATAL(fds[i] > 0);
+    CU_ASSERT(file_pwrite(fds[i], (char*)&i, sizeof(i), 0) == sizeof(i));
+  }
+
+  for (i = 0; i < MANY_FILES; i++) {
+    int n = -1;
+
+    CU_ASSERT(file_pread(fds[i], (char*)&n, sizeof(n), 0) == sizeof(n));
+    CU_ASSERT(n == i);
+  }
+
+  file_get_stats(&stats);
+  CU_ASSERT(stats.lru_closes >= 2 * MANY_FILES - MAX_FILES);
+  CU_ASSERT(stats.reopens == MANY_FILES);
+  CU_ASSERT(stats.opens == MANY_FILES + stats.reopens);
+
+  printf("\nopens %lu, reopens %lu, LRU closes %lu, %.2f us per open\n", (unsigned long)stats.opens,
+         (unsigned long)stats.reopens, (unsigned long)stats.lru_closes, (double)stats.open_time_us / stats.opens);
+
+  for (i = 0; i < MANY_FILES; i++) {
+    file_unlink(fds[i]);
+  }
+}
+
 static void register_test() {
   memory_context_init();
 
+  MaxFilesPerProcess = MAX_FILES;
+
   TEST("Max NO File", test_max_file_per_process);
   TEST("File Write and Read", test_basic_read_write);
+  TEST("Vectored Write and Read", test_vectored_read_write);
+  TEST("Positional read benchmark", test_pread_benchmark);
+  TEST("Shared VFDs", test_shared_vfds);
+  TEST("Unlinking a shared VFD", test_shared_unlink);
+  TEST("LRU stats", test_lru_stats);
 }
 
 MAIN("fd")
\ No newline at end of file
@@ -0,0 +1,327 @@
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../template.h"
+#include "rdbms/miscadmin.h"
+#include "rdbms/storage/buf_internals.h"
+#include "rdbms/storage/bufmgr.h"
+#include "rdbms/utils/memutils.h"
+
+// Benchmark of the clock sweep replacement strategy against the LRU
+// freelist it replaced, on a Zipfian block access trace.
+//
+// The LRU side is a private model of the old freelist.c: a doubly-linked
+// list of unpinned buffers that every pin unlinks from and every unpin
+// appends to. The clock side runs the real freelist.c code.
+
+#define BENCH_NBUFFERS 1024
+#define BENCH_NBLOCKS  (16 * BENCH_NBUFFERS)
+#define BENCH_ACCESSES (1024 * 1024)
+#define BENCH_SKEW     0.99
+#define BENCH_PINS     (4 * 1024 * 1024)
+
+static BlockNumber* Trace;
+
+static double elapsed_seconds(struct timespec* start, struct timespec* end) {
+  return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Build a trace of BENCH_ACCESSES block numbers following a Zipf
+// distribution with exponent BENCH_SKEW. Block numbers are scattered so
+// that the hot blocks are not adjacent.
+static void build_zipf_trace() {
+  double* cdf = malloc(BENCH_NBLOCKS * sizeof(double));
+  double sum = 0.0;
+  unsigned int seed = 42;
+  int i;
+
+  for (i = 0; i < BENCH_NBLOCKS; i++) {
+    sum += 1.0 / pow(i + 1, BENCH_SKEW);
+    cdf[i] = sum;
+  }
+
+  Trace = malloc(BENCH_ACCESSES * sizeof(BlockNumber));
+
+  for (i = 0; i < BENCH_ACCESSES; i++) {
+    double u = sum * rand_r(&seed) / ((double)RAND_MAX + 1);
+    int lo = 0;
+    int hi = BENCH_NBLOCKS - 1;
+
+    while (lo < hi) {
+      int mid = (lo + hi) / 2;
+
+      if (cdf[mid] < u) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+
+    Trace[i] = (BlockNumber)(((uint64)lo * 7919) % BENCH_NBLOCKS);
+  }
+
+  free(cdf);
+}
+
+// Model of the old strict LRU freelist.
+typedef struct LruModel {
+  int* next;
+  int* prev;
+  int* ref_count;
+  BlockNumber* block;
+  int head;  // Sentinel index == nbuffers
+} LruModel;
+
+static void lru_init(LruModel* lru, int nbuffers) {
+  int i;
+
+  lru->next = malloc((nbuffers + 1) * sizeof(int));
+  lru->prev = malloc((nbuffers + 1) * sizeof(int));
+  lru->ref_count = calloc(nbuffers, sizeof(int));
+  lru->block = malloc(nbuffers * sizeof(BlockNumber));
+  lru->head = nbuffers;
+
+  for (i = 0; i <= nbuffers; i++) {
+    lru->next[i] = (i + 1) % (nbuffers + 1);
+    lru->prev[i] = (i + nbuffers) % (nbuffers + 1);
+  }
+
+  for (i = 0; i < nbuffers; i++) {
+    lru->block[i] = INVALID_BLOCK_NUMBER;
+  }
+}
+
+static void lru_free(LruModel* lru) {
+  free(lru->next);
+  free(lru->prev);
+  free(lru->ref_count);
+  free(lru->block);
+}
+
+static void lru_pin(LruModel* lru, int b) {
+  if (lru->ref_count[b]++ == 0) {
+    lru->next[lru->prev[b]] = lru->next[b];
+    lru->prev[lru->next[b]] = lru->prev[b];
+  }
+}
+
+static void lru_unpin(LruModel* lru, int b) {
+  if (--lru->ref_count[b] == 0) {
+    lru->next[b] = lru->head;
+    lru->prev[b] = lru->prev[lru->head];
+    lru->next[lru->prev[b]] = b;
+    lru->prev[lru->head] = b;
+  }
+}
+
+static double lru_hit_ratio() {
+  LruModel lru;
+  int* block_to_buf = malloc(BENCH_NBLOCKS * sizeof(int));
+  long hits = 0;
+  int i;
+
+  lru_init(&lru, BENCH_NBUFFERS);
+
+  for (i = 0; i < BENCH_NBLOCKS; i++) {
+    block_to_buf[i] = -1;
+  }
+
+  for (i = 0; i < BENCH_ACCESSES; i++) {
+    BlockNumber blk = Trace[i];
+    int b = block_to_buf[blk];
+
+    if (b >= 0) {
+      hits++;
+    } else {
+      b = lru.next[lru.head];
+
+      if (lru.block[b] != INVALID_BLOCK_NUMBER) {
+        block_to_buf[lru.block[b]] = -1;
+      }
+
+      lru.block[b] = blk;
+      block_to_buf[blk] = b;
+    }
+
+    lru_pin(&lru, b);
+    lru_unpin(&lru, b);
+  }
+
+  lru_free(&lru);
+  free(block_to_buf);
+
+  return (double)hits / BENCH_ACCESSES;
+}
+
+static double clock_hit_ratio() {
+  int* block_to_buf = malloc(BENCH_NBLOCKS * sizeof(int));
+  long hits = 0;
+  int i;
+
+  for (i = 0; i < BENCH_NBLOCKS; i++) {
+    block_to_buf[i] = -1;
+  }
+
+  for (i = 0; i < BENCH_ACCESSES; i++) {
+    BlockNumber blk = Trace[i];
+    BufferDesc* buf;
+    uint32 buf_state;
+
+    if (block_to_buf[blk] >= 0) {
+      hits++;
+      buf = &BufferDescriptors[block_to_buf[blk]];
+    } else {
+      buf = get_free_buffer(NULL, &buf_state);
+      CU_ASSERT_FATAL(buf != NULL);
+
+      if (buf->tag.block_num != INVALID_BLOCK_NUMBER) {
+        block_to_buf[buf->tag.block_num] = -1;
+      }
+
+      buf->tag.block_num = blk;
+      block_to_buf[blk] = buf->buf_id;
+      UNLOCK_BUF_HDR(buf, buf_state);
+    }
+
+    pin_buffer(buf);
+    unpin_buffer(buf);
+  }
+
+  free(block_to_buf);
+
+  return (double)hits / BENCH_ACCESSES;
+}
+
+static void test_hit_ratio() {
+  double lru;
+  double clock;
+
+  lru = lru_hit_ratio();
+  clock = clock_hit_ratio();
+
+  printf("\nzipf(%.2f) %d blocks, %d buffers: LRU hit ratio %.4f, clock hit ratio %.4f\n", BENCH_SKEW,
+         BENCH_NBLOCKS, BENCH_NBUFFERS, lru, clock);
+
+  // Clock approximates LRU; it should not be meaningfully worse.
+  CU_ASSERT(clock > lru - 0.02);
+}
+
+static void test_pin_unpin_throughput() {
+  struct timespec start;
+  struct timespec end;
+  LruModel lru;
+  double lru_secs;
+  double clock_secs;
+  int i;
+
+  lru_init(&lru, BENCH_NBUFFERS);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < BENCH_PINS; i++) {
+    int b = Trace[i % BENCH_ACCESSES] % BENCH_NBUFFERS;
+
+    lru_pin(&lru, b);
+    lru_unpin(&lru, b);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  lru_secs = elapsed_seconds(&start, &end);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < BENCH_PINS; i++) {
+    BufferDesc* buf = &BufferDescriptors[Trace[i % BENCH_ACCESSES] % BENCH_NBUFFERS];
+
+    pin_buffer(buf);
+    unpin_buffer(buf);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  clock_secs = elapsed_seconds(&start, &end);
+
+  printf("pin/unpin pairs per second: LRU %.0f, clock %.0f\n", BENCH_PINS / lru_secs, BENCH_PINS / clock_secs);
+
+  lru_free(&lru);
+}
+
+static void test_all_pinned() {
+  BufferDesc* buf;
+  uint32 buf_state;
+  int i;
+
+  for (i = 0; i < NBuffers; i++) {
+    pin_buffer(&BufferDescriptors[i]);
+  }
+
+  CU_ASSERT(get_free_buffer(NULL, &buf_state) == NULL);
+
+  for (i = 0; i < NBuffers; i++) {
+    unpin_buffer(&BufferDescriptors[i]);
+  }
+
+  buf = get_free_buffer(NULL, &buf_state);
+  CU_ASSERT_FATAL(buf != NULL);
+  UNLOCK_BUF_HDR(buf, buf_state);
+}
+
+// A bulk scan through a ring strategy must only recycle its own ring and
+// leave the usage counts of the rest of the pool alone.
+static void test_ring_strategy() {
+  BufferAccessStrategy strategy;
+  BufferDesc* buf;
+  uint32 buf_state;
+  bool* used = calloc(NBuffers, sizeof(bool));
+  int distinct = 0;
+  int i;
+
+  // Warm the pool so that every buffer has a nonzero usage count.
+  for (i = 0; i < NBuffers; i++) {
+    pin_buffer(&BufferDescriptors[i]);
+    unpin_buffer(&BufferDescriptors[i]);
+  }
+
+  strategy = get_access_strategy(BAS_BULKREAD);
+  CU_ASSERT_FATAL(strategy != NULL);
+
+  for (i = 0; i < 16 * NBuffers; i++) {
+    buf = get_free_buffer(strategy, &buf_state);
+    CU_ASSERT_FATAL(buf != NULL);
+
+    // Mimic buffer_alloc(): pin, give the new page a usage count of one.
+    pin_buffer_locked(buf);
+    buf_state = lock_buf_hdr(buf);
+    buf_state &= ~BUF_USAGECOUNT_MASK;
+    buf_state += BUF_USAGECOUNT_ONE;
+    UNLOCK_BUF_HDR(buf, buf_state);
+    unpin_buffer(buf);
+
+    if (!used[buf->buf_id]) {
+      used[buf->buf_id] = true;
+      distinct++;
+    }
+  }
+
+  printf("\n%d allocations through a BAS_BULKREAD ring touched %d of %d buffers\n", 16 * NBuffers, distinct,
+         NBuffers);
+
+  // The first pass of the clock may need to sweep past the warm buffers
+  // while filling the ring, but afterwards only the ring is recycled.
+  CU_ASSERT(distinct <= 256 * 1024 / BLCKSZ);
+
+  free_access_strategy(strategy);
+  free(used);
+}
+
+static void register_test() {
+  memory_context_init();
+
+  NBuffers = BENCH_NBUFFERS;
+  create_shared_memory_and_semaphores(true, 1);
+  init_buffer_pool();
+  build_zipf_trace();
+
+  TEST("Clock vs LRU hit ratio", test_hit_ratio);
+  TEST("Clock vs LRU pin/unpin throughput", test_pin_unpin_throughput);
+  TEST("All buffers pinned", test_all_pinned);
+  TEST("Ring strategy recycles its ring", test_ring_strategy);
+}
+
+MAIN("freelist")
@@ -0,0 +1,81 @@
+#include "../template.h"
+#include "rnode.h"
+#include "rdbms/miscadmin.h"
+#include "rdbms/postmaster/bgwriter.h"
+#include "rdbms/storage/ipc.h"
+#include "rdbms/storage/smgr.h"
+#include "rdbms/utils/memutils.h"
+
+// Tests of the fsync request queue in bgwriter.c, and of md.c syncing
+// what was asked for.
+
+#define QUEUE_SIZE 16
+
+// The queue holds one request per shared buffer, and emptying it starts
+// a new cycle.
+static void test_queue() {
+  uint32 cycle;
+  int i;
+
+  for (i = 0; i < QUEUE_SIZE; i++) {
+    CU_ASSERT(forward_fsync_request(make_rnode(1, 100 + i), 0));
+  }
+
+  // All different, so compacting doesn't make room.
+  CU_ASSERT(!forward_fsync_request(make_rnode(1, 200), 0));
+
+  cycle = fsync_request_cycle();
+  absorb_fsync_requests();
+  CU_ASSERT(fsync_request_cycle() == cycle + 1);
+
+  CU_ASSERT(forward_fsync_request(make_rnode(1, 200), 0));
+  absorb_fsync_requests();
+}
+
+// Repeated requests for the same segments are folded together when the
+// queue fills up.
+static void test_compaction() {
+  int i;
+
+  for (i = 0; i < 10 * QUEUE_SIZE; i++) {
+    CU_ASSERT(forward_fsync_request(make_rnode(2, 100 + i % 3), i % 2));
+  }
+
+  // Six distinct requests, so there is room for QUEUE_SIZE - 6 more.
+  for (i = 0; i < QUEUE_SIZE - 6; i++) {
+    CU_ASSERT(forward_fsync_request(make_rnode(2, 200 + i), 0));
+  }
+
+  CU_ASSERT(!forward_fsync_request(make_rnode(2, 300), 0));
+
+  absorb_fsync_requests();
+}
+
+// Requests for segments that have been dropped since are satisfied by
+// the sync, not kept to fail at every checkpoint.
+static void test_sync() {
+  CU_ASSERT(forward_fsync_request(make_rnode(3, 100), 0));
+  CU_ASSERT(forward_fsync_request(make_rnode(3, 100), 1));
+  remember_fsync_request(make_rnode(3, 101), 0);
+
+  CU_ASSERT(md_sync() == SM_SUCCESS);
+
+  // Nothing left to do at commit.
+  CU_ASSERT(md_commit() == SM_SUCCESS);
+}
+
+static void register_test() {
+  DataDir = "/tmp/pgdata";
+  NBuffers = QUEUE_SIZE;
+  memory_context_init();
+
+  create_shared_memory_and_semaphores(true, 1);
+  bgwriter_shmem_init();
+  md_init();
+
+  TEST("Queue", test_queue);
+  TEST("Compaction", test_compaction);
+  TEST("Sync", test_sync);
+}
+
+MAIN("fsync_request")
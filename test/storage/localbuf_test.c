@@ -0,0 +1,211 @@
+#include <stdlib.h>
+#include <time.h>
+
+#include "../template.h"
+#include "rdbms/storage/buf_internals.h"
+#include "rdbms/storage/bufmgr.h"
+#include "rdbms/utils/memutils.h"
+#include "rdbms/utils/rel.h"
+
+// Tests of the local buffer pool's lookup table and clock sweep. The
+// blocks are never read from disk; we only look at which buffer each
+// block is given.
+
+#define TEST_TEMP_BUFFERS 16
+#define BENCH_TEMP_BUFFERS (64 * 1024)
+
+static RelationData TestRelation;
+
+static BufferDesc* alloc_block(BlockNumber block_num, bool* found) {
+  return local_buffer_alloc(&TestRelation, block_num, found);
+}
+
+static void release_block(BufferDesc* buf) {
+  Buffer buffer = BUFFER_DESCRIPTOR_GET_BUFFER(buf);
+
+  ASSERT(LocalRefCount[-buffer - 1] > 0);
+  LocalRefCount[-buffer - 1]--;
+}
+
+static void test_lookup() {
+  BufferDesc* bufs[TEST_TEMP_BUFFERS];
+  BufferDesc* buf;
+  bool found;
+  int i;
+
+  for (i = 0; i < TEST_TEMP_BUFFERS; i++) {
+    bufs[i] = alloc_block(i, &found);
+    CU_ASSERT(!found);
+    CU_ASSERT(bufs[i]->tag.block_num == (BlockNumber)i);
+    CU_ASSERT(BUFFER_IS_LOCAL(BUFFER_DESCRIPTOR_GET_BUFFER(bufs[i])));
+    release_block(bufs[i]);
+  }
+
+  // Every block is found again in the buffer it was given.
+  for (i = TEST_TEMP_BUFFERS - 1; i >= 0; i--) {
+    buf = alloc_block(i, &found);
+    CU_ASSERT(found);
+    CU_ASSERT(buf == bufs[i]);
+    release_block(buf);
+  }
+
+  // A block of another relation with the same rel_node is a different
+  // block. (It may well evict block 0, the pool being full.)
+  TestRelation.rd_node.tbl_node++;
+  buf = alloc_block(0, &found);
+  CU_ASSERT(!found);
+  CU_ASSERT(REL_FILE_NODE_EQUALS(buf->tag.rnode, TestRelation.rd_node));
+  release_block(buf);
+  TestRelation.rd_node.tbl_node--;
+
+  reset_local_buffer_pool();
+}
+
+// Recently used buffers survive a sweep; pinned ones are never chosen.
+static void test_clock_eviction() {
+  BufferDesc* pinned;
+  BufferDesc* hot;
+  BufferDesc* buf;
+  bool found;
+  int i;
+
+  pinned = alloc_block(0, &found);
+
+  for (i = 1; i < TEST_TEMP_BUFFERS; i++) {
+    release_block(alloc_block(i, &found));
+  }
+
+  // Use block 1 a few more times.
+  for (i = 0; i < 3; i++) {
+    hot = alloc_block(1, &found);
+    CU_ASSERT(found);
+    release_block(hot);
+  }
+
+  // Read a stream of new blocks through the pool.
+  for (i = TEST_TEMP_BUFFERS; i < 2 * TEST_TEMP_BUFFERS; i++) {
+    buf = alloc_block(i, &found);
+    CU_ASSERT(!found);
+    CU_ASSERT(buf != pinned);
+    release_block(buf);
+  }
+
+  buf = alloc_block(0, &found);
+  CU_ASSERT(found && buf == pinned);
+  release_block(buf);
+  release_block(pinned);
+
+  buf = alloc_block(1, &found);
+  CU_ASSERT(found && buf == hot);
+  release_block(buf);
+
+  reset_local_buffer_pool();
+}
+
+// Is the block in the pool? Leaves it unpinned either way; a block that
+// wasn't there now is.
+static bool block_cached(BlockNumber block_num) {
+  bool found;
+
+  release_block(alloc_block(block_num, &found));
+
+  return found;
+}
+
+// Truncating and dropping discard just the relation's blocks, whether
+// they are looked up one by one or found by sweeping the pool.
+static void test_drop() {
+  bool found;
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    release_block(alloc_block(i, &found));
+  }
+
+  TestRelation.rd_node.tbl_node++;
+  for (i = 0; i < 4; i++) {
+    release_block(alloc_block(i, &found));
+  }
+  TestRelation.rd_node.tbl_node--;
+
+  TestRelation.rd_nblocks = 8;
+  drop_local_relation_buffers(&TestRelation, 4);
+
+  CU_ASSERT(block_cached(3));
+  CU_ASSERT(!block_cached(4));
+  CU_ASSERT(!block_cached(7));
+
+  // Past the pool size, so the pool is swept.
+  TestRelation.rd_nblocks = 4 * TEST_TEMP_BUFFERS;
+  drop_local_relation_buffers(&TestRelation, 0);
+  TestRelation.rd_nblocks = 0;
+
+  for (i = 0; i < 8; i++) {
+    CU_ASSERT(!block_cached(i));
+  }
+
+  TestRelation.rd_node.tbl_node++;
+  for (i = 0; i < 4; i++) {
+    CU_ASSERT(block_cached(i));
+  }
+  TestRelation.rd_node.tbl_node--;
+
+  reset_local_buffer_pool();
+}
+
+// temp_buffers takes effect when the pool is next set up.
+static void test_resize() {
+  bool found;
+
+  CU_ASSERT(NLocBuffer == TEST_TEMP_BUFFERS);
+
+  NumTempBuffers = BENCH_TEMP_BUFFERS;
+  reset_local_buffer_pool();
+  CU_ASSERT(NLocBuffer == 0);
+
+  release_block(alloc_block(0, &found));
+  CU_ASSERT(NLocBuffer == BENCH_TEMP_BUFFERS);
+}
+
+// Lookups must not get slower as the pool grows.
+static void test_lookup_speed() {
+  struct timespec start;
+  struct timespec end;
+  bool found;
+  long i;
+
+  for (i = 0; i < BENCH_TEMP_BUFFERS; i++) {
+    release_block(alloc_block(i, &found));
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < 16 * BENCH_TEMP_BUFFERS; i++) {
+    release_block(alloc_block(i % BENCH_TEMP_BUFFERS, &found));
+    CU_ASSERT_FATAL(found);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  printf("\n%d buffers: %.0f ns per lookup\n", BENCH_TEMP_BUFFERS,
+         ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / (16.0 * BENCH_TEMP_BUFFERS));
+
+  reset_local_buffer_pool();
+}
+
+static void register_test() {
+  memory_context_init();
+
+  NumTempBuffers = TEST_TEMP_BUFFERS;
+
+  TestRelation.rd_fd = -1;
+  TestRelation.rd_node.tbl_node = 1;
+  TestRelation.rd_node.rel_node = 1;
+  TestRelation.rd_my_xact_only = true;
+
+  TEST("Lookup finds blocks", test_lookup);
+  TEST("Clock eviction", test_clock_eviction);
+  TEST("Drop and truncate", test_drop);
+  TEST("Resize on reset", test_resize);
+  TEST("Lookup speed", test_lookup_speed);
+}
+
+MAIN("localbuf")
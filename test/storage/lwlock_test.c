@@ -0,0 +1,180 @@
+#include "rdbms/storage/lwlock.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../template.h"
+#include "rdbms/miscadmin.h"
+#include "rdbms/storage/ipc.h"
+#include "rdbms/storage/proc.h"
+#include "rdbms/utils/memutils.h"
+
+// Tests of the lightweight locks in lwlock.c, with real processes
+// sleeping on real semaphores.
+
+#define TEST_PROCS      8
+#define TEST_INCREMENTS 20000
+
+typedef struct SharedTest {
+  LWLock lock;
+  AtomicUint32 holders;  // Processes inside the lock right now
+  AtomicUint32 max_holders;
+  unsigned counter;  // Only changed under the exclusive lock
+} SharedTest;
+
+static SharedTest* Shared;
+static Proc* Procs;
+static IpcSemaphoreId SemId;
+
+// Become process i, with Procs[i] and semaphore i to sleep on.
+static void become_proc(int i) {
+  MyProc = &Procs[i];
+  MyProc->sem.sem_id = SemId;
+  MyProc->sem.sem_num = i;
+  atomic_init_u32(&MyProc->lw_waiting, false);
+  MyProc->lw_wait_link = INVALID_OFFSET;
+}
+
+static void wait_children(int nprocs) {
+  int status;
+  int i;
+
+  for (i = 0; i < nprocs; i++) {
+    CU_ASSERT(wait(&status) > 0);
+    CU_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+}
+
+static void note_holder(void) {
+  uint32 holders = atomic_fetch_add_u32(&Shared->holders, 1) + 1;
+  uint32 max = atomic_read_u32(&Shared->max_holders);
+
+  while (holders > max && !atomic_compare_exchange_u32(&Shared->max_holders, &max, holders)) {
+  }
+}
+
+// Exclusive holders never overlap, and no increment is lost.
+static void test_exclusive() {
+  int i;
+  int j;
+
+  lwlock_init(&Shared->lock);
+  atomic_init_u32(&Shared->holders, 0);
+  atomic_init_u32(&Shared->max_holders, 0);
+  Shared->counter = 0;
+
+  for (i = 0; i < TEST_PROCS; i++) {
+    pid_t pid = fork();
+
+    CU_ASSERT_FATAL(pid >= 0);
+
+    if (pid == 0) {
+      become_proc(i);
+
+      for (j = 0; j < TEST_INCREMENTS; j++) {
+        lwlock_acquire(&Shared->lock, LW_EXCLUSIVE);
+        note_holder();
+        Shared->counter++;
+        atomic_fetch_sub_u32(&Shared->holders, 1);
+        lwlock_release(&Shared->lock);
+      }
+      _exit(0);
+    }
+  }
+
+  wait_children(TEST_PROCS);
+
+  CU_ASSERT(Shared->counter == TEST_PROCS * TEST_INCREMENTS);
+  CU_ASSERT(atomic_read_u32(&Shared->max_holders) == 1);
+  CU_ASSERT(atomic_read_u32(&Shared->lock.state) == 0);
+}
+
+// Shared holders don't block each other: all of them get in at once.
+static void test_shared() {
+  int i;
+
+  lwlock_init(&Shared->lock);
+  atomic_init_u32(&Shared->holders, 0);
+
+  for (i = 0; i < TEST_PROCS; i++) {
+    pid_t pid = fork();
+
+    CU_ASSERT_FATAL(pid >= 0);
+
+    if (pid == 0) {
+      become_proc(i);
+
+      lwlock_acquire(&Shared->lock, LW_SHARED);
+      atomic_fetch_add_u32(&Shared->holders, 1);
+
+      while (atomic_read_u32(&Shared->holders) < TEST_PROCS) {
+        usleep(1000);
+      }
+
+      lwlock_release(&Shared->lock);
+      _exit(0);
+    }
+  }
+
+  wait_children(TEST_PROCS);
+
+  CU_ASSERT(atomic_read_u32(&Shared->holders) == TEST_PROCS);
+  CU_ASSERT(atomic_read_u32(&Shared->lock.state) == 0);
+}
+
+// A writer waiting for readers sleeps on the queue until the last
+// reader leaves, and readers arriving meanwhile queue up after it.
+static void test_writer_sleeps() {
+  pid_t pid;
+  int i;
+
+  lwlock_init(&Shared->lock);
+  Shared->counter = 0;
+
+  become_proc(0);
+  lwlock_acquire(&Shared->lock, LW_SHARED);
+
+  pid = fork();
+  CU_ASSERT_FATAL(pid >= 0);
+
+  if (pid == 0) {
+    become_proc(1);
+    lwlock_acquire(&Shared->lock, LW_EXCLUSIVE);
+    Shared->counter = 1;
+    lwlock_release(&Shared->lock);
+    _exit(0);
+  }
+
+  // Wait for the writer to get on the queue.
+  for (i = 0; i < 1000 && !atomic_read_u32(&Procs[1].lw_waiting); i++) {
+    usleep(1000);
+  }
+
+  CU_ASSERT(atomic_read_u32(&Procs[1].lw_waiting));
+  CU_ASSERT(Shared->counter == 0);
+
+  lwlock_release(&Shared->lock);
+
+  wait_children(1);
+
+  CU_ASSERT(Shared->counter == 1);
+  CU_ASSERT(atomic_read_u32(&Shared->lock.state) == 0);
+
+  MyProc = NULL;
+}
+
+static void register_test() {
+  memory_context_init();
+
+  create_shared_memory_and_semaphores(true, 1);
+
+  Shared = (SharedTest*)shmem_alloc(sizeof(SharedTest));
+  Procs = (Proc*)shmem_alloc(TEST_PROCS * sizeof(Proc));
+  SemId = ipc_semaphore_create(TEST_PROCS, IPC_PROTECTION, 0, true);
+
+  TEST("Exclusive", test_exclusive);
+  TEST("Shared", test_shared);
+  TEST("Writer sleeps", test_writer_sleeps);
+}
+
+MAIN("lwlock")
@@ -0,0 +1,114 @@
+#include <string.h>
+
+#include "../template.h"
+#include "rdbms/storage/ipc.h"
+#include "rdbms/storage/smgr.h"
+#include "rdbms/utils/memutils.h"
+#include "rdbms/utils/rel.h"
+
+// Tests of the main memory storage manager in mm.c.
+
+#define POOL_BLOCKS 16
+
+static RelationData Rel1;
+static RelationData Rel2;
+
+static void init_relation(Relation relation, Oid rel_node) {
+  MEMSET(relation, 0, sizeof(RelationData));
+  relation->rd_fd = -1;
+  relation->rd_node.tbl_node = 1;
+  relation->rd_node.rel_node = rel_node;
+}
+
+static void fill_page(char* page, int n) { memset(page, 'a' + n % 26, BLCKSZ); }
+
+// Blocks come back as they were written, and blocks never written read
+// as zeroes.
+static void test_read_write() {
+  char page[BLCKSZ];
+  char read[BLCKSZ];
+  int i;
+
+  CU_ASSERT(mm_create(&Rel1) >= 0);
+  CU_ASSERT(mm_create(&Rel1) < 0);
+  CU_ASSERT(mm_nblocks(&Rel1) == 0);
+
+  for (i = 0; i < 4; i++) {
+    fill_page(page, i);
+    CU_ASSERT(mm_extend(&Rel1, page) == SM_SUCCESS);
+  }
+
+  CU_ASSERT(mm_nblocks(&Rel1) == 4);
+
+  fill_page(page, 10);
+  CU_ASSERT(mm_write(&Rel1, 2, page) == SM_SUCCESS);
+  CU_ASSERT(mm_blind_wrt(Rel1.rd_node, 3, page, false) == SM_SUCCESS);
+
+  for (i = 0; i < 4; i++) {
+    CU_ASSERT(mm_read(&Rel1, i, read) == SM_SUCCESS);
+    fill_page(page, i < 2 ? i : 10);
+    CU_ASSERT(memcmp(page, read, BLCKSZ) == 0);
+  }
+
+  CU_ASSERT(mm_read(&Rel1, 100, read) == SM_SUCCESS);
+  CU_ASSERT(read[0] == 0 && read[BLCKSZ - 1] == 0);
+
+  CU_ASSERT(mm_extend_by(&Rel1, 2) == SM_SUCCESS);
+  CU_ASSERT(mm_nblocks(&Rel1) == 6);
+  CU_ASSERT(mm_read(&Rel1, 5, read) == SM_SUCCESS && read[0] == 0);
+
+  // Another relation's blocks are its own.
+  CU_ASSERT(mm_nblocks(&Rel2) == 0);
+  fill_page(page, 20);
+  CU_ASSERT(mm_extend(&Rel2, page) == SM_SUCCESS);
+  CU_ASSERT(mm_read(&Rel1, 0, read) == SM_SUCCESS && read[0] == 'a');
+}
+
+// The pool runs out, and truncating or dropping a relation gives its
+// pages back.
+static void test_pool() {
+  char page[BLCKSZ];
+  int i;
+
+  fill_page(page, 0);
+
+  // 7 of the pages are taken by now.
+  for (i = 7; i < POOL_BLOCKS; i++) {
+    CU_ASSERT(mm_extend(&Rel2, page) == SM_SUCCESS);
+  }
+
+  CU_ASSERT(mm_extend(&Rel2, page) == SM_FAIL);
+  CU_ASSERT(mm_extend_by(&Rel1, 1) == SM_FAIL);
+
+  CU_ASSERT(mm_truncate(&Rel1, 100) < 0);
+  CU_ASSERT(mm_truncate(&Rel1, 2) == 2);
+  CU_ASSERT(mm_nblocks(&Rel1) == 2);
+  CU_ASSERT(mm_extend_by(&Rel2, 4) == SM_SUCCESS);
+  CU_ASSERT(mm_extend(&Rel2, page) == SM_FAIL);
+
+  CU_ASSERT(mm_unlink(Rel1.rd_node) == SM_SUCCESS);
+  CU_ASSERT(mm_nblocks(&Rel1) == 0);
+  CU_ASSERT(mm_extend_by(&Rel2, 2) == SM_SUCCESS);
+
+  CU_ASSERT(mm_unlink(Rel2.rd_node) == SM_SUCCESS);
+  CU_ASSERT(mm_extend_by(&Rel1, POOL_BLOCKS) == SM_SUCCESS);
+  CU_ASSERT(mm_nblocks(&Rel1) == POOL_BLOCKS);
+}
+
+static void register_test() {
+  memory_context_init();
+
+  create_shared_memory_and_semaphores(true, 1);
+
+  EnableMemoryStorage = true;
+  MemStorageBlocks = POOL_BLOCKS;
+  mm_shmem_init();
+
+  init_relation(&Rel1, 100);
+  init_relation(&Rel2, 101);
+
+  TEST("ReadWrite", test_read_write);
+  TEST("Pool", test_pool);
+}
+
+MAIN("mm")
@@ -0,0 +1,140 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../template.h"
+#include "rdbms/postgres.h"
+#include "rdbms/storage/fd.h"
+#include "rdbms/utils/memutils.h"
+
+// Cold-cache benchmark of file_prefetch(), the call md_prefetch() ends
+// up in for prefetch_buffer().
+//
+// The relation file is read one block at a time in a scattered order,
+// the way a bitmap heap scan or an index scan visits the heap, once with
+// plain reads and once issuing a prefetch PREFETCH_DISTANCE blocks ahead
+// of each read. The kernel's own readahead can't help with this order,
+// so without the hints every read waits for the disk.
+//
+// Before each pass the file's pages are dropped from the OS cache. Set
+// PREFETCH_BENCH_MB to a few times the machine's RAM to measure a truly
+// cold relation; the default keeps the test short.
+
+#define FILE_MODE 0600
+#define FILE_FLAG O_CREAT | O_RDWR | O_TRUNC
+
+#define BENCH_FILE        "/tmp/prefetch_bench.dat"
+#define DEFAULT_BENCH_MB  256
+#define PREFETCH_DISTANCE 32
+
+static File BenchFile;
+static long BenchBlocks;
+
+static double elapsed_seconds(struct timespec* start, struct timespec* end) {
+  return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// The i'th block to visit. The stride is odd and BenchBlocks a power of
+// two, so every block is visited exactly once, far from its neighbours.
+static long visit_order(long i) { return (i * 7919) & (BenchBlocks - 1); }
+
+static void drop_cache() {
+  int fd = open(BENCH_FILE, O_RDONLY);
+
+  CU_ASSERT_FATAL(fd >= 0);
+  CU_ASSERT(posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0);
+  close(fd);
+}
+
+// Read every block in visit order, prefetching distance blocks ahead.
+// Returns MB/s.
+static double run_pass(int distance) {
+  struct timespec start;
+  struct timespec end;
+  char block[BLCKSZ];
+  long i;
+
+  drop_cache();
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (i = 0; i < distance && i < BenchBlocks; i++) {
+    CU_ASSERT(file_prefetch(BenchFile, visit_order(i) * BLCKSZ, BLCKSZ) == 0);
+  }
+
+  for (i = 0; i < BenchBlocks; i++) {
+    long block_num = visit_order(i);
+
+    if (distance > 0 && i + distance < BenchBlocks) {
+      file_prefetch(BenchFile, visit_order(i + distance) * BLCKSZ, BLCKSZ);
+    }
+
+    CU_ASSERT_FATAL(file_seek(BenchFile, block_num * BLCKSZ, SEEK_SET) == block_num * BLCKSZ);
+    CU_ASSERT_FATAL(file_read(BenchFile, block, BLCKSZ) == BLCKSZ);
+    CU_ASSERT(*(long*)block == block_num);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  return (double)BenchBlocks * BLCKSZ / (1024 * 1024) / elapsed_seconds(&start, &end);
+}
+
+static void test_cold_cache() {
+  double plain = run_pass(0);
+  double prefetched = run_pass(PREFETCH_DISTANCE);
+
+  printf("\n%ld MB, %ld blocks\n", BenchBlocks * BLCKSZ / (1024 * 1024), BenchBlocks);
+  printf("%-24s %10.1f MB/s\n", "plain reads", plain);
+  printf("prefetch distance %-6d %10.1f MB/s\n", PREFETCH_DISTANCE, prefetched);
+
+  file_unlink(BenchFile);
+}
+
+// A prefetch is only a hint: it must not move the file position or
+// disturb a following read.
+static void test_prefetch_keeps_position() {
+  char block[BLCKSZ];
+
+  CU_ASSERT(file_seek(BenchFile, 3 * BLCKSZ, SEEK_SET) == 3 * BLCKSZ);
+  CU_ASSERT(file_prefetch(BenchFile, 0, BLCKSZ) == 0);
+  CU_ASSERT(file_prefetch(BenchFile, (BenchBlocks - 1) * BLCKSZ, BLCKSZ) == 0);
+  CU_ASSERT(file_read(BenchFile, block, BLCKSZ) == BLCKSZ);
+  CU_ASSERT(*(long*)block == 3);
+}
+
+static void register_test() {
+  char block[BLCKSZ];
+  char* env;
+  long mb = DEFAULT_BENCH_MB;
+  long i;
+
+  memory_context_init();
+
+  if ((env = getenv("PREFETCH_BENCH_MB")) != NULL && atol(env) > 0) {
+    mb = atol(env);
+  }
+
+  // Round down to a power of two for visit_order().
+  BenchBlocks = mb * 1024 * 1024 / BLCKSZ;
+  while (BenchBlocks & (BenchBlocks - 1)) {
+    BenchBlocks &= BenchBlocks - 1;
+  }
+
+  BenchFile = path_name_open_file(BENCH_FILE, FILE_FLAG, FILE_MODE);
+  assert(BenchFile > 0);
+
+  // Each block starts with its own number, so reads can be checked.
+  MEMSET(block, 0, BLCKSZ);
+  for (i = 0; i < BenchBlocks; i++) {
+    *(long*)block = i;
+    file_write(BenchFile, block, BLCKSZ);
+  }
+  file_sync(BenchFile);
+
+  TEST("Prefetch keeps position", test_prefetch_keeps_position);
+  TEST("Cold cache scattered reads", test_cold_cache);
+}
+
+MAIN("prefetch")
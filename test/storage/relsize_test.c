@@ -0,0 +1,292 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../template.h"
+#include "rnode.h"
+#include "rdbms/storage/ipc.h"
+#include "rdbms/storage/smgr.h"
+#include "rdbms/utils/memutils.h"
+
+// Tests of the shared relation size cache in relsize.c.
+
+#define MANY_RELATIONS 20000
+#define WRITER_PROCS   4
+#define READER_PROCS   4
+#define OPS_PER_PROC   200000
+
+// More relations than the cache holds, so the writers keep evicting.
+#define CHURN_RELATIONS 10000
+
+// Count the blocks of a relation, as md_nblocks() does.
+static void fill(RelFileNode rnode, BlockNumber nblocks) {
+  relsize_cache_fill(rnode, nblocks, relsize_cache_start_fill(rnode));
+}
+
+static void wait_children(int nprocs) {
+  int status;
+  int i;
+
+  for (i = 0; i < nprocs; i++) {
+    CU_ASSERT(wait(&status) > 0);
+    CU_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+}
+
+// Each way of changing a size does what it says.
+static void test_updates() {
+  RelFileNode rnode = make_rnode(1, 100);
+
+  CU_ASSERT(relsize_cache_get(rnode) == INVALID_BLOCK_NUMBER);
+
+  fill(rnode, 10);
+  CU_ASSERT(relsize_cache_get(rnode) == 10);
+
+  // Somebody else's count doesn't override what is known.
+  fill(rnode, 7);
+  CU_ASSERT(relsize_cache_get(rnode) == 10);
+
+  // Extensions arriving out of order only raise the size.
+  relsize_cache_extend(rnode, 12);
+  relsize_cache_extend(rnode, 11);
+  CU_ASSERT(relsize_cache_get(rnode) == 12);
+
+  relsize_cache_set(rnode, 3);
+  CU_ASSERT(relsize_cache_get(rnode) == 3);
+
+  relsize_cache_forget(rnode);
+  CU_ASSERT(relsize_cache_get(rnode) == INVALID_BLOCK_NUMBER);
+
+  fill(rnode, 5);
+  CU_ASSERT(relsize_cache_get(rnode) == 5);
+
+  // Another relation in the same database is another entry.
+  CU_ASSERT(relsize_cache_get(make_rnode(1, 101)) == INVALID_BLOCK_NUMBER);
+  relsize_cache_extend(make_rnode(1, 101), 1);
+  CU_ASSERT(relsize_cache_get(make_rnode(1, 101)) == 1);
+  CU_ASSERT(relsize_cache_get(rnode) == 5);
+}
+
+// A count that was made while the relation changed is dropped.
+static void test_fill_race() {
+  RelFileNode rnode = make_rnode(1, 200);
+  uint32 ticket;
+  uint32 other;
+
+  ticket = relsize_cache_start_fill(rnode);
+  CU_ASSERT(ticket != 0);
+  CU_ASSERT(relsize_cache_get(rnode) == INVALID_BLOCK_NUMBER);
+
+  // Truncated, say, before the count was done.
+  relsize_cache_forget(rnode);
+  relsize_cache_fill(rnode, 4, ticket);
+  CU_ASSERT(relsize_cache_get(rnode) == INVALID_BLOCK_NUMBER);
+
+  // Extended meanwhile: the extension is kept, not the count.
+  ticket = relsize_cache_start_fill(rnode);
+  relsize_cache_extend(rnode, 9);
+  relsize_cache_fill(rnode, 4, ticket);
+  CU_ASSERT(relsize_cache_get(rnode) == 9);
+
+  // Of two counts made at once, the first one in is kept.
+  relsize_cache_forget(rnode);
+  ticket = relsize_cache_start_fill(rnode);
+  other = relsize_cache_start_fill(rnode);
+  CU_ASSERT(ticket == other);
+  relsize_cache_fill(rnode, 6, other);
+  relsize_cache_fill(rnode, 5, ticket);
+  CU_ASSERT(relsize_cache_get(rnode) == 6);
+}
+
+// A write past the end raises a known size, and spoils a count being
+// made, but doesn't make up a size nobody knows.
+static void test_writes() {
+  RelFileNode rnode = make_rnode(1, 300);
+  uint32 ticket;
+
+  relsize_cache_note_write(rnode, 3);
+  CU_ASSERT(relsize_cache_get(rnode) == INVALID_BLOCK_NUMBER);
+
+  fill(rnode, 5);
+  relsize_cache_note_write(rnode, 2);
+  CU_ASSERT(relsize_cache_get(rnode) == 5);
+  relsize_cache_note_write(rnode, 8);
+  CU_ASSERT(relsize_cache_get(rnode) == 8);
+
+  relsize_cache_forget(rnode);
+  ticket = relsize_cache_start_fill(rnode);
+  relsize_cache_note_write(rnode, 9);
+  relsize_cache_fill(rnode, 8, ticket);
+  CU_ASSERT(relsize_cache_get(rnode) == INVALID_BLOCK_NUMBER);
+}
+
+// Blocks added by md_extend_by() are handed out once each, and blocks
+// written or added by md_extend() are never handed out.
+static void test_spare_blocks() {
+  RelFileNode rnode = make_rnode(1, 400);
+  BlockNumber nblocks;
+  uint32 ticket;
+  bool known;
+
+  // Nobody knows which blocks of a relation just counted are spare.
+  fill(rnode, 4);
+  CU_ASSERT(relsize_cache_take(rnode, 1, &known) == INVALID_BLOCK_NUMBER);
+  CU_ASSERT(!known);
+
+  ticket = relsize_cache_start_reclaim(rnode, &nblocks);
+  CU_ASSERT(ticket != 0);
+  CU_ASSERT(nblocks == 4);
+  CU_ASSERT(relsize_cache_finish_reclaim(rnode, 4, ticket));
+
+  CU_ASSERT(relsize_cache_take(rnode, 1, &known) == INVALID_BLOCK_NUMBER);
+  CU_ASSERT(known);
+  CU_ASSERT(relsize_cache_start_reclaim(rnode, &nblocks) == 0);
+
+  relsize_cache_grow(rnode, 10);
+  CU_ASSERT(relsize_cache_get(rnode) == 10);
+  CU_ASSERT(relsize_cache_take(rnode, 1, &known) == 4);
+  CU_ASSERT(relsize_cache_take(rnode, 3, &known) == 5);
+  CU_ASSERT(relsize_cache_take(rnode, 3, &known) == INVALID_BLOCK_NUMBER);
+  CU_ASSERT(known);
+
+  // A block that is written is somebody's, and so are those before it.
+  relsize_cache_note_write(rnode, 9);
+  CU_ASSERT(relsize_cache_take(rnode, 1, &known) == 9);
+
+  relsize_cache_grow(rnode, 14);
+  relsize_cache_extend(rnode, 15);
+  CU_ASSERT(relsize_cache_take(rnode, 1, &known) == INVALID_BLOCK_NUMBER);
+
+  // Truncation takes spare blocks away with the rest.
+  relsize_cache_grow(rnode, 20);
+  relsize_cache_set(rnode, 17);
+  CU_ASSERT(relsize_cache_take(rnode, 2, &known) == 15);
+  CU_ASSERT(relsize_cache_take(rnode, 1, &known) == INVALID_BLOCK_NUMBER);
+
+  relsize_cache_forget(rnode);
+  CU_ASSERT(relsize_cache_take(rnode, 1, &known) == INVALID_BLOCK_NUMBER);
+  CU_ASSERT(!known);
+}
+
+// A write while somebody looks for spare blocks spoils the search; of
+// two searches at once, the later one is kept.
+static void test_reclaim_race() {
+  RelFileNode rnode = make_rnode(1, 500);
+  BlockNumber nblocks;
+  uint32 ticket;
+  uint32 other;
+  bool known;
+
+  fill(rnode, 8);
+  CU_ASSERT(relsize_cache_covers(rnode, 8));
+  CU_ASSERT(!relsize_cache_covers(rnode, 9));
+
+  ticket = relsize_cache_start_reclaim(rnode, &nblocks);
+  CU_ASSERT(!relsize_cache_covers(rnode, 8));
+  relsize_cache_note_write(rnode, 7);
+  CU_ASSERT(!relsize_cache_finish_reclaim(rnode, 6, ticket));
+  CU_ASSERT(relsize_cache_take(rnode, 1, &known) == INVALID_BLOCK_NUMBER);
+  CU_ASSERT(!known);
+
+  ticket = relsize_cache_start_reclaim(rnode, &nblocks);
+  other = relsize_cache_start_reclaim(rnode, &nblocks);
+  CU_ASSERT(!relsize_cache_finish_reclaim(rnode, 5, ticket));
+  CU_ASSERT(relsize_cache_finish_reclaim(rnode, 6, other));
+  CU_ASSERT(relsize_cache_covers(rnode, 6));
+  CU_ASSERT(!relsize_cache_covers(rnode, 7));
+  CU_ASSERT(relsize_cache_take(rnode, 2, &known) == 6);
+  CU_ASSERT(relsize_cache_covers(rnode, 8));
+}
+
+// With more relations than slots some are evicted, but a lookup never
+// returns another relation's size.
+static void test_eviction() {
+  BlockNumber nblocks;
+  int hits = 0;
+  int i;
+
+  for (i = 0; i < MANY_RELATIONS; i++) {
+    fill(make_rnode(2, i + 1), i * 3);
+  }
+
+  for (i = 0; i < MANY_RELATIONS; i++) {
+    nblocks = relsize_cache_get(make_rnode(2, i + 1));
+
+    if (nblocks != INVALID_BLOCK_NUMBER) {
+      CU_ASSERT(nblocks == (BlockNumber)i * 3);
+      hits++;
+    }
+  }
+
+  CU_ASSERT(hits > 0 && hits < MANY_RELATIONS);
+  CU_ASSERT(relsize_cache_get(make_rnode(2, MANY_RELATIONS)) == (BlockNumber)(MANY_RELATIONS - 1) * 3);
+}
+
+// Readers racing with writers that change sizes and evict entries see
+// either nothing or a size that was written for that relation.
+static void test_concurrent() {
+  int i;
+
+  for (i = 0; i < WRITER_PROCS + READER_PROCS; i++) {
+    pid_t pid = fork();
+
+    CU_ASSERT_FATAL(pid >= 0);
+
+    if (pid == 0) {
+      bool writer = i < WRITER_PROCS;
+      int op;
+
+      srandom(getpid());
+
+      for (op = 0; op < OPS_PER_PROC; op++) {
+        Oid rel_node = 1 + random() % CHURN_RELATIONS;
+        RelFileNode rnode = make_rnode(3, rel_node);
+
+        // Every size ever written for a relation is a multiple of its
+        // rel_node.
+        if (writer) {
+          switch (op % 4) {
+            case 0:
+              fill(rnode, rel_node * (op % 100));
+              break;
+            case 1:
+              relsize_cache_extend(rnode, rel_node * (op % 100));
+              break;
+            case 2:
+              relsize_cache_set(rnode, rel_node * (op % 100));
+              break;
+            default:
+              relsize_cache_forget(rnode);
+              break;
+          }
+        } else {
+          BlockNumber nblocks = relsize_cache_get(rnode);
+
+          if (nblocks != INVALID_BLOCK_NUMBER && nblocks % rel_node != 0) {
+            _exit(1);
+          }
+        }
+      }
+
+      _exit(0);
+    }
+  }
+
+  wait_children(WRITER_PROCS + READER_PROCS);
+}
+
+static void register_test() {
+  memory_context_init();
+
+  create_shared_memory_and_semaphores(true, 1);
+  relsize_cache_shmem_init();
+
+  TEST("Updates", test_updates);
+  TEST("Fill race", test_fill_race);
+  TEST("Writes", test_writes);
+  TEST("Spare blocks", test_spare_blocks);
+  TEST("Reclaim race", test_reclaim_race);
+  TEST("Eviction", test_eviction);
+  TEST("Concurrent", test_concurrent);
+}
+
+MAIN("relsize")
@@ -0,0 +1,16 @@
+#ifndef TEST_STORAGE_RNODE_H_
+#define TEST_STORAGE_RNODE_H_
+
+#include "rdbms/storage/relfilenode.h"
+
+// Name a relation for the storage tests, which need not open it.
+static inline RelFileNode make_rnode(Oid tbl_node, Oid rel_node) {
+  RelFileNode rnode;
+
+  rnode.tbl_node = tbl_node;
+  rnode.rel_node = rel_node;
+
+  return rnode;
+}
+
+#endif  // TEST_STORAGE_RNODE_H_